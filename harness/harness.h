@@ -0,0 +1,143 @@
+/*-
+ * Copyright (c) 2015-2019 Alexandre Fenyo <alex@fenyo.net> - http://www.fenyo.net
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Interface between the module built in userland with its kernel shims
+ * (kshim.c, kapi.c) and the programs driving it. It only uses plain C
+ * types, as both sides have their own idea of the network headers:
+ * addrs are 16 bytes in network order, MACs 6 bytes, frames start with
+ * the Ethernet header.
+ */
+
+#ifndef _HARNESS_H_
+#define _HARNESS_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* What became of a frame given to h_input(). */
+#define	H_PASS		0	/* Left to the stack. */
+#define	H_CONSUMED	1	/* Taken by a hook. */
+
+/* Flags of h_input(). */
+#define	H_IN_SPLIT	0x01	/* IPv6 header in a second mbuf. */
+#define	H_IN_CSUM	0x02	/* ICMPv6 sum computed by the NIC. */
+#define	H_IN_PSEUDO	0x04	/* With the pseudo header (with H_IN_CSUM). */
+#define	H_IN_RDONLY	0x08	/* Read-only mbuf, not reusable for a reply. */
+#define	H_IN_VLAN	0x10	/* Tag of VLAN 5 stripped by the NIC. */
+#define	H_IN_PRIO	0x20	/* Priority tag (VLAN 0) stripped by the NIC. */
+
+/* How an advertisement left. */
+#define	H_OUT_DIRECT	0	/* Handed to the driver by the module. */
+#define	H_OUT_IP6	1	/* Through ip6_output(). */
+
+/*
+ * Called for each frame sent, in the thread that sent it. Frames sent
+ * through ip6_output() have a zero destination MAC when it is unicast,
+ * as the harness has no neighbor cache.
+ */
+typedef void h_output_t(void *arg, int ifindex, int via, const uint8_t *frame,
+    size_t len);
+
+/* Load the module for ncpu CPUs, and unload it. */
+int	h_init(int ncpu);
+void	h_fini(void);
+
+/*
+ * Run the calling thread as a CPU, below the ncpu of h_init(). A thread
+ * calls h_thread_fini() before it exits, to free the mbufs it cached.
+ */
+void	h_thread_init(int cpu);
+void	h_thread_fini(void);
+
+/*
+ * Interfaces, their addrs and the routes. Interfaces are Ethernet ones,
+ * named by the caller; h_ifattach() returns the index of the new one.
+ * A link-local addr is the link-local addr of the interface, any other
+ * one its global addr.
+ */
+int	h_ifattach(const char *name, const uint8_t *mac);
+/* ifconfig name, as if_rename() does it. */
+int	h_ifrename(int ifindex, const char *name);
+int	h_ifaddr_add(int ifindex, const uint8_t *addr);
+int	h_route_add(const uint8_t *prefix, int len, int ifindex, int reject);
+void	h_route_flush(void);
+void	h_set_output(h_output_t *func, void *arg);
+/* Make if_transmit() of an interface fail with err, or succeed if 0. */
+void	h_if_error(int ifindex, int err);
+
+/*
+ * sysctl(3) on the nodes of the module, by full name. h_stat() reads a
+ * counter of net.inet6.ndproxy.counters.
+ */
+int	h_sysctl(const char *name, void *old, size_t *oldlen, const void *new,
+	    size_t newlen);
+int	h_sysctl_str(const char *name, const char *val);
+int	h_sysctl_int(const char *name, int val);
+uint64_t h_stat(const char *name);
+
+/*
+ * Receive a frame on an interface, in the net epoch, as ether_input()
+ * does: through the link-layer pfil hooks, then, for IPv6 packets left
+ * to the stack, the inet6 ones. A frame to the unicast MAC of another
+ * host only goes through the inet6 hooks, as on an interface in
+ * permanently promiscuous mode.
+ */
+int	h_input(int ifindex, const uint8_t *frame, size_t len, int flags);
+
+/*
+ * Let n ticks elapse, firing the callouts due, and run the tasks queued
+ * by the CPU of the caller.
+ */
+void	h_tick(int n);
+void	h_run_tasks(void);
+
+/* mbufs allocated and not freed by the calling thread. */
+long	h_mbufs(void);
+
+/*
+ * Microbenchmarks of the tables of the hook (kbench.c), each against the
+ * loop the hook ran before it. They return the ns per lookup of both in
+ * *fast and *slow, and -1 if they do not agree on every lookup.
+ */
+int	h_bench_exceptions(unsigned n, double *fast, double *slow);
+int	h_bench_uplink(unsigned n, double *fast, double *slow);
+int	h_bench_policy(unsigned n, double *fast, double *slow);
+/*
+ * Advertisements built on ifindex from its template, against the fields
+ * filled one by one and summed by in6_cksum(), in cycles per reply.
+ */
+int	h_bench_na(int ifindex, double *fast, double *slow);
+/*
+ * The rule name of the variant of the hook linked on the link layer, or
+ * NULL. h_hook_force() runs the variant for a shape of conf in its place
+ * until the conf changes, and returns its name, or NULL. A variant falls
+ * back to the generic hook on a conf without its shape.
+ */
+const char *h_hook_linked(void);
+const char *h_hook_force(int shape);
+
+#endif
@@ -0,0 +1,355 @@
+/*-
+ * Copyright (c) 2015-2019 Alexandre Fenyo <alex@fenyo.net> - http://www.fenyo.net
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * The API of harness.h, on the kernel side.
+ */
+
+#include "harness.h"
+#include "kshim.h"
+
+int
+h_init(int ncpu)
+{
+	if (ncpu < 1 || ncpu > MAXCPU)
+		return (EINVAL);
+	mp_ncpus = ncpu;
+	mp_maxid = ncpu - 1;
+	h_curcpu = 0;
+	h_sysinit_run(H_SI_MODULE, MOD_LOAD);
+	h_sysinit_run(H_SI_VNET_INIT, 0);
+	return (0);
+}
+
+/*
+ * Detach the interfaces, then unload the module, so that the next
+ * h_init() starts from scratch.
+ */
+void
+h_fini(void)
+{
+	struct ifnet *ifp;
+	u_int i;
+
+	for (i = 1; i <= h_nifnets; i++)
+		h_eventhandler_invoke("ifnet_departure_event", h_ifnets[i]);
+	h_sysinit_run(H_SI_MODULE, MOD_UNLOAD);
+	h_sysinit_run(H_SI_VNET_UNINIT, 0);
+	h_sysinit_run(H_SI_UNINIT, 0);
+
+	pthread_mutex_lock(&h_net_lock);
+	atomic_store_rel_ptr(&h_ifnet.cstqh_first, NULL);
+	h_epoch_wait();
+	for (i = 1; i <= h_nifnets; i++) {
+		ifp = h_ifnets[i];
+		h_ifnets[i] = NULL;
+		h_if_errors[i] = 0;
+		h_free(ifp);
+	}
+	h_nifnets = 0;
+	h_nroutes = 0;
+	h_output = NULL;
+	pthread_mutex_unlock(&h_net_lock);
+}
+
+void
+h_thread_init(int cpu)
+{
+	h_curcpu = cpu;
+}
+
+void
+h_thread_fini(void)
+{
+	h_mbuf_drain();
+}
+
+int
+h_ifattach(const char *name, const uint8_t *mac)
+{
+	struct ifnet *ifp, **ifpp;
+
+	pthread_mutex_lock(&h_net_lock);
+	if (h_nifnets + 1 >= H_IFNET_MAX) {
+		pthread_mutex_unlock(&h_net_lock);
+		return (-1);
+	}
+	ifp = h_malloc(sizeof(*ifp), M_WAITOK | M_ZERO);
+	ifp->if_index = ++h_nifnets;
+	ifp->if_type = IFT_ETHER;
+	strlcpy(ifp->if_xname, name, sizeof(ifp->if_xname));
+	memcpy(ifp->if_lladdr, mac, ETHER_ADDR_LEN);
+	ifp->if_transmit = h_if_transmit;
+	for (ifpp = &h_ifnet.cstqh_first; *ifpp != NULL;
+	    ifpp = &(*ifpp)->if_link.cstqe_next)
+		;
+	atomic_store_rel_ptr(&h_ifnets[ifp->if_index], ifp);
+	atomic_store_rel_ptr(ifpp, ifp);
+	pthread_mutex_unlock(&h_net_lock);
+
+	h_eventhandler_invoke("ifnet_arrival_event", ifp);
+	return (ifp->if_index);
+}
+
+int
+h_ifrename(int ifindex, const char *name)
+{
+	struct ifnet *ifp;
+	char old[IFNAMSIZ];
+
+	if ((ifp = ifnet_byindex(ifindex)) == NULL)
+		return (ENXIO);
+	pthread_mutex_lock(&h_net_lock);
+	strlcpy(old, ifp->if_xname, sizeof(old));
+	strlcpy(ifp->if_xname, name, sizeof(ifp->if_xname));
+	pthread_mutex_unlock(&h_net_lock);
+
+	h_eventhandler_invoke_name("ifnet_rename_event", ifp, old);
+	return (0);
+}
+
+int
+h_ifaddr_add(int ifindex, const uint8_t *addr)
+{
+	struct ifnet *ifp;
+	struct in6_addr in6;
+
+	if ((ifp = ifnet_byindex(ifindex)) == NULL)
+		return (ENXIO);
+	memcpy(&in6, addr, sizeof(in6));
+	pthread_mutex_lock(&h_net_lock);
+	if (IN6_IS_ADDR_LINKLOCAL(&in6)) {
+		in6_setscope(&in6, ifp, NULL);
+		ifp->if_ll.ia_addr.sin6_family = AF_INET6;
+		ifp->if_ll.ia_addr.sin6_len = sizeof(struct sockaddr_in6);
+		ifp->if_ll.ia_addr.sin6_addr = in6;
+		ifp->if_has_ll = 1;
+	} else {
+		ifp->if_global = in6;
+		ifp->if_has_global = 1;
+	}
+	pthread_mutex_unlock(&h_net_lock);
+
+	h_eventhandler_invoke("ifaddr_event", ifp);
+	return (0);
+}
+
+int
+h_route_add(const uint8_t *prefix, int len, int ifindex, int reject)
+{
+	struct h_route *hr;
+	struct ifnet *ifp;
+
+	if (len < 0 || len > 128 || (ifp = ifnet_byindex(ifindex)) == NULL)
+		return (EINVAL);
+	pthread_mutex_lock(&h_net_lock);
+	if (h_nroutes == H_ROUTE_MAX) {
+		pthread_mutex_unlock(&h_net_lock);
+		return (ENOSPC);
+	}
+	hr = &h_routes[h_nroutes];
+	memcpy(&hr->hr_prefix, prefix, sizeof(hr->hr_prefix));
+	hr->hr_len = len;
+	hr->hr_nh.nh_ifp = ifp;
+	hr->hr_nh.nh_flags = reject ? NHF_REJECT : 0;
+	__atomic_store_n(&h_nroutes, h_nroutes + 1, __ATOMIC_RELEASE);
+	pthread_mutex_unlock(&h_net_lock);
+
+	h_rib_notify();
+	return (0);
+}
+
+void
+h_route_flush(void)
+{
+	pthread_mutex_lock(&h_net_lock);
+	__atomic_store_n(&h_nroutes, 0, __ATOMIC_RELEASE);
+	pthread_mutex_unlock(&h_net_lock);
+	h_rib_notify();
+}
+
+void
+h_set_output(h_output_t *func, void *arg)
+{
+	h_output_arg = arg;
+	h_output = func;
+}
+
+void
+h_if_error(int ifindex, int err)
+{
+	if (ifindex > 0 && ifindex < H_IFNET_MAX)
+		h_if_errors[ifindex] = err;
+}
+
+int
+h_sysctl(const char *name, void *old, size_t *oldlen, const void *new,
+    size_t newlen)
+{
+	struct sysctl_oid *oidp;
+	struct sysctl_req req;
+	int err;
+
+	if ((err = h_sysctl_find(name, &oidp)) != 0)
+		return (err);
+	if (new != NULL && (oidp->oid_kind & CTLFLAG_WR) == 0)
+		return (EPERM);
+	memset(&req, 0, sizeof(req));
+	req.td = &thread0;
+	req.oldptr = old;
+	req.oldlen = oldlen != NULL ? *oldlen : 0;
+	req.newptr = new;
+	req.newlen = newlen;
+	err = oidp->oid_handler(oidp, oidp->oid_arg1, oidp->oid_arg2, &req);
+	if (oldlen != NULL)
+		*oldlen = req.oldidx;
+	return (err);
+}
+
+int
+h_sysctl_str(const char *name, const char *val)
+{
+	return (h_sysctl(name, NULL, NULL, val, strlen(val)));
+}
+
+int
+h_sysctl_int(const char *name, int val)
+{
+	return (h_sysctl(name, NULL, NULL, &val, sizeof(val)));
+}
+
+uint64_t
+h_stat(const char *name)
+{
+	char oid[128];
+	uint64_t val = 0;
+	size_t len = sizeof(val);
+
+	snprintf(oid, sizeof(oid), "net.inet6.ndproxy.counters.%s", name);
+	if (h_sysctl(oid, &val, &len, NULL, 0) != 0)
+		h_panic("h_stat: no counter %s", name);
+	return (val);
+}
+
+/*
+ * Strip the Ethernet header, as ether_demux() does before handing the
+ * packet to ip6_input().
+ */
+static struct mbuf *
+h_m_strip(struct mbuf *m)
+{
+	struct mbuf *n;
+
+	m->m_pkthdr.len -= ETHER_HDR_LEN;
+	if (m->m_len > ETHER_HDR_LEN) {
+		m->m_data += ETHER_HDR_LEN;
+		m->m_len -= ETHER_HDR_LEN;
+		return (m);
+	}
+	n = m->m_next;
+	n->m_flags |= M_PKTHDR | (m->m_flags & ~(M_EXT | M_RDONLY));
+	n->m_pkthdr = m->m_pkthdr;
+	m->m_next = NULL;
+	m_freem(m);
+	return (n);
+}
+
+int
+h_input(int ifindex, const uint8_t *frame, size_t len, int flags)
+{
+	const struct ether_header *eh;
+	struct ifnet *ifp;
+	struct mbuf *m;
+	uint16_t sum;
+	int rv = H_PASS;
+
+	if ((ifp = ifnet_byindex(ifindex)) == NULL || len < ETHER_HDR_LEN ||
+	    (m = h_m_devget(frame, len, flags & H_IN_SPLIT)) == NULL)
+		return (-1);
+	m->m_pkthdr.rcvif = ifp;
+	if (flags & H_IN_RDONLY)
+		m->m_flags |= M_RDONLY;
+	if (flags & (H_IN_VLAN | H_IN_PRIO)) {
+		m->m_flags |= M_VLANTAG;
+		m->m_pkthdr.ether_vtag = flags & H_IN_VLAN ? 0x2005 : 0x2000;
+	}
+	eh = (const struct ether_header *)frame;
+	if (eh->ether_dhost[0] & 1)
+		m->m_flags |= memcmp(eh->ether_dhost, "\xff\xff\xff\xff\xff\xff",
+		    ETHER_ADDR_LEN) == 0 ? M_BCAST : M_MCAST;
+	else if (memcmp(eh->ether_dhost, ifp->if_lladdr, ETHER_ADDR_LEN) != 0)
+		m->m_flags |= M_PROMISC;
+	if ((flags & H_IN_CSUM) && len >= ETHER_HDR_LEN + 40) {
+		sum = h_cksum_mbuf(m, ETHER_HDR_LEN + 40,
+		    len - ETHER_HDR_LEN - 40, 0);
+		m->m_pkthdr.csum_flags = CSUM_DATA_VALID;
+		m->m_pkthdr.csum_data = sum;
+		if (flags & H_IN_PSEUDO) {
+			m->m_pkthdr.csum_flags |= CSUM_PSEUDO_HDR;
+			m->m_pkthdr.csum_data = in6_cksum_pseudo(
+			    (struct ip6_hdr *)(frame + ETHER_HDR_LEN),
+			    len - ETHER_HDR_LEN - 40, IPPROTO_ICMPV6, sum);
+		}
+	}
+
+	h_epoch_enter();
+	if ((m->m_flags & M_PROMISC) == 0 &&
+	    h_pfil_run(h_link_pfil_head, &m, ifp) != PFIL_PASS)
+		rv = H_CONSUMED;
+	else if (ntohs(eh->ether_type) != ETHERTYPE_IPV6)
+		;
+	else if ((m = h_m_strip(m)) != NULL &&
+	    h_pfil_run(h_inet6_pfil_head, &m, ifp) != PFIL_PASS)
+		rv = H_CONSUMED;
+	h_epoch_exit();
+	if (m != NULL && rv == H_PASS)
+		m_freem(m);
+	else if (m != NULL)
+		h_panic("h_input: mbuf left by a hook that took the packet");
+	h_epoch_poll();
+	return (rv);
+}
+
+void
+h_tick(int n)
+{
+	while (n-- > 0) {
+		__atomic_add_fetch(&h_ticks, 1, __ATOMIC_RELAXED);
+		if (h_ticks % hz == 0)
+			time_uptime++;
+		h_callout_tick();
+		h_epoch_poll();
+	}
+}
+
+void
+h_run_tasks(void)
+{
+	h_epoch_enter();
+	h_taskqueue_run(h_curcpu);
+	h_epoch_exit();
+	h_epoch_poll();
+}
@@ -0,0 +1,509 @@
+/*-
+ * Copyright (c) 2015-2019 Alexandre Fenyo <alex@fenyo.net> - http://www.fenyo.net
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Microbenchmarks of the tables the pfil hook reads, against the loops
+ * over plain arrays they replaced. They run the inline lookups of the
+ * module headers, on the kernel side of the harness. The variant of the
+ * hook linked can be forced, to time each one against the generic hook.
+ */
+
+#include <time.h>
+
+#include "harness.h"
+#include "kshim.h"
+
+#include "ndproxy.h"
+#include "ndpacket.h"
+#include "ndconf.h"
+#include "ndhash.h"
+#include "ndtrie.h"
+
+#include <netinet/icmp6.h>
+
+/* Addrs looked up per run, a power of 2. */
+#define	KB_PROBES	1024
+
+/* Minimum time of a measure. */
+#define	KB_MIN_NS	50000000.0
+
+static double
+kb_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (ts.tv_sec * 1e9 + ts.tv_nsec);
+}
+
+/*
+ * Pseudo-random addrs in 2001:db8:1::/64, the same on every run.
+ */
+static void
+kb_addr(uint64_t *seed, struct in6_addr *addr)
+{
+	uint64_t lo;
+
+	*seed = *seed * 6364136223846793005ULL + 1442695040888963407ULL;
+	lo = *seed ^ (*seed >> 29);
+	memset(addr, 0, sizeof(*addr));
+	addr->s6_addr[0] = 0x20;
+	addr->s6_addr[1] = 0x01;
+	addr->s6_addr[2] = 0x0d;
+	addr->s6_addr[3] = 0xb8;
+	addr->s6_addr[5] = 0x01;
+	bcopy(&lo, &addr->s6_addr[8], sizeof(lo));
+}
+
+/*
+ * Run a lookup function over the probes until it took KB_MIN_NS, and
+ * return the time of a lookup. *hits is the sum of what the lookups of
+ * the probes returned: the number found, or of the ranks of the entries
+ * found.
+ */
+typedef u_int kb_lookup_t(const void *, const struct in6_addr *);
+
+static double
+kb_time(kb_lookup_t *f, const void *arg, const struct in6_addr *probes,
+    u_int *hits)
+{
+	double t, start;
+	u_long n = 0;
+	u_int i, found;
+
+	start = kb_now();
+	do {
+		found = 0;
+		for (i = 0; i < KB_PROBES; i++)
+			found += f(arg, &probes[i]);
+		n += KB_PROBES;
+	} while ((t = kb_now() - start) < KB_MIN_NS);
+	*hits = found;
+	return (t / n);
+}
+
+/*
+ * Exception addrs: the hash set against the loop over exception_addrs[]
+ * of the hook before it.
+ */
+struct kb_array {
+	u_int			 ka_count;
+	struct in6_addr		*ka_addrs;
+};
+
+static u_int
+kb_exc_hash(const void *arg, const struct in6_addr *addr)
+{
+	return (nd_hash_lookup(arg, addr) != 0);
+}
+
+/* The loop over exception_addrs[] or uplink_addrs[]. */
+static u_int
+kb_scan(const void *arg, const struct in6_addr *addr)
+{
+	const struct kb_array *ka = arg;
+	u_int i;
+
+	for (i = 0; i < ka->ka_count; i++)
+		if (IN6_ARE_ADDR_EQUAL(&ka->ka_addrs[i], addr))
+			return (true);
+	return (false);
+}
+
+int
+h_bench_exceptions(u_int n, double *fast, double *slow)
+{
+	struct nd_addr_hash *h;
+	struct kb_array ka;
+	struct in6_addr *probes;
+	uint64_t seed = 1;
+	u_int i, fast_hits, slow_hits;
+
+	ka.ka_count = n;
+	ka.ka_addrs = mallocarray(n, sizeof(struct in6_addr), M_NDPROXY,
+	    M_WAITOK);
+	h = nd_hash_alloc(n);
+	for (i = 0; i < n; i++) {
+		kb_addr(&seed, &ka.ka_addrs[i]);
+		nd_hash_insert(h, &ka.ka_addrs[i]);
+	}
+	/* Half of the probes are exceptions, spread over the array. */
+	probes = mallocarray(KB_PROBES, sizeof(struct in6_addr), M_NDPROXY,
+	    M_WAITOK);
+	for (i = 0; i < KB_PROBES; i++)
+		if (i % 2 == 0)
+			probes[i] = ka.ka_addrs[(uint64_t)i * n / KB_PROBES];
+		else
+			kb_addr(&seed, &probes[i]);
+
+	*fast = kb_time(kb_exc_hash, h, probes, &fast_hits);
+	*slow = kb_time(kb_scan, &ka, probes, &slow_hits);
+
+	free(probes, M_NDPROXY);
+	nd_hash_free(h);
+	free(ka.ka_addrs, M_NDPROXY);
+	return (fast_hits == slow_hits && fast_hits == KB_PROBES / 2 ? 0 : -1);
+}
+
+/*
+ * Uplink router addrs: nd_uplink_match() on the halves of the addrs
+ * against the loop over uplink_addrs[] of the hook before it.
+ */
+static u_int
+kb_uplink_match(const void *arg, const struct in6_addr *addr)
+{
+	return (nd_uplink_match(arg, addr) != 0);
+}
+
+int
+h_bench_uplink(u_int n, double *fast, double *slow)
+{
+	struct nd_iface *nif;
+	struct nd_addr64 *u;
+	struct kb_array ka;
+	struct in6_addr *a, *probes;
+	uint64_t seed = 2;
+	u_int i, fast_hits, slow_hits;
+
+	nif = malloc(sizeof(*nif), M_NDPROXY, M_WAITOK | M_ZERO);
+	u = mallocarray(n, sizeof(*u), M_NDPROXY, M_WAITOK);
+	ka.ka_count = n;
+	ka.ka_addrs = mallocarray(n, sizeof(struct in6_addr), M_NDPROXY,
+	    M_WAITOK);
+	for (i = 0; i < n; i++) {
+		a = &ka.ka_addrs[i];
+		kb_addr(&seed, a);
+		bcopy(&a->s6_addr[0], &u[i].a_hi, sizeof(u[i].a_hi));
+		bcopy(&a->s6_addr[8], &u[i].a_lo, sizeof(u[i].a_lo));
+	}
+	nif->ni_uplink = u;
+	nif->ni_uplink_addrs_set = n;
+	probes = mallocarray(KB_PROBES, sizeof(struct in6_addr), M_NDPROXY,
+	    M_WAITOK);
+	for (i = 0; i < KB_PROBES; i++)
+		if (i % 2 == 0)
+			probes[i] = ka.ka_addrs[(i / 2) % n];
+		else
+			kb_addr(&seed, &probes[i]);
+
+	*fast = kb_time(kb_uplink_match, nif, probes, &fast_hits);
+	*slow = kb_time(kb_scan, &ka, probes, &slow_hits);
+
+	free(probes, M_NDPROXY);
+	free(ka.ka_addrs, M_NDPROXY);
+	free(u, M_NDPROXY);
+	free(nif, M_NDPROXY);
+	return (fast_hits == slow_hits && fast_hits == KB_PROBES / 2 ? 0 : -1);
+}
+
+/*
+ * Target policies: the trie against a scan of the policies from the
+ * longest prefix down, which stops at the first one holding the addr.
+ * The policies are a /32 and /56 prefixes in it, as for CPEs owning
+ * parts of a delegated prefix.
+ */
+static u_int
+kb_policy_trie(const void *arg, const struct in6_addr *addr)
+{
+	const struct nd_policy_trie *pt = arg;
+	const struct nd_policy *np;
+
+	np = nd_trie_lookup(pt, addr);
+	return (np == NULL ? 0 : np - pt->pt_policies + 1);
+}
+
+static u_int
+kb_policy_scan(const void *arg, const struct in6_addr *addr)
+{
+	const struct nd_policy_trie *pt = arg;
+	const struct nd_policy *np;
+	u_int bytes, i;
+	int bits;
+
+	for (i = pt->pt_count; i > 0; i--) {
+		np = &pt->pt_policies[i - 1];
+		bytes = np->np_len / 8;
+		bits = np->np_len % 8;
+		if (memcmp(&np->np_prefix, addr, bytes) == 0 && (bits == 0 ||
+		    ((np->np_prefix.s6_addr[bytes] ^ addr->s6_addr[bytes]) &
+		    (0xff << (8 - bits))) == 0))
+			return (i);
+	}
+	return (0);
+}
+
+int
+h_bench_policy(u_int n, double *fast, double *slow)
+{
+	struct nd_policy_trie *pt;
+	struct nd_policy *policies, *np;
+	struct in6_addr *probes;
+	uint64_t seed = 4;
+	u_int i, fast_hits, slow_hits;
+
+	policies = mallocarray(n, sizeof(struct nd_policy), M_NDPROXY,
+	    M_WAITOK | M_ZERO);
+	for (i = 0; i < n; i++) {
+		np = &policies[i];
+		np->np_prefix.s6_addr[0] = 0x20;
+		np->np_prefix.s6_addr[1] = 0x01;
+		np->np_prefix.s6_addr[2] = 0x0d;
+		np->np_prefix.s6_addr[3] = 0xb8;
+		if (i == 0) {
+			np->np_len = 32;
+			np->np_ignore = true;
+			continue;
+		}
+		np->np_len = 56;
+		np->np_prefix.s6_addr[5] = i >> 8;
+		np->np_prefix.s6_addr[6] = i & 0xff;
+		np->np_mac.octet[0] = 0x02;
+		np->np_mac.octet[4] = i >> 8;
+		np->np_mac.octet[5] = i & 0xff;
+	}
+	if (nd_trie_build(policies, n, &pt) != 0) {
+		free(policies, M_NDPROXY);
+		return (-1);
+	}
+	/* Half of the probes in a /56, the others only in the /32. */
+	probes = mallocarray(KB_PROBES, sizeof(struct in6_addr), M_NDPROXY,
+	    M_WAITOK);
+	for (i = 0; i < KB_PROBES; i++) {
+		kb_addr(&seed, &probes[i]);
+		probes[i].s6_addr[4] = i % 2;
+		probes[i].s6_addr[5] = (i / 2 % n) >> 8;
+		probes[i].s6_addr[6] = (i / 2 % n) & 0xff;
+	}
+
+	*fast = kb_time(kb_policy_trie, pt, probes, &fast_hits);
+	*slow = kb_time(kb_policy_scan, pt, probes, &slow_hits);
+
+	free(probes, M_NDPROXY);
+	nd_trie_free(pt);
+	return (fast_hits == slow_hits ? 0 : -1);
+}
+
+/*
+ * Advertisements: the template of the interface and the sum of what
+ * changes, as nd_reply() builds them, against the header fields filled
+ * one by one and in6_cksum() over the whole reply of the hook before
+ * the template. Both start from an mbuf like the reused solicitation,
+ * with the reply addrs as nd_reply() has them, zone ids embedded.
+ */
+struct kb_na {
+	struct in6_addr		 kn_src;
+	struct in6_addr		 kn_dst;
+	struct ether_addr	 kn_mac;
+};
+
+static void
+kb_na_template(struct mbuf *m, const struct nd_iface *nif,
+    const struct kb_na *kn, const struct in6_addr *target)
+{
+	struct ip6_hdr *ip6reply = mtod(m, struct ip6_hdr *);
+	struct nd_neighbor_advert *nd_na;
+	uint32_t flags, na_sum;
+
+	bcopy(&nif->ni_na, ip6reply, sizeof(struct nd_na_template));
+	bcopy(&kn->kn_mac, &((struct nd_na_template *)ip6reply)->nt_mac,
+	    ETHER_ADDR_LEN);
+	ip6reply->ip6_dst = kn->kn_dst;
+	ip6reply->ip6_src = kn->kn_src;
+	nd_na = (struct nd_neighbor_advert *)(ip6reply + 1);
+	flags = ND_NA_FLAG_SOLICITED;
+	nd_na->nd_na_flags_reserved |= flags;
+	nd_na->nd_na_target = *target;
+
+	na_sum = nd_cksum_add(nif->ni_na_sum, &kn->kn_mac, ETHER_ADDR_LEN);
+	na_sum = nd_cksum_addr(na_sum, &kn->kn_src);
+	na_sum = nd_cksum_addr(na_sum, &kn->kn_dst);
+	na_sum = nd_cksum_addr(na_sum, target);
+	na_sum = nd_cksum_add(na_sum, &flags, sizeof(flags));
+	nd_na->nd_na_cksum = nd_cksum_fold(na_sum);
+}
+
+static void
+kb_na_full(struct mbuf *m, const struct nd_iface *nif,
+    const struct kb_na *kn, const struct in6_addr *target)
+{
+	struct ip6_hdr *ip6reply = mtod(m, struct ip6_hdr *);
+	struct nd_neighbor_advert *nd_na;
+	struct nd_opt_hdr *nd_opt;
+	int optlen;
+
+	ip6reply->ip6_flow = 0;
+	ip6reply->ip6_vfc &= ~IPV6_VERSION_MASK;
+	ip6reply->ip6_vfc |= IPV6_VERSION;
+	ip6reply->ip6_plen = htons((u_short)(m->m_len -
+	    sizeof(struct ip6_hdr)));
+	ip6reply->ip6_nxt = IPPROTO_ICMPV6;
+	ip6reply->ip6_hlim = 255;
+	ip6reply->ip6_dst = kn->kn_dst;
+	ip6reply->ip6_src = kn->kn_src;
+
+	nd_na = (struct nd_neighbor_advert *)(ip6reply + 1);
+	nd_na->nd_na_type = ND_NEIGHBOR_ADVERT;
+	nd_na->nd_na_code = 0;
+	nd_na->nd_na_flags_reserved = ND_NA_FLAG_SOLICITED;
+	nd_na->nd_na_target = *target;
+	nd_na->nd_na_flags_reserved |= ND_NA_FLAG_ROUTER;
+
+	optlen = sizeof(struct nd_opt_hdr) + ETHER_ADDR_LEN;
+	nd_opt = (struct nd_opt_hdr *)(nd_na + 1);
+	optlen = (optlen + 7) & ~7;
+	bzero((caddr_t)nd_opt, optlen);
+	nd_opt->nd_opt_type = ND_OPT_TARGET_LINKADDR;
+	nd_opt->nd_opt_len = optlen >> 3;
+	bcopy(&kn->kn_mac, (caddr_t)(nd_opt + 1), ETHER_ADDR_LEN);
+
+	nd_na->nd_na_cksum = 0;
+	nd_na->nd_na_cksum = in6_cksum(m, IPPROTO_ICMPV6,
+	    sizeof(struct ip6_hdr), m->m_len - sizeof(struct ip6_hdr));
+}
+
+typedef void kb_na_t(struct mbuf *, const struct nd_iface *,
+    const struct kb_na *, const struct in6_addr *);
+
+/*
+ * Build replies for the probes until it took KB_MIN_NS, and return the
+ * cycles per reply. sums gets the checksum of each reply.
+ */
+static double
+kb_na_time(kb_na_t *f, struct mbuf *m, const struct nd_iface *nif,
+    const struct kb_na *kn, const struct in6_addr *probes, uint16_t *sums)
+{
+	struct nd_neighbor_advert *nd_na;
+	double start;
+	uint64_t cycles = 0, c;
+	u_long n = 0;
+	u_int i;
+
+	nd_na = (struct nd_neighbor_advert *)(mtod(m, struct ip6_hdr *) + 1);
+	start = kb_now();
+	do {
+		c = get_cyclecount();
+		for (i = 0; i < KB_PROBES; i++) {
+			f(m, nif, kn, &probes[i]);
+			sums[i] = nd_na->nd_na_cksum;
+		}
+		cycles += get_cyclecount() - c;
+		n += KB_PROBES;
+	} while (kb_now() - start < KB_MIN_NS);
+	return ((double)cycles / n);
+}
+
+int
+h_bench_na(int ifindex, double *fast, double *slow)
+{
+	struct ifnet *ifp;
+	struct nd_conf *conf;
+	struct nd_iface *nif;
+	struct kb_na kn;
+	struct mbuf *m;
+	struct in6_addr *probes;
+	uint16_t *fast_sums, *slow_sums;
+	uint64_t seed = 3;
+	u_int i;
+	int ret;
+
+	conf = V_nd_active_conf;
+	if (conf == NULL || (u_int)ifindex >= conf->nc_ifaces_size ||
+	    (nif = conf->nc_ifaces[ifindex]) == NULL ||
+	    (ifp = ifnet_byindex(ifindex)) == NULL)
+		return (-1);
+	/* A reply from the link-local addr of the interface to the PE. */
+	memset(&kn, 0, sizeof(kn));
+	kn.kn_src.s6_addr[0] = kn.kn_dst.s6_addr[0] = 0xfe;
+	kn.kn_src.s6_addr[1] = kn.kn_dst.s6_addr[1] = 0x80;
+	kn.kn_src.s6_addr[15] = 2;
+	kn.kn_dst.s6_addr[15] = 1;
+	in6_setscope(&kn.kn_src, ifp, NULL);
+	in6_setscope(&kn.kn_dst, ifp, NULL);
+	kn.kn_mac = nif->ni_downlink_mac;
+
+	m = m_getcl(M_WAITOK, MT_DATA, M_PKTHDR);
+	m->m_data += max_linkhdr;
+	m->m_len = m->m_pkthdr.len = sizeof(struct nd_na_template);
+	probes = mallocarray(KB_PROBES, sizeof(struct in6_addr), M_NDPROXY,
+	    M_WAITOK);
+	fast_sums = mallocarray(KB_PROBES, sizeof(uint16_t), M_NDPROXY,
+	    M_WAITOK);
+	slow_sums = mallocarray(KB_PROBES, sizeof(uint16_t), M_NDPROXY,
+	    M_WAITOK);
+	for (i = 0; i < KB_PROBES; i++)
+		kb_addr(&seed, &probes[i]);
+
+	*fast = kb_na_time(kb_na_template, m, nif, &kn, probes, fast_sums);
+	*slow = kb_na_time(kb_na_full, m, nif, &kn, probes, slow_sums);
+	ret = memcmp(fast_sums, slow_sums, KB_PROBES * sizeof(uint16_t)) == 0 ?
+	    0 : -1;
+
+	free(slow_sums, M_NDPROXY);
+	free(fast_sums, M_NDPROXY);
+	free(probes, M_NDPROXY);
+	m_freem(m);
+	return (ret);
+}
+
+/*
+ * The variant of packet() linked on the link head, by its shape, and its
+ * position on the head in *idx; -1 if none is.
+ */
+static int
+kb_hook_shape(int *idx)
+{
+	pfil_func_t func;
+	int i, shape;
+
+	for (i = 0; (func = h_pfil_func(h_link_pfil_head, i, NULL)) != NULL;
+	    i++)
+		for (shape = 0; shape < ND_SHAPE_COUNT; shape++)
+			if (nd_packet_variants[shape].pv_func == func) {
+				*idx = i;
+				return (shape);
+			}
+	return (-1);
+}
+
+const char *
+h_hook_linked(void)
+{
+	int i, shape;
+
+	shape = kb_hook_shape(&i);
+	return (shape < 0 ? NULL : nd_packet_variants[shape].pv_name);
+}
+
+const char *
+h_hook_force(int shape)
+{
+	int i;
+
+	if (shape < 0 || shape >= ND_SHAPE_COUNT || kb_hook_shape(&i) < 0)
+		return (NULL);
+	h_pfil_func(h_link_pfil_head, i, nd_packet_variants[shape].pv_func);
+	return (nd_packet_variants[shape].pv_name);
+}
@@ -0,0 +1,877 @@
+/*-
+ * Copyright (c) 2015-2019 Alexandre Fenyo <alex@fenyo.net> - http://www.fenyo.net
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Userland stand-ins for the kernel interfaces the module uses. The
+ * Makefile includes this file first in every source of the module, and
+ * points the system headers they include to empty files, so that the
+ * module is built unmodified, as a kernel without VIMAGE would build it.
+ *
+ * Only what the module needs is here, and it behaves as the kernel does
+ * as far as the module can tell: mbufs have a size and leading space,
+ * counters are per CPU, the net epoch defers frees until the readers are
+ * gone. The services themselves are in kshim.c.
+ */
+
+#ifndef _HARNESS_KERN_H_
+#define _HARNESS_KERN_H_
+
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/types.h>
+#ifdef __linux__
+#include <endian.h>
+#else
+#include <sys/endian.h>
+#endif
+
+/*
+ * cdefs, param and systm.
+ */
+#define	__FreeBSD_version	1400000
+#define	__unused		__attribute__((__unused__))
+#define	__packed		__attribute__((__packed__))
+#define	__aligned(x)		__attribute__((__aligned__(x)))
+#define	__predict_true(e)	__builtin_expect(!!(e), 1)
+#define	__predict_false(e)	__builtin_expect(!!(e), 0)
+#define	__containerof(p, t, f)	((t *)((char *)(p) - offsetof(t, f)))
+#define	__read_mostly
+#define	__exclusive_cache_line	__aligned(CACHE_LINE_SIZE)
+
+#define	CACHE_LINE_SIZE		64
+#define	MAXCPU			64
+#define	hz			1000
+
+#undef	MIN
+#undef	MAX
+#define	MIN(a, b)		((a) < (b) ? (a) : (b))
+#define	MAX(a, b)		((a) > (b) ? (a) : (b))
+#define	nitems(x)		(sizeof((x)) / sizeof((x)[0]))
+#define	roundup2(x, y)		(((x) + ((y) - 1)) & (~((y) - 1)))
+#define	howmany(x, y)		(((x) + ((y) - 1)) / (y))
+#define	powerof2(x)		((((x) - 1) & (x)) == 0)
+#define	CTASSERT(x)		_Static_assert(x, "compile-time assertion failed")
+#define	KASSERT(e, m)		do {					\
+	if (__predict_false(!(e)))					\
+		h_panic m;						\
+} while (0)
+#define	MPASS(e)		KASSERT((e), ("%s", #e))
+
+typedef int64_t			sbintime_t;
+#define	SBT_1S			((sbintime_t)1 << 32)
+#define	SBT_1MS			(SBT_1S / 1000)
+#define	SBT_1US			(SBT_1S / 1000000)
+
+extern volatile int		h_ticks;
+extern int			mp_ncpus;
+extern u_int			mp_maxid;
+extern __thread u_int		h_curcpu;
+extern __thread int		h_critnest;
+extern int64_t			time_uptime;
+#define	ticks			h_ticks
+#define	curcpu			h_curcpu
+#define	CPU_FOREACH(i)		for ((i) = 0; (i) <= (int)mp_maxid; (i)++)
+
+void	h_panic(const char *, ...) __attribute__((__noreturn__));
+int	h_log(int, const char *, ...);
+size_t	h_strlcpy(char *, const char *, size_t);
+#define	log			h_log
+#define	uprintf			printf
+#define	strlcpy			h_strlcpy
+#define	kdb_backtrace()		do { } while (0)
+#define	critical_enter()	do { h_critnest++; } while (0)
+#define	critical_exit()		do {					\
+	KASSERT(h_critnest > 0, ("critical_exit: not in a critical section")); \
+	h_critnest--;							\
+} while (0)
+#define	LOG_ERR			3
+#define	LOG_WARNING		4
+#define	LOG_NOTICE		5
+#define	LOG_INFO		6
+
+int	ppsratecheck(struct timeval *, int *, int);
+uint64_t get_cyclecount(void);
+#define	flsll(x)		((x) == 0 ? 0 : 64 - __builtin_clzll(x))
+
+#define	htons(x)		htobe16(x)
+#define	ntohs(x)		be16toh(x)
+#define	htonl(x)		htobe32(x)
+#define	ntohl(x)		be32toh(x)
+
+/*
+ * malloc(9): allocations of a cache line or more are aligned on one.
+ */
+struct malloc_type {
+	const char	*ks_shortdesc;
+};
+#define	MALLOC_DECLARE(t)	extern struct malloc_type t[1]
+#define	MALLOC_DEFINE(t, s, l)	struct malloc_type t[1] = { { s } }
+#define	M_NOWAIT		0x0001
+#define	M_WAITOK		0x0002
+#define	M_ZERO			0x0100
+
+void	*h_malloc(size_t, int);
+void	 h_free(void *);
+#define	malloc(s, t, f)		h_malloc((s), (f))
+#define	mallocarray(n, s, t, f)	h_malloc((n) * (s), (f))
+#define	free(p, t)		h_free(p)
+
+/*
+ * atomic(9), on the builtins of the compiler. Readers in the epoch load
+ * a published pointer with atomic_load_ptr() and rely on the dependency
+ * of what they read through it, which is a consume load for the
+ * compiler and the thread sanitizer.
+ */
+#define	atomic_load_int(p)	__atomic_load_n((p), __ATOMIC_RELAXED)
+#define	atomic_load_ptr(p)	__atomic_load_n((p), __ATOMIC_CONSUME)
+#define	atomic_load_acq_int(p)	__atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define	atomic_store_int(p, v)	__atomic_store_n((p), (v), __ATOMIC_RELAXED)
+#define	atomic_store_rel_int(p, v) __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+#define	atomic_store_rel_ptr(p, v)					\
+	__atomic_store_n((p), (v), __ATOMIC_RELEASE)
+#define	atomic_add_rel_int(p, v) (void)__atomic_add_fetch((p), (v), __ATOMIC_RELEASE)
+#define	atomic_add_int(p, v)	(void)__atomic_add_fetch((p), (v), __ATOMIC_RELAXED)
+#define	atomic_fetchadd_int(p, v) __atomic_fetch_add((p), (v), __ATOMIC_SEQ_CST)
+#define	atomic_thread_fence_acq() __atomic_thread_fence(__ATOMIC_ACQUIRE)
+#define	atomic_thread_fence_rel() __atomic_thread_fence(__ATOMIC_RELEASE)
+#define	atomic_thread_fence_seq_cst() __atomic_thread_fence(__ATOMIC_SEQ_CST)
+
+static __inline int
+atomic_cmpset_int(volatile u_int *p, u_int old, u_int new)
+{
+	return (__atomic_compare_exchange_n(p, &old, new, 0, __ATOMIC_SEQ_CST,
+	    __ATOMIC_SEQ_CST));
+}
+#define	atomic_cmpset_acq_int	atomic_cmpset_int
+
+/*
+ * counter(9): one line per CPU, written by its thread only.
+ */
+typedef uint64_t		*counter_u64_t;
+#define	H_COUNTER_STRIDE	(CACHE_LINE_SIZE / sizeof(uint64_t))
+
+counter_u64_t counter_u64_alloc(int);
+void	counter_u64_free(counter_u64_t);
+uint64_t counter_u64_fetch(counter_u64_t);
+void	counter_u64_zero(counter_u64_t);
+
+static __inline void
+counter_u64_add(counter_u64_t c, int64_t v)
+{
+	c[h_curcpu * H_COUNTER_STRIDE] += v;
+}
+
+#define	COUNTER_ARRAY_ALLOC(a, n, wait) do {				\
+	u_int _i;							\
+	for (_i = 0; _i < (n); _i++)					\
+		(a)[_i] = counter_u64_alloc(wait);			\
+} while (0)
+#define	COUNTER_ARRAY_FREE(a, n) do {					\
+	u_int _i;							\
+	for (_i = 0; _i < (n); _i++) {					\
+		counter_u64_free((a)[_i]);				\
+		(a)[_i] = NULL;						\
+	}								\
+} while (0)
+#define	COUNTER_ARRAY_COPY(a, dstp, n) do {				\
+	u_int _i;							\
+	for (_i = 0; _i < (n); _i++)					\
+		((uint64_t *)(dstp))[_i] = counter_u64_fetch((a)[_i]);	\
+} while (0)
+#define	COUNTER_ARRAY_ZERO(a, n) do {					\
+	u_int _i;							\
+	for (_i = 0; _i < (n); _i++)					\
+		counter_u64_zero((a)[_i]);				\
+} while (0)
+
+/*
+ * vnet(9), as a kernel without VIMAGE has it: a single instance.
+ */
+struct vnet;
+#define	curvnet			((struct vnet *)NULL)
+#define	VNET_NAME(n)		vnet_entry_##n
+#define	VNET_DECLARE(t, n)	extern t VNET_NAME(n)
+#define	VNET_DEFINE(t, n)	t VNET_NAME(n)
+#define	VNET_DEFINE_STATIC(t, n) static t VNET_NAME(n)
+#define	VNET(n)			VNET_NAME(n)
+#define	CURVNET_SET(v)		do { (void)(v)
+#define	CURVNET_RESTORE()	} while (0)
+#define	VNET_PCPUSTAT_DECLARE(t, n)					\
+	VNET_DECLARE(counter_u64_t, n[sizeof(t) / sizeof(uint64_t)])
+#define	VNET_PCPUSTAT_DEFINE(t, n)					\
+	VNET_DEFINE(counter_u64_t, n[sizeof(t) / sizeof(uint64_t)])
+#define	VNET_PCPUSTAT_ALLOC(n, wait)					\
+	COUNTER_ARRAY_ALLOC(VNET(n), nitems(VNET(n)), (wait))
+#define	VNET_PCPUSTAT_FREE(n)						\
+	COUNTER_ARRAY_FREE(VNET(n), nitems(VNET(n)))
+
+/*
+ * Module and SYSINIT(9), run by h_init() and h_fini(): the module event
+ * handler, then the vnet init functions, in that order.
+ */
+struct module;
+typedef int (*modeventhand_t)(struct module *, int, void *);
+typedef struct moduledata {
+	const char	*name;
+	modeventhand_t	 evhand;
+	void		*priv;
+} moduledata_t;
+#define	MOD_LOAD		1
+#define	MOD_UNLOAD		2
+
+#define	H_SI_MODULE		0
+#define	H_SI_VNET_INIT		1
+#define	H_SI_VNET_UNINIT	2
+#define	H_SI_UNINIT		3
+void	h_sysinit_register(int, void (*)(const void *), const void *);
+
+#define	H_SYSINIT(kind, name, func, arg)				\
+static void __attribute__((__constructor__))				\
+h_sysinit_##name(void)							\
+{									\
+	h_sysinit_register((kind), (void (*)(const void *))(func),	\
+	    (const void *)(arg));					\
+}									\
+struct h_sysinit_dummy_##name
+#define	DECLARE_MODULE(name, data, sub, order)				\
+	H_SYSINIT(H_SI_MODULE, name##_mod, NULL, &(data))
+#define	SYSINIT(name, sub, order, func, arg)				\
+	H_SYSINIT(H_SI_VNET_INIT, name, func, arg)
+#define	SYSUNINIT(name, sub, order, func, arg)				\
+	H_SYSINIT(H_SI_UNINIT, name, func, arg)
+#define	VNET_SYSINIT(name, sub, order, func, arg)			\
+	H_SYSINIT(H_SI_VNET_INIT, name, func, arg)
+#define	VNET_SYSUNINIT(name, sub, order, func, arg)			\
+	H_SYSINIT(H_SI_VNET_UNINIT, name, func, arg)
+
+/*
+ * eventhandler(9), invoked by h_ifattach() and h_ifaddr_add().
+ */
+typedef void *eventhandler_tag;
+#define	EVENTHANDLER_PRI_ANY	10000
+eventhandler_tag h_eventhandler_register(const char *, void *, void *);
+void	h_eventhandler_deregister(eventhandler_tag);
+#define	EVENTHANDLER_REGISTER(name, func, arg, pri)			\
+	h_eventhandler_register(#name, (void *)(func), (arg))
+#define	EVENTHANDLER_DEREGISTER(name, tag) h_eventhandler_deregister(tag)
+
+/*
+ * Locks. The sx lock only protects the configuration, so it is a mutex.
+ */
+struct mtx {
+	pthread_mutex_t	mtx_lock;
+};
+struct sx {
+	pthread_mutex_t	sx_lock;
+};
+#define	MTX_DEF			0
+#define	MA_OWNED		1
+#define	SA_XLOCKED		1
+#define	SA_LOCKED		2
+#define	mtx_init(m, n, t, o)	pthread_mutex_init(&(m)->mtx_lock, NULL)
+#define	mtx_destroy(m)		pthread_mutex_destroy(&(m)->mtx_lock)
+#define	mtx_lock(m)		pthread_mutex_lock(&(m)->mtx_lock)
+#define	mtx_unlock(m)		pthread_mutex_unlock(&(m)->mtx_lock)
+#define	mtx_assert(m, w)	do { } while (0)
+#define	sx_init(s, n)		pthread_mutex_init(&(s)->sx_lock, NULL)
+#define	sx_xlock(s)		pthread_mutex_lock(&(s)->sx_lock)
+#define	sx_xunlock(s)		pthread_mutex_unlock(&(s)->sx_lock)
+#define	sx_slock(s)		pthread_mutex_lock(&(s)->sx_lock)
+#define	sx_sunlock(s)		pthread_mutex_unlock(&(s)->sx_lock)
+#define	sx_assert(s, w)		do { } while (0)
+#define	SX_SYSINIT(name, s, desc)					\
+static void __attribute__((__constructor__))				\
+h_sx_init_##name(void)							\
+{									\
+	sx_init((s), (desc));						\
+}									\
+struct h_sx_dummy_##name
+#define	MTX_SYSINIT(name, m, desc, opts)				\
+static void __attribute__((__constructor__))				\
+h_mtx_init_##name(void)							\
+{									\
+	mtx_init((m), (desc), NULL, (opts));				\
+}									\
+struct h_mtx_dummy_##name
+
+/*
+ * The net epoch. A callback runs once every thread that was in the
+ * epoch when it was queued has left it.
+ */
+struct epoch_context {
+	void			(*ec_func)(struct epoch_context *);
+	struct epoch_context	*ec_next;
+	uint64_t		 ec_gen;
+};
+struct epoch_tracker {
+	int			 et_unused;
+};
+void	h_epoch_enter(void);
+void	h_epoch_exit(void);
+void	h_epoch_call(void (*)(struct epoch_context *), struct epoch_context *);
+void	h_epoch_wait(void);
+#define	NET_EPOCH_ENTER(et)	((void)&(et), h_epoch_enter())
+#define	NET_EPOCH_EXIT(et)	((void)&(et), h_epoch_exit())
+#define	NET_EPOCH_CALL(f, c)	h_epoch_call((f), (c))
+#define	NET_EPOCH_WAIT()	h_epoch_wait()
+#define	NET_EPOCH_DRAIN_CALLBACKS() h_epoch_wait()
+#define	NET_EPOCH_ASSERT()	do { } while (0)
+
+/*
+ * callout(9) and taskqueue(9). Callouts fire from h_tick(), tasks run
+ * from h_run_tasks(), on the thread calling them.
+ */
+struct callout {
+	void		(*c_func)(void *);
+	void		*c_arg;
+	int		 c_time;
+	int		 c_active;
+	struct callout	*c_next;
+	int		 c_linked;
+};
+void	callout_init(struct callout *, int);
+int	callout_reset(struct callout *, int, void (*)(void *), void *);
+int	callout_reset_sbt(struct callout *, sbintime_t, sbintime_t,
+	    void (*)(void *), void *, int);
+int	callout_drain(struct callout *);
+#define	callout_stop(c)		callout_drain(c)
+
+typedef void task_fn_t(void *, int);
+struct task {
+	struct task	*ta_next;
+	int		 ta_pending;
+	task_fn_t	*ta_func;
+	void		*ta_context;
+};
+struct taskqueue;
+typedef void (*taskqueue_enqueue_fn)(void *, struct taskqueue **);
+#define	TASK_INIT(t, prio, func, ctx) do {				\
+	(t)->ta_next = NULL;						\
+	(t)->ta_pending = 0;						\
+	(t)->ta_func = (func);						\
+	(t)->ta_context = (ctx);					\
+} while (0)
+#define	PI_NET			0
+typedef struct {
+	uint64_t	__bits[1];
+} cpuset_t;
+#define	CPU_SETOF(n, p)		((p)->__bits[0] = (uint64_t)1 << (n))
+void	taskqueue_thread_enqueue(void *, struct taskqueue **);
+struct taskqueue *taskqueue_create(const char *, int, taskqueue_enqueue_fn,
+	    void *);
+int	taskqueue_start_threads_cpuset(struct taskqueue **, int, int,
+	    cpuset_t *, const char *, ...);
+int	taskqueue_enqueue(struct taskqueue *, struct task *);
+void	taskqueue_drain(struct taskqueue *, struct task *);
+void	taskqueue_free(struct taskqueue *);
+
+/*
+ * sysctl(9). Each oid registers itself when the program starts, and
+ * h_sysctl() finds it by its full name.
+ */
+struct thread;
+struct sysctl_req {
+	struct thread	*td;
+	void		*oldptr;
+	size_t		 oldlen;
+	size_t		 oldidx;
+	const void	*newptr;
+	size_t		 newlen;
+	size_t		 newidx;
+};
+struct sysctl_oid;
+#define	SYSCTL_HANDLER_ARGS	struct sysctl_oid *oidp, void *arg1,	\
+	intmax_t arg2, struct sysctl_req *req
+struct sysctl_oid {
+	struct sysctl_oid *oid_parent;
+	const char	*oid_name;
+	int		 oid_kind;
+	void		*oid_arg1;
+	intmax_t	 oid_arg2;
+	int		(*oid_handler)(SYSCTL_HANDLER_ARGS);
+	struct sysctl_oid *oid_next;
+};
+#define	CTLTYPE_NODE		1
+#define	CTLTYPE_INT		2
+#define	CTLTYPE_STRING		3
+#define	CTLTYPE_U64		4
+#define	CTLTYPE_OPAQUE		5
+#define	CTLFLAG_RD		0x80000000
+#define	CTLFLAG_WR		0x40000000
+#define	CTLFLAG_RW		(CTLFLAG_RD | CTLFLAG_WR)
+#define	CTLFLAG_VNET		0x00080000
+#define	CTLFLAG_MPSAFE		0x00040000
+#define	OID_AUTO		(-1)
+
+void	h_sysctl_register(struct sysctl_oid *);
+int	sysctl_handle_int(SYSCTL_HANDLER_ARGS);
+int	sysctl_handle_64(SYSCTL_HANDLER_ARGS);
+int	sysctl_handle_string(SYSCTL_HANDLER_ARGS);
+int	h_sysctl_handle_counter(SYSCTL_HANDLER_ARGS);
+int	h_sysctl_handle_counter_array(SYSCTL_HANDLER_ARGS);
+int	SYSCTL_IN(struct sysctl_req *, void *, size_t);
+int	SYSCTL_OUT(struct sysctl_req *, const void *, size_t);
+
+#define	H_SYSCTL_OID(scope, parent, name, kind, a1, a2, handler)	\
+scope struct sysctl_oid sysctl_##parent##_##name = {			\
+	&sysctl_##parent, #name, (kind), (void *)(a1), (a2), (handler),	\
+	NULL								\
+};									\
+static void __attribute__((__constructor__))				\
+h_sysctl_init_##parent##_##name(void)					\
+{									\
+	h_sysctl_register(&sysctl_##parent##_##name);			\
+}									\
+struct h_sysctl_dummy_##parent##_##name
+#define	SYSCTL_DECL(name)	extern struct sysctl_oid sysctl_##name
+#define	SYSCTL_NODE(parent, nbr, name, access, handler, descr)		\
+	H_SYSCTL_OID(, parent, name, CTLTYPE_NODE | (access), NULL, 0, NULL)
+#define	SYSCTL_PROC(parent, nbr, name, access, ptr, arg, handler, fmt,	\
+    descr)								\
+	H_SYSCTL_OID(static, parent, name, (access), (ptr), (arg), (handler))
+#define	SYSCTL_INT(parent, nbr, name, access, ptr, val, descr)		\
+	H_SYSCTL_OID(static, parent, name, CTLTYPE_INT | (access), (ptr),	\
+	    (val), sysctl_handle_int)
+#define	SYSCTL_COUNTER_U64(parent, nbr, name, access, ptr, descr)	\
+	H_SYSCTL_OID(static, parent, name, CTLTYPE_U64 | (access), (ptr),	\
+	    0, h_sysctl_handle_counter)
+#define	SYSCTL_COUNTER_U64_ARRAY(parent, nbr, name, access, ptr, len,	\
+    descr)								\
+	H_SYSCTL_OID(static, parent, name, CTLTYPE_OPAQUE | (access),	\
+	    (ptr), (len), h_sysctl_handle_counter_array)
+
+/*
+ * sbuf(9), only as sbuf_new_for_sysctl() uses it. sbuf_printf() knows
+ * the formats the module uses, %6D included.
+ */
+struct sbuf {
+	char		*s_buf;
+	size_t		 s_len;
+	size_t		 s_size;
+	int		 s_error;
+	struct sysctl_req *s_req;
+};
+struct sbuf *sbuf_new_for_sysctl(struct sbuf *, char *, int,
+	    struct sysctl_req *);
+int	sbuf_putc(struct sbuf *, int);
+int	sbuf_cat(struct sbuf *, const char *);
+int	sbuf_printf(struct sbuf *, const char *, ...);
+int	sbuf_finish(struct sbuf *);
+void	sbuf_delete(struct sbuf *);
+
+/*
+ * Privileges and jails. The harness runs as the superuser of the host.
+ */
+struct ucred {
+	int		cr_jailed;
+};
+struct thread {
+	struct ucred	*td_ucred;
+};
+#define	PRIV_NETINET_ND6	503
+int	priv_check(struct thread *, int);
+#define	jailed(cred)		((cred)->cr_jailed)
+#define	prison_owns_vnet(cred)	0
+
+/*
+ * SDT(9) probes are not fired.
+ */
+#define	SDT_PROVIDER_DEFINE(p)	struct h_sdt_dummy_provider_##p
+#define	SDT_PROVIDER_DECLARE(p)	struct h_sdt_dummy_provider_##p
+#define	SDT_PROBE_DEFINE2(p, m, f, n, a0, a1)				\
+	struct h_sdt_dummy_##p##_##f##_##n
+#define	SDT_PROBE_DEFINE3(p, m, f, n, a0, a1, a2)			\
+	struct h_sdt_dummy_##p##_##f##_##n
+#define	SDT_PROBE_DECLARE(p, m, f, n)	struct h_sdt_dummy_##p##_##f##_##n
+#define	SDT_PROBE2(p, m, f, n, a0, a1)	do { } while (0)
+#define	SDT_PROBE3(p, m, f, n, a0, a1, a2) do { } while (0)
+
+/*
+ * Addresses and headers of the network stack.
+ */
+#define	AF_INET6		28
+#define	INET6_ADDRSTRLEN	46
+#define	IFNAMSIZ		16
+#define	RT_DEFAULT_FIB		0
+
+struct in6_addr {
+	union {
+		uint8_t		__u6_addr8[16];
+		uint16_t	__u6_addr16[8];
+		uint32_t	__u6_addr32[4];
+	} __u6_addr;
+};
+#define	s6_addr			__u6_addr.__u6_addr8
+#define	s6_addr8		__u6_addr.__u6_addr8
+#define	s6_addr16		__u6_addr.__u6_addr16
+#define	s6_addr32		__u6_addr.__u6_addr32
+
+struct sockaddr_in6 {
+	uint8_t		sin6_len;
+	uint8_t		sin6_family;
+	uint16_t	sin6_port;
+	uint32_t	sin6_flowinfo;
+	struct in6_addr	sin6_addr;
+	uint32_t	sin6_scope_id;
+};
+
+extern const struct in6_addr in6addr_any;
+extern const struct in6_addr in6addr_linklocal_allnodes;
+
+#define	IN6_ARE_ADDR_EQUAL(a, b)					\
+	(memcmp(&(a)->s6_addr[0], &(b)->s6_addr[0], sizeof(struct in6_addr)) == 0)
+#define	IN6_IS_ADDR_UNSPECIFIED(a)					\
+	((a)->s6_addr32[0] == 0 && (a)->s6_addr32[1] == 0 &&		\
+	(a)->s6_addr32[2] == 0 && (a)->s6_addr32[3] == 0)
+#define	IN6_IS_ADDR_LOOPBACK(a)						\
+	((a)->s6_addr32[0] == 0 && (a)->s6_addr32[1] == 0 &&		\
+	(a)->s6_addr32[2] == 0 && (a)->s6_addr32[3] == htonl(1))
+#define	IN6_IS_ADDR_MULTICAST(a)	((a)->s6_addr[0] == 0xff)
+#define	IN6_IS_ADDR_LINKLOCAL(a)					\
+	((a)->s6_addr[0] == 0xfe && ((a)->s6_addr[1] & 0xc0) == 0x80)
+#define	IN6_IS_ADDR_MC_INTFACELOCAL(a)					\
+	(IN6_IS_ADDR_MULTICAST(a) && ((a)->s6_addr[1] & 0x0f) == 0x01)
+#define	IN6_IS_ADDR_MC_LINKLOCAL(a)					\
+	(IN6_IS_ADDR_MULTICAST(a) && ((a)->s6_addr[1] & 0x0f) == 0x02)
+#define	IN6_IS_SCOPE_LINKLOCAL(a)					\
+	(IN6_IS_ADDR_LINKLOCAL(a) || IN6_IS_ADDR_MC_LINKLOCAL(a))
+#define	IN6_IS_SCOPE_EMBED(a)						\
+	(IN6_IS_ADDR_LINKLOCAL(a) || IN6_IS_ADDR_MC_LINKLOCAL(a) ||	\
+	IN6_IS_ADDR_MC_INTFACELOCAL(a))
+
+#define	IPV6_ADDR_INT16_MLL	htons(0xff02)
+#define	IPV6_ADDR_INT32_ONE	htonl(1)
+#define	IPV6_ADDR_SCOPE_INTFACELOCAL	0x01
+#define	IPV6_ADDR_SCOPE_LINKLOCAL	0x02
+#define	IPV6_ADDR_SCOPE_SITELOCAL	0x05
+#define	IPV6_ADDR_SCOPE_GLOBAL		0x0e
+
+const char *h_inet_ntop(const void *, char *, size_t);
+int	h_inet_pton(const char *, void *);
+#define	inet_ntop(af, src, dst, size)	h_inet_ntop((src), (dst), (size))
+#define	inet_pton(af, src, dst)		h_inet_pton((src), (dst))
+
+#define	IPPROTO_ICMPV6		58
+#define	IPV6_VERSION		0x60
+#define	IPV6_VERSION_MASK	0xf0
+
+struct ip6_hdr {
+	union {
+		struct ip6_hdrctl {
+			uint32_t ip6_un1_flow;
+			uint16_t ip6_un1_plen;
+			uint8_t  ip6_un1_nxt;
+			uint8_t  ip6_un1_hlim;
+		} ip6_un1;
+		uint8_t ip6_un2_vfc;
+	} ip6_ctlun;
+	struct in6_addr ip6_src;
+	struct in6_addr ip6_dst;
+} __packed;
+#define	ip6_vfc			ip6_ctlun.ip6_un2_vfc
+#define	ip6_flow		ip6_ctlun.ip6_un1.ip6_un1_flow
+#define	ip6_plen		ip6_ctlun.ip6_un1.ip6_un1_plen
+#define	ip6_nxt			ip6_ctlun.ip6_un1.ip6_un1_nxt
+#define	ip6_hlim		ip6_ctlun.ip6_un1.ip6_un1_hlim
+
+struct icmp6_hdr {
+	uint8_t		icmp6_type;
+	uint8_t		icmp6_code;
+	uint16_t	icmp6_cksum;
+	union {
+		uint32_t	icmp6_un_data32[1];
+		uint16_t	icmp6_un_data16[2];
+		uint8_t		icmp6_un_data8[4];
+	} icmp6_dataun;
+} __packed;
+#define	icmp6_data32		icmp6_dataun.icmp6_un_data32
+
+#define	ND_NEIGHBOR_SOLICIT	135
+#define	ND_NEIGHBOR_ADVERT	136
+struct nd_neighbor_solicit {
+	struct icmp6_hdr	nd_ns_hdr;
+	struct in6_addr		nd_ns_target;
+} __packed;
+#define	nd_ns_type		nd_ns_hdr.icmp6_type
+#define	nd_ns_code		nd_ns_hdr.icmp6_code
+#define	nd_ns_cksum		nd_ns_hdr.icmp6_cksum
+struct nd_neighbor_advert {
+	struct icmp6_hdr	nd_na_hdr;
+	struct in6_addr		nd_na_target;
+} __packed;
+#define	nd_na_type		nd_na_hdr.icmp6_type
+#define	nd_na_code		nd_na_hdr.icmp6_code
+#define	nd_na_cksum		nd_na_hdr.icmp6_cksum
+#define	nd_na_flags_reserved	nd_na_hdr.icmp6_data32[0]
+#if BYTE_ORDER == BIG_ENDIAN
+#define	ND_NA_FLAG_ROUTER	0x80000000
+#define	ND_NA_FLAG_SOLICITED	0x40000000
+#define	ND_NA_FLAG_OVERRIDE	0x20000000
+#else
+#define	ND_NA_FLAG_ROUTER	0x80
+#define	ND_NA_FLAG_SOLICITED	0x40
+#define	ND_NA_FLAG_OVERRIDE	0x20
+#endif
+struct nd_opt_hdr {
+	uint8_t		nd_opt_type;
+	uint8_t		nd_opt_len;
+} __packed;
+#define	ND_OPT_SOURCE_LINKADDR	1
+#define	ND_OPT_TARGET_LINKADDR	2
+
+#define	ETHER_ADDR_LEN		6
+#define	ETHER_TYPE_LEN		2
+#define	ETHER_HDR_LEN		(ETHER_ADDR_LEN * 2 + ETHER_TYPE_LEN)
+#define	ETHERTYPE_IPV6		0x86dd
+#define	EVL_VLID_MASK		0x0fff
+#define	EVL_VLANOFTAG(tag)	((tag) & EVL_VLID_MASK)
+struct ether_addr {
+	u_char		octet[ETHER_ADDR_LEN];
+} __packed;
+struct ether_header {
+	u_char		ether_dhost[ETHER_ADDR_LEN];
+	u_char		ether_shost[ETHER_ADDR_LEN];
+	u_short		ether_type;
+} __packed;
+#define	ETHER_MAP_IPV6_MULTICAST(ip6addr, enaddr) do {			\
+	(enaddr)[0] = 0x33;						\
+	(enaddr)[1] = 0x33;						\
+	(enaddr)[2] = ((const u_char *)(ip6addr))[12];			\
+	(enaddr)[3] = ((const u_char *)(ip6addr))[13];			\
+	(enaddr)[4] = ((const u_char *)(ip6addr))[14];			\
+	(enaddr)[5] = ((const u_char *)(ip6addr))[15];			\
+} while (0)
+
+/*
+ * mbuf(9). A packet header mbuf holds MHLEN bytes, a cluster MCLBYTES;
+ * both are carved from the same storage, but their size is what the
+ * macros see.
+ */
+#define	MHLEN			160
+#define	MCLBYTES		2048
+#define	MT_DATA			1
+#define	M_EXT			0x00000001
+#define	M_PKTHDR		0x00000002
+#define	M_RDONLY		0x00000008
+#define	M_BCAST			0x00000010
+#define	M_MCAST			0x00000020
+#define	M_PROMISC		0x00000040
+#define	M_VLANTAG		0x00000080
+#define	M_PROTOFLAGS		0x00fc0000
+#define	CSUM_DATA_VALID		0x00000400
+#define	CSUM_PSEUDO_HDR		0x00000800
+
+struct pkthdr {
+	struct ifnet	*rcvif;
+	int		 len;
+	uint32_t	 flowid;
+	uint32_t	 csum_flags;
+	uint32_t	 csum_data;
+	uint8_t		 rsstype;
+	uint16_t	 ether_vtag;
+};
+struct mbuf {
+	struct mbuf	*m_next;
+	caddr_t		 m_data;
+	int		 m_len;
+	int		 m_flags;
+	struct pkthdr	 m_pkthdr;
+	int		 m_size;
+	struct mbuf	*m_freelist;
+	char		 m_storage[MCLBYTES] __aligned(8);
+};
+#define	mtod(m, t)		((t)((m)->m_data))
+#define	M_START(m)		((m)->m_storage)
+#define	M_WRITABLE(m)		(((m)->m_flags & M_RDONLY) == 0)
+#define	M_LEADINGSPACE(m)						\
+	(M_WRITABLE(m) ? (int)((m)->m_data - M_START(m)) : 0)
+#define	M_TRAILINGSPACE(m)						\
+	(M_WRITABLE(m) ? (int)(M_START(m) + (m)->m_size -		\
+	((m)->m_data + (m)->m_len)) : 0)
+#define	M_HASHTYPE_CLEAR(m)	((m)->m_pkthdr.rsstype = 0)
+#define	M_PREPEND(m, plen, how)	((m) = h_m_prepend((m), (plen)))
+#define	m_clrprotoflags(m)	((m)->m_flags &= ~M_PROTOFLAGS)
+#define	m_tag_delete_chain(m, t) do { } while (0)
+
+extern int max_linkhdr;
+struct mbuf *m_gethdr(int, short);
+struct mbuf *m_getcl(int, short, int);
+void	m_freem(struct mbuf *);
+struct mbuf *m_pullup(struct mbuf *, int);
+struct mbuf *h_m_prepend(struct mbuf *, int);
+
+/*
+ * Interfaces, with the addrs and routes the harness gives them.
+ */
+#define	IFT_ETHER		0x6
+#define	IFT_L2VLAN		0x87
+struct in6_ifaddr {
+	struct sockaddr_in6	ia_addr;
+};
+struct ifaddr;
+struct ifnet {
+	struct {
+		struct ifnet	*cstqe_next;
+	}		 if_link;
+	u_short		 if_index;
+	u_char		 if_type;
+	struct vnet	*if_vnet;
+	char		 if_xname[IFNAMSIZ];
+	u_char		 if_lladdr[ETHER_ADDR_LEN];
+	int		(*if_transmit)(struct ifnet *, struct mbuf *);
+	struct in6_ifaddr if_ll;		/* Link-local addr, if any. */
+	int		 if_has_ll;
+	struct in6_addr	 if_global;		/* Global addr, if any. */
+	int		 if_has_global;
+};
+struct ifnethead {
+	struct ifnet	*cstqh_first;
+};
+extern struct ifnethead	h_ifnet;
+#define	V_ifnet			h_ifnet
+#define	CK_STAILQ_FOREACH(var, head, field)				\
+	for ((var) = atomic_load_ptr(&(head)->cstqh_first);		\
+	    (var) != NULL;						\
+	    (var) = atomic_load_ptr(&(var)->field.cstqe_next))
+#define	if_name(ifp)		((ifp)->if_xname)
+#define	IF_LLADDR(ifp)		((ifp)->if_lladdr)
+struct ifnet *ifnet_byindex(u_int);
+#define	ifa_free(ifa)		do { } while (0)
+
+int	in6_addrscope(const struct in6_addr *);
+int	in6_setscope(struct in6_addr *, struct ifnet *, uint32_t *);
+int	in6_clearscope(struct in6_addr *);
+void	in6_splitscope(const struct in6_addr *, struct in6_addr *, uint32_t *);
+int	in6_selectsrc_addr(uint32_t, const struct in6_addr *, uint32_t,
+	    struct ifnet *, struct in6_addr *, int *);
+struct in6_ifaddr *in6ifa_ifpforlinklocal(struct ifnet *, int);
+int	in6_cksum(struct mbuf *, uint8_t, uint32_t, uint32_t);
+uint16_t in6_cksum_pseudo(struct ip6_hdr *, uint32_t, uint8_t, uint16_t);
+
+struct ip6_moptions {
+	struct ifnet	*im6o_multicast_ifp;
+	u_char		 im6o_multicast_hlim;
+	u_char		 im6o_multicast_loop;
+};
+struct ip6_pktopts;
+struct route_in6;
+struct inpcb;
+int	ip6_output(struct mbuf *, struct ip6_pktopts *, struct route_in6 *,
+	    int, struct ip6_moptions *, struct ifnet **, struct inpcb *);
+
+#define	NHF_REJECT		0x0010
+#define	NHF_BLACKHOLE		0x0020
+#define	NHR_NONE		0
+struct nhop_object {
+	struct ifnet	*nh_ifp;
+	int		 nh_flags;
+};
+struct nhop_object *fib6_lookup(uint32_t, const struct in6_addr *, uint32_t,
+	    uint32_t, uint32_t);
+
+struct rib_head;
+struct rib_cmd_info;
+struct rib_subscription;
+enum rib_subscription_type {
+	RIB_NOTIFY_IMMEDIATE,
+	RIB_NOTIFY_DELAYED
+};
+typedef void rib_subscription_cb_t(struct rib_head *, struct rib_cmd_info *,
+	    void *);
+struct rib_subscription *rib_subscribe(uint32_t, int, rib_subscription_cb_t *,
+	    void *, enum rib_subscription_type, bool);
+void	rib_unsubscribe(struct rib_subscription *);
+
+/*
+ * pfil(9): the link-layer and inet6 heads, which h_input() runs.
+ */
+typedef enum {
+	PFIL_PASS = 0,
+	PFIL_DROPPED,
+	PFIL_CONSUMED,
+	PFIL_REALLOCED,
+} pfil_return_t;
+typedef pfil_return_t (*pfil_func_t)(struct mbuf **, struct ifnet *, int,
+	    void *, struct inpcb *);
+typedef struct pfil_hook *pfil_hook_t;
+typedef struct pfil_head *pfil_head_t;
+#define	PFIL_VERSION		2
+#define	PFIL_IN			0x00010000
+#define	PFIL_OUT		0x00020000
+#define	PFIL_HEADPTR		0x00100000
+#define	PFIL_HOOKPTR		0x00200000
+#define	PFIL_APPEND		0x00400000
+#define	PFIL_UNLINK		0x00800000
+#define	PFIL_TYPE_IP6		2
+#define	PFIL_TYPE_ETHERNET	3
+struct pfil_hook_args {
+	int		 pa_version;
+	int		 pa_flags;
+	int		 pa_type;
+	void		*pa_ruleset;
+	pfil_func_t	 pa_func;
+	const char	*pa_modname;
+	const char	*pa_rulname;
+};
+struct pfil_link_args {
+	int		pa_version;
+	int		pa_flags;
+	union {
+		const char	*pa_headname;
+		pfil_head_t	 pa_head;
+	};
+	union {
+		struct {
+			const char	*pa_modname;
+			const char	*pa_rulname;
+		};
+		pfil_hook_t	 pa_hook;
+	};
+};
+pfil_hook_t pfil_add_hook(struct pfil_hook_args *);
+void	pfil_remove_hook(pfil_hook_t);
+int	pfil_link(struct pfil_link_args *);
+extern pfil_head_t	h_link_pfil_head;
+extern pfil_head_t	h_inet6_pfil_head;
+#define	V_link_pfil_head	h_link_pfil_head
+#define	V_inet6_pfil_head	h_inet6_pfil_head
+
+/*
+ * The character device of ndctl.c, which the harness does not build.
+ */
+struct cdev;
+struct make_dev_args;
+
+#endif
@@ -0,0 +1,1556 @@
+/*-
+ * Copyright (c) 2015-2019 Alexandre Fenyo <alex@fenyo.net> - http://www.fenyo.net
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Kernel services the module calls, see kern.h.
+ */
+
+#include <sched.h>
+#include <time.h>
+
+#include "harness.h"
+#include "kshim.h"
+
+/* The allocator of libc, under the malloc(9) macros. */
+#undef malloc
+#undef free
+
+volatile int h_ticks = 1;
+int mp_ncpus = 1;
+u_int mp_maxid = 0;
+__thread u_int h_curcpu;
+__thread int h_critnest;		/* Depth of critical sections. */
+int64_t time_uptime = 1;
+int max_linkhdr = 16;
+
+const struct in6_addr in6addr_any;
+const struct in6_addr in6addr_linklocal_allnodes = {{{
+	0xff, 0x02, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0x01 }}};
+
+struct thread thread0 = { &(struct ucred){ 0 } };
+
+struct sysctl_oid sysctl__net_inet6 = {
+	NULL, "net.inet6", CTLTYPE_NODE | CTLFLAG_RW, NULL, 0, NULL, NULL
+};
+
+/*
+ * systm.
+ */
+void
+h_panic(const char *fmt, ...)
+{
+	va_list ap;
+
+	va_start(ap, fmt);
+	fprintf(stderr, "panic: ");
+	vfprintf(stderr, fmt, ap);
+	fprintf(stderr, "\n");
+	va_end(ap);
+	abort();
+}
+
+int
+h_log(int pri, const char *fmt, ...)
+{
+	va_list ap;
+
+	if (getenv("NDHARNESS_LOG") == NULL)
+		return (0);
+	va_start(ap, fmt);
+	vfprintf(stderr, fmt, ap);
+	va_end(ap);
+	return (0);
+}
+
+size_t
+h_strlcpy(char *dst, const char *src, size_t size)
+{
+	size_t len = strlen(src);
+
+	if (size != 0) {
+		size = MIN(len, size - 1);
+		memcpy(dst, src, size);
+		dst[size] = '\0';
+	}
+	return (len);
+}
+
+uint64_t
+get_cyclecount(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+	return (__builtin_ia32_rdtsc());
+#else
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec);
+#endif
+}
+
+/*
+ * As the kernel one, but on ticks.
+ */
+int
+ppsratecheck(struct timeval *lasttime, int *curpps, int maxpps)
+{
+	int now = ticks;
+
+	if (lasttime->tv_sec == 0 || (u_int)(now - lasttime->tv_usec) >= hz) {
+		lasttime->tv_sec = 1;
+		lasttime->tv_usec = now;
+		*curpps = 1;
+		return (maxpps != 0);
+	}
+	if (*curpps < INT32_MAX)
+		(*curpps)++;
+	return (maxpps < 0 || *curpps <= maxpps);
+}
+
+void *
+h_malloc(size_t size, int flags)
+{
+	void *p;
+
+	if (size >= CACHE_LINE_SIZE)
+		p = aligned_alloc(CACHE_LINE_SIZE, roundup2(size, CACHE_LINE_SIZE));
+	else
+		p = malloc(size == 0 ? 1 : size);
+	if (p == NULL) {
+		if (flags & M_WAITOK)
+			h_panic("out of memory");
+		return (NULL);
+	}
+	if (flags & M_ZERO)
+		memset(p, 0, size);
+	return (p);
+}
+
+void
+h_free(void *p)
+{
+	free(p);
+}
+
+/*
+ * counter(9).
+ */
+counter_u64_t
+counter_u64_alloc(int flags)
+{
+	return (h_malloc(MAXCPU * CACHE_LINE_SIZE, flags | M_ZERO));
+}
+
+void
+counter_u64_free(counter_u64_t c)
+{
+	free(c);
+}
+
+uint64_t
+counter_u64_fetch(counter_u64_t c)
+{
+	uint64_t sum = 0;
+	u_int cpu;
+
+	for (cpu = 0; cpu <= mp_maxid; cpu++)
+		sum += __atomic_load_n(&c[cpu * H_COUNTER_STRIDE],
+		    __ATOMIC_RELAXED);
+	return (sum);
+}
+
+void
+counter_u64_zero(counter_u64_t c)
+{
+	u_int cpu;
+
+	for (cpu = 0; cpu <= mp_maxid; cpu++)
+		__atomic_store_n(&c[cpu * H_COUNTER_STRIDE], 0,
+		    __ATOMIC_RELAXED);
+}
+
+/*
+ * SYSINIT and eventhandler registries, filled before main().
+ */
+struct h_sysinit {
+	int			 si_kind;
+	void			(*si_func)(const void *);
+	const void		*si_arg;
+	struct h_sysinit	*si_next;
+};
+static struct h_sysinit *h_sysinits;
+
+void
+h_sysinit_register(int kind, void (*func)(const void *), const void *arg)
+{
+	struct h_sysinit *si;
+
+	si = h_malloc(sizeof(*si), M_WAITOK);
+	si->si_kind = kind;
+	si->si_func = func;
+	si->si_arg = arg;
+	si->si_next = h_sysinits;
+	h_sysinits = si;
+}
+
+/*
+ * Run the functions of a kind, or the module event handler with the
+ * event MOD_LOAD or MOD_UNLOAD for H_SI_MODULE.
+ */
+void
+h_sysinit_run(int kind, int event)
+{
+	const moduledata_t *mod;
+	struct h_sysinit *si;
+
+	for (si = h_sysinits; si != NULL; si = si->si_next) {
+		if (si->si_kind != kind)
+			continue;
+		if (kind == H_SI_MODULE) {
+			mod = si->si_arg;
+			mod->evhand(NULL, event, mod->priv);
+		} else
+			si->si_func(si->si_arg);
+	}
+}
+
+struct h_eventhandler {
+	const char		*eh_name;
+	void			*eh_func;
+	void			*eh_arg;
+	struct h_eventhandler	*eh_next;
+};
+static struct h_eventhandler *h_eventhandlers;
+
+eventhandler_tag
+h_eventhandler_register(const char *name, void *func, void *arg)
+{
+	struct h_eventhandler *eh;
+
+	eh = h_malloc(sizeof(*eh), M_WAITOK);
+	eh->eh_name = name;
+	eh->eh_func = func;
+	eh->eh_arg = arg;
+	eh->eh_next = h_eventhandlers;
+	h_eventhandlers = eh;
+	return (eh);
+}
+
+void
+h_eventhandler_deregister(eventhandler_tag tag)
+{
+	struct h_eventhandler **ehp;
+
+	for (ehp = &h_eventhandlers; *ehp != NULL; ehp = &(*ehp)->eh_next)
+		if (*ehp == tag) {
+			*ehp = (*ehp)->eh_next;
+			free(tag);
+			return;
+		}
+}
+
+void
+h_eventhandler_invoke(const char *name, struct ifnet *ifp)
+{
+	struct h_eventhandler *eh;
+
+	for (eh = h_eventhandlers; eh != NULL; eh = eh->eh_next)
+		if (strcmp(eh->eh_name, name) == 0)
+			((void (*)(void *, struct ifnet *))eh->eh_func)(
+			    eh->eh_arg, ifp);
+}
+
+/*
+ * For the handlers of ifnet_rename_event, which also get the old name.
+ */
+void
+h_eventhandler_invoke_name(const char *name, struct ifnet *ifp,
+    const char *ifname)
+{
+	struct h_eventhandler *eh;
+
+	for (eh = h_eventhandlers; eh != NULL; eh = eh->eh_next)
+		if (strcmp(eh->eh_name, name) == 0)
+			((void (*)(void *, struct ifnet *, const char *))
+			    eh->eh_func)(eh->eh_arg, ifp, ifname);
+}
+
+/*
+ * The net epoch. Each thread publishes the generation it entered at;
+ * a callback queued at generation g runs once no thread is in the epoch
+ * since before g.
+ */
+struct h_epoch_rec {
+	uint64_t		 er_state;	/* gen << 1 | in the epoch. */
+	int			 er_depth;
+	struct h_epoch_rec	*er_next;
+};
+
+static uint64_t h_epoch_gen = 1;
+static struct h_epoch_rec *h_epoch_recs;
+static __thread struct h_epoch_rec *h_epoch_self;
+static pthread_mutex_t h_epoch_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct epoch_context *h_epoch_head, **h_epoch_tail = &h_epoch_head;
+
+static struct h_epoch_rec *
+h_epoch_register(void)
+{
+	struct h_epoch_rec *er;
+
+	er = h_malloc(sizeof(*er), M_WAITOK | M_ZERO);
+	pthread_mutex_lock(&h_epoch_lock);
+	er->er_next = h_epoch_recs;
+	__atomic_store_n(&h_epoch_recs, er, __ATOMIC_RELEASE);
+	pthread_mutex_unlock(&h_epoch_lock);
+	h_epoch_self = er;
+	return (er);
+}
+
+void
+h_epoch_enter(void)
+{
+	struct h_epoch_rec *er = h_epoch_self;
+
+	if (er == NULL)
+		er = h_epoch_register();
+	if (er->er_depth++ == 0) {
+		__atomic_store_n(&er->er_state,
+		    __atomic_load_n(&h_epoch_gen, __ATOMIC_RELAXED) << 1 | 1,
+		    __ATOMIC_RELAXED);
+		__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	}
+}
+
+void
+h_epoch_exit(void)
+{
+	struct h_epoch_rec *er = h_epoch_self;
+
+	if (--er->er_depth == 0)
+		__atomic_store_n(&er->er_state, 0, __ATOMIC_RELEASE);
+}
+
+/*
+ * Oldest generation a thread is in the epoch since.
+ */
+static uint64_t
+h_epoch_oldest(void)
+{
+	struct h_epoch_rec *er;
+	uint64_t oldest = UINT64_MAX, state;
+
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	for (er = __atomic_load_n(&h_epoch_recs, __ATOMIC_ACQUIRE); er != NULL;
+	    er = er->er_next) {
+		state = __atomic_load_n(&er->er_state, __ATOMIC_ACQUIRE);
+		if ((state & 1) != 0 && (state >> 1) < oldest)
+			oldest = state >> 1;
+	}
+	return (oldest);
+}
+
+/*
+ * Run the callbacks no thread can still see the object of.
+ */
+void
+h_epoch_poll(void)
+{
+	struct epoch_context *ctx, *ready;
+	uint64_t oldest;
+
+	pthread_mutex_lock(&h_epoch_lock);
+	oldest = h_epoch_oldest();
+	ready = h_epoch_head;
+	for (ctx = NULL; h_epoch_head != NULL && h_epoch_head->ec_gen <= oldest;
+	    h_epoch_head = h_epoch_head->ec_next)
+		ctx = h_epoch_head;
+	if (ctx == NULL)
+		ready = NULL;
+	else
+		ctx->ec_next = NULL;
+	if (h_epoch_head == NULL)
+		h_epoch_tail = &h_epoch_head;
+	pthread_mutex_unlock(&h_epoch_lock);
+
+	while ((ctx = ready) != NULL) {
+		ready = ctx->ec_next;
+		ctx->ec_func(ctx);
+	}
+}
+
+void
+h_epoch_call(void (*func)(struct epoch_context *), struct epoch_context *ctx)
+{
+	ctx->ec_func = func;
+	ctx->ec_next = NULL;
+	pthread_mutex_lock(&h_epoch_lock);
+	ctx->ec_gen = __atomic_add_fetch(&h_epoch_gen, 1, __ATOMIC_SEQ_CST);
+	*h_epoch_tail = ctx;
+	h_epoch_tail = &ctx->ec_next;
+	pthread_mutex_unlock(&h_epoch_lock);
+	h_epoch_poll();
+}
+
+/*
+ * Wait for the threads in the epoch to leave it, and run the callbacks.
+ */
+void
+h_epoch_wait(void)
+{
+	uint64_t gen;
+
+	gen = __atomic_add_fetch(&h_epoch_gen, 1, __ATOMIC_SEQ_CST);
+	while (h_epoch_oldest() < gen)
+		sched_yield();
+	h_epoch_poll();
+}
+
+/*
+ * callout(9), fired by h_tick().
+ */
+static struct callout *h_callouts;
+static pthread_mutex_t h_callout_lock = PTHREAD_MUTEX_INITIALIZER;
+
+void
+callout_init(struct callout *c, int mpsafe)
+{
+	pthread_mutex_lock(&h_callout_lock);
+	if (!c->c_linked) {
+		c->c_next = h_callouts;
+		h_callouts = c;
+		c->c_linked = 1;
+	}
+	c->c_active = 0;
+	pthread_mutex_unlock(&h_callout_lock);
+}
+
+int
+callout_reset(struct callout *c, int to_ticks, void (*func)(void *), void *arg)
+{
+	int was;
+
+	pthread_mutex_lock(&h_callout_lock);
+	was = c->c_active;
+	c->c_func = func;
+	c->c_arg = arg;
+	c->c_time = ticks + MAX(to_ticks, 1);
+	c->c_active = 1;
+	pthread_mutex_unlock(&h_callout_lock);
+	return (was);
+}
+
+int
+callout_reset_sbt(struct callout *c, sbintime_t sbt, sbintime_t pr,
+    void (*func)(void *), void *arg, int flags)
+{
+	return (callout_reset(c, (int)(sbt * hz / SBT_1S), func, arg));
+}
+
+int
+callout_drain(struct callout *c)
+{
+	int was;
+
+	pthread_mutex_lock(&h_callout_lock);
+	was = c->c_active;
+	c->c_active = 0;
+	pthread_mutex_unlock(&h_callout_lock);
+	return (was);
+}
+
+void
+h_callout_tick(void)
+{
+	struct callout *c;
+	void (*func)(void *);
+	void *arg;
+
+again:
+	pthread_mutex_lock(&h_callout_lock);
+	for (c = h_callouts; c != NULL; c = c->c_next)
+		if (c->c_active && ticks - c->c_time >= 0) {
+			c->c_active = 0;
+			func = c->c_func;
+			arg = c->c_arg;
+			pthread_mutex_unlock(&h_callout_lock);
+			func(arg);
+			goto again;
+		}
+	pthread_mutex_unlock(&h_callout_lock);
+}
+
+/*
+ * taskqueue(9). A queue belongs to the CPU its thread is bound to, and
+ * h_run_tasks() runs it on the thread of that CPU.
+ */
+struct taskqueue {
+	pthread_mutex_t		 tq_lock;
+	struct task		*tq_head;
+	struct task		**tq_tail;
+	u_int			 tq_cpu;
+	struct taskqueue	*tq_next;
+};
+static struct taskqueue *h_taskqueues;
+static pthread_mutex_t h_taskqueue_lock = PTHREAD_MUTEX_INITIALIZER;
+
+void
+taskqueue_thread_enqueue(void *context, struct taskqueue **tqp)
+{
+}
+
+struct taskqueue *
+taskqueue_create(const char *name, int flags, taskqueue_enqueue_fn enqueue,
+    void *context)
+{
+	struct taskqueue *tq;
+
+	tq = h_malloc(sizeof(*tq), M_WAITOK | M_ZERO);
+	pthread_mutex_init(&tq->tq_lock, NULL);
+	tq->tq_tail = &tq->tq_head;
+	pthread_mutex_lock(&h_taskqueue_lock);
+	tq->tq_next = h_taskqueues;
+	h_taskqueues = tq;
+	pthread_mutex_unlock(&h_taskqueue_lock);
+	return (tq);
+}
+
+int
+taskqueue_start_threads_cpuset(struct taskqueue **tqp, int count, int pri,
+    cpuset_t *mask, const char *name, ...)
+{
+	(*tqp)->tq_cpu = __builtin_ctzll(mask->__bits[0]);
+	return (0);
+}
+
+/*
+ * The lock of a queue not made by taskqueue_create_fast() may sleep: it
+ * can not be taken in a critical section.
+ */
+int
+taskqueue_enqueue(struct taskqueue *tq, struct task *task)
+{
+	KASSERT(h_critnest == 0, ("taskqueue_enqueue in a critical section"));
+	pthread_mutex_lock(&tq->tq_lock);
+	if (task->ta_pending++ == 0) {
+		task->ta_next = NULL;
+		*tq->tq_tail = task;
+		tq->tq_tail = &task->ta_next;
+	}
+	pthread_mutex_unlock(&tq->tq_lock);
+	return (0);
+}
+
+static void
+h_taskqueue_run_one(struct taskqueue *tq)
+{
+	struct task *task;
+	int pending;
+
+	pthread_mutex_lock(&tq->tq_lock);
+	while ((task = tq->tq_head) != NULL) {
+		if ((tq->tq_head = task->ta_next) == NULL)
+			tq->tq_tail = &tq->tq_head;
+		pending = task->ta_pending;
+		task->ta_pending = 0;
+		pthread_mutex_unlock(&tq->tq_lock);
+		task->ta_func(task->ta_context, pending);
+		pthread_mutex_lock(&tq->tq_lock);
+	}
+	pthread_mutex_unlock(&tq->tq_lock);
+}
+
+void
+h_taskqueue_run(u_int cpu)
+{
+	struct taskqueue *tq;
+
+	for (tq = h_taskqueues; tq != NULL; tq = tq->tq_next)
+		if (tq->tq_cpu == cpu)
+			h_taskqueue_run_one(tq);
+}
+
+void
+taskqueue_drain(struct taskqueue *tq, struct task *task)
+{
+	h_taskqueue_run_one(tq);
+}
+
+void
+taskqueue_free(struct taskqueue *tq)
+{
+	struct taskqueue **tqp;
+
+	h_taskqueue_run_one(tq);
+	pthread_mutex_lock(&h_taskqueue_lock);
+	for (tqp = &h_taskqueues; *tqp != tq; tqp = &(*tqp)->tq_next)
+		;
+	*tqp = tq->tq_next;
+	pthread_mutex_unlock(&h_taskqueue_lock);
+	pthread_mutex_destroy(&tq->tq_lock);
+	free(tq);
+}
+
+/*
+ * sysctl(9).
+ */
+static struct sysctl_oid *h_sysctls;
+
+void
+h_sysctl_register(struct sysctl_oid *oidp)
+{
+	oidp->oid_next = h_sysctls;
+	h_sysctls = oidp;
+}
+
+static int
+h_sysctl_match(const struct sysctl_oid *oidp, const char *name, size_t len)
+{
+	size_t n;
+
+	if (oidp->oid_parent == NULL)
+		return (len == strlen(oidp->oid_name) &&
+		    strncmp(oidp->oid_name, name, len) == 0);
+	n = strlen(oidp->oid_name);
+	return (len > n && name[len - n - 1] == '.' &&
+	    strncmp(name + len - n, oidp->oid_name, n) == 0 &&
+	    h_sysctl_match(oidp->oid_parent, name, len - n - 1));
+}
+
+int
+h_sysctl_find(const char *name, struct sysctl_oid **oidpp)
+{
+	struct sysctl_oid *oidp;
+
+	for (oidp = h_sysctls; oidp != NULL; oidp = oidp->oid_next)
+		if ((oidp->oid_kind & 0xf) != CTLTYPE_NODE &&
+		    h_sysctl_match(oidp, name, strlen(name))) {
+			*oidpp = oidp;
+			return (0);
+		}
+	return (ENOENT);
+}
+
+int
+SYSCTL_OUT(struct sysctl_req *req, const void *p, size_t l)
+{
+	size_t i = req->oldidx;
+
+	req->oldidx += l;
+	if (req->oldptr == NULL)
+		return (0);
+	if (i >= req->oldlen)
+		return (l == 0 ? 0 : ENOMEM);
+	memcpy((char *)req->oldptr + i, p, MIN(l, req->oldlen - i));
+	return (i + l > req->oldlen ? ENOMEM : 0);
+}
+
+int
+SYSCTL_IN(struct sysctl_req *req, void *p, size_t l)
+{
+	if (req->newptr == NULL)
+		return (0);
+	if (req->newlen - req->newidx < l)
+		return (EINVAL);
+	memcpy(p, (const char *)req->newptr + req->newidx, l);
+	req->newidx += l;
+	return (0);
+}
+
+int
+sysctl_handle_int(SYSCTL_HANDLER_ARGS)
+{
+	int err, val;
+
+	val = arg1 != NULL ? *(int *)arg1 : (int)arg2;
+	if ((err = SYSCTL_OUT(req, &val, sizeof(val))) != 0 ||
+	    req->newptr == NULL)
+		return (err);
+	if (arg1 == NULL)
+		return (EPERM);
+	return (SYSCTL_IN(req, arg1, sizeof(int)));
+}
+
+int
+sysctl_handle_64(SYSCTL_HANDLER_ARGS)
+{
+	uint64_t val;
+	int err;
+
+	val = *(uint64_t *)arg1;
+	if ((err = SYSCTL_OUT(req, &val, sizeof(val))) != 0 ||
+	    req->newptr == NULL)
+		return (err);
+	return (SYSCTL_IN(req, arg1, sizeof(uint64_t)));
+}
+
+int
+sysctl_handle_string(SYSCTL_HANDLER_ARGS)
+{
+	size_t len;
+	int err;
+
+	if ((err = SYSCTL_OUT(req, arg1, strlen(arg1) + 1)) != 0 ||
+	    req->newptr == NULL)
+		return (err);
+	if ((len = req->newlen - req->newidx) >= (size_t)arg2)
+		return (EINVAL);
+	if ((err = SYSCTL_IN(req, arg1, len)) == 0)
+		((char *)arg1)[len] = '\0';
+	return (err);
+}
+
+/*
+ * Counters read as their sum, zeroed by writing anything.
+ */
+int
+h_sysctl_handle_counter(SYSCTL_HANDLER_ARGS)
+{
+	counter_u64_t c = *(counter_u64_t *)arg1;
+	uint64_t val;
+	int err;
+
+	val = counter_u64_fetch(c);
+	if ((err = SYSCTL_OUT(req, &val, sizeof(val))) != 0 ||
+	    req->newptr == NULL)
+		return (err);
+	counter_u64_zero(c);
+	return (0);
+}
+
+int
+h_sysctl_handle_counter_array(SYSCTL_HANDLER_ARGS)
+{
+	counter_u64_t *c = arg1;
+	uint64_t val;
+	intmax_t i;
+	int err;
+
+	for (i = 0; i < arg2; i++) {
+		val = counter_u64_fetch(c[i]);
+		if ((err = SYSCTL_OUT(req, &val, sizeof(val))) != 0)
+			return (err);
+	}
+	if (req->newptr != NULL)
+		for (i = 0; i < arg2; i++)
+			counter_u64_zero(c[i]);
+	return (0);
+}
+
+int
+priv_check(struct thread *td, int priv)
+{
+	return (td == NULL || jailed(td->td_ucred) ? EPERM : 0);
+}
+
+/*
+ * sbuf(9).
+ */
+struct sbuf *
+sbuf_new_for_sysctl(struct sbuf *s, char *buf, int length,
+    struct sysctl_req *req)
+{
+	s->s_size = MAX(length, 16);
+	s->s_buf = malloc(s->s_size);
+	s->s_len = 0;
+	s->s_error = s->s_buf == NULL ? ENOMEM : 0;
+	s->s_req = req;
+	return (s);
+}
+
+static int
+sbuf_bcat(struct sbuf *s, const void *p, size_t len)
+{
+	char *buf;
+
+	if (s->s_error != 0)
+		return (-1);
+	if (s->s_len + len + 1 > s->s_size) {
+		while (s->s_len + len + 1 > s->s_size)
+			s->s_size *= 2;
+		if ((buf = realloc(s->s_buf, s->s_size)) == NULL) {
+			s->s_error = ENOMEM;
+			return (-1);
+		}
+		s->s_buf = buf;
+	}
+	memcpy(s->s_buf + s->s_len, p, len);
+	s->s_len += len;
+	return (0);
+}
+
+int
+sbuf_putc(struct sbuf *s, int c)
+{
+	char ch = c;
+
+	return (sbuf_bcat(s, &ch, 1));
+}
+
+int
+sbuf_cat(struct sbuf *s, const char *str)
+{
+	return (sbuf_bcat(s, str, strlen(str)));
+}
+
+/*
+ * The conversions of printf(9) the module uses: c, s, d, u, x with a
+ * width, and D, which prints the bytes of its first argument in hex
+ * separated by its second one.
+ */
+int
+sbuf_printf(struct sbuf *s, const char *fmt, ...)
+{
+	char spec[16], tmp[64];
+	const u_char *bytes;
+	const char *sep;
+	va_list ap;
+	int i, width;
+
+	va_start(ap, fmt);
+	for (; *fmt != '\0'; fmt++) {
+		if (*fmt != '%') {
+			sbuf_putc(s, *fmt);
+			continue;
+		}
+		i = 0;
+		spec[i++] = *fmt++;
+		while (*fmt >= '0' && *fmt <= '9' && i < 8)
+			spec[i++] = *fmt++;
+		spec[i++] = *fmt;
+		spec[i] = '\0';
+		switch (*fmt) {
+		case 'D':
+			width = atoi(spec + 1);
+			bytes = va_arg(ap, const u_char *);
+			sep = va_arg(ap, const char *);
+			for (i = 0; i < width; i++) {
+				snprintf(tmp, sizeof(tmp), "%s%02x",
+				    i == 0 ? "" : sep, bytes[i]);
+				sbuf_cat(s, tmp);
+			}
+			continue;
+		case 's':
+			snprintf(tmp, sizeof(tmp), "%s", "");
+			sbuf_cat(s, va_arg(ap, const char *));
+			continue;
+		case 'c':
+		case 'd':
+			snprintf(tmp, sizeof(tmp), spec, va_arg(ap, int));
+			break;
+		case 'u':
+		case 'x':
+			snprintf(tmp, sizeof(tmp), spec, va_arg(ap, u_int));
+			break;
+		case '%':
+			strcpy(tmp, "%");
+			break;
+		default:
+			h_panic("sbuf_printf: unsupported format %s", spec);
+		}
+		sbuf_cat(s, tmp);
+	}
+	va_end(ap);
+	return (s->s_error != 0 ? -1 : 0);
+}
+
+int
+sbuf_finish(struct sbuf *s)
+{
+	if (s->s_error != 0)
+		return (s->s_error);
+	s->s_buf[s->s_len] = '\0';
+	return (SYSCTL_OUT(s->s_req, s->s_buf, s->s_len + 1));
+}
+
+void
+sbuf_delete(struct sbuf *s)
+{
+	free(s->s_buf);
+	s->s_buf = NULL;
+}
+
+/*
+ * mbuf(9). Each thread has its own free list, as the UMA caches of the
+ * CPUs.
+ */
+static __thread struct mbuf *h_mbuf_free;
+static __thread long h_mbuf_live;
+
+static struct mbuf *
+h_m_alloc(int size, int flags)
+{
+	struct mbuf *m;
+
+	if ((m = h_mbuf_free) != NULL)
+		h_mbuf_free = m->m_freelist;
+	else if ((m = h_malloc(sizeof(*m), M_NOWAIT)) == NULL)
+		return (NULL);
+	h_mbuf_live++;
+	m->m_next = NULL;
+	m->m_data = m->m_storage;
+	m->m_len = 0;
+	m->m_flags = flags;
+	memset(&m->m_pkthdr, 0, sizeof(m->m_pkthdr));
+	m->m_size = size;
+	return (m);
+}
+
+static void
+h_m_free(struct mbuf *m)
+{
+	m->m_freelist = h_mbuf_free;
+	h_mbuf_free = m;
+	h_mbuf_live--;
+}
+
+long
+h_mbufs(void)
+{
+	return (h_mbuf_live);
+}
+
+void
+h_mbuf_drain(void)
+{
+	struct mbuf *m;
+
+	while ((m = h_mbuf_free) != NULL) {
+		h_mbuf_free = m->m_freelist;
+		h_free(m);
+	}
+}
+
+struct mbuf *
+m_gethdr(int how, short type)
+{
+	return (h_m_alloc(MHLEN, M_PKTHDR));
+}
+
+struct mbuf *
+m_getcl(int how, short type, int flags)
+{
+	return (h_m_alloc(MCLBYTES, M_EXT | flags));
+}
+
+void
+m_freem(struct mbuf *m)
+{
+	struct mbuf *n;
+
+	for (; m != NULL; m = n) {
+		n = m->m_next;
+		h_m_free(m);
+	}
+}
+
+/*
+ * Make the first len bytes of the chain contiguous, in the first mbuf
+ * when it has room for them.
+ */
+struct mbuf *
+m_pullup(struct mbuf *m, int len)
+{
+	struct mbuf *n, *s;
+	int count;
+
+	if (m->m_len >= len)
+		return (m);
+	if (len > MCLBYTES || m->m_pkthdr.len < len) {
+		m_freem(m);
+		return (NULL);
+	}
+	if (M_WRITABLE(m) && m->m_data + len <= M_START(m) + m->m_size)
+		n = m;
+	else {
+		if ((n = m_getcl(M_NOWAIT, MT_DATA, M_PKTHDR)) == NULL) {
+			m_freem(m);
+			return (NULL);
+		}
+		n->m_flags |= m->m_flags & ~(M_EXT | M_RDONLY);
+		n->m_pkthdr = m->m_pkthdr;
+		/* Keep the alignment of the data, ETHER_ALIGN in a frame. */
+		n->m_data += (uintptr_t)m->m_data & (sizeof(uint64_t) - 1);
+		memcpy(n->m_data, m->m_data, m->m_len);
+		n->m_len = m->m_len;
+		n->m_next = m->m_next;
+		h_m_free(m);
+	}
+	while (n->m_len < len) {
+		s = n->m_next;
+		count = MIN(len - n->m_len, s->m_len);
+		memcpy(n->m_data + n->m_len, s->m_data, count);
+		n->m_len += count;
+		s->m_data += count;
+		s->m_len -= count;
+		if (s->m_len == 0) {
+			n->m_next = s->m_next;
+			h_m_free(s);
+		}
+	}
+	return (n);
+}
+
+struct mbuf *
+h_m_prepend(struct mbuf *m, int plen)
+{
+	struct mbuf *n;
+
+	if (M_LEADINGSPACE(m) >= plen) {
+		m->m_data -= plen;
+		m->m_len += plen;
+	} else {
+		if ((n = m_gethdr(M_NOWAIT, MT_DATA)) == NULL) {
+			m_freem(m);
+			return (NULL);
+		}
+		n->m_flags = m->m_flags & ~(M_EXT | M_RDONLY);
+		n->m_pkthdr = m->m_pkthdr;
+		m->m_flags &= ~M_PKTHDR;
+		n->m_data = M_START(n) + n->m_size - plen;
+		n->m_len = plen;
+		n->m_next = m;
+		m = n;
+	}
+	m->m_pkthdr.len += plen;
+	return (m);
+}
+
+/*
+ * A received frame, in a cluster as a driver would put it, or split
+ * after the Ethernet header.
+ */
+struct mbuf *
+h_m_devget(const uint8_t *frame, size_t len, int split)
+{
+	struct mbuf *m, *n;
+	int first;
+
+	first = split ? MIN((int)len, ETHER_HDR_LEN) : (int)len;
+	if (len > MCLBYTES - 2 || (m = m_getcl(M_NOWAIT, MT_DATA,
+	    M_PKTHDR)) == NULL)
+		return (NULL);
+	m->m_data += 2;		/* ETHER_ALIGN */
+	memcpy(m->m_data, frame, first);
+	m->m_len = first;
+	m->m_pkthdr.len = len;
+	if (first < (int)len) {
+		if ((n = m_getcl(M_NOWAIT, MT_DATA, 0)) == NULL) {
+			m_freem(m);
+			return (NULL);
+		}
+		memcpy(n->m_data, frame + first, len - first);
+		n->m_len = len - first;
+		m->m_next = n;
+	}
+	return (m);
+}
+
+void
+h_mbuf_copydata(const struct mbuf *m, uint8_t *p)
+{
+	for (; m != NULL; m = m->m_next) {
+		memcpy(p, m->m_data, m->m_len);
+		p += m->m_len;
+	}
+}
+
+/*
+ * Internet checksum of len bytes of the chain from off, added to sum,
+ * in the byte order of the packet. Whole 64-bit words are added as two
+ * 32-bit ones, as in_cksum() does, which folds to the same sum.
+ */
+uint16_t
+h_cksum_mbuf(const struct mbuf *m, int off, int len, uint32_t sum)
+{
+	const uint8_t *p;
+	uint64_t acc = sum, q;
+	uint16_t w;
+	int count, odd = 0;
+	uint8_t last = 0;
+
+	for (; m != NULL && off >= m->m_len; m = m->m_next)
+		off -= m->m_len;
+	for (; m != NULL && len > 0; m = m->m_next, off = 0) {
+		p = (const uint8_t *)m->m_data + off;
+		count = MIN(len, m->m_len - off);
+		len -= count;
+		if (odd && count > 0) {
+			((uint8_t *)&w)[0] = last;
+			((uint8_t *)&w)[1] = *p++;
+			acc += w;
+			count--;
+			odd = 0;
+		}
+		for (; count >= 8; count -= 8, p += 8) {
+			memcpy(&q, p, sizeof(q));
+			acc += (q & 0xffffffff) + (q >> 32);
+		}
+		for (; count > 1; count -= 2, p += 2) {
+			memcpy(&w, p, sizeof(w));
+			acc += w;
+		}
+		if (count == 1) {
+			last = *p;
+			odd = 1;
+		}
+	}
+	if (odd) {
+		((uint8_t *)&w)[0] = last;
+		((uint8_t *)&w)[1] = 0;
+		acc += w;
+	}
+	while (acc >> 16)
+		acc = (acc >> 16) + (acc & 0xffff);
+	return (acc);
+}
+
+/*
+ * Sum of the pseudo header, the zone ids embedded in the addrs left
+ * out, as the kernel does.
+ */
+static uint32_t
+h_cksum_pseudo(const struct ip6_hdr *ip6, uint32_t len, uint8_t nxt)
+{
+	struct in6_addr src = ip6->ip6_src, dst = ip6->ip6_dst;
+	uint32_t sum = 0, words[2];
+	uint16_t w[8];
+	int i;
+
+	in6_clearscope(&src);
+	in6_clearscope(&dst);
+	memcpy(w, &src, sizeof(w));
+	for (i = 0; i < 8; i++)
+		sum += w[i];
+	memcpy(w, &dst, sizeof(w));
+	for (i = 0; i < 8; i++)
+		sum += w[i];
+	words[0] = htonl(len);
+	words[1] = htonl(nxt);
+	memcpy(w, words, sizeof(words));
+	for (i = 0; i < 4; i++)
+		sum += w[i];
+	return (sum);
+}
+
+int
+in6_cksum(struct mbuf *m, uint8_t nxt, uint32_t off, uint32_t len)
+{
+	uint16_t sum;
+
+	sum = h_cksum_mbuf(m, off, len,
+	    h_cksum_pseudo(mtod(m, struct ip6_hdr *), len, nxt));
+	return (~sum & 0xffff);
+}
+
+uint16_t
+in6_cksum_pseudo(struct ip6_hdr *ip6, uint32_t len, uint8_t nxt, uint16_t csum)
+{
+	uint32_t sum;
+
+	sum = h_cksum_pseudo(ip6, len, nxt) + csum;
+	sum = (sum >> 16) + (sum & 0xffff);
+	sum += sum >> 16;
+	return (sum & 0xffff);
+}
+
+/*
+ * Scopes, as in scope6.c: the zone of a link-scoped addr is the index
+ * of its interface, embedded in its second word.
+ */
+int
+in6_addrscope(const struct in6_addr *addr)
+{
+	if (IN6_IS_ADDR_MULTICAST(addr))
+		return (addr->s6_addr[1] & 0x0f);
+	if (IN6_IS_ADDR_LINKLOCAL(addr) || IN6_IS_ADDR_LOOPBACK(addr))
+		return (IPV6_ADDR_SCOPE_LINKLOCAL);
+	if (addr->s6_addr[0] == 0xfe && (addr->s6_addr[1] & 0xc0) == 0xc0)
+		return (IPV6_ADDR_SCOPE_SITELOCAL);
+	return (IPV6_ADDR_SCOPE_GLOBAL);
+}
+
+int
+in6_setscope(struct in6_addr *in6, struct ifnet *ifp, uint32_t *ret_id)
+{
+	if (ret_id != NULL)
+		*ret_id = 0;
+	if (IN6_IS_SCOPE_EMBED(in6)) {
+		in6->s6_addr16[1] = htons(ifp->if_index);
+		if (ret_id != NULL)
+			*ret_id = ifp->if_index;
+	}
+	return (0);
+}
+
+int
+in6_clearscope(struct in6_addr *in6)
+{
+	if (IN6_IS_SCOPE_EMBED(in6) && in6->s6_addr16[1] != 0) {
+		in6->s6_addr16[1] = 0;
+		return (1);
+	}
+	return (0);
+}
+
+void
+in6_splitscope(const struct in6_addr *src, struct in6_addr *dst,
+    uint32_t *scopeid)
+{
+	*dst = *src;
+	*scopeid = 0;
+	if (IN6_IS_SCOPE_EMBED(dst)) {
+		*scopeid = ntohs(dst->s6_addr16[1]);
+		dst->s6_addr16[1] = 0;
+	}
+}
+
+/*
+ * Source address selection, reduced to the two addrs an interface has:
+ * the link-local one for link-scoped destinations, the global one for
+ * the others. With no global addr, there is no route for them.
+ */
+int
+in6_selectsrc_addr(uint32_t fibnum, const struct in6_addr *dst,
+    uint32_t scopeid, struct ifnet *ifp, struct in6_addr *srcp, int *hlim)
+{
+	if (scopeid != 0 || IN6_IS_SCOPE_EMBED(dst)) {
+		if (!ifp->if_has_ll)
+			return (EADDRNOTAVAIL);
+		*srcp = ifp->if_ll.ia_addr.sin6_addr;
+		return (0);
+	}
+	if (!ifp->if_has_global)
+		return (EHOSTUNREACH);
+	*srcp = ifp->if_global;
+	return (0);
+}
+
+struct in6_ifaddr *
+in6ifa_ifpforlinklocal(struct ifnet *ifp, int ignoreflags)
+{
+	return (ifp->if_has_ll ? &ifp->if_ll : NULL);
+}
+
+/*
+ * Interfaces and routes.
+ */
+struct ifnethead h_ifnet;
+struct ifnet *h_ifnets[H_IFNET_MAX];
+int h_if_errors[H_IFNET_MAX];
+u_int h_nifnets;
+struct h_route h_routes[H_ROUTE_MAX];
+u_int h_nroutes;
+pthread_mutex_t h_net_lock = PTHREAD_MUTEX_INITIALIZER;
+h_output_t *h_output;
+void *h_output_arg;
+
+struct ifnet *
+ifnet_byindex(u_int idx)
+{
+	return (idx < H_IFNET_MAX ? atomic_load_ptr(&h_ifnets[idx]) : NULL);
+}
+
+static void
+h_output_frame(struct ifnet *ifp, int via, struct mbuf *m)
+{
+	uint8_t frame[MCLBYTES * 2];
+
+	if (h_output != NULL && m->m_pkthdr.len <= (int)sizeof(frame)) {
+		h_mbuf_copydata(m, frame);
+		h_output(h_output_arg, ifp->if_index, via, frame,
+		    m->m_pkthdr.len);
+	}
+	m_freem(m);
+}
+
+int
+h_if_transmit(struct ifnet *ifp, struct mbuf *m)
+{
+	int err;
+
+	if ((err = h_if_errors[ifp->if_index]) != 0) {
+		m_freem(m);
+		return (err);
+	}
+	h_output_frame(ifp, H_OUT_DIRECT, m);
+	return (0);
+}
+
+struct nhop_object *
+fib6_lookup(uint32_t fibnum, const struct in6_addr *dst, uint32_t scopeid,
+    uint32_t flags, uint32_t flowid)
+{
+	struct h_route *hr, *best = NULL;
+	u_int i, n;
+	int bits, len;
+
+	n = __atomic_load_n(&h_nroutes, __ATOMIC_ACQUIRE);
+	for (i = 0; i < n; i++) {
+		hr = &h_routes[i];
+		if (best != NULL && hr->hr_len <= best->hr_len)
+			continue;
+		for (bits = 0, len = hr->hr_len; len > 0; bits++, len -= 8)
+			if (len >= 8 ? hr->hr_prefix.s6_addr[bits] !=
+			    dst->s6_addr[bits] :
+			    ((hr->hr_prefix.s6_addr[bits] ^ dst->s6_addr[bits]) &
+			    (0xff00 >> len)) != 0)
+				break;
+		if (len <= 0)
+			best = hr;
+	}
+	return (best != NULL ? &best->hr_nh : NULL);
+}
+
+/*
+ * ip6_output(), as far as the replies need it: the interface is the
+ * zone of the destination, or the one of its route.
+ */
+int
+ip6_output(struct mbuf *m, struct ip6_pktopts *opt, struct route_in6 *ro,
+    int flags, struct ip6_moptions *im6o, struct ifnet **ifpp,
+    struct inpcb *inp)
+{
+	struct ether_header *eh;
+	struct nhop_object *nh;
+	struct ip6_hdr *ip6;
+	struct ifnet *ifp = NULL;
+
+	ip6 = mtod(m, struct ip6_hdr *);
+	if (im6o != NULL && im6o->im6o_multicast_ifp != NULL)
+		ifp = im6o->im6o_multicast_ifp;
+	else if (IN6_IS_SCOPE_EMBED(&ip6->ip6_dst))
+		ifp = ifnet_byindex(ntohs(ip6->ip6_dst.s6_addr16[1]));
+	else if ((nh = fib6_lookup(RT_DEFAULT_FIB, &ip6->ip6_dst, 0, NHR_NONE,
+	    0)) != NULL && (nh->nh_flags & (NHF_REJECT | NHF_BLACKHOLE)) == 0)
+		ifp = nh->nh_ifp;
+	if (ifp == NULL) {
+		m_freem(m);
+		return (EHOSTUNREACH);
+	}
+	if (h_if_errors[ifp->if_index] != 0) {
+		m_freem(m);
+		return (h_if_errors[ifp->if_index]);
+	}
+	in6_clearscope(&ip6->ip6_src);
+	in6_clearscope(&ip6->ip6_dst);
+	M_PREPEND(m, ETHER_HDR_LEN, M_NOWAIT);
+	if (m == NULL)
+		return (ENOBUFS);
+	eh = mtod(m, struct ether_header *);
+	ip6 = (struct ip6_hdr *)(eh + 1);
+	if (IN6_IS_ADDR_MULTICAST(&ip6->ip6_dst))
+		ETHER_MAP_IPV6_MULTICAST(&ip6->ip6_dst, eh->ether_dhost);
+	else
+		memset(eh->ether_dhost, 0, ETHER_ADDR_LEN);
+	memcpy(eh->ether_shost, IF_LLADDR(ifp), ETHER_ADDR_LEN);
+	eh->ether_type = htons(ETHERTYPE_IPV6);
+	h_output_frame(ifp, H_OUT_IP6, m);
+	return (0);
+}
+
+/*
+ * A single subscriber is enough for the module.
+ */
+static rib_subscription_cb_t *h_rib_cb;
+static void *h_rib_arg;
+
+struct rib_subscription *
+rib_subscribe(uint32_t fibnum, int family, rib_subscription_cb_t *f, void *arg,
+    enum rib_subscription_type type, bool waitok)
+{
+	h_rib_cb = f;
+	h_rib_arg = arg;
+	return ((struct rib_subscription *)&h_rib_cb);
+}
+
+void
+rib_unsubscribe(struct rib_subscription *rs)
+{
+	h_rib_cb = NULL;
+}
+
+void
+h_rib_notify(void)
+{
+	if (h_rib_cb != NULL)
+		h_rib_cb(NULL, NULL, h_rib_arg);
+}
+
+/*
+ * pfil(9). The hooks of a head are an array replaced as a whole when
+ * one is linked or unlinked, and freed once the readers are gone.
+ */
+#define	H_PFIL_HOOKS	8
+
+struct pfil_hook {
+	pfil_func_t		 ph_func;
+	int			 ph_type;
+	int			 ph_linked;
+	struct epoch_context	 ph_epoch_ctx;
+};
+struct h_pfil_chain {
+	int			 pc_count;
+	pfil_hook_t		 pc_hooks[H_PFIL_HOOKS];
+	struct epoch_context	 pc_epoch_ctx;
+};
+struct pfil_head {
+	int			 ph_type;
+	struct h_pfil_chain	*ph_chain;
+};
+
+static struct pfil_head h_link_head = { PFIL_TYPE_ETHERNET, NULL };
+static struct pfil_head h_inet6_head = { PFIL_TYPE_IP6, NULL };
+pfil_head_t h_link_pfil_head = &h_link_head;
+pfil_head_t h_inet6_pfil_head = &h_inet6_head;
+static pthread_mutex_t h_pfil_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void
+h_pfil_free_cb(struct epoch_context *ctx)
+{
+	free(__containerof(ctx, struct h_pfil_chain, pc_epoch_ctx));
+}
+
+static void
+h_pfil_free_hook_cb(struct epoch_context *ctx)
+{
+	free(__containerof(ctx, struct pfil_hook, ph_epoch_ctx));
+}
+
+pfil_hook_t
+pfil_add_hook(struct pfil_hook_args *pa)
+{
+	pfil_hook_t hook;
+
+	hook = h_malloc(sizeof(*hook), M_WAITOK | M_ZERO);
+	hook->ph_func = pa->pa_func;
+	hook->ph_type = pa->pa_type;
+	return (hook);
+}
+
+/*
+ * Replace the hooks of a head with them but hook, and hook first if
+ * link is set. Called with h_pfil_lock held.
+ */
+static int
+h_pfil_relink(pfil_head_t head, pfil_hook_t hook, int link)
+{
+	struct h_pfil_chain *old, *new;
+	int i;
+
+	old = head->ph_chain;
+	new = h_malloc(sizeof(*new), M_WAITOK | M_ZERO);
+	if (link)
+		new->pc_hooks[new->pc_count++] = hook;
+	for (i = 0; old != NULL && i < old->pc_count; i++)
+		if (old->pc_hooks[i] != hook && new->pc_count < H_PFIL_HOOKS)
+			new->pc_hooks[new->pc_count++] = old->pc_hooks[i];
+	atomic_store_rel_ptr(&head->ph_chain, new);
+	if (old != NULL)
+		h_epoch_call(h_pfil_free_cb, &old->pc_epoch_ctx);
+	return (0);
+}
+
+int
+pfil_link(struct pfil_link_args *pa)
+{
+	pfil_hook_t hook = pa->pa_hook;
+	pfil_head_t head = pa->pa_head;
+	int err;
+
+	if (hook->ph_type != head->ph_type)
+		return (EINVAL);
+	pthread_mutex_lock(&h_pfil_lock);
+	err = h_pfil_relink(head, hook, (pa->pa_flags & PFIL_UNLINK) == 0);
+	hook->ph_linked = (pa->pa_flags & PFIL_UNLINK) == 0;
+	pthread_mutex_unlock(&h_pfil_lock);
+	return (err);
+}
+
+void
+pfil_remove_hook(pfil_hook_t hook)
+{
+	pthread_mutex_lock(&h_pfil_lock);
+	if (hook->ph_linked)
+		h_pfil_relink(hook->ph_type == PFIL_TYPE_IP6 ? &h_inet6_head :
+		    &h_link_head, hook, false);
+	pthread_mutex_unlock(&h_pfil_lock);
+	h_epoch_call(h_pfil_free_hook_cb, &hook->ph_epoch_ctx);
+}
+
+/*
+ * Run the hooks of a head, in the net epoch.
+ */
+pfil_return_t
+h_pfil_run(pfil_head_t head, struct mbuf **mp, struct ifnet *ifp)
+{
+	struct h_pfil_chain *chain;
+	pfil_return_t rv;
+	int i;
+
+	chain = __atomic_load_n(&head->ph_chain, __ATOMIC_ACQUIRE);
+	for (i = 0; chain != NULL && i < chain->pc_count; i++) {
+		rv = chain->pc_hooks[i]->ph_func(mp, ifp, PFIL_IN, NULL, NULL);
+		if (rv != PFIL_PASS || *mp == NULL)
+			return (rv != PFIL_PASS ? rv : PFIL_CONSUMED);
+	}
+	return (PFIL_PASS);
+}
+
+/*
+ * The function of the ith hook linked on a head, replaced by func
+ * unless NULL, or NULL past the last hook.
+ */
+pfil_func_t
+h_pfil_func(pfil_head_t head, int i, pfil_func_t func)
+{
+	struct h_pfil_chain *chain;
+	pfil_func_t old = NULL;
+
+	pthread_mutex_lock(&h_pfil_lock);
+	chain = head->ph_chain;
+	if (chain != NULL && i < chain->pc_count) {
+		old = chain->pc_hooks[i]->ph_func;
+		if (func != NULL)
+			chain->pc_hooks[i]->ph_func = func;
+	}
+	pthread_mutex_unlock(&h_pfil_lock);
+	return (old);
+}
+
+/*
+ * ndctl.c is not built: its nvlists have no userland counterpart here,
+ * so /dev/ndproxy does not exist.
+ */
+int
+nd_ctl_init(void)
+{
+	return (0);
+}
+
+void
+nd_ctl_free(void)
+{
+}
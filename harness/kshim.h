@@ -0,0 +1,71 @@
+/*-
+ * Copyright (c) 2015-2019 Alexandre Fenyo <alex@fenyo.net> - http://www.fenyo.net
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * State of the kernel shims that kapi.c drives.
+ */
+
+#ifndef _HARNESS_KSHIM_H_
+#define _HARNESS_KSHIM_H_
+
+#define	H_IFNET_MAX	64
+#define	H_ROUTE_MAX	256
+
+struct h_route {
+	struct in6_addr		hr_prefix;
+	int			hr_len;
+	struct nhop_object	hr_nh;
+};
+
+extern struct ifnet	*h_ifnets[H_IFNET_MAX];
+extern int		 h_if_errors[H_IFNET_MAX];
+extern u_int		 h_nifnets;
+extern struct h_route	 h_routes[H_ROUTE_MAX];
+extern u_int		 h_nroutes;
+extern pthread_mutex_t	 h_net_lock;
+
+extern h_output_t	*h_output;
+extern void		*h_output_arg;
+
+extern struct thread	 thread0;
+
+void	h_sysinit_run(int, int);
+void	h_eventhandler_invoke(const char *, struct ifnet *);
+void	h_eventhandler_invoke_name(const char *, struct ifnet *, const char *);
+void	h_rib_notify(void);
+void	h_callout_tick(void);
+void	h_taskqueue_run(u_int);
+void	h_epoch_poll(void);
+pfil_return_t h_pfil_run(pfil_head_t, struct mbuf **, struct ifnet *);
+pfil_func_t h_pfil_func(pfil_head_t, int, pfil_func_t);
+int	h_if_transmit(struct ifnet *, struct mbuf *);
+int	h_sysctl_find(const char *, struct sysctl_oid **);
+struct mbuf *h_m_devget(const uint8_t *, size_t, int);
+void	h_mbuf_copydata(const struct mbuf *, uint8_t *);
+void	h_mbuf_drain(void);
+uint16_t h_cksum_mbuf(const struct mbuf *, int, int, uint32_t);
+
+#endif
@@ -0,0 +1,1783 @@
+/*-
+ * Copyright (c) 2015-2019 Alexandre Fenyo <alex@fenyo.net> - http://www.fenyo.net
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Replay harness of the pfil hooks of ndproxy, see TESTING.TXT.
+ *
+ *   ndharness check [test ...]
+ *   ndharness replay [-i uplink_mac] [-m downlink_mac] [-n iterations]
+ *	[-p uplink_addrs] file
+ *   ndharness bench [-n iterations] [benchmark ...]
+ *   ndharness gen [-t mixed|flood|scan] file [count]
+ *
+ * The module is loaded on a CPE with an uplink interface facing a PE
+ * and a downlink one, and fed with frames received on the uplink. Every
+ * frame it sends is checked against the solicitation it answers.
+ */
+
+#include <sys/types.h>
+#ifdef __linux__
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+
+#include <linux/perf_event.h>
+#endif
+
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "harness.h"
+#include "pcap.h"
+#include "pkt.h"
+
+/*
+ * The network of the tests: the PE and the CPE on the uplink, targets
+ * in 2001:db8:1::/64 behind the downlink.
+ */
+#define	UPLINK		"vlan2"
+#define	DOWNLINK	"em0"
+#define	CPE_MAC		"02:00:00:00:00:02"
+#define	CPE_LL		"fe80::2"
+#define	CPE_ADDR	"2001:db8::2"
+#define	PE_MAC		"02:00:00:00:00:01"
+#define	PE_LL		"fe80::1"
+#define	DOWN_MAC	"02:00:00:00:00:d1"
+#define	DOWN_IF_MAC	"02:00:00:00:00:03"
+#define	TARGET		"2001:db8:1::10"
+
+struct env {
+	int		e_up;
+	int		e_down;
+	uint8_t		e_cpe_mac[6];
+	uint8_t		e_pe_mac[6];
+	uint8_t		e_down_mac[6];
+	uint8_t		e_pe[16];
+	uint8_t		e_cpe[16];
+};
+static struct env env;
+static const char *env_cpe_mac = CPE_MAC;
+
+/*
+ * Frames sent by the module, collected by out_collect().
+ */
+#define	OUT_MAX		256
+
+struct out {
+	int		o_ifindex;
+	int		o_via;
+	size_t		o_len;
+	uint8_t		o_frame[PKT_MAX];
+};
+static struct out outs[OUT_MAX];
+static int nouts;
+static pthread_mutex_t out_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void
+out_collect(void *arg, int ifindex, int via, const uint8_t *frame, size_t len)
+{
+	struct out *o;
+
+	pthread_mutex_lock(&out_lock);
+	if (nouts < OUT_MAX && len <= PKT_MAX) {
+		o = &outs[nouts];
+		o->o_ifindex = ifindex;
+		o->o_via = via;
+		o->o_len = len;
+		memcpy(o->o_frame, frame, len);
+	}
+	nouts++;
+	pthread_mutex_unlock(&out_lock);
+}
+
+static void
+out_discard(void *arg, int ifindex, int via, const uint8_t *frame, size_t len)
+{
+}
+
+static int
+sysctl_set(const char *name, const char *val)
+{
+	char oid[128];
+	int err;
+
+	snprintf(oid, sizeof(oid), "net.inet6.ndproxy.%s", name);
+	if ((err = h_sysctl_str(oid, val)) != 0)
+		fprintf(stderr, "%s=\"%s\": %s\n", oid, val, strerror(err));
+	return (err);
+}
+
+static int
+sysctl_set_int(const char *name, int val)
+{
+	char oid[128];
+	int err;
+
+	snprintf(oid, sizeof(oid), "net.inet6.ndproxy.%s", name);
+	if ((err = h_sysctl_int(oid, val)) != 0)
+		fprintf(stderr, "%s=%d: %s\n", oid, val, strerror(err));
+	return (err);
+}
+
+/*
+ * Load the module on a CPE with its two interfaces, configured to proxy
+ * the solicitations of the PE and its duplicate address detection.
+ */
+static void
+env_setup(int ncpu)
+{
+	uint8_t addr[16], mac[6];
+
+	if (h_init(ncpu) != 0) {
+		fprintf(stderr, "h_init failed\n");
+		exit(2);
+	}
+	pkt_mac(env_cpe_mac, env.e_cpe_mac);
+	pkt_mac(PE_MAC, env.e_pe_mac);
+	pkt_mac(DOWN_MAC, env.e_down_mac);
+	pkt_addr(PE_LL, env.e_pe);
+	pkt_addr(CPE_ADDR, env.e_cpe);
+	env.e_up = h_ifattach(UPLINK, env.e_cpe_mac);
+	pkt_mac(DOWN_IF_MAC, mac);
+	env.e_down = h_ifattach(DOWNLINK, mac);
+	pkt_addr(CPE_LL, addr);
+	h_ifaddr_add(env.e_up, addr);
+	h_ifaddr_add(env.e_up, env.e_cpe);
+	pkt_addr("2001:db8:1::", addr);
+	h_route_add(addr, 64, env.e_down, 0);
+
+	sysctl_set("uplink_iface_list", UPLINK);
+	sysctl_set("downlink_mac_list", DOWN_MAC);
+	sysctl_set("uplink_addr_list", PE_LL " ::");
+	nouts = 0;
+	h_set_output(out_collect, NULL);
+}
+
+static void
+env_teardown(void)
+{
+	h_fini();
+}
+
+/*
+ * A solicitation of the PE for a target, with its MAC in an option.
+ */
+static void
+ns_from_pe(struct pkt_ns *pn, const char *target)
+{
+	memset(pn, 0, sizeof(*pn));
+	memcpy(pn->pn_src_mac, env.e_pe_mac, 6);
+	memcpy(pn->pn_src, env.e_pe, 16);
+	pkt_addr(target, pn->pn_target);
+	pn->pn_sllao = 1;
+}
+
+static int
+input_ns(int ifindex, const struct pkt_ns *pn, int flags)
+{
+	uint8_t frame[PKT_MAX];
+	size_t len;
+
+	len = pkt_ns(frame, pn);
+	return (h_input(ifindex, frame, len, flags));
+}
+
+/*
+ * Tests. Each one runs on a module loaded for it, and fails at its
+ * first failed check.
+ */
+static const char *test_name;
+static int test_failed;
+
+#define	CHECK(e) do {							\
+	if (!(e)) {							\
+		fprintf(stderr, "%s: %s:%d: %s\n", test_name, __FILE__,	\
+		    __LINE__, #e);					\
+		test_failed = 1;					\
+		return;							\
+	}								\
+} while (0)
+
+/* Check that the nth frame sent answers pn with mac, through via. */
+#define	CHECK_NA(n, pn, mac, via) do {					\
+	const char *_why;						\
+									\
+	CHECK(nouts > (n));						\
+	CHECK(outs[(n)].o_ifindex == env.e_up);				\
+	CHECK(outs[(n)].o_via == (via));				\
+	_why = pkt_na_check(outs[(n)].o_frame, outs[(n)].o_len,		\
+	    outs[(n)].o_via, (pn), (mac));				\
+	if (_why != NULL)						\
+		fprintf(stderr, "%s: advertisement: %s\n", test_name,	\
+		    _why);						\
+	CHECK(_why == NULL);						\
+} while (0)
+
+static void
+t_proxy(void)
+{
+	struct pkt_ns pn;
+
+	ns_from_pe(&pn, TARGET);
+	CHECK(input_ns(env.e_up, &pn, 0) == H_CONSUMED);
+	CHECK(nouts == 1);
+	CHECK_NA(0, &pn, env.e_down_mac, H_OUT_DIRECT);
+	CHECK(h_stat("received") == 1);
+	CHECK(h_stat("sent") == 1);
+	CHECK(h_stat("direct") == 1);
+	CHECK(h_stat("inplace") == 1);
+	CHECK(h_stat("cksum_sw") == 1);
+
+	/* Priority tagged only: still for the uplink itself. */
+	CHECK(input_ns(env.e_up, &pn, H_IN_PRIO) == H_CONSUMED);
+	CHECK_NA(1, &pn, env.e_down_mac, H_OUT_DIRECT);
+}
+
+static void
+t_dad(void)
+{
+	struct pkt_ns pn;
+
+	ns_from_pe(&pn, TARGET);
+	memset(pn.pn_src, 0, 16);
+	pn.pn_sllao = 0;
+	CHECK(input_ns(env.e_up, &pn, 0) == H_CONSUMED);
+	CHECK(nouts == 1);
+	CHECK_NA(0, &pn, env.e_down_mac, H_OUT_DIRECT);
+	CHECK(h_stat("sent") == 1);
+
+	/* From :: to the target itself: not a DAD probe. */
+	memcpy(pn.pn_dst, pn.pn_target, 16);
+	CHECK(input_ns(env.e_up, &pn, 0) == H_PASS);
+	CHECK(h_stat("bad_dst") == 1);
+	CHECK(nouts == 1);
+}
+
+static void
+t_ip6_output(void)
+{
+	struct pkt_ns pn;
+
+	/* Without the MAC of the PE, the reply needs its neighbor cache. */
+	ns_from_pe(&pn, TARGET);
+	pn.pn_sllao = 0;
+	CHECK(input_ns(env.e_up, &pn, 0) == H_CONSUMED);
+	CHECK_NA(0, &pn, env.e_down_mac, H_OUT_IP6);
+
+	CHECK(sysctl_set_int("direct_output", 0) == 0);
+	pn.pn_sllao = 1;
+	CHECK(input_ns(env.e_up, &pn, 0) == H_CONSUMED);
+	CHECK_NA(1, &pn, env.e_down_mac, H_OUT_IP6);
+	CHECK(sysctl_set_int("direct_output", 1) == 0);
+	CHECK(h_stat("sent") == 2);
+	CHECK(h_stat("direct") == 0);
+}
+
+static void
+t_not_proxied(void)
+{
+	struct pkt_ns pn;
+
+	/* Not from the PE. */
+	ns_from_pe(&pn, TARGET);
+	pkt_addr("fe80::99", pn.pn_src);
+	CHECK(input_ns(env.e_up, &pn, 0) == H_PASS);
+	CHECK(h_stat("not_router") == 1);
+
+	/* Bad checksum, in software and by the NIC. */
+	ns_from_pe(&pn, TARGET);
+	pn.pn_badsum = 1;
+	CHECK(input_ns(env.e_up, &pn, 0) == H_PASS);
+	CHECK(input_ns(env.e_up, &pn, H_IN_CSUM) == H_PASS);
+	CHECK(input_ns(env.e_up, &pn, H_IN_CSUM | H_IN_PSEUDO) == H_PASS);
+	CHECK(h_stat("badsum") == 3);
+
+	/* Multicast target. */
+	ns_from_pe(&pn, "ff02::5");
+	CHECK(input_ns(env.e_up, &pn, 0) == H_PASS);
+	CHECK(h_stat("mcast_target") == 1);
+
+	/* Received on the downlink. */
+	ns_from_pe(&pn, TARGET);
+	CHECK(input_ns(env.e_down, &pn, 0) == H_PASS);
+	CHECK(h_stat("not_uplink") == 1);
+
+	/* For a VLAN on the uplink, tag stripped by the NIC. */
+	CHECK(input_ns(env.e_up, &pn, H_IN_VLAN) == H_PASS);
+	CHECK(h_stat("not_uplink") == 2);
+
+	CHECK(nouts == 0);
+	CHECK(h_stat("sent") == 0);
+}
+
+static void
+t_other_traffic(void)
+{
+	uint8_t frame[PKT_MAX], dst[16];
+	size_t len;
+
+	pkt_addr("2001:db8:1::10", dst);
+	len = pkt_udp(frame, env.e_pe_mac, env.e_cpe_mac, env.e_cpe, dst, 100);
+	CHECK(h_input(env.e_up, frame, len, 0) == H_PASS);
+	len = pkt_echo(frame, env.e_pe_mac, env.e_cpe_mac, env.e_cpe, dst);
+	CHECK(h_input(env.e_up, frame, len, 0) == H_PASS);
+	CHECK(h_input(env.e_up, frame, len, H_IN_SPLIT) == H_PASS);
+	/* Not IPv6. */
+	frame[12] = 0x08;
+	frame[13] = 0x06;
+	CHECK(h_input(env.e_up, frame, len, 0) == H_PASS);
+
+	CHECK(h_stat("not_icmp6") == 2);
+	CHECK(h_stat("not_ns") == 2);
+	CHECK(nouts == 0);
+}
+
+/*
+ * The ways a driver hands a frame: split after the Ethernet header,
+ * summed by the NIC, in a read-only buffer. The options of a split
+ * frame are not pulled up, so the MAC of the PE is not known and the
+ * reply goes through ip6_output().
+ */
+static void
+t_mbufs(void)
+{
+	static const int flags[] = { H_IN_SPLIT, H_IN_CSUM,
+	    H_IN_CSUM | H_IN_PSEUDO, H_IN_RDONLY, H_IN_SPLIT | H_IN_RDONLY };
+	struct pkt_ns pn;
+	size_t i;
+
+	ns_from_pe(&pn, TARGET);
+	for (i = 0; i < sizeof(flags) / sizeof(flags[0]); i++) {
+		CHECK(input_ns(env.e_up, &pn, flags[i]) == H_CONSUMED);
+		CHECK(nouts == (int)i + 1);
+		CHECK_NA(i, &pn, env.e_down_mac,
+		    flags[i] & H_IN_SPLIT ? H_OUT_IP6 : H_OUT_DIRECT);
+	}
+	CHECK(h_stat("cksum_hw") == 2);
+	/* The split read-only one was pulled up into a new mbuf. */
+	CHECK(h_stat("inplace") == 4);
+
+	/* Out of place, by request. */
+	CHECK(sysctl_set_int("inplace", 0) == 0);
+	CHECK(input_ns(env.e_up, &pn, 0) == H_CONSUMED);
+	CHECK_NA(i, &pn, env.e_down_mac, H_OUT_DIRECT);
+	CHECK(sysctl_set_int("inplace", 1) == 0);
+	CHECK(h_stat("inplace") == 4);
+}
+
+/*
+ * A unicast solicitation of the PE checking that a target is still
+ * reachable goes to the downlink MAC, not to the one of the uplink
+ * interface: only the inet6 hook sees it.
+ */
+static void
+t_promisc(void)
+{
+	struct pkt_ns pn;
+
+	ns_from_pe(&pn, TARGET);
+	memcpy(pn.pn_dst, pn.pn_target, 16);
+	memcpy(pn.pn_dst_mac, env.e_down_mac, 6);
+	CHECK(input_ns(env.e_up, &pn, 0) == H_CONSUMED);
+	CHECK_NA(0, &pn, env.e_down_mac, H_OUT_DIRECT);
+	CHECK(h_stat("promisc") == 1);
+	CHECK(h_stat("received") == 0);
+
+	/* The same, to the MAC of the interface, goes to the link hook. */
+	memcpy(pn.pn_dst_mac, env.e_cpe_mac, 6);
+	CHECK(input_ns(env.e_up, &pn, 0) == H_CONSUMED);
+	CHECK_NA(1, &pn, env.e_down_mac, H_OUT_DIRECT);
+	CHECK(h_stat("promisc") == 1);
+	CHECK(h_stat("received") == 1);
+}
+
+/*
+ * An uplink interface listed before it is attached is handled when it
+ * comes, with its own downlink MAC.
+ */
+static void
+t_late_attach(void)
+{
+	struct pkt_ns pn;
+	uint8_t addr[16], mac[6], down2[6];
+	int vlan3;
+
+	CHECK(sysctl_set("uplink_iface_list", UPLINK " vlan3") == 0);
+	CHECK(sysctl_set("downlink_mac_list", DOWN_MAC " 02:00:00:00:00:d2")
+	    == 0);
+	ns_from_pe(&pn, TARGET);
+	pkt_mac("02:00:00:00:00:04", mac);
+	pkt_mac("02:00:00:00:00:d2", down2);
+	vlan3 = h_ifattach("vlan3", mac);
+	/* Without a link-local addr, there is no source for the reply. */
+	CHECK(input_ns(vlan3, &pn, 0) == H_PASS);
+	CHECK(h_stat("scope") == 1);
+	pkt_addr("fe80::4", addr);
+	h_ifaddr_add(vlan3, addr);
+	CHECK(input_ns(vlan3, &pn, 0) == H_CONSUMED);
+	CHECK(nouts == 1 && outs[0].o_ifindex == vlan3);
+	CHECK(pkt_na_check(outs[0].o_frame, outs[0].o_len, outs[0].o_via, &pn,
+	    down2) == NULL);
+	CHECK(input_ns(env.e_up, &pn, 0) == H_CONSUMED);
+	CHECK_NA(1, &pn, env.e_down_mac, H_OUT_DIRECT);
+}
+
+/*
+ * An interface renamed away from an uplink name is no longer an
+ * uplink, and one renamed to it becomes one.
+ */
+static void
+t_rename(void)
+{
+	struct pkt_ns pn;
+	uint8_t addr[16];
+
+	ns_from_pe(&pn, TARGET);
+	CHECK(h_ifrename(env.e_up, "vlan9") == 0);
+	CHECK(input_ns(env.e_up, &pn, 0) == H_PASS);
+	CHECK(nouts == 0);
+	pkt_addr("fe80::3", addr);
+	CHECK(h_ifaddr_add(env.e_down, addr) == 0);
+	CHECK(h_ifrename(env.e_down, UPLINK) == 0);
+	CHECK(input_ns(env.e_down, &pn, 0) == H_CONSUMED);
+	CHECK(nouts == 1 && outs[0].o_ifindex == env.e_down);
+	CHECK(h_ifrename(env.e_down, DOWNLINK) == 0);
+	CHECK(h_ifrename(env.e_up, UPLINK) == 0);
+	CHECK(input_ns(env.e_up, &pn, 0) == H_CONSUMED);
+	CHECK_NA(1, &pn, env.e_down_mac, H_OUT_DIRECT);
+	CHECK(h_stat("sent") == 2);
+}
+
+/*
+ * The limits on the advertisements, on the buckets and the ceiling the
+ * vnet got when it was set up. A second is 1000 ticks.
+ */
+static void
+rate(void)
+{
+	struct pkt_ns pn;
+
+	CHECK(h_sysctl_int("net.inet6.ndproxy.rate_pe", 1000001) == EINVAL);
+	CHECK(sysctl_set_int("rate_pe", 1000000) == 0);
+	ns_from_pe(&pn, TARGET);
+	CHECK(sysctl_set_int("rate_pe", 2) == 0);
+	h_tick(1000);
+	CHECK(input_ns(env.e_up, &pn, 0) == H_CONSUMED);
+	CHECK(input_ns(env.e_up, &pn, 0) == H_CONSUMED);
+	CHECK(input_ns(env.e_up, &pn, 0) == H_PASS);
+	CHECK(h_stat("rl_pe") == 1);
+	h_tick(500);
+	CHECK(input_ns(env.e_up, &pn, 0) == H_CONSUMED);
+
+	CHECK(sysctl_set_int("rate_pe", 0) == 0);
+	CHECK(sysctl_set_int("rate_global", 1) == 0);
+	h_tick(1000);
+	CHECK(input_ns(env.e_up, &pn, 0) == H_CONSUMED);
+	CHECK(input_ns(env.e_up, &pn, 0) == H_PASS);
+	CHECK(h_stat("rl_global") == 1);
+	CHECK(h_stat("sent") == 4);
+}
+
+/* The limits are not per vnet: leave them off for the next tests. */
+static void
+t_rate(void)
+{
+	rate();
+	sysctl_set_int("rate_pe", 0);
+	sysctl_set_int("rate_global", 0);
+}
+
+/*
+ * The reachability filter: targets routed through an interface other
+ * than an uplink, or seen as a source on one, from the caches once
+ * looked up.
+ */
+static void
+reach(void)
+{
+	struct pkt_ns pn;
+	uint8_t frame[PKT_MAX], src[16], dst[16], mac[6];
+	size_t len;
+
+	CHECK(sysctl_set_int("reach_filter", 1) == 0);
+	ns_from_pe(&pn, TARGET);
+	CHECK(input_ns(env.e_up, &pn, 0) == H_CONSUMED);
+	CHECK(input_ns(env.e_up, &pn, 0) == H_CONSUMED);
+	CHECK(h_stat("reach_miss") == 1 && h_stat("reach_hit") == 1);
+
+	ns_from_pe(&pn, "2001:db8:2::5");
+	CHECK(input_ns(env.e_up, &pn, 0) == H_PASS);
+	CHECK(input_ns(env.e_up, &pn, 0) == H_PASS);
+	CHECK(h_stat("unreachable") == 2);
+	CHECK(h_stat("reach_miss") == 2 && h_stat("reach_hit") == 2);
+
+	pkt_addr("2001:db8:2::5", src);
+	pkt_addr(CPE_ADDR, dst);
+	pkt_mac(DOWN_IF_MAC, mac);
+	len = pkt_echo(frame, env.e_down_mac, mac, src, dst);
+	CHECK(h_input(env.e_down, frame, len, 0) == H_PASS);
+	CHECK(h_input(env.e_down, frame, len, 0) == H_PASS);
+	CHECK(h_stat("reach_learned") == 1);
+	CHECK(input_ns(env.e_up, &pn, 0) == H_CONSUMED);
+	CHECK_NA(2, &pn, env.e_down_mac, H_OUT_DIRECT);
+	CHECK(h_stat("unreachable") == 2);
+}
+
+/* The filter is not per vnet: leave it off for the next tests. */
+static void
+t_reach(void)
+{
+	reach();
+	sysctl_set_int("reach_filter", 0);
+}
+
+/*
+ * The lists read back as they were written.
+ */
+static void
+t_sysctl(void)
+{
+	char buf[256];
+	size_t len = sizeof(buf);
+
+	CHECK(h_sysctl("net.inet6.ndproxy.downlink_mac_list", buf, &len, NULL,
+	    0) == 0);
+	CHECK(strcmp(buf, DOWN_MAC) == 0);
+	len = sizeof(buf);
+	CHECK(h_sysctl("net.inet6.ndproxy.uplink_iface_list", buf, &len, NULL,
+	    0) == 0);
+	CHECK(strcmp(buf, UPLINK) == 0);
+	CHECK(h_sysctl_str("net.inet6.ndproxy.downlink_mac_list",
+	    "02:00:00:00:00:zz") == EINVAL);
+	len = sizeof(buf);
+	CHECK(h_sysctl("net.inet6.ndproxy.downlink_mac_list", buf, &len, NULL,
+	    0) == 0);
+	CHECK(strcmp(buf, DOWN_MAC) == 0);
+}
+
+/*
+ * In deferred mode, the hook queues the solicitation and the taskqueue
+ * of its CPU answers it.
+ */
+static void
+deferred(void)
+{
+	struct pkt_ns pn;
+
+	ns_from_pe(&pn, TARGET);
+	CHECK(input_ns(env.e_up, &pn, 0) == H_CONSUMED);
+	CHECK(input_ns(env.e_up, &pn, 0) == H_CONSUMED);
+	CHECK(h_stat("deferred") == 2);
+	CHECK(nouts == 0);
+	h_run_tasks();
+	CHECK_NA(0, &pn, env.e_down_mac, H_OUT_DIRECT);
+	CHECK_NA(1, &pn, env.e_down_mac, H_OUT_DIRECT);
+	CHECK(h_stat("sent") == 2);
+
+	/* Dropped if the uplink is gone when the task runs. */
+	CHECK(input_ns(env.e_up, &pn, 0) == H_CONSUMED);
+	CHECK(sysctl_set("uplink_iface_list", "") == 0);
+	h_run_tasks();
+	CHECK(nouts == 2);
+	CHECK(h_stat("defer_stale") == 1);
+	CHECK(h_stat("not_uplink") == 0);
+}
+
+/* The mode is not per vnet: leave it off for the next tests. */
+static void
+t_deferred(void)
+{
+	CHECK(sysctl_set_int("deferred", 1) == 0);
+	deferred();
+	sysctl_set_int("deferred", 0);
+}
+
+static double
+bench_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (ts.tv_sec + ts.tv_nsec / 1e9);
+}
+
+/*
+ * Replays. The frames of a file are loaded first, then fed to the
+ * uplink interface once to check the advertisements and sort the frames
+ * by the path they take through the hooks, and timed by path.
+ */
+struct frame {
+	size_t		f_len;
+	int		f_path;
+	uint8_t		*f_data;
+};
+
+struct replay {
+	struct frame	*r_frames;
+	u_long		 r_count;
+	u_long		 r_ns;
+	u_long		 r_consumed;
+	u_long		 r_na;
+	u_long		 r_bad;
+};
+
+/*
+ * The paths, named by the counter a frame moves: the first one of the
+ * list that moves. A frame answered moves "sent".
+ */
+static const char *const paths[] = {
+	"sent", "deferred", "not_uplink", "not_icmp6", "not_ns", "no_mac",
+	"not_router", "badsum", "mcast_target", "exception", "bad_dst",
+	"policy_ignore", "unreachable", "rl_pe", "rl_target", "rl_global",
+	"scope", "nombuf", "output_err", "defer_overflow",
+};
+#define	NPATHS		(sizeof(paths) / sizeof(paths[0]))
+#define	PATH_OTHER	NPATHS
+
+static void
+paths_snapshot(uint64_t *snap)
+{
+	size_t i;
+
+	for (i = 0; i < NPATHS; i++)
+		snap[i] = h_stat(paths[i]);
+}
+
+static int
+replay_load(const char *path, struct replay *r)
+{
+	struct pcap_file pf;
+	struct frame *f;
+	uint8_t frame[PCAP_SNAPLEN];
+	u_long size = 0;
+	int len;
+
+	memset(r, 0, sizeof(*r));
+	if (pcap_open_read(&pf, path) != 0) {
+		fprintf(stderr, "%s: can not read\n", path);
+		return (-1);
+	}
+	while ((len = pcap_read(&pf, frame, sizeof(frame))) > 0) {
+		if (r->r_count == size) {
+			size = size != 0 ? 2 * size : 1024;
+			if ((f = realloc(r->r_frames, size * sizeof(*f))) ==
+			    NULL) {
+				len = -1;
+				break;
+			}
+			r->r_frames = f;
+		}
+		f = &r->r_frames[r->r_count];
+		if ((f->f_data = malloc(len)) == NULL) {
+			len = -1;
+			break;
+		}
+		memcpy(f->f_data, frame, len);
+		f->f_len = len;
+		f->f_path = PATH_OTHER;
+		r->r_count++;
+	}
+	pcap_close(&pf);
+	if (len < 0)
+		fprintf(stderr, "%s: bad frame after %lu\n", path, r->r_count);
+	return (len);
+}
+
+static void
+replay_free(struct replay *r)
+{
+	u_long i;
+
+	for (i = 0; i < r->r_count; i++)
+		free(r->r_frames[i].f_data);
+	free(r->r_frames);
+	r->r_frames = NULL;
+}
+
+/*
+ * Feed the frames to the uplink interface, and check the advertisement
+ * sent for each solicitation the module takes. A frame left to the
+ * stack must not get one.
+ */
+static void
+replay_check(struct replay *r, int flags, const uint8_t *mac)
+{
+	struct pkt_ns pn;
+	struct frame *f;
+	uint64_t before[NPATHS], after[NPATHS];
+	const char *why;
+	u_long i;
+	size_t p;
+	int rv;
+
+	r->r_ns = r->r_consumed = r->r_na = r->r_bad = 0;
+	paths_snapshot(before);
+	for (i = 0; i < r->r_count; i++) {
+		f = &r->r_frames[i];
+		nouts = 0;
+		rv = h_input(env.e_up, f->f_data, f->f_len, flags);
+		paths_snapshot(after);
+		for (p = 0; p < NPATHS && after[p] == before[p]; p++)
+			;
+		f->f_path = p;
+		memcpy(before, after, sizeof(before));
+
+		r->r_na += nouts;
+		if (rv == H_CONSUMED)
+			r->r_consumed++;
+		if (pkt_ns_parse(f->f_data, f->f_len, &pn) != 0) {
+			if (rv == H_CONSUMED || nouts != 0)
+				r->r_bad++;
+			continue;
+		}
+		r->r_ns++;
+		if (rv != H_CONSUMED) {
+			if (nouts != 0)
+				r->r_bad++;
+			continue;
+		}
+		if (nouts != 1) {
+			r->r_bad++;
+			continue;
+		}
+		why = pkt_na_check(outs[0].o_frame, outs[0].o_len,
+		    outs[0].o_via, &pn, mac);
+		if (why != NULL) {
+			fprintf(stderr, "frame %lu: %s\n", i + 1, why);
+			r->r_bad++;
+		}
+	}
+}
+
+/*
+ * Time the frames of each path, replayed in their order until at least
+ * iters of them went through, then the whole file the same way.
+ */
+static void
+replay_time(struct replay *r, u_long iters)
+{
+	struct frame *f;
+	double t;
+	u_long i, n, total;
+	size_t p;
+
+	printf("%-16s %8s %12s %14s\n", "path", "frames", "ns/frame",
+	    "frames/s");
+	for (p = 0; p <= NPATHS; p++) {
+		for (i = total = 0; i < r->r_count; i++)
+			total += r->r_frames[i].f_path == (int)p;
+		if (total == 0)
+			continue;
+		n = 0;
+		t = bench_now();
+		do {
+			for (i = 0; i < r->r_count; i++) {
+				f = &r->r_frames[i];
+				if (f->f_path != (int)p)
+					continue;
+				h_input(env.e_up, f->f_data, f->f_len, 0);
+				n++;
+			}
+		} while (n < iters);
+		t = bench_now() - t;
+		printf("%-16s %8lu %12.1f %14.0f\n",
+		    p < NPATHS ? paths[p] : "other", total, t * 1e9 / n, n / t);
+	}
+	n = 0;
+	t = bench_now();
+	do {
+		for (i = 0; i < r->r_count; i++) {
+			f = &r->r_frames[i];
+			h_input(env.e_up, f->f_data, f->f_len, 0);
+			n++;
+		}
+	} while (n < iters);
+	t = bench_now() - t;
+	printf("%-16s %8lu %12.1f %14.0f\n", "all", r->r_count, t * 1e9 / n,
+	    n / t);
+}
+
+static int gen_file(const char *, const char *, int);
+
+/*
+ * Many uplink router addrs, matched four at a time by the hook.
+ */
+static void
+t_uplink_addrs(void)
+{
+	struct pkt_ns pn;
+	char list[64 * 16], *p = list;
+	int i;
+
+	for (i = 1; i <= 40; i++)
+		p += sprintf(p, "fe80::%x ", i);
+	strcpy(p, "::");
+	CHECK(sysctl_set("uplink_addr_list", list) == 0);
+	for (i = 1; i <= 40; i++) {
+		ns_from_pe(&pn, TARGET);
+		snprintf(list, sizeof(list), "fe80::%x", i);
+		pkt_addr(list, pn.pn_src);
+		CHECK(input_ns(env.e_up, &pn, 0) == H_CONSUMED);
+		CHECK_NA(i - 1, &pn, env.e_down_mac, H_OUT_DIRECT);
+	}
+	pkt_addr("fe80::29", pn.pn_src);
+	CHECK(input_ns(env.e_up, &pn, 0) == H_PASS);
+	CHECK(h_stat("not_router") == 1);
+	memset(pn.pn_src, 0, 16);
+	pn.pn_sllao = 0;
+	CHECK(input_ns(env.e_up, &pn, 0) == H_CONSUMED);
+	CHECK_NA(40, &pn, env.e_down_mac, H_OUT_DIRECT);
+}
+
+/*
+ * The variant of the hook follows the shape of the conf, and proxies as
+ * the generic one does.
+ */
+static int
+hook_is(const char *name)
+{
+	char val[32];
+	size_t len = sizeof(val);
+	const char *linked;
+
+	if (h_sysctl("net.inet6.ndproxy.hook_variant", val, &len, NULL,
+	    0) != 0 || strcmp(val, name) != 0)
+		return (0);
+	linked = h_hook_linked();
+	return (linked != NULL && strcmp(linked, name) == 0);
+}
+
+static void
+t_hook_variant(void)
+{
+	struct pkt_ns pn;
+	uint8_t mac[6];
+
+	ns_from_pe(&pn, TARGET);
+	CHECK(hook_is("link-1if-noexc-fewpe"));
+	CHECK(input_ns(env.e_up, &pn, 0) == H_CONSUMED);
+	CHECK_NA(0, &pn, env.e_down_mac, H_OUT_DIRECT);
+
+	CHECK(sysctl_set("exception_addr_list", "2001:db8:1::e") == 0);
+	CHECK(hook_is("link-1if-fewpe"));
+	CHECK(input_ns(env.e_up, &pn, 0) == H_CONSUMED);
+	CHECK_NA(1, &pn, env.e_down_mac, H_OUT_DIRECT);
+	ns_from_pe(&pn, "2001:db8:1::e");
+	CHECK(input_ns(env.e_up, &pn, 0) == H_PASS);
+	CHECK(h_stat("exception") == 1);
+
+	CHECK(sysctl_set("uplink_addr_list", PE_LL " fe80::3 fe80::4 ::") ==
+	    0);
+	CHECK(hook_is("link-1if"));
+	ns_from_pe(&pn, TARGET);
+	pkt_addr("fe80::4", pn.pn_src);
+	CHECK(input_ns(env.e_up, &pn, 0) == H_CONSUMED);
+	CHECK_NA(2, &pn, env.e_down_mac, H_OUT_DIRECT);
+
+	pkt_mac("02:00:00:00:00:04", mac);
+	CHECK(h_ifattach("vlan3", mac) > 0);
+	CHECK(sysctl_set("uplink_iface_list", UPLINK " vlan3") == 0);
+	CHECK(hook_is("default-link"));
+	CHECK(input_ns(env.e_up, &pn, 0) == H_CONSUMED);
+	CHECK_NA(3, &pn, env.e_down_mac, H_OUT_DIRECT);
+
+	CHECK(sysctl_set("exception_addr_list", "") == 0);
+	CHECK(sysctl_set("uplink_addr_list", PE_LL " ::") == 0);
+	CHECK(hook_is("link-noexc-fewpe"));
+	ns_from_pe(&pn, TARGET);
+	CHECK(input_ns(env.e_up, &pn, 0) == H_CONSUMED);
+	CHECK_NA(4, &pn, env.e_down_mac, H_OUT_DIRECT);
+
+	CHECK(sysctl_set_int("hook_specialize", 0) == 0);
+	CHECK(hook_is("default-link"));
+	CHECK(input_ns(env.e_up, &pn, 0) == H_CONSUMED);
+	CHECK_NA(5, &pn, env.e_down_mac, H_OUT_DIRECT);
+	CHECK(sysctl_set_int("hook_specialize", 1) == 0);
+	CHECK(hook_is("link-noexc-fewpe"));
+	CHECK(h_stat("sent") == 6);
+}
+
+/*
+ * A large exception set, as the hash of the module allows, read back
+ * and replaced. The handler refuses more than EXCEPTION_MAX addrs.
+ */
+#define	EXCEPTIONS	100000
+#define	EXCEPTION_MAX	262144
+
+static char *
+exception_list(int count)
+{
+	char *list, *p;
+	int i;
+
+	if ((list = malloc((size_t)count * 32 + 1)) == NULL)
+		return (NULL);
+	p = list;
+	*p = '\0';
+	for (i = 0; i < count; i++)
+		p += sprintf(p, "%s2001:db8:1::%x:%x:e", i > 0 ? " " : "",
+		    i >> 16, i & 0xffff);
+	return (list);
+}
+
+static void
+t_exceptions(void)
+{
+	struct pkt_ns pn;
+	char *list, *p;
+	size_t len;
+	int count;
+
+	CHECK((list = exception_list(EXCEPTIONS)) != NULL);
+	CHECK(sysctl_set("exception_addr_list", list) == 0);
+	len = strlen(list) + 1;
+	memset(list, 0, len);
+	CHECK(h_sysctl("net.inet6.ndproxy.exception_addr_list", list, &len,
+	    NULL, 0) == 0);
+	for (count = 1, p = list; (p = strchr(p, ' ')) != NULL; p++)
+		count++;
+	free(list);
+	CHECK(count == EXCEPTIONS);
+
+	ns_from_pe(&pn, "2001:db8:1::1:5:e");
+	CHECK(input_ns(env.e_up, &pn, 0) == H_PASS);
+	ns_from_pe(&pn, "2001:db8:1::0:ffff:e");
+	CHECK(input_ns(env.e_up, &pn, 0) == H_PASS);
+	CHECK(h_stat("exception") == 2);
+	ns_from_pe(&pn, TARGET);
+	CHECK(input_ns(env.e_up, &pn, 0) == H_CONSUMED);
+	CHECK_NA(0, &pn, env.e_down_mac, H_OUT_DIRECT);
+
+	CHECK((list = exception_list(EXCEPTION_MAX + 1)) != NULL);
+	CHECK(h_sysctl_str("net.inet6.ndproxy.exception_addr_list", list) ==
+	    EINVAL);
+	free(list);
+	ns_from_pe(&pn, "2001:db8:1::1:5:e");
+	CHECK(input_ns(env.e_up, &pn, 0) == H_PASS);
+
+	CHECK(sysctl_set("exception_addr_list", "") == 0);
+	CHECK(input_ns(env.e_up, &pn, 0) == H_CONSUMED);
+	CHECK_NA(1, &pn, env.e_down_mac, H_OUT_DIRECT);
+	CHECK(h_stat("exception") == 3);
+}
+
+/*
+ * Target policies: the longest prefix holding the target decides, and
+ * the others are proxied with the MAC of the interface. The policies
+ * read back sorted by length.
+ */
+#define	POLICY_MAX	65536
+
+static void
+t_policy(void)
+{
+	struct pkt_ns pn;
+	char buf[256], *list, *p;
+	size_t len = sizeof(buf);
+	uint8_t mac[6];
+	int i;
+
+	CHECK(sysctl_set("target_policy_list",
+	    "2001:db8:1::100/120=02:00:00:00:00:e2 2001:db8:1::/112=ignore "
+	    "2001:db8:1::/64=02:00:00:00:00:e1") == 0);
+	CHECK(h_sysctl("net.inet6.ndproxy.target_policy_list", buf, &len, NULL,
+	    0) == 0);
+	CHECK(strcmp(buf, "2001:db8:1::/64=02:00:00:00:00:e1 "
+	    "2001:db8:1::/112=ignore 2001:db8:1::100/120=02:00:00:00:00:e2") ==
+	    0);
+
+	ns_from_pe(&pn, TARGET);
+	CHECK(input_ns(env.e_up, &pn, 0) == H_PASS);
+	CHECK(h_stat("policy_ignore") == 1);
+	ns_from_pe(&pn, "2001:db8:1::105");
+	CHECK(input_ns(env.e_up, &pn, 0) == H_CONSUMED);
+	pkt_mac("02:00:00:00:00:e2", mac);
+	CHECK_NA(0, &pn, mac, H_OUT_DIRECT);
+	ns_from_pe(&pn, "2001:db8:1::1:0");
+	CHECK(input_ns(env.e_up, &pn, 0) == H_CONSUMED);
+	pkt_mac("02:00:00:00:00:e1", mac);
+	CHECK_NA(1, &pn, mac, H_OUT_DIRECT);
+	ns_from_pe(&pn, "2001:db8:2::1");
+	CHECK(input_ns(env.e_up, &pn, 0) == H_CONSUMED);
+	CHECK_NA(2, &pn, env.e_down_mac, H_OUT_DIRECT);
+
+	/* Duplicates are refused, and leave the policies alone. */
+	CHECK(h_sysctl_str("net.inet6.ndproxy.target_policy_list",
+	    "2001:db8:1::/64=ignore 2001:db8:1::/64=ignore") == EINVAL);
+	ns_from_pe(&pn, TARGET);
+	CHECK(input_ns(env.e_up, &pn, 0) == H_PASS);
+
+	/* As many /56 as allowed, one with its own MAC. */
+	CHECK((list = malloc(POLICY_MAX * 48 + 64)) != NULL);
+	for (i = 0, p = list; i < POLICY_MAX; i++)
+		p += sprintf(p, "%s2001:db8:%x:%x00::/56=%s", i > 0 ? " " : "",
+		    i >> 8, i & 0xff, i == 0x1234 ? "02:00:00:00:12:34" :
+		    "ignore");
+	CHECK(sysctl_set("target_policy_list", list) == 0);
+	strcpy(p, " 2001:db8::/32=ignore");
+	CHECK(h_sysctl_str("net.inet6.ndproxy.target_policy_list", list) ==
+	    EINVAL);
+	free(list);
+	ns_from_pe(&pn, "2001:db8:12:3400::1");
+	CHECK(input_ns(env.e_up, &pn, 0) == H_CONSUMED);
+	pkt_mac("02:00:00:00:12:34", mac);
+	CHECK_NA(3, &pn, mac, H_OUT_DIRECT);
+	ns_from_pe(&pn, "2001:db8:12:3500::1");
+	CHECK(input_ns(env.e_up, &pn, 0) == H_PASS);
+
+	CHECK(sysctl_set("target_policy_list", "") == 0);
+	CHECK(input_ns(env.e_up, &pn, 0) == H_CONSUMED);
+	CHECK_NA(4, &pn, env.e_down_mac, H_OUT_DIRECT);
+}
+
+/*
+ * Configs swapped while solicitations are received on other CPUs. In
+ * config A, the solicitations of PE A are answered with MAC A, in
+ * config B those of PE B with MAC B. The writer goes from one to the
+ * other through configs answering neither PE, so an advertisement for
+ * a PE with the MAC of the other one could only come from a hook
+ * reading parts of two configs.
+ */
+#define	SWAP_READERS	2
+#define	SWAP_CYCLES	200
+#define	SWAP_PE_A	"fe80::1"
+#define	SWAP_PE_B	"fe80::5"
+#define	SWAP_MAC_B	"02:00:00:00:00:d2"
+
+struct swap_state {
+	struct pkt_ns	ss_ns[2];	/* From PE A and from PE B. */
+	uint8_t		ss_mac[2][6];
+	int		ss_stop;
+	u_long		ss_input;
+	u_long		ss_na[2];
+	u_long		ss_mixed;
+	u_long		ss_bad;
+};
+
+static void
+swap_output(void *arg, int ifindex, int via, const uint8_t *frame, size_t len)
+{
+	struct swap_state *ss = arg;
+	struct pkt_na pa;
+	int pe;
+
+	if (pkt_na_parse(frame, len, via, &pa) != NULL) {
+		__atomic_add_fetch(&ss->ss_bad, 1, __ATOMIC_RELAXED);
+		return;
+	}
+	pe = memcmp(pa.pa_dst, ss->ss_ns[1].pn_src, 16) == 0;
+	if (pkt_na_check(frame, len, via, &ss->ss_ns[pe], ss->ss_mac[pe]) ==
+	    NULL)
+		__atomic_add_fetch(&ss->ss_na[pe], 1, __ATOMIC_RELAXED);
+	else if (pkt_na_check(frame, len, via, &ss->ss_ns[pe],
+	    ss->ss_mac[!pe]) == NULL)
+		__atomic_add_fetch(&ss->ss_mixed, 1, __ATOMIC_RELAXED);
+	else
+		__atomic_add_fetch(&ss->ss_bad, 1, __ATOMIC_RELAXED);
+}
+
+struct swap_reader {
+	struct swap_state *sr_ss;
+	int		sr_cpu;
+	long		sr_mbufs;
+};
+
+static void *
+swap_reader(void *arg)
+{
+	struct swap_reader *sr = arg;
+	struct swap_state *ss = sr->sr_ss;
+	uint8_t frame[2][PKT_MAX];
+	size_t len[2];
+	u_long n;
+
+	h_thread_init(sr->sr_cpu);
+	len[0] = pkt_ns(frame[0], &ss->ss_ns[0]);
+	len[1] = pkt_ns(frame[1], &ss->ss_ns[1]);
+	for (n = 0; !__atomic_load_n(&ss->ss_stop, __ATOMIC_RELAXED); n++)
+		h_input(env.e_up, frame[n & 1], len[n & 1], 0);
+	__atomic_add_fetch(&ss->ss_input, n, __ATOMIC_RELAXED);
+	h_run_tasks();
+	sr->sr_mbufs = h_mbufs();
+	h_thread_fini();
+	return (NULL);
+}
+
+static int
+swap_set(const char *name, const char *val)
+{
+	int err;
+
+	err = sysctl_set(name, val);
+	sched_yield();
+	return (err);
+}
+
+static void
+t_conf_swap(void)
+{
+	static struct swap_state ss;
+	struct swap_reader sr[SWAP_READERS];
+	pthread_t tid[SWAP_READERS];
+	int i, err = 0;
+
+	memset(&ss, 0, sizeof(ss));
+	ns_from_pe(&ss.ss_ns[0], TARGET);
+	pkt_addr(SWAP_PE_A, ss.ss_ns[0].pn_src);
+	ns_from_pe(&ss.ss_ns[1], TARGET);
+	pkt_addr(SWAP_PE_B, ss.ss_ns[1].pn_src);
+	memcpy(ss.ss_mac[0], env.e_down_mac, 6);
+	pkt_mac(SWAP_MAC_B, ss.ss_mac[1]);
+	CHECK(sysctl_set("uplink_addr_list", SWAP_PE_A) == 0);
+	h_set_output(swap_output, &ss);
+
+	for (i = 0; i < SWAP_READERS; i++) {
+		sr[i].sr_ss = &ss;
+		sr[i].sr_cpu = i + 1;
+		CHECK(pthread_create(&tid[i], NULL, swap_reader, &sr[i]) == 0);
+	}
+	for (i = 0; i < SWAP_CYCLES; i++) {
+		err |= swap_set("uplink_addr_list", "fe80::dead");
+		err |= swap_set("downlink_mac_list", SWAP_MAC_B);
+		err |= swap_set("uplink_addr_list", SWAP_PE_B);
+		err |= swap_set("uplink_addr_list", "fe80::dead");
+		err |= swap_set("downlink_mac_list", DOWN_MAC);
+		err |= swap_set("uplink_addr_list", SWAP_PE_A);
+	}
+	__atomic_store_n(&ss.ss_stop, 1, __ATOMIC_RELAXED);
+	for (i = 0; i < SWAP_READERS; i++)
+		pthread_join(tid[i], NULL);
+	h_set_output(out_collect, NULL);
+
+	CHECK(err == 0);
+	for (i = 0; i < SWAP_READERS; i++)
+		CHECK(sr[i].sr_mbufs == 0);
+	CHECK(ss.ss_mixed == 0);
+	CHECK(ss.ss_bad == 0);
+	CHECK(ss.ss_na[0] > 0 && ss.ss_na[1] > 0);
+	CHECK(h_stat("sent") == ss.ss_na[0] + ss.ss_na[1]);
+	CHECK(h_stat("received") == ss.ss_input);
+}
+
+static void
+t_replay(void)
+{
+	static const char *const kinds[] = { "mixed", "flood", "scan" };
+	struct replay r;
+	char path[] = "/tmp/ndharness.XXXXXX";
+	size_t k;
+	int expected, fd;
+
+	CHECK((fd = mkstemp(path)) >= 0);
+	close(fd);
+	for (k = 0; k < sizeof(kinds) / sizeof(kinds[0]); k++) {
+		expected = gen_file(kinds[k], path, 600);
+		CHECK(expected > 0);
+		CHECK(replay_load(path, &r) == 0);
+		replay_check(&r, 0, env.e_down_mac);
+		replay_check(&r, H_IN_SPLIT | H_IN_CSUM, env.e_down_mac);
+		replay_free(&r);
+		CHECK(r.r_count == 600);
+		CHECK(r.r_bad == 0);
+		CHECK(r.r_consumed == (u_long)expected);
+		CHECK(r.r_na == (u_long)expected);
+	}
+	unlink(path);
+}
+
+struct test {
+	const char	*t_name;
+	void		(*t_func)(void);
+	int		 t_ncpu;
+};
+
+static const struct test tests[] = {
+	{ "proxy", t_proxy, 1 },
+	{ "dad", t_dad, 1 },
+	{ "ip6_output", t_ip6_output, 1 },
+	{ "not_proxied", t_not_proxied, 1 },
+	{ "other_traffic", t_other_traffic, 1 },
+	{ "mbufs", t_mbufs, 1 },
+	{ "promisc", t_promisc, 1 },
+	{ "late_attach", t_late_attach, 1 },
+	{ "rename", t_rename, 1 },
+	{ "sysctl", t_sysctl, 1 },
+	{ "rate", t_rate, 1 },
+	{ "reach", t_reach, 1 },
+	{ "deferred", t_deferred, 1 },
+	{ "uplink_addrs", t_uplink_addrs, 1 },
+	{ "exceptions", t_exceptions, 1 },
+	{ "policy", t_policy, 1 },
+	{ "hook_variant", t_hook_variant, 1 },
+	{ "conf_swap", t_conf_swap, 1 + SWAP_READERS },
+	{ "replay", t_replay, 1 },
+};
+
+/*
+ * Run a test on a freshly loaded module. The mbufs it got must all be
+ * freed once it is over.
+ */
+static int
+run_test(const struct test *t)
+{
+	long mbufs;
+
+	test_name = t->t_name;
+	test_failed = 0;
+	env_setup(t->t_ncpu);
+	t->t_func();
+	h_run_tasks();
+	if (!test_failed && (mbufs = h_mbufs()) != 0) {
+		fprintf(stderr, "%s: %ld mbufs leaked\n", t->t_name, mbufs);
+		test_failed = 1;
+	}
+	env_teardown();
+	printf("%s %s\n", test_failed ? "FAIL" : "ok  ", t->t_name);
+	return (test_failed);
+}
+
+static int
+cmd_check(int argc, char **argv)
+{
+	size_t i;
+	int failed = 0, j, ran = 0;
+
+	for (i = 0; i < sizeof(tests) / sizeof(tests[0]); i++) {
+		for (j = 0; j < argc; j++)
+			if (strcmp(argv[j], tests[i].t_name) == 0)
+				break;
+		if (argc != 0 && j == argc)
+			continue;
+		failed += run_test(&tests[i]);
+		ran++;
+	}
+	printf("%d of %d tests failed\n", failed, ran);
+	return (failed != 0 || ran == 0);
+}
+
+/*
+ * Traffic received by the uplink interface of a CPE. A flood is made of
+ * solicitations of the PE for a single target, a scan of solicitations
+ * for the successive addrs of the prefix downstream. Mixed traffic holds
+ * solicitations of the PE with and without their option, DAD probes,
+ * and what must be left to the stack. Return the number of solicitations
+ * to proxy.
+ */
+static int
+gen_file(const char *kind, const char *path, int count)
+{
+	struct pcap_file pf;
+	struct pkt_ns pn;
+	uint8_t frame[PKT_MAX], dst[16];
+	char target[64];
+	size_t len;
+	int i, proxied = 0;
+
+	if (strcmp(kind, "mixed") != 0 && strcmp(kind, "flood") != 0 &&
+	    strcmp(kind, "scan") != 0)
+		return (-1);
+	if (pcap_open_write(&pf, path) != 0)
+		return (-1);
+	for (i = 0; i < count; i++) {
+		if (strcmp(kind, "flood") == 0) {
+			ns_from_pe(&pn, TARGET);
+			len = pkt_ns(frame, &pn);
+			proxied++;
+			goto write;
+		}
+		snprintf(target, sizeof(target), "2001:db8:1::%x:%x",
+		    (i + 1) >> 16, (i + 1) & 0xffff);
+		ns_from_pe(&pn, target);
+		if (strcmp(kind, "scan") == 0) {
+			len = pkt_ns(frame, &pn);
+			proxied++;
+			goto write;
+		}
+		switch (i % 8) {
+		case 0:
+		case 1:
+			proxied++;
+			len = pkt_ns(frame, &pn);
+			break;
+		case 2:
+			pn.pn_sllao = 0;
+			proxied++;
+			len = pkt_ns(frame, &pn);
+			break;
+		case 3:
+			memset(pn.pn_src, 0, 16);
+			pn.pn_sllao = 0;
+			proxied++;
+			len = pkt_ns(frame, &pn);
+			break;
+		case 4:
+			pkt_addr("fe80::99", pn.pn_src);
+			len = pkt_ns(frame, &pn);
+			break;
+		case 5:
+			pn.pn_badsum = 1;
+			len = pkt_ns(frame, &pn);
+			break;
+		case 6:
+			memcpy(dst, pn.pn_target, 16);
+			len = pkt_udp(frame, env.e_pe_mac, env.e_cpe_mac,
+			    env.e_cpe, dst, 64 + i % 512);
+			break;
+		default:
+			memcpy(dst, pn.pn_target, 16);
+			len = pkt_echo(frame, env.e_pe_mac, env.e_cpe_mac,
+			    env.e_cpe, dst);
+			break;
+		}
+write:
+		if (pcap_write(&pf, frame, len) != 0) {
+			pcap_close(&pf);
+			return (-1);
+		}
+	}
+	pcap_close(&pf);
+	return (proxied);
+}
+
+static int
+cmd_gen(int argc, char **argv)
+{
+	const char *kind = "mixed";
+	int ch, count, proxied;
+
+	while ((ch = getopt(argc, argv, "t:")) != -1)
+		switch (ch) {
+		case 't':
+			kind = optarg;
+			break;
+		default:
+			return (2);
+		}
+	argc -= optind;
+	argv += optind;
+	if (argc < 1 || argc > 2)
+		return (2);
+	count = argc > 1 ? atoi(argv[1]) : 1000;
+	pkt_mac(CPE_MAC, env.e_cpe_mac);
+	pkt_mac(PE_MAC, env.e_pe_mac);
+	pkt_addr(PE_LL, env.e_pe);
+	pkt_addr(CPE_ADDR, env.e_cpe);
+	if ((proxied = gen_file(kind, argv[0], count)) < 0) {
+		fprintf(stderr, "%s: can not write %s traffic\n", argv[0],
+		    kind);
+		return (1);
+	}
+	printf("%s: %d frames, %d solicitations to proxy\n", argv[0], count,
+	    proxied);
+	return (0);
+}
+
+static int
+cmd_replay(int argc, char **argv)
+{
+	struct replay r;
+	const char *downmac = NULL, *peaddrs = NULL;
+	uint8_t mac[6];
+	u_long iters = 0;
+	int ch;
+
+	while ((ch = getopt(argc, argv, "i:m:n:p:")) != -1)
+		switch (ch) {
+		case 'i':
+			/* The MAC the capture was made with. */
+			env_cpe_mac = optarg;
+			break;
+		case 'm':
+			downmac = optarg;
+			break;
+		case 'n':
+			iters = strtoul(optarg, NULL, 0);
+			break;
+		case 'p':
+			peaddrs = optarg;
+			break;
+		default:
+			return (2);
+		}
+	argc -= optind;
+	argv += optind;
+	if (argc != 1)
+		return (2);
+
+	if (replay_load(argv[0], &r) != 0)
+		return (1);
+	env_setup(1);
+	memcpy(mac, env.e_down_mac, 6);
+	if (downmac != NULL) {
+		pkt_mac(downmac, mac);
+		sysctl_set("downlink_mac_list", downmac);
+	}
+	if (peaddrs != NULL)
+		sysctl_set("uplink_addr_list", peaddrs);
+	replay_check(&r, 0, mac);
+	printf("%lu frames, %lu solicitations, %lu taken, %lu advertisements, "
+	    "%lu wrong\n", r.r_count, r.r_ns, r.r_consumed, r.r_na, r.r_bad);
+	if (iters != 0) {
+		h_set_output(out_discard, NULL);
+		replay_time(&r, iters);
+	}
+	env_teardown();
+	replay_free(&r);
+	return (r.r_bad != 0);
+}
+
+/*
+ * Benchmarks: the cost of h_input() for a frame, on each path through
+ * the hooks.
+ */
+static void
+bench_frame(const char *name, const uint8_t *frame, size_t len, int flags,
+    int iters)
+{
+	double t;
+	int i;
+
+	for (i = 0; i < iters / 10; i++)
+		h_input(env.e_up, frame, len, flags);
+	t = bench_now();
+	for (i = 0; i < iters; i++)
+		h_input(env.e_up, frame, len, flags);
+	t = bench_now() - t;
+	printf("%-28s %8.1f ns/frame %10.0f frames/s\n", name, t * 1e9 / iters,
+	    iters / t);
+}
+
+static int
+bench_paths(int iters)
+{
+	struct pkt_ns pn;
+	uint8_t frame[PKT_MAX], dst[16];
+	size_t len;
+
+	env_setup(1);
+	h_set_output(out_discard, NULL);
+
+	ns_from_pe(&pn, TARGET);
+	len = pkt_ns(frame, &pn);
+	bench_frame("proxied, direct", frame, len, 0, iters);
+	bench_frame("proxied, direct, NIC sum", frame, len,
+	    H_IN_CSUM | H_IN_PSEUDO, iters);
+	bench_frame("proxied, read-only mbuf", frame, len, H_IN_RDONLY, iters);
+	sysctl_set_int("direct_output", 0);
+	bench_frame("proxied, ip6_output", frame, len, 0, iters);
+	sysctl_set_int("direct_output", 1);
+	pkt_addr("fe80::99", pn.pn_src);
+	len = pkt_ns(frame, &pn);
+	bench_frame("solicitation, not PE", frame, len, 0, iters);
+	ns_from_pe(&pn, TARGET);
+	pn.pn_badsum = 1;
+	len = pkt_ns(frame, &pn);
+	bench_frame("solicitation, bad sum", frame, len, 0, iters);
+	pkt_addr(TARGET, dst);
+	len = pkt_echo(frame, env.e_pe_mac, env.e_cpe_mac, env.e_cpe, dst);
+	bench_frame("echo request", frame, len, 0, iters);
+	len = pkt_udp(frame, env.e_pe_mac, env.e_cpe_mac, env.e_cpe, dst, 512);
+	bench_frame("UDP", frame, len, 0, iters);
+
+	env_teardown();
+	return (0);
+}
+
+/*
+ * Each variant of the hook against the generic one, on a proxied and a
+ * rejected solicitation. The conf has every shape flag, so that none
+ * falls back to the generic hook.
+ */
+static int
+bench_variants(int iters)
+{
+	struct pkt_ns pn;
+	uint8_t proxied[PKT_MAX], rejected[PKT_MAX];
+	size_t plen, rlen;
+	char name[64];
+	const char *variant;
+	int shape;
+
+	env_setup(1);
+	h_set_output(out_discard, NULL);
+	ns_from_pe(&pn, TARGET);
+	plen = pkt_ns(proxied, &pn);
+	pkt_addr("fe80::99", pn.pn_src);
+	rlen = pkt_ns(rejected, &pn);
+	for (shape = 0; (variant = h_hook_force(shape)) != NULL; shape++) {
+		snprintf(name, sizeof(name), "%s, proxy", variant);
+		bench_frame(name, proxied, plen, 0, iters);
+		snprintf(name, sizeof(name), "%s, not PE", variant);
+		bench_frame(name, rejected, rlen, 0, iters);
+	}
+	env_teardown();
+	return (shape == 0);
+}
+
+/*
+ * The tables of the hook, against the loops they replaced, for sizes in
+ * powers of step up to max.
+ */
+static int
+bench_table(const char *name, int (*f)(unsigned, double *, double *),
+    const char *fast_name, const char *slow_name, unsigned step, unsigned max)
+{
+	double fast, slow;
+	unsigned n;
+	int ret = 0;
+
+	printf("%-10s %10s %12s %12s\n", name, "entries", fast_name,
+	    slow_name);
+	for (n = 1; n <= max; n *= step) {
+		if (f(n, &fast, &slow) != 0) {
+			fprintf(stderr, "%s: %u entries: lookups differ\n",
+			    name, n);
+			ret = 1;
+		}
+		printf("%-10s %10u %9.1f ns %9.1f ns\n", "", n, fast, slow);
+	}
+	return (ret);
+}
+
+static int
+bench_exceptions(int iters)
+{
+	return (bench_table("exceptions", h_bench_exceptions, "hash", "scan",
+	    10, EXCEPTIONS));
+}
+
+/* Up to UPLINK_MAX routers. */
+static int
+bench_uplink(int iters)
+{
+	return (bench_table("uplink", h_bench_uplink, "match", "loop", 2,
+	    256));
+}
+
+/* Up to POLICY_MAX prefixes. */
+static int
+bench_policy(int iters)
+{
+	return (bench_table("policy", h_bench_policy, "trie", "scan", 16,
+	    65536));
+}
+
+/*
+ * The advertisements of the replay of a scan, built from the template
+ * of the uplink or field by field.
+ */
+static int
+bench_na(int iters)
+{
+	double fast, slow;
+	int ret;
+
+	env_setup(1);
+	ret = h_bench_na(env.e_up, &fast, &slow);
+	env_teardown();
+	if (ret != 0)
+		fprintf(stderr, "na: checksums differ\n");
+	printf("%-10s %10s %12s %12s\n", "na", "", "template", "fields");
+	printf("%-10s %10s %6.1f cycles %6.1f cycles\n", "", "", fast, slow);
+	return (ret != 0);
+}
+
+/*
+ * L1 data cache read misses of the calling thread in userland, where the
+ * module runs, from the performance counters of Linux. Return -1 if they
+ * can not be read: another system, no counter in a VM, or not allowed by
+ * kernel.perf_event_paranoid.
+ */
+static int
+l1d_open(void)
+{
+#ifdef __linux__
+	struct perf_event_attr pa;
+
+	memset(&pa, 0, sizeof(pa));
+	pa.size = sizeof(pa);
+	pa.type = PERF_TYPE_HW_CACHE;
+	pa.config = PERF_COUNT_HW_CACHE_L1D |
+	    PERF_COUNT_HW_CACHE_OP_READ << 8 |
+	    PERF_COUNT_HW_CACHE_RESULT_MISS << 16;
+	pa.disabled = 1;
+	pa.exclude_kernel = 1;
+	pa.exclude_hv = 1;
+	return (syscall(SYS_perf_event_open, &pa, 0, -1, -1, 0));
+#else
+	return (-1);
+#endif
+}
+
+/*
+ * Misses per frame of h_input() for a frame, or -1.
+ */
+static double
+l1d_frame(int fd, const uint8_t *frame, size_t len, int iters)
+{
+#ifdef __linux__
+	uint64_t count;
+	int i;
+
+	for (i = 0; i < iters / 10; i++)
+		h_input(env.e_up, frame, len, 0);
+	if (ioctl(fd, PERF_EVENT_IOC_RESET, 0) != 0 ||
+	    ioctl(fd, PERF_EVENT_IOC_ENABLE, 0) != 0)
+		return (-1);
+	for (i = 0; i < iters; i++)
+		h_input(env.e_up, frame, len, 0);
+	if (ioctl(fd, PERF_EVENT_IOC_DISABLE, 0) != 0 ||
+	    read(fd, &count, sizeof(count)) != sizeof(count))
+		return (-1);
+	return ((double)count / iters);
+#else
+	return (-1);
+#endif
+}
+
+/*
+ * The L1 misses of a frame on the main paths, which the layout of the
+ * conf and of the interfaces keeps to a few lines.
+ */
+static int
+bench_cache(int iters)
+{
+	static const char *const names[] = { "proxied, direct",
+	    "solicitation, not PE", "solicitation, bad sum", "echo request" };
+	struct pkt_ns pn;
+	uint8_t frame[PKT_MAX], dst[16];
+	size_t i, len;
+	double misses;
+	int fd;
+
+	env_setup(1);
+	h_set_output(out_discard, NULL);
+	fd = l1d_open();
+	for (i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+		ns_from_pe(&pn, TARGET);
+		if (i == 1)
+			pkt_addr("fe80::99", pn.pn_src);
+		pn.pn_badsum = i == 2;
+		len = pkt_ns(frame, &pn);
+		if (i == 3) {
+			pkt_addr(TARGET, dst);
+			len = pkt_echo(frame, env.e_pe_mac, env.e_cpe_mac,
+			    env.e_cpe, dst);
+		}
+		misses = fd >= 0 ? l1d_frame(fd, frame, len, iters) : -1;
+		if (misses < 0)
+			printf("%-28s %8s L1D misses/frame\n", names[i], "n/a");
+		else
+			printf("%-28s %8.2f L1D misses/frame\n", names[i],
+			    misses);
+	}
+	if (fd >= 0)
+		close(fd);
+	env_teardown();
+	return (0);
+}
+
+struct bench {
+	const char	*b_name;
+	int		(*b_func)(int);
+};
+
+static const struct bench benches[] = {
+	{ "paths", bench_paths },
+	{ "variants", bench_variants },
+	{ "exceptions", bench_exceptions },
+	{ "uplink", bench_uplink },
+	{ "policy", bench_policy },
+	{ "na", bench_na },
+	{ "cache", bench_cache },
+};
+
+static int
+cmd_bench(int argc, char **argv)
+{
+	size_t i;
+	int ch, iters = 200000, j, ret = 0;
+
+	while ((ch = getopt(argc, argv, "n:")) != -1)
+		switch (ch) {
+		case 'n':
+			iters = atoi(optarg);
+			break;
+		default:
+			return (2);
+		}
+	argc -= optind;
+	argv += optind;
+	for (i = 0; i < sizeof(benches) / sizeof(benches[0]); i++) {
+		for (j = 0; j < argc; j++)
+			if (strcmp(argv[j], benches[i].b_name) == 0)
+				break;
+		if (argc != 0 && j == argc)
+			continue;
+		ret |= benches[i].b_func(iters);
+	}
+	return (ret);
+}
+
+static void
+usage(void)
+{
+	fprintf(stderr,
+	    "usage: ndharness check [test ...]\n"
+	    "       ndharness replay [-i uplink_mac] [-m downlink_mac] "
+	    "[-n iterations]\n"
+	    "                        [-p uplink_addrs] file\n"
+	    "       ndharness bench [-n iterations] [benchmark ...]\n"
+	    "       ndharness gen [-t mixed|flood|scan] file [count]\n");
+	exit(2);
+}
+
+int
+main(int argc, char **argv)
+{
+	int ret;
+
+	if (argc < 2)
+		usage();
+	if (strcmp(argv[1], "check") == 0)
+		ret = cmd_check(argc - 2, argv + 2);
+	else if (strcmp(argv[1], "replay") == 0)
+		ret = cmd_replay(argc - 1, argv + 1);
+	else if (strcmp(argv[1], "bench") == 0)
+		ret = cmd_bench(argc - 1, argv + 1);
+	else if (strcmp(argv[1], "gen") == 0)
+		ret = cmd_gen(argc - 1, argv + 1);
+	else
+		usage();
+	if (ret == 2)
+		usage();
+	return (ret);
+}
@@ -0,0 +1,149 @@
+/*-
+ * Copyright (c) 2015-2019 Alexandre Fenyo <alex@fenyo.net> - http://www.fenyo.net
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Classic pcap files, see pcap.h. Only the Ethernet link type is read.
+ */
+
+#include <string.h>
+
+#include "pcap.h"
+
+#define	PCAP_MAGIC		0xa1b2c3d4
+#define	PCAP_MAGIC_SWAPPED	0xd4c3b2a1
+#define	PCAP_LINKTYPE_ETHERNET	1
+
+struct pcap_hdr {
+	uint32_t	ph_magic;
+	uint16_t	ph_version_major;
+	uint16_t	ph_version_minor;
+	int32_t		ph_thiszone;
+	uint32_t	ph_sigfigs;
+	uint32_t	ph_snaplen;
+	uint32_t	ph_linktype;
+};
+
+struct pcap_rec {
+	uint32_t	pr_sec;
+	uint32_t	pr_usec;
+	uint32_t	pr_caplen;
+	uint32_t	pr_len;
+};
+
+static uint32_t
+pcap_u32(const struct pcap_file *pf, uint32_t v)
+{
+	return (pf->pf_swap ? __builtin_bswap32(v) : v);
+}
+
+int
+pcap_open_read(struct pcap_file *pf, const char *path)
+{
+	struct pcap_hdr ph;
+
+	if ((pf->pf_fp = fopen(path, "rb")) == NULL)
+		return (-1);
+	if (fread(&ph, sizeof(ph), 1, pf->pf_fp) != 1)
+		goto bad;
+	if (ph.ph_magic == PCAP_MAGIC)
+		pf->pf_swap = 0;
+	else if (ph.ph_magic == PCAP_MAGIC_SWAPPED)
+		pf->pf_swap = 1;
+	else
+		goto bad;
+	if (pcap_u32(pf, ph.ph_linktype) != PCAP_LINKTYPE_ETHERNET)
+		goto bad;
+	return (0);
+bad:
+	fclose(pf->pf_fp);
+	pf->pf_fp = NULL;
+	return (-1);
+}
+
+int
+pcap_open_write(struct pcap_file *pf, const char *path)
+{
+	struct pcap_hdr ph;
+
+	if ((pf->pf_fp = fopen(path, "wb")) == NULL)
+		return (-1);
+	pf->pf_swap = 0;
+	memset(&ph, 0, sizeof(ph));
+	ph.ph_magic = PCAP_MAGIC;
+	ph.ph_version_major = 2;
+	ph.ph_version_minor = 4;
+	ph.ph_snaplen = PCAP_SNAPLEN;
+	ph.ph_linktype = PCAP_LINKTYPE_ETHERNET;
+	if (fwrite(&ph, sizeof(ph), 1, pf->pf_fp) != 1) {
+		fclose(pf->pf_fp);
+		pf->pf_fp = NULL;
+		return (-1);
+	}
+	return (0);
+}
+
+int
+pcap_read(struct pcap_file *pf, uint8_t *buf, size_t size)
+{
+	struct pcap_rec pr;
+	uint32_t caplen;
+
+	if (fread(&pr, sizeof(pr), 1, pf->pf_fp) != 1)
+		return (feof(pf->pf_fp) ? 0 : -1);
+	caplen = pcap_u32(pf, pr.pr_caplen);
+	if (caplen > size || caplen > PCAP_SNAPLEN)
+		return (-1);
+	if (fread(buf, 1, caplen, pf->pf_fp) != caplen)
+		return (-1);
+	return (caplen);
+}
+
+/*
+ * Frames are stamped with their rank, so that a replay does not depend
+ * on the time they were generated at.
+ */
+int
+pcap_write(struct pcap_file *pf, const uint8_t *buf, size_t len)
+{
+	static uint32_t rank;
+	struct pcap_rec pr;
+
+	pr.pr_sec = rank / 1000000;
+	pr.pr_usec = rank++ % 1000000;
+	pr.pr_caplen = pr.pr_len = len;
+	if (fwrite(&pr, sizeof(pr), 1, pf->pf_fp) != 1 ||
+	    fwrite(buf, 1, len, pf->pf_fp) != len)
+		return (-1);
+	return (0);
+}
+
+void
+pcap_close(struct pcap_file *pf)
+{
+	if (pf->pf_fp != NULL)
+		fclose(pf->pf_fp);
+	pf->pf_fp = NULL;
+}
@@ -0,0 +1,53 @@
+/*-
+ * Copyright (c) 2015-2019 Alexandre Fenyo <alex@fenyo.net> - http://www.fenyo.net
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Classic pcap files of Ethernet frames, as tcpdump(1) reads and writes
+ * them.
+ */
+
+#ifndef _HARNESS_PCAP_H_
+#define _HARNESS_PCAP_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#define	PCAP_SNAPLEN	65535
+
+struct pcap_file {
+	FILE		*pf_fp;
+	int		 pf_swap;	/* Written in the other byte order. */
+};
+
+int	pcap_open_read(struct pcap_file *, const char *);
+int	pcap_open_write(struct pcap_file *, const char *);
+/* Read the next frame: its length, 0 at the end of the file, -1 on error. */
+int	pcap_read(struct pcap_file *, uint8_t *, size_t);
+int	pcap_write(struct pcap_file *, const uint8_t *, size_t);
+void	pcap_close(struct pcap_file *);
+
+#endif
@@ -0,0 +1,376 @@
+/*-
+ * Copyright (c) 2015-2019 Alexandre Fenyo <alex@fenyo.net> - http://www.fenyo.net
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Frames of the tests, see pkt.h. Built and checked with the headers of
+ * libc, apart from the module.
+ */
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include <net/ethernet.h>
+#include <netinet/in.h>
+#include <netinet/ip6.h>
+#include <netinet/icmp6.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "harness.h"
+#include "pkt.h"
+
+#define	PKT_ETHER_HDR_LEN	14
+#define	PKT_IPV6_VERSION	0x60
+
+static const uint8_t pkt_allnodes[16] = {
+	0xff, 0x02, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0x01 };
+static const uint8_t pkt_zero[16];
+
+void
+pkt_addr(const char *str, uint8_t *addr)
+{
+	if (inet_pton(AF_INET6, str, addr) != 1) {
+		fprintf(stderr, "bad address %s\n", str);
+		exit(2);
+	}
+}
+
+void
+pkt_mac(const char *str, uint8_t *mac)
+{
+	u_int b[6];
+	int i;
+
+	if (sscanf(str, "%x:%x:%x:%x:%x:%x", &b[0], &b[1], &b[2], &b[3],
+	    &b[4], &b[5]) != 6) {
+		fprintf(stderr, "bad MAC %s\n", str);
+		exit(2);
+	}
+	for (i = 0; i < 6; i++)
+		mac[i] = b[i];
+}
+
+void
+pkt_solnode(const uint8_t *target, uint8_t *group)
+{
+	static const uint8_t prefix[13] = {
+		0xff, 0x02, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0x01, 0xff };
+
+	memcpy(group, prefix, sizeof(prefix));
+	memcpy(group + 13, target + 13, 3);
+}
+
+/*
+ * The addr as a string, in one of a few static buffers.
+ */
+const char *
+pkt_ntop(const uint8_t *addr)
+{
+	static char buf[4][INET6_ADDRSTRLEN];
+	static int next;
+	char *p = buf[next++ % 4];
+
+	return (inet_ntop(AF_INET6, addr, p, INET6_ADDRSTRLEN));
+}
+
+/*
+ * Internet checksum of the payload of an IPv6 packet, with its pseudo
+ * header.
+ */
+static uint16_t
+pkt_cksum(const struct ip6_hdr *ip6, const uint8_t *p, size_t len)
+{
+	uint32_t sum = 0;
+	size_t i;
+
+	for (i = 0; i < 16; i += 2) {
+		sum += ip6->ip6_src.s6_addr[i] << 8 | ip6->ip6_src.s6_addr[i + 1];
+		sum += ip6->ip6_dst.s6_addr[i] << 8 | ip6->ip6_dst.s6_addr[i + 1];
+	}
+	sum += len + ip6->ip6_nxt;
+	for (i = 0; i + 1 < len; i += 2)
+		sum += p[i] << 8 | p[i + 1];
+	if (len & 1)
+		sum += p[len - 1] << 8;
+	while (sum >> 16)
+		sum = (sum >> 16) + (sum & 0xffff);
+	return (htons(~sum & 0xffff));
+}
+
+/*
+ * Frames are built and parsed in a buffer of the thread where the IPv6
+ * header is aligned, as a driver would put it, and copied from or to
+ * the buffer of the caller.
+ */
+static __thread union {
+	uint32_t	ps_align;
+	uint8_t		ps_buf[2 + PKT_MAX];
+} pkt_scratch;
+
+static uint8_t *
+pkt_in(const uint8_t *frame, size_t len)
+{
+	memcpy(pkt_scratch.ps_buf + 2, frame, len);
+	return (pkt_scratch.ps_buf + 2);
+}
+
+static size_t
+pkt_out(uint8_t *out, size_t len)
+{
+	memcpy(out, pkt_scratch.ps_buf + 2, len);
+	return (len);
+}
+
+static uint8_t *
+pkt_ip6(uint8_t *frame, const uint8_t *src_mac, const uint8_t *dst_mac,
+    const uint8_t *src, const uint8_t *dst, int nxt, int hlim, size_t plen)
+{
+	struct ether_header *eh = (struct ether_header *)frame;
+	struct ip6_hdr *ip6 = (struct ip6_hdr *)(frame + PKT_ETHER_HDR_LEN);
+
+	memcpy(eh->ether_dhost, dst_mac, 6);
+	memcpy(eh->ether_shost, src_mac, 6);
+	eh->ether_type = htons(ETHERTYPE_IPV6);
+	memset(ip6, 0, sizeof(*ip6));
+	ip6->ip6_vfc = PKT_IPV6_VERSION;
+	ip6->ip6_plen = htons(plen);
+	ip6->ip6_nxt = nxt;
+	ip6->ip6_hlim = hlim;
+	memcpy(&ip6->ip6_src, src, 16);
+	memcpy(&ip6->ip6_dst, dst, 16);
+	return ((uint8_t *)(ip6 + 1));
+}
+
+size_t
+pkt_ns(uint8_t *out, const struct pkt_ns *pn)
+{
+	struct nd_neighbor_solicit *ns;
+	struct ip6_hdr *ip6;
+	uint8_t dst[16], dst_mac[6], *opt;
+	size_t plen;
+	uint8_t *frame = pkt_scratch.ps_buf + 2;
+
+	if (memcmp(pn->pn_dst, pkt_zero, 16) == 0)
+		pkt_solnode(pn->pn_target, dst);
+	else
+		memcpy(dst, pn->pn_dst, 16);
+	if (memcmp(pn->pn_dst_mac, pkt_zero, 6) == 0) {
+		dst_mac[0] = dst_mac[1] = 0x33;
+		memcpy(dst_mac + 2, dst + 12, 4);
+	} else
+		memcpy(dst_mac, pn->pn_dst_mac, 6);
+	plen = sizeof(*ns) + (pn->pn_sllao ? 8 : 0);
+	ns = (struct nd_neighbor_solicit *)pkt_ip6(frame, pn->pn_src_mac,
+	    dst_mac, pn->pn_src, dst, IPPROTO_ICMPV6,
+	    pn->pn_hlim != 0 ? pn->pn_hlim : 255, plen);
+	memset(ns, 0, sizeof(*ns));
+	ns->nd_ns_type = ND_NEIGHBOR_SOLICIT;
+	memcpy(&ns->nd_ns_target, pn->pn_target, 16);
+	if (pn->pn_sllao) {
+		opt = (uint8_t *)(ns + 1);
+		opt[0] = ND_OPT_SOURCE_LINKADDR;
+		opt[1] = 1;
+		memcpy(opt + 2, pn->pn_src_mac, 6);
+	}
+	ip6 = (struct ip6_hdr *)(frame + PKT_ETHER_HDR_LEN);
+	ns->nd_ns_cksum = pkt_cksum(ip6, (uint8_t *)ns, plen);
+	if (pn->pn_badsum)
+		ns->nd_ns_cksum ^= 0x0101;
+	return (pkt_out(out, PKT_ETHER_HDR_LEN + sizeof(*ip6) + plen));
+}
+
+int
+pkt_ns_parse(const uint8_t *frame, size_t len, struct pkt_ns *pn)
+{
+	const struct ether_header *eh;
+	const struct nd_neighbor_solicit *ns;
+	const struct ip6_hdr *ip6;
+	const uint8_t *opt;
+	size_t plen;
+
+	if (len > PKT_MAX)
+		return (-1);
+	frame = pkt_in(frame, len);
+	eh = (const struct ether_header *)frame;
+	if (len < PKT_ETHER_HDR_LEN + sizeof(*ip6) + sizeof(*ns) ||
+	    ntohs(eh->ether_type) != ETHERTYPE_IPV6)
+		return (-1);
+	ip6 = (const struct ip6_hdr *)(frame + PKT_ETHER_HDR_LEN);
+	ns = (const struct nd_neighbor_solicit *)(ip6 + 1);
+	plen = ntohs(ip6->ip6_plen);
+	if (ip6->ip6_nxt != IPPROTO_ICMPV6 || ns->nd_ns_type !=
+	    ND_NEIGHBOR_SOLICIT || plen < sizeof(*ns) ||
+	    PKT_ETHER_HDR_LEN + sizeof(*ip6) + plen > len)
+		return (-1);
+	memset(pn, 0, sizeof(*pn));
+	memcpy(pn->pn_src_mac, eh->ether_shost, 6);
+	memcpy(pn->pn_dst_mac, eh->ether_dhost, 6);
+	memcpy(pn->pn_src, &ip6->ip6_src, 16);
+	memcpy(pn->pn_dst, &ip6->ip6_dst, 16);
+	memcpy(pn->pn_target, &ns->nd_ns_target, 16);
+	pn->pn_hlim = ip6->ip6_hlim;
+	pn->pn_badsum = pkt_cksum(ip6, (const uint8_t *)ns, plen) != 0;
+	for (opt = (const uint8_t *)(ns + 1);
+	    opt + 8 <= (const uint8_t *)ns + plen && opt[1] != 0;
+	    opt += opt[1] * 8)
+		if (opt[0] == ND_OPT_SOURCE_LINKADDR && opt[1] == 1) {
+			memcpy(pn->pn_src_mac, opt + 2, 6);
+			pn->pn_sllao = 1;
+		}
+	return (0);
+}
+
+size_t
+pkt_udp(uint8_t *out, const uint8_t *src_mac, const uint8_t *dst_mac,
+    const uint8_t *src, const uint8_t *dst, size_t paylen)
+{
+	struct ip6_hdr *ip6;
+	uint8_t *udp;
+	size_t plen = 8 + paylen;
+	uint8_t *frame = pkt_scratch.ps_buf + 2;
+
+	udp = pkt_ip6(frame, src_mac, dst_mac, src, dst, IPPROTO_UDP, 64,
+	    plen);
+	memset(udp, 0, plen);
+	udp[0] = 0x30;			/* Ports 12345 and 53. */
+	udp[1] = 0x39;
+	udp[3] = 53;
+	udp[4] = plen >> 8;
+	udp[5] = plen & 0xff;
+	ip6 = (struct ip6_hdr *)(frame + PKT_ETHER_HDR_LEN);
+	memcpy(udp + 6, &(uint16_t){ pkt_cksum(ip6, udp, plen) }, 2);
+	return (pkt_out(out, PKT_ETHER_HDR_LEN + sizeof(*ip6) + plen));
+}
+
+size_t
+pkt_echo(uint8_t *out, const uint8_t *src_mac, const uint8_t *dst_mac,
+    const uint8_t *src, const uint8_t *dst)
+{
+	struct icmp6_hdr *icmp6;
+	struct ip6_hdr *ip6;
+	uint8_t *frame = pkt_scratch.ps_buf + 2;
+
+	icmp6 = (struct icmp6_hdr *)pkt_ip6(frame, src_mac, dst_mac, src, dst,
+	    IPPROTO_ICMPV6, 64, sizeof(*icmp6));
+	memset(icmp6, 0, sizeof(*icmp6));
+	icmp6->icmp6_type = ICMP6_ECHO_REQUEST;
+	ip6 = (struct ip6_hdr *)(frame + PKT_ETHER_HDR_LEN);
+	icmp6->icmp6_cksum = pkt_cksum(ip6, (uint8_t *)icmp6, sizeof(*icmp6));
+	return (pkt_out(out, PKT_ETHER_HDR_LEN + sizeof(*ip6) + sizeof(*icmp6)));
+}
+
+const char *
+pkt_na_parse(const uint8_t *frame, size_t len, int via, struct pkt_na *pa)
+{
+	const struct ether_header *eh;
+	const struct ip6_hdr *ip6;
+	const struct nd_neighbor_advert *na;
+	const uint8_t *opt;
+	size_t plen;
+	uint32_t flags;
+
+	if (len > PKT_MAX)
+		return ("frame too long");
+	frame = pkt_in(frame, len);
+	eh = (const struct ether_header *)frame;
+	if (len < PKT_ETHER_HDR_LEN + sizeof(*ip6) + sizeof(*na) + 8)
+		return ("short frame");
+	if (ntohs(eh->ether_type) != ETHERTYPE_IPV6)
+		return ("not IPv6");
+	ip6 = (const struct ip6_hdr *)(frame + PKT_ETHER_HDR_LEN);
+	na = (const struct nd_neighbor_advert *)(ip6 + 1);
+	opt = (const uint8_t *)(na + 1);
+	plen = ntohs(ip6->ip6_plen);
+	if ((ip6->ip6_vfc & 0xf0) != PKT_IPV6_VERSION)
+		return ("bad IP version");
+	if (plen != sizeof(*na) + 8 ||
+	    PKT_ETHER_HDR_LEN + sizeof(*ip6) + plen != len)
+		return ("bad payload length");
+	if (ip6->ip6_nxt != IPPROTO_ICMPV6)
+		return ("not ICMPv6");
+	if (ip6->ip6_hlim != 255)
+		return ("hop limit not 255");
+	if (na->nd_na_type != ND_NEIGHBOR_ADVERT || na->nd_na_code != 0)
+		return ("not a neighbor advertisement");
+	if (pkt_cksum(ip6, (const uint8_t *)na, plen) != 0)
+		return ("bad checksum");
+	if (opt[0] != ND_OPT_TARGET_LINKADDR || opt[1] != 1)
+		return ("no target link-layer address option");
+	flags = na->nd_na_flags_reserved;
+	if ((flags & ND_NA_FLAG_ROUTER) == 0)
+		return ("router flag not set");
+	if (flags & ND_NA_FLAG_OVERRIDE)
+		return ("override flag set");
+	if (flags & ~(ND_NA_FLAG_ROUTER | ND_NA_FLAG_SOLICITED |
+	    ND_NA_FLAG_OVERRIDE))
+		return ("reserved bits set");
+	if (memcmp(eh->ether_shost, pkt_zero, 6) == 0)
+		return ("no source MAC");
+	pa->pa_via = via;
+	memcpy(pa->pa_dst_mac, eh->ether_dhost, 6);
+	memcpy(pa->pa_src, &ip6->ip6_src, 16);
+	memcpy(pa->pa_dst, &ip6->ip6_dst, 16);
+	memcpy(pa->pa_target, &na->nd_na_target, 16);
+	memcpy(pa->pa_mac, opt + 2, 6);
+	pa->pa_solicited = (flags & ND_NA_FLAG_SOLICITED) != 0;
+	return (NULL);
+}
+
+const char *
+pkt_na_check(const uint8_t *frame, size_t len, int via,
+    const struct pkt_ns *pn, const uint8_t *mac)
+{
+	static const uint8_t allnodes_mac[6] = { 0x33, 0x33, 0, 0, 0, 1 };
+	struct pkt_na pa;
+	const char *why;
+	int unspec;
+
+	if ((why = pkt_na_parse(frame, len, via, &pa)) != NULL)
+		return (why);
+	unspec = memcmp(pn->pn_src, pkt_zero, 16) == 0;
+	if (memcmp(pa.pa_target, pn->pn_target, 16) != 0)
+		return ("wrong target");
+	if (memcmp(pa.pa_mac, mac, 6) != 0)
+		return ("wrong target link-layer address");
+	if (pa.pa_solicited == unspec)
+		return (unspec ? "solicited flag set for an unspecified source" :
+		    "solicited flag not set");
+	if (memcmp(pa.pa_dst, pkt_allnodes, 16) != 0 &&
+	    (unspec || memcmp(pa.pa_dst, pn->pn_src, 16) != 0))
+		return ("wrong destination");
+	if (memcmp(pa.pa_src, pkt_zero, 16) != 0 && pa.pa_src[0] != 0xfe &&
+	    !unspec && pn->pn_src[0] == 0xfe)
+		return ("global source for a link-local destination");
+	if (via == H_OUT_DIRECT) {
+		if (memcmp(pa.pa_dst, pkt_allnodes, 16) == 0 ?
+		    memcmp(pa.pa_dst_mac, allnodes_mac, 6) != 0 :
+		    !pn->pn_sllao || memcmp(pa.pa_dst_mac, pn->pn_src_mac, 6) != 0)
+			return ("wrong destination MAC");
+	}
+	return (NULL);
+}
@@ -0,0 +1,95 @@
+/*-
+ * Copyright (c) 2015-2019 Alexandre Fenyo <alex@fenyo.net> - http://www.fenyo.net
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Frames of the tests: solicitations and other traffic to feed the
+ * hooks, and the checks of the advertisements they send.
+ */
+
+#ifndef _HARNESS_PKT_H_
+#define _HARNESS_PKT_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define	PKT_MAX		1536
+
+/*
+ * A solicitation. A zero destination addr stands for the solicited-node
+ * group of the target, a zero destination MAC for the MAC of the group.
+ */
+struct pkt_ns {
+	uint8_t		pn_src_mac[6];
+	uint8_t		pn_dst_mac[6];
+	uint8_t		pn_src[16];
+	uint8_t		pn_dst[16];
+	uint8_t		pn_target[16];
+	int		pn_sllao;	/* With a source link-layer addr option. */
+	int		pn_hlim;	/* 0: 255. */
+	int		pn_badsum;
+};
+
+/* An advertisement, as sent by the module. */
+struct pkt_na {
+	int		pa_via;		/* H_OUT_DIRECT or H_OUT_IP6. */
+	uint8_t		pa_dst_mac[6];
+	uint8_t		pa_src[16];
+	uint8_t		pa_dst[16];
+	uint8_t		pa_target[16];
+	uint8_t		pa_mac[6];	/* Of the target link-layer addr option. */
+	int		pa_solicited;
+};
+
+void	pkt_addr(const char *, uint8_t *);
+void	pkt_mac(const char *, uint8_t *);
+void	pkt_solnode(const uint8_t *, uint8_t *);
+const char *pkt_ntop(const uint8_t *);
+
+size_t	pkt_ns(uint8_t *, const struct pkt_ns *);
+/*
+ * Parse a frame holding a solicitation: 0 if it is one, -1 otherwise.
+ * The source MAC is the one of its link-layer addr option, if any.
+ */
+int	pkt_ns_parse(const uint8_t *, size_t, struct pkt_ns *);
+size_t	pkt_udp(uint8_t *, const uint8_t *, const uint8_t *, const uint8_t *,
+	    const uint8_t *, size_t);
+size_t	pkt_echo(uint8_t *, const uint8_t *, const uint8_t *, const uint8_t *,
+	    const uint8_t *);
+
+/*
+ * Check that a frame is a valid advertisement, as RFC 4861 (7.2.4) has
+ * it, and parse it into *na. Return NULL, or what is wrong with it.
+ */
+const char *pkt_na_parse(const uint8_t *, size_t, int, struct pkt_na *);
+
+/*
+ * Check that a frame is the advertisement answering a solicitation,
+ * for the MAC mac. Return NULL, or what is wrong with it.
+ */
+const char *pkt_na_check(const uint8_t *, size_t, int, const struct pkt_ns *,
+	    const uint8_t *);
+
+#endif
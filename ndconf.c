@@ -25,34 +25,487 @@
  */
 
 #include <sys/param.h>
+#include <sys/systm.h>
+#include <sys/kernel.h>
+#include <sys/epoch.h>
+#include <sys/lock.h>
+#include <sys/malloc.h>
 #include <sys/socket.h>
+#include <sys/sx.h>
 #include <net/if.h>
+#include <net/if_var.h>
 #include <net/ethernet.h>
+#include <net/vnet.h>
 #include <netinet/in.h>
+#include <netinet/icmp6.h>
+#include <netinet/ip6.h>
 
 #include "ndconf.h"
+#include "ndhash.h"
+#include "ndtrie.h"
+
+CTASSERT(sizeof(struct nd_na_template) % 8 == 0);
+
+MALLOC_DEFINE(M_NDPROXY, "ndproxy", "NDPROXY configuration tables");
+
+struct sx ndproxy_conf_lock;
+SX_SYSINIT(ndproxy_conf_lock, &ndproxy_conf_lock, "ndproxy config");
 
 /* Uplink interface names. */
-char up_ifaces[UP_IFACE_MAX][IFNAMSIZ];
+VNET_DEFINE(nd_ifname_t *, up_ifaces) = NULL;
+VNET_DEFINE(int, up_ifaces_set) = 0;
 
 /* Uplink router addrs. */
-struct in6_addr uplink_addrs[UPLINK_MAX];
-int uplink_addrs_set = 0;
-
-/* Addrs to exclude from proxying. */
-struct in6_addr exception_addrs[EXCEPTION_MAX];
-int exception_addrs_set = 0;
+VNET_DEFINE(struct nd_uplink_addr *, uplink_addrs) = NULL;
+VNET_DEFINE(int, uplink_addrs_set) = 0;
 
 /*
  * MAC addresses to supply as the downlink. Provide one MAC
  * addr per interface to handle multihoming.
  */
-struct ether_addr downlink_mac_addrs[UP_IFACE_MAX];
-int downlink_mac_addrs_set = 0;
+VNET_DEFINE(struct ether_addr *, downlink_mac_addrs) = NULL;
+VNET_DEFINE(int, downlink_mac_addrs_set) = 0;
+
+/* The conf the pfil hook reads. */
+VNET_DEFINE(struct nd_conf *, nd_active_conf) = NULL;
+
+/* Generation of the source addr caches; zeroed entries are stale. */
+u_int nd_src_gen __read_mostly = 1;
+
+/*
+ * Per-interface state built from the config vars, shared by all the
+ * confs built until these vars change again.
+ */
+struct nd_iface_name {
+	char	nn_name[IFNAMSIZ];
+	int	nn_rank;
+};
+
+/* The checks of a solicitation only read the first line of its nd_iface. */
+CTASSERT(offsetof(struct nd_iface, ni_na) <= CACHE_LINE_SIZE);
+
+struct nd_iface_set {
+	int			 ns_count;
+	struct nd_iface_name	*ns_byname;	/* Sorted by name. */
+	struct nd_addr64	*ns_uplink;	/* Uplink router addrs. */
+	struct nd_iface		 ns_ifaces[];	/* By rank in up_ifaces. */
+};
+
+/* Parts of the active conf, to share with the next one. */
+#define nd_conf_exceptions() \
+	(V_nd_active_conf != NULL ? V_nd_active_conf->nc_exceptions : NULL)
+#define nd_conf_set() \
+	(V_nd_active_conf != NULL ? V_nd_active_conf->nc_set : NULL)
+#define nd_conf_policy() \
+	(V_nd_active_conf != NULL ? V_nd_active_conf->nc_policy : NULL)
+
+static int
+nd_iface_name_cmp(const void *a, const void *b)
+{
+	return (strncmp(((const struct nd_iface_name *)a)->nn_name,
+	    ((const struct nd_iface_name *)b)->nn_name, IFNAMSIZ));
+}
+
+static int
+nd_iface_rank_cmp(const void *a, const void *b)
+{
+	const struct nd_iface_name *na = a, *nb = b;
+	int cmp;
+
+	if ((cmp = nd_iface_name_cmp(a, b)) != 0)
+		return (cmp);
+	return (na->nn_rank - nb->nn_rank);
+}
+
+/*
+ * Rank of an interface in up_ifaces, or -1 if it is not an uplink.
+ */
+static int
+nd_iface_rank(const struct nd_iface_set *set, const char *name)
+{
+	struct nd_iface_name key, *found;
+
+	if (set == NULL || set->ns_count == 0)
+		return (-1);
+	strlcpy(key.nn_name, name, IFNAMSIZ);
+	found = bsearch(&key, set->ns_byname, set->ns_count,
+	    sizeof(struct nd_iface_name), nd_iface_name_cmp);
+	if (found == NULL)
+		return (-1);
+
+	/* Keep the first rank of a name given twice. */
+	while (found > set->ns_byname &&
+	    nd_iface_name_cmp(found - 1, &key) == 0)
+		found--;
+	return (found->nn_rank);
+}
+
+static void
+nd_iface_set_free(struct nd_iface_set *set)
+{
+	if (set == NULL)
+		return;
+	free(set->ns_byname, M_NDPROXY);
+	free(set->ns_uplink, M_NDPROXY);
+	free(set, M_NDPROXY);
+}
+
+static void
+nd_iface_set_addr(struct nd_iface_set *set, int i, const struct in6_addr *addr)
+{
+	bcopy(&addr->s6_addr[0], &set->ns_uplink[i].a_hi, sizeof(uint64_t));
+	bcopy(&addr->s6_addr[8], &set->ns_uplink[i].a_lo, sizeof(uint64_t));
+}
+
+/*
+ * Point an interface to its uplink router addrs, copied in the nd_iface
+ * when there are few of them so that the hook finds them on the line it
+ * has just read.
+ */
+static void
+nd_iface_set_uplink(struct nd_iface *nif, const struct nd_addr64 *addrs,
+    int count)
+{
+	nif->ni_uplink_addrs_set = count;
+	if (count <= ND_UPLINK_INLINE) {
+		bcopy(addrs, nif->ni_uplink_inline,
+		    count * sizeof(struct nd_addr64));
+		nif->ni_uplink = nif->ni_uplink_inline;
+	} else
+		nif->ni_uplink = addrs;
+}
+
+/*
+ * Number of uplink router addrs bound to the interface name.
+ */
+static int
+nd_uplink_addrs_bound(const char *name)
+{
+	int i, count = 0;
+
+	for (i = 0; i < V_uplink_addrs_set; i++)
+		if (strncmp(V_uplink_addrs[i].nu_ifname, name, IFNAMSIZ) == 0)
+			count++;
+	return (count);
+}
+
+/*
+ * Prebuild the advertisement for an interface and sum everything but
+ * the addrs, the solicited flag and the MAC, which a target policy may
+ * replace: the ICMPv6 part and the length and next header words of the
+ * pseudo header (RFC 2460, section 8.1).
+ */
+static void
+nd_na_template_init(struct nd_iface *nif)
+{
+	struct nd_na_template *nt = &nif->ni_na;
+	uint16_t plen;
+
+	plen = sizeof(*nt) - sizeof(struct ip6_hdr);
+	bzero(nt, sizeof(*nt));
+	nt->nt_ip6.ip6_vfc = IPV6_VERSION;
+	nt->nt_ip6.ip6_plen = htons(plen);
+	nt->nt_ip6.ip6_nxt = IPPROTO_ICMPV6;
+	nt->nt_ip6.ip6_hlim = 255;
+	nt->nt_na.nd_na_type = ND_NEIGHBOR_ADVERT;
+	nt->nt_na.nd_na_code = 0;
+	/*
+	 * According to RFC-4861 (section 7.2.4), a proxy SHOULD set the
+	 * Override flag to zero, so only the Router flag is always set.
+	 */
+	nt->nt_na.nd_na_flags_reserved = ND_NA_FLAG_ROUTER;
+	nt->nt_opt.nd_opt_type = ND_OPT_TARGET_LINKADDR;
+	nt->nt_opt.nd_opt_len = (sizeof(struct nd_opt_hdr) + ETHER_ADDR_LEN) >> 3;
+	nt->nt_mac = nif->ni_downlink_mac;
+
+	nif->ni_na_sum = nd_cksum_add(htons(plen) + htons(IPPROTO_ICMPV6),
+	    &nt->nt_na, plen - ETHER_ADDR_LEN);
+}
+
+/*
+ * Build the per-interface state from the config vars. Interfaces
+ * with no router addr of their own share the list of unbound addrs.
+ */
+static struct nd_iface_set *
+nd_iface_set_build(void)
+{
+	struct nd_iface_set *set;
+	struct nd_iface *nif;
+	int i, j, nunbound, naddrs, next, first;
+
+	sx_assert(&ndproxy_conf_lock, SA_XLOCKED);
+
+	nunbound = nd_uplink_addrs_bound("");
+	naddrs = nunbound;
+	for (i = 0; i < V_up_ifaces_set; i++)
+		if ((j = nd_uplink_addrs_bound(V_up_ifaces[i])) > 0)
+			naddrs += j + nunbound;
+
+	/*
+	 * malloc(9) aligns allocations of a cache line or more on a cache
+	 * line, as the nd_iface expect.
+	 */
+	set = malloc(sizeof(*set) + V_up_ifaces_set * sizeof(struct nd_iface),
+	    M_NDPROXY, M_WAITOK | M_ZERO);
+	KASSERT(((uintptr_t)set & (CACHE_LINE_SIZE - 1)) == 0,
+	    ("%s: misaligned nd_iface_set %p", __func__, set));
+	set->ns_count = V_up_ifaces_set;
+	set->ns_byname = mallocarray(MAX(V_up_ifaces_set, 1),
+	    sizeof(struct nd_iface_name), M_NDPROXY, M_WAITOK | M_ZERO);
+	set->ns_uplink = mallocarray(MAX(naddrs, 1), sizeof(struct nd_addr64),
+	    M_NDPROXY, M_WAITOK | M_ZERO);
+
+	/* Unbound addrs first, then each interface with bound addrs. */
+	next = 0;
+	for (j = 0; j < V_uplink_addrs_set; j++)
+		if (V_uplink_addrs[j].nu_ifname[0] == '\0')
+			nd_iface_set_addr(set, next++, &V_uplink_addrs[j].nu_addr);
 
-/* MAC addresses of uplink routers. */
-struct ether_addr uplink_mac_addrs[UPLINK_MAX];
-int up_mac_addrs_set = 0;
+	for (i = 0; i < V_up_ifaces_set; i++) {
+		strlcpy(set->ns_byname[i].nn_name, V_up_ifaces[i], IFNAMSIZ);
+		set->ns_byname[i].nn_rank = i;
 
-/* packets handled counter. */
-int ndproxy_conf_count = 0;
+		nif = &set->ns_ifaces[i];
+		nif->ni_index = i;
+		if (i < V_downlink_mac_addrs_set) {
+			nif->ni_has_mac = true;
+			nif->ni_downlink_mac = V_downlink_mac_addrs[i];
+		}
+		nd_na_template_init(nif);
+		if (nd_uplink_addrs_bound(V_up_ifaces[i]) == 0) {
+			nd_iface_set_uplink(nif, set->ns_uplink, nunbound);
+			continue;
+		}
+		first = next;
+		for (j = 0; j < V_uplink_addrs_set; j++)
+			if (V_uplink_addrs[j].nu_ifname[0] == '\0' ||
+			    strncmp(V_uplink_addrs[j].nu_ifname, V_up_ifaces[i],
+			    IFNAMSIZ) == 0)
+				nd_iface_set_addr(set, next++,
+				    &V_uplink_addrs[j].nu_addr);
+		nd_iface_set_uplink(nif, &set->ns_uplink[first], next - first);
+	}
+
+	qsort(set->ns_byname, V_up_ifaces_set, sizeof(struct nd_iface_name),
+	    nd_iface_rank_cmp);
+	return (set);
+}
+
+static void
+nd_conf_free_cb(struct epoch_context *ctx)
+{
+	struct nd_conf *conf;
+
+	conf = __containerof(ctx, struct nd_conf, nc_epoch_ctx);
+	if (conf->nc_free_exceptions)
+		nd_hash_free(conf->nc_exceptions);
+	if (conf->nc_free_set)
+		nd_iface_set_free(conf->nc_set);
+	if (conf->nc_free_policy)
+		nd_trie_free(conf->nc_policy);
+	free(conf, M_NDPROXY);
+}
+
+/*
+ * Find out which of the shapes the hook is specialized for a conf has.
+ */
+static void
+nd_conf_shape(struct nd_conf *conf)
+{
+	struct nd_iface *nif;
+	u_int i, n = 0;
+
+	conf->nc_shape = ND_SHAPE_FEW_PE;
+	if ((conf->nc_exceptions == NULL ||
+	    (conf->nc_exceptions->nh_count == 0 &&
+	    !conf->nc_exceptions->nh_unspec)) && conf->nc_policy == NULL)
+		conf->nc_shape |= ND_SHAPE_NO_EXCEPT;
+	for (i = 0; i < conf->nc_ifaces_size; i++) {
+		if ((nif = conf->nc_ifaces[i]) == NULL)
+			continue;
+		if (nif->ni_uplink_addrs_set > ND_UPLINK_INLINE)
+			conf->nc_shape &= ~ND_SHAPE_FEW_PE;
+		conf->nc_single_index = i;
+		conf->nc_single = nif;
+		n++;
+	}
+	if (n == 1)
+		conf->nc_shape |= ND_SHAPE_ONE_IFACE;
+	else {
+		conf->nc_single_index = 0;
+		conf->nc_single = NULL;
+	}
+}
+
+/*
+ * Build a conf from the exception set, the target policies and the
+ * per-interface state, and map the if_index of every attached uplink
+ * interface to its state. gone is an interface being detached, to
+ * leave out of the conf.
+ */
+static struct nd_conf *
+nd_conf_build(struct nd_addr_hash *exceptions, struct nd_policy_trie *policy,
+    struct nd_iface_set *set, struct ifnet *gone)
+{
+	struct epoch_tracker et;
+	struct nd_conf *conf;
+	struct ifnet *ifp;
+	u_int size = 0;
+	int rank;
+
+	NET_EPOCH_ENTER(et);
+	CK_STAILQ_FOREACH(ifp, &V_ifnet, if_link)
+		if (ifp != gone && nd_iface_rank(set, if_name(ifp)) >= 0)
+			size = MAX(size, ifp->if_index + 1);
+	NET_EPOCH_EXIT(et);
+
+	conf = malloc(sizeof(*conf) + size * sizeof(struct nd_iface *),
+	    M_NDPROXY, M_WAITOK | M_ZERO);
+	conf->nc_exceptions = exceptions;
+	conf->nc_policy = policy;
+	conf->nc_set = set;
+	conf->nc_ifaces_size = size;
+
+	/*
+	 * An interface attached since the first pass is left out: its
+	 * arrival event will build the conf again.
+	 */
+	NET_EPOCH_ENTER(et);
+	CK_STAILQ_FOREACH(ifp, &V_ifnet, if_link) {
+		if (ifp == gone || ifp->if_index >= size)
+			continue;
+		if ((rank = nd_iface_rank(set, if_name(ifp))) >= 0)
+			conf->nc_ifaces[ifp->if_index] = &set->ns_ifaces[rank];
+	}
+	NET_EPOCH_EXIT(et);
+	nd_conf_shape(conf);
+	return (conf);
+}
+
+/*
+ * Swap in a new conf with a single pointer store. The old conf, and
+ * the parts of it the new conf does not share, are freed once no pfil
+ * hook can be running on them. A part that is replaced is never
+ * shared again, so it is freed with the last conf using it.
+ */
+static void
+nd_conf_publish(struct nd_conf *conf)
+{
+	struct nd_conf *old;
+
+	sx_assert(&ndproxy_conf_lock, SA_XLOCKED);
+
+	old = V_nd_active_conf;
+	atomic_store_rel_ptr((volatile uintptr_t *)&V_nd_active_conf,
+	    (uintptr_t)conf);
+	nd_hook_link(conf);
+	if (old == NULL)
+		return;
+	old->nc_free_exceptions = old->nc_exceptions != conf->nc_exceptions;
+	old->nc_free_set = old->nc_set != conf->nc_set;
+	old->nc_free_policy = old->nc_policy != conf->nc_policy;
+	NET_EPOCH_CALL(nd_conf_free_cb, &old->nc_epoch_ctx);
+}
+
+/*
+ * Publish a new conf after a change of the uplink interfaces, downlink
+ * MACs or uplink router addrs.
+ * Called with ndproxy_conf_lock held exclusively.
+ */
+void
+nd_iface_conf_update(void)
+{
+	nd_conf_publish(nd_conf_build(nd_conf_exceptions(), nd_conf_policy(),
+	    nd_iface_set_build(), NULL));
+}
+
+/*
+ * Publish a new conf with another set of exception addrs, which the
+ * conf then owns.
+ * Called with ndproxy_conf_lock held exclusively.
+ */
+void
+nd_exceptions_update(struct nd_addr_hash *exceptions)
+{
+	nd_conf_publish(nd_conf_build(exceptions, nd_conf_policy(),
+	    nd_conf_set(), NULL));
+}
+
+/*
+ * Publish a new conf with other target policies, which the conf then
+ * owns.
+ * Called with ndproxy_conf_lock held exclusively.
+ */
+void
+nd_policy_update(struct nd_policy_trie *policy)
+{
+	nd_conf_publish(nd_conf_build(nd_conf_exceptions(), policy,
+	    nd_conf_set(), NULL));
+}
+
+/*
+ * Publish a new conf when an uplink interface is attached, detached or
+ * renamed. Other interfaces leave the conf unchanged. A renamed
+ * interface was an uplink if the conf has its index, and is one if the
+ * list has its new name.
+ */
+void
+nd_iface_event(struct ifnet *ifp, int departure)
+{
+	struct nd_conf *conf;
+	int uplink;
+
+	sx_xlock(&ndproxy_conf_lock);
+	conf = V_nd_active_conf;
+	uplink = conf != NULL && ifp->if_index < conf->nc_ifaces_size &&
+	    conf->nc_ifaces[ifp->if_index] != NULL;
+	if (departure ? uplink :
+	    uplink || nd_iface_rank(nd_conf_set(), if_name(ifp)) >= 0)
+		nd_conf_publish(nd_conf_build(nd_conf_exceptions(),
+		    nd_conf_policy(), nd_conf_set(), departure ? ifp : NULL));
+	sx_xunlock(&ndproxy_conf_lock);
+}
+
+/*
+ * Free the active conf of the current vnet when unloading or when the
+ * vnet is destroyed, once its pfil hook is gone.
+ */
+void
+nd_conf_free(void)
+{
+	NET_EPOCH_DRAIN_CALLBACKS();
+	if (V_nd_active_conf != NULL) {
+		V_nd_active_conf->nc_free_exceptions = true;
+		V_nd_active_conf->nc_free_set = true;
+		V_nd_active_conf->nc_free_policy = true;
+		nd_conf_free_cb(&V_nd_active_conf->nc_epoch_ctx);
+	}
+	V_nd_active_conf = NULL;
+}
+
+/*
+ * Free the config vars of the current vnet, once its conf is freed.
+ */
+void
+nd_vars_free(void)
+{
+	free(V_up_ifaces, M_NDPROXY);
+	V_up_ifaces = NULL;
+	V_up_ifaces_set = 0;
+	free(V_uplink_addrs, M_NDPROXY);
+	V_uplink_addrs = NULL;
+	V_uplink_addrs_set = 0;
+	free(V_downlink_mac_addrs, M_NDPROXY);
+	V_downlink_mac_addrs = NULL;
+	V_downlink_mac_addrs_set = 0;
+}
+
+/*
+ * Expire every cached reply source addr. Called from the addr and
+ * route change notifications, so it must not sleep.
+ */
+void
+nd_src_invalidate(void)
+{
+	atomic_add_rel_int(&nd_src_gen, 1);
+}
@@ -42,30 +42,297 @@
 /*
  * Limits on lengths of lists.
  */
-#define EXCEPTION_MAX		32	/* Max exception addrs. */
-#define UP_IFACE_MAX		32	/* Max uplink ifaces. */
-#define UPLINK_MAX		32	/* Max uplinkl rouyters. */
-
-/* Maximum sysctl string lengths. */
-#define UP_IFACE_STR_MAX	((UP_IFACE_MAX * IFNAMSIZ) + 1)
-#define DOWN_MAC_STR_MAX	((UP_IFACE_MAX * ETHER_ADDR_STRLEN) + 1)
-#define EXCEPTION_STR_MAX	((EXCEPTION_MAX * INET6_ADDRSTRLEN) + 1)
-#define UPLINK_STR_MAX		((UPLINK_MAX * INET6_ADDRSTRLEN) + 1)
+#define EXCEPTION_MAX		262144	/* Max exception addrs. */
+#define UP_IFACE_MAX		4096	/* Max uplink ifaces. */
+#define UPLINK_MAX		256	/* Max uplinkl rouyters. */
+#define POLICY_MAX		65536	/* Max target policies. */
 
 /* Seperator of elements in sysctl strings. */
 #define	DELIM	' '
 
-/* Config vars. */
-extern char up_ifaces[UP_IFACE_MAX][IFNAMSIZ];
-extern struct in6_addr uplink_addrs[UPLINK_MAX];
-extern int uplink_addrs_set;
-extern struct in6_addr exception_addrs[EXCEPTION_MAX];
-extern int exception_addrs_set;
-extern struct ether_addr downlink_mac_addrs[UP_IFACE_MAX];
-extern int downlink_mac_addrs_set;
-extern struct ether_addr uplink_mac_addrs[UPLINK_MAX];
-
-/* Packets handled counter. */
-extern int ndproxy_conf_count;
+/* Seperator of an uplink router addr and the interface it is bound to. */
+#define	SCOPE_DELIM	'%'
+
+/* Seperators of a target policy prefix, its length and its action. */
+#define	PREFIX_DELIM	'/'
+#define	ACTION_DELIM	'='
+#define	POLICY_IGNORE	"ignore"
+
+MALLOC_DECLARE(M_NDPROXY);
+
+/*
+ * Uplink router addr. An addr with an interface name is only accepted
+ * on that interface; otherwise it is accepted on every uplink interface.
+ */
+struct nd_uplink_addr {
+	struct in6_addr	nu_addr;
+	char		nu_ifname[IFNAMSIZ];	/* Empty for any interface. */
+};
+
+/*
+ * Neighbor advertisement sent on an uplink interface: IPv6 header,
+ * NA and target link-layer address option carrying the downlink MAC.
+ * Only the addrs and the flags change from one reply to the next.
+ */
+struct nd_na_template {
+	struct ip6_hdr			nt_ip6;
+	struct nd_neighbor_advert	nt_na;
+	struct nd_opt_hdr		nt_opt;
+	struct ether_addr		nt_mac;
+} __packed;
+
+/*
+ * Entry of the caches the hook fills without a lock: an addr and a
+ * value, written at a generation of nd_src_gen. ce_seq is odd while
+ * the entry is written, and a reader that sees it odd or changed takes
+ * a miss.
+ */
+struct nd_cache_entry {
+	u_int		ce_seq;
+	u_int		ce_gen;		/* nd_src_gen when filled. */
+	int		ce_ticks;	/* When filled. */
+	int		ce_val;
+	struct in6_addr	ce_addr;
+};
+
+/*
+ * Copy out an entry. Return false on a miss, when the entry is being
+ * written concurrently.
+ */
+static __inline int
+nd_cache_get(const struct nd_cache_entry *ce, struct nd_cache_entry *copy)
+{
+	u_int seq;
+
+	seq = atomic_load_acq_int(&ce->ce_seq);
+	if ((seq & 1) != 0)
+		return (false);
+	copy->ce_gen = ce->ce_gen;
+	copy->ce_ticks = ce->ce_ticks;
+	copy->ce_val = ce->ce_val;
+	copy->ce_addr = ce->ce_addr;
+	atomic_thread_fence_acq();
+	return (atomic_load_int(&ce->ce_seq) == seq);
+}
+
+/*
+ * Fill an entry, unless another CPU is already filling it.
+ */
+static __inline void
+nd_cache_put(struct nd_cache_entry *ce, u_int gen, int val,
+    const struct in6_addr *addr)
+{
+	u_int seq;
+
+	seq = atomic_load_int(&ce->ce_seq);
+	if ((seq & 1) != 0 || !atomic_cmpset_acq_int(&ce->ce_seq, seq, seq + 1))
+		return;
+	ce->ce_gen = gen;
+	ce->ce_ticks = ticks;
+	ce->ce_val = val;
+	ce->ce_addr = *addr;
+	atomic_store_rel_int(&ce->ce_seq, seq + 2);
+}
+
+/*
+ * Reply source addrs are cached per scope of the solicitation source,
+ * in ce_addr, with ce_val set to reply to all-nodes from it. An entry
+ * is stale once nd_src_gen has moved or after ND_SRC_TTL, which catches
+ * changes that fire no event, such as an addr completing DAD.
+ */
+
+#define	ND_SRC_TTL		hz
+#define	ND_SRC_LINKLOCAL	0
+#define	ND_SRC_GLOBAL		1
+#define	ND_SRC_UNSPEC		2	/* DAD probes and refreshes. */
+#define	ND_SRC_SLOTS		3
+
+/*
+ * IPv6 addr as two 64-bit words, compared without a loop over bytes.
+ */
+struct nd_addr64 {
+	uint64_t	a_hi;
+	uint64_t	a_lo;
+};
+
+/* Uplink router addrs kept in the nd_iface itself. */
+#define	ND_UPLINK_INLINE	2
+
+/*
+ * What the pfil hook needs to know about an uplink interface. The
+ * fields it reads come first, in the order it reads them: the checks of
+ * a solicitation only touch the first cache line, the advertisement
+ * template comes next. The source addr caches, which the hook writes,
+ * are on a line of their own so that filling them does not invalidate
+ * the read-mostly lines on the other CPUs.
+ */
+struct nd_iface {
+	int			 ni_has_mac;	/* A downlink MAC is configured. */
+	int			 ni_uplink_addrs_set;	/* Routers on this interface. */
+	const struct nd_addr64	*ni_uplink;	/* ni_uplink_inline if they fit. */
+	struct nd_addr64	 ni_uplink_inline[ND_UPLINK_INLINE];
+	struct ether_addr	 ni_downlink_mac;
+	uint32_t		 ni_na_sum;	/* Unfolded sum of ni_na but nt_mac. */
+	int			 ni_index;	/* Rank in up_ifaces. */
+	struct nd_na_template	 ni_na;
+	struct nd_cache_entry	 ni_src[ND_SRC_SLOTS] __aligned(CACHE_LINE_SIZE);
+} __aligned(CACHE_LINE_SIZE);
+
+/*
+ * Internet checksum helpers (RFC 1071). Sums are kept unfolded in
+ * 32 bits over 16-bit words in memory order, so that the fixed part of
+ * a reply can be summed once and the variable fields added per packet.
+ */
+static __inline uint32_t
+nd_cksum_add(uint32_t sum, const void *data, int len)
+{
+	const uint16_t *w = data;
+
+	for (; len > 1; len -= 2)
+		sum += *w++;
+	return (sum);
+}
+
+/*
+ * Add an addr as it will be on the wire: ip6_output() clears the zone
+ * id the kernel embeds in scoped addrs, so it is not summed.
+ */
+static __inline uint32_t
+nd_cksum_addr(uint32_t sum, const struct in6_addr *addr)
+{
+	sum = nd_cksum_add(sum, addr, sizeof(*addr));
+	if (IN6_IS_SCOPE_EMBED(addr))
+		sum -= addr->s6_addr16[1];
+	return (sum);
+}
+
+static __inline uint16_t
+nd_cksum_fold(uint32_t sum)
+{
+	sum = (sum >> 16) + (sum & 0xffff);
+	sum += sum >> 16;
+	return (~sum & 0xffff);
+}
+
+/*
+ * Return true if addr is one of the uplink routers of the interface.
+ *
+ * Each addr is compared with two 64-bit operations on its halves,
+ * which share a cache line, and four addrs are tested between two
+ * branches. The kernel can not use SIMD registers without saving the
+ * FPU state, which costs more than a few compares, so this is plain
+ * integer code.
+ */
+static __inline int
+nd_uplink_match(const struct nd_iface *nif, const struct in6_addr *addr)
+{
+	const struct nd_addr64 *u = nif->ni_uplink;
+	uint64_t ahi, alo;
+	int i, n = nif->ni_uplink_addrs_set;
+
+	bcopy(&addr->s6_addr[0], &ahi, sizeof(ahi));
+	bcopy(&addr->s6_addr[8], &alo, sizeof(alo));
+	for (i = 0; i + 4 <= n; i += 4)
+		if ((((u[i].a_hi ^ ahi) | (u[i].a_lo ^ alo)) == 0) |
+		    (((u[i + 1].a_hi ^ ahi) | (u[i + 1].a_lo ^ alo)) == 0) |
+		    (((u[i + 2].a_hi ^ ahi) | (u[i + 2].a_lo ^ alo)) == 0) |
+		    (((u[i + 3].a_hi ^ ahi) | (u[i + 3].a_lo ^ alo)) == 0))
+			return (true);
+	for (; i < n; i++)
+		if (((u[i].a_hi ^ ahi) | (u[i].a_lo ^ alo)) == 0)
+			return (true);
+	return (false);
+}
+
+/*
+ * nd_uplink_match() for an interface with at most ND_UPLINK_INLINE
+ * routers, which are then in the nd_iface itself: no loop, and no
+ * pointer to follow.
+ */
+static __inline int
+nd_uplink_match_few(const struct nd_iface *nif, const struct in6_addr *addr)
+{
+	const struct nd_addr64 *u = nif->ni_uplink_inline;
+	uint64_t ahi, alo;
+	int n = nif->ni_uplink_addrs_set;
+
+	CTASSERT(ND_UPLINK_INLINE == 2);
+	bcopy(&addr->s6_addr[0], &ahi, sizeof(ahi));
+	bcopy(&addr->s6_addr[8], &alo, sizeof(alo));
+	return ((n > 0 && ((u[0].a_hi ^ ahi) | (u[0].a_lo ^ alo)) == 0) |
+	    (n > 1 && ((u[1].a_hi ^ ahi) | (u[1].a_lo ^ alo)) == 0));
+}
+
+/*
+ * Shapes of a conf the pfil hook is specialized for: a variant of the
+ * hook is compiled for every combination, and the one matching the
+ * conf is linked when the conf is published.
+ */
+#define	ND_SHAPE_ONE_IFACE	0x1	/* A single uplink interface. */
+#define	ND_SHAPE_NO_EXCEPT	0x2	/* No exception, no target policy. */
+#define	ND_SHAPE_FEW_PE		0x4	/* ND_UPLINK_INLINE routers at most. */
+#define	ND_SHAPE_COUNT		8
+
+/*
+ * Everything the pfil hook reads, built aside from the config vars and
+ * published with a single pointer swap. A conf is never modified once
+ * published, apart from the source addr caches, and the hook loads the
+ * pointer once per packet, so a reply is always built from a single
+ * conf. Uplink interfaces are indexed by if_index; other interfaces are
+ * NULL. The fields the hook reads come first, those only used to update
+ * and free the conf after them.
+ */
+struct nd_conf {
+	int			 nc_shape;	/* ND_SHAPE_* flags. */
+	u_int			 nc_single_index; /* With ND_SHAPE_ONE_IFACE. */
+	struct nd_iface		*nc_single;
+	u_int			 nc_ifaces_size;
+	struct nd_addr_hash	*nc_exceptions;	/* Addrs not to proxy. */
+	struct nd_policy_trie	*nc_policy;	/* Target policies. */
+	struct nd_iface_set	*nc_set;	/* Owner of the nd_iface. */
+	int			 nc_free_exceptions;
+	int			 nc_free_policy;
+	int			 nc_free_set;
+	struct epoch_context	 nc_epoch_ctx;
+	struct nd_iface		*nc_ifaces[];
+};
+
+/* Serializes updates of the config vars and of the tables built from them. */
+extern struct sx ndproxy_conf_lock;
+
+typedef char nd_ifname_t[IFNAMSIZ];
+
+/*
+ * Config vars, and the conf read by the pfil hook: each vnet has its
+ * own. Tables are allocated, the vnet data area of a module is small.
+ */
+VNET_DECLARE(nd_ifname_t *, up_ifaces);
+VNET_DECLARE(int, up_ifaces_set);
+VNET_DECLARE(struct nd_uplink_addr *, uplink_addrs);
+VNET_DECLARE(int, uplink_addrs_set);
+VNET_DECLARE(struct ether_addr *, downlink_mac_addrs);
+VNET_DECLARE(int, downlink_mac_addrs_set);
+VNET_DECLARE(struct nd_conf *, nd_active_conf);
+#define	V_up_ifaces		VNET(up_ifaces)
+#define	V_up_ifaces_set		VNET(up_ifaces_set)
+#define	V_uplink_addrs		VNET(uplink_addrs)
+#define	V_uplink_addrs_set	VNET(uplink_addrs_set)
+#define	V_downlink_mac_addrs	VNET(downlink_mac_addrs)
+#define	V_downlink_mac_addrs_set VNET(downlink_mac_addrs_set)
+#define	V_nd_active_conf	VNET(nd_active_conf)
+
+/* Bumped when addrs or routes change, to expire the source addr caches. */
+extern u_int nd_src_gen;
+
+void nd_iface_conf_update(void);
+void nd_exceptions_update(struct nd_addr_hash *);
+void nd_policy_update(struct nd_policy_trie *);
+void nd_iface_event(struct ifnet *, int);
+void nd_conf_free(void);
+void nd_vars_free(void);
+void nd_src_invalidate(void);
+
+/* In ndproxy.c. */
+void nd_hook_link(const struct nd_conf *);
 
 #endif
@@ -0,0 +1,315 @@
+/*-
+ * Copyright (c) 2015-2019 Alexandre Fenyo <alex@fenyo.net> - http://www.fenyo.net
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Control device for bulk configuration.
+ *
+ * The string sysctls are parsed element by element and replace a whole
+ * table. Loading, adding or deleting many exception addrs or target
+ * policies is done here instead, from binary arrays in an nvlist, in
+ * one call. The new table is built from the active one while holding
+ * ndproxy_conf_lock, then published in a new conf like the sysctls do.
+ */
+
+#include <sys/param.h>
+#include <sys/systm.h>
+#include <sys/conf.h>
+#include <sys/fcntl.h>
+#include <sys/ioccom.h>
+#include <sys/jail.h>
+#include <sys/kernel.h>
+#include <sys/lock.h>
+#include <sys/malloc.h>
+#include <sys/nv.h>
+#include <sys/priv.h>
+#include <sys/proc.h>
+#include <sys/socket.h>
+#include <sys/sx.h>
+#include <net/if.h>
+#include <net/ethernet.h>
+#include <net/vnet.h>
+#include <netinet/in.h>
+#include <netinet/icmp6.h>
+#include <netinet/ip6.h>
+
+#include "ndconf.h"
+#include "ndctl.h"
+#include "ndhash.h"
+#include "ndproxy.h"
+#include "ndtrie.h"
+
+static d_ioctl_t nd_ctl_ioctl;
+
+static struct cdevsw nd_ctl_cdevsw = {
+	.d_version =	D_VERSION,
+	.d_ioctl =	nd_ctl_ioctl,
+	.d_name =	NDPROXY_DEV,
+};
+
+static struct cdev *nd_ctl_dev;
+
+int
+nd_ctl_init(void)
+{
+	struct make_dev_args args;
+
+	make_dev_args_init(&args);
+	args.mda_devsw = &nd_ctl_cdevsw;
+	args.mda_uid = UID_ROOT;
+	args.mda_gid = GID_WHEEL;
+	args.mda_mode = 0600;
+	return (make_dev_s(&args, &nd_ctl_dev, NDPROXY_DEV));
+}
+
+/*
+ * Called before the conf is freed: waits for the ioctls in progress.
+ */
+void
+nd_ctl_free(void)
+{
+	if (nd_ctl_dev != NULL)
+		destroy_dev(nd_ctl_dev);
+	nd_ctl_dev = NULL;
+}
+
+/*
+ * Load, add or delete exception addrs. The array is left out of the
+ * nvlist when empty, e.g. to load an empty table.
+ * Called with ndproxy_conf_lock held exclusively.
+ */
+static int
+nd_ctl_exceptions(const nvlist_t *nvl, int op)
+{
+	struct nd_addr_hash *del, *h, *old;
+	const struct in6_addr *addrs;
+	struct in6_addr addr;
+	size_t size;
+	u_int count, cursor, i;
+
+	addrs = NULL;
+	size = 0;
+	if (nvlist_exists_binary(nvl, "addrs"))
+		addrs = nvlist_get_binary(nvl, "addrs", &size);
+	if (size % sizeof(struct in6_addr) != 0)
+		return (EINVAL);
+	count = size / sizeof(struct in6_addr);
+	if (count > EXCEPTION_MAX)
+		return (E2BIG);
+	old = V_nd_active_conf != NULL ? V_nd_active_conf->nc_exceptions : NULL;
+
+	switch (op) {
+	case NDPROXY_OP_LOAD:
+		h = nd_hash_alloc(count);
+		for (i = 0; i < count; i++)
+			nd_hash_insert(h, &addrs[i]);
+		break;
+	case NDPROXY_OP_ADD:
+		h = nd_hash_alloc((old != NULL ? old->nh_count : 0) + count);
+		cursor = 0;
+		while (nd_hash_next(old, &cursor, &addr))
+			nd_hash_insert(h, &addr);
+		for (i = 0; i < count; i++)
+			nd_hash_insert(h, &addrs[i]);
+		break;
+	case NDPROXY_OP_DELETE:
+		for (i = 0; i < count; i++)
+			if (!nd_hash_lookup(old, &addrs[i]))
+				return (ENOENT);
+		del = nd_hash_alloc(count);
+		for (i = 0; i < count; i++)
+			nd_hash_insert(del, &addrs[i]);
+		h = nd_hash_alloc((old != NULL ? old->nh_count : 0) -
+		    del->nh_count);
+		cursor = 0;
+		while (nd_hash_next(old, &cursor, &addr))
+			if (!nd_hash_lookup(del, &addr))
+				nd_hash_insert(h, &addr);
+		nd_hash_free(del);
+		break;
+	default:
+		return (EINVAL);
+	}
+	if (h->nh_count > EXCEPTION_MAX) {
+		nd_hash_free(h);
+		return (E2BIG);
+	}
+	nd_exceptions_update(h);
+	return (0);
+}
+
+/*
+ * Load, add or delete target policies. Adding a prefix already there
+ * fails with EINVAL, as a duplicate in target_policy_list does, while
+ * a prefix listed twice is deleted once. The array is left out of the
+ * nvlist when empty.
+ * Called with ndproxy_conf_lock held exclusively.
+ */
+static int
+nd_ctl_policies(const nvlist_t *nvl, int op)
+{
+	const struct ndproxy_policy *npp;
+	struct nd_policy_trie *old, *pt;
+	struct nd_policy *np, *policies, *req;
+	size_t size;
+	u_int count, i, n, oldcount;
+	int err;
+
+	npp = NULL;
+	size = 0;
+	if (nvlist_exists_binary(nvl, "policies"))
+		npp = nvlist_get_binary(nvl, "policies", &size);
+	if (size % sizeof(struct ndproxy_policy) != 0)
+		return (EINVAL);
+	count = size / sizeof(struct ndproxy_policy);
+	if (count > POLICY_MAX)
+		return (E2BIG);
+	old = V_nd_active_conf != NULL ? V_nd_active_conf->nc_policy : NULL;
+	oldcount = old != NULL ? old->pt_count : 0;
+	if (op == NDPROXY_OP_ADD && oldcount + count > POLICY_MAX)
+		return (E2BIG);
+
+	req = mallocarray(MAX(count, 1), sizeof(struct nd_policy), M_NDPROXY,
+	    M_WAITOK | M_ZERO);
+	for (i = 0; i < count; i++) {
+		if (npp[i].npp_len > 128) {
+			free(req, M_NDPROXY);
+			return (EINVAL);
+		}
+		np = &req[i];
+		np->np_prefix = npp[i].npp_prefix;
+		np->np_len = npp[i].npp_len;
+		np->np_ignore = npp[i].npp_ignore != 0;
+		bcopy(npp[i].npp_mac, np->np_mac.octet, ETHER_ADDR_LEN);
+		nd_policy_mask(np);
+	}
+
+	switch (op) {
+	case NDPROXY_OP_LOAD:
+		policies = req;
+		n = count;
+		req = NULL;
+		break;
+	case NDPROXY_OP_ADD:
+		policies = mallocarray(MAX(oldcount + count, 1),
+		    sizeof(struct nd_policy), M_NDPROXY, M_WAITOK);
+		if (oldcount > 0)
+			bcopy(old->pt_policies, policies,
+			    oldcount * sizeof(struct nd_policy));
+		bcopy(req, policies + oldcount, count * sizeof(struct nd_policy));
+		n = oldcount + count;
+		break;
+	case NDPROXY_OP_DELETE:
+		/* Policies in a trie are sorted, and their prefix masked. */
+		qsort(req, count, sizeof(struct nd_policy), nd_policy_cmp);
+		for (i = n = 0; i < count; i++)
+			if (n == 0 ||
+			    nd_policy_cmp(&req[n - 1], &req[i]) != 0)
+				req[n++] = req[i];
+		count = n;
+		policies = mallocarray(MAX(oldcount, 1),
+		    sizeof(struct nd_policy), M_NDPROXY, M_WAITOK);
+		for (i = n = 0; i < oldcount; i++)
+			if (bsearch(&old->pt_policies[i], req, count,
+			    sizeof(struct nd_policy), nd_policy_cmp) == NULL)
+				policies[n++] = old->pt_policies[i];
+		if (n + count != oldcount) {
+			free(policies, M_NDPROXY);
+			free(req, M_NDPROXY);
+			return (ENOENT);
+		}
+		break;
+	default:
+		free(req, M_NDPROXY);
+		return (EINVAL);
+	}
+	free(req, M_NDPROXY);
+
+	pt = NULL;
+	err = 0;
+	if (n > 0)
+		err = nd_trie_build(policies, n, &pt);
+	if (err != 0 || n == 0)
+		free(policies, M_NDPROXY);
+	if (err != 0)
+		return (err);
+	nd_policy_update(pt);
+	return (0);
+}
+
+static int
+nd_ctl_ioctl(struct cdev *dev, u_long cmd, caddr_t data, int flags,
+    struct thread *td)
+{
+	struct ndproxy_nv *nn = (struct ndproxy_nv *)data;
+	nvlist_t *nvl;
+	void *buf;
+	uint64_t op;
+	int err;
+
+	if (cmd != NDPROXYIOC_EXCEPTIONS && cmd != NDPROXYIOC_POLICIES)
+		return (ENOTTY);
+	if ((flags & FWRITE) == 0)
+		return (EPERM);
+	/*
+	 * The mode of the device is not enough: it is also visible in the
+	 * jails, which may only change the conf of a vnet of their own.
+	 */
+	if ((err = priv_check(td, PRIV_NETINET_ND6)) != 0)
+		return (err);
+	if (jailed(td->td_ucred) && !prison_owns_vnet(td->td_ucred))
+		return (EPERM);
+	if (nn->nn_len > NDPROXY_NV_MAX)
+		return (E2BIG);
+
+	buf = malloc(nn->nn_len, M_NDPROXY, M_WAITOK);
+	if ((err = copyin(nn->nn_data, buf, nn->nn_len)) != 0) {
+		free(buf, M_NDPROXY);
+		return (err);
+	}
+	nvl = nvlist_unpack(buf, nn->nn_len, 0);
+	free(buf, M_NDPROXY);
+	if (nvl == NULL)
+		return (EINVAL);
+	if (!nvlist_exists_number(nvl, "op")) {
+		nvlist_destroy(nvl);
+		return (EINVAL);
+	}
+	op = nvlist_get_number(nvl, "op");
+
+	/* The device is shared: act on the vnet of the caller. */
+	CURVNET_SET(TD_TO_VNET(td));
+	sx_xlock(&ndproxy_conf_lock);
+	if (op > NDPROXY_OP_DELETE)
+		err = EINVAL;
+	else if (cmd == NDPROXYIOC_EXCEPTIONS)
+		err = nd_ctl_exceptions(nvl, op);
+	else
+		err = nd_ctl_policies(nvl, op);
+	sx_xunlock(&ndproxy_conf_lock);
+	CURVNET_RESTORE();
+	nvlist_destroy(nvl);
+	return (err);
+}
@@ -0,0 +1,245 @@
+/*-
+ * Copyright (c) 2015-2019 Alexandre Fenyo <alex@fenyo.net> - http://www.fenyo.net
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Errors of the hot path. A flood of crafted solicitations must not
+ * turn into a flood of console messages, which would serialize every
+ * CPU on the console. The errors are queued as struct ndproxy_event on
+ * a ring of the CPU they are met on, a few stores with no lock and no
+ * shared cache line, and drained through a sysctl. A callout logs a
+ * summary of the errors of the last interval.
+ *
+ * The rings belong to a vnet, so that an instance only drains the
+ * addrs and interface indexes of its own vnet.
+ *
+ * Each ring has a single producer, the CPU in a critical section, and
+ * a single consumer, the drain under nd_event_lock. When a ring is
+ * full, new events are only counted.
+ */
+
+#include <sys/param.h>
+#include <sys/systm.h>
+#include <sys/counter.h>
+#include <sys/kernel.h>
+#include <sys/lock.h>
+#include <sys/malloc.h>
+#include <sys/mutex.h>
+#include <sys/pcpu.h>
+#include <sys/proc.h>
+#include <sys/smp.h>
+#include <sys/socket.h>
+#include <sys/syslog.h>
+#include <sys/time.h>
+#include <net/if.h>
+#include <net/if_var.h>
+#include <net/ethernet.h>
+#include <net/vnet.h>
+#include <netinet/in.h>
+#include <netinet/icmp6.h>
+#include <netinet/ip6.h>
+
+#include "ndconf.h"
+#include "ndevent.h"
+#include "ndproxy.h"
+
+struct nd_event_cpu {
+	u_int			ec_head;	/* Written by the CPU. */
+	u_int			ec_tail;	/* Written by the drain. */
+	struct ndproxy_event	ec_ring[ND_EVENT_RING];
+} __aligned(CACHE_LINE_SIZE);
+
+int nd_event_interval = 60;
+counter_u64_t nd_event_lost;
+
+VNET_DEFINE_STATIC(struct nd_event_cpu *, nd_event_cpus) = NULL;
+#define	V_nd_event_cpus	VNET(nd_event_cpus)
+
+static counter_u64_t nd_event_count[NDPROXY_EV_COUNT];
+static uint64_t nd_event_logged[NDPROXY_EV_COUNT];
+static uint64_t nd_event_lost_logged;
+static struct callout nd_event_callout;
+static struct mtx nd_event_lock;
+MTX_SYSINIT(nd_event_lock, &nd_event_lock, "ndproxy events", MTX_DEF);
+
+static const char *nd_event_names[NDPROXY_EV_COUNT] = { NDPROXY_EV_NAMES };
+
+static void	nd_event_summary(void *);
+
+void
+nd_event_init(void)
+{
+	COUNTER_ARRAY_ALLOC(nd_event_count, NDPROXY_EV_COUNT, M_WAITOK);
+	nd_event_lost = counter_u64_alloc(M_WAITOK);
+	callout_init(&nd_event_callout, 1);
+	callout_reset(&nd_event_callout, nd_event_interval * hz,
+	    nd_event_summary, NULL);
+}
+
+/*
+ * Called once every pfil hook is gone.
+ */
+void
+nd_event_free(void)
+{
+	callout_drain(&nd_event_callout);
+	counter_u64_free(nd_event_lost);
+	COUNTER_ARRAY_FREE(nd_event_count, NDPROXY_EV_COUNT);
+}
+
+/*
+ * Allocate the rings of the current vnet.
+ */
+void
+nd_event_vnet_init(void)
+{
+	V_nd_event_cpus = mallocarray(mp_maxid + 1,
+	    sizeof(struct nd_event_cpu), M_NDPROXY, M_WAITOK | M_ZERO);
+}
+
+/*
+ * Called once the pfil hook of the vnet is gone and its deferred
+ * requests and refreshes are done.
+ */
+void
+nd_event_vnet_free(void)
+{
+	free(V_nd_event_cpus, M_NDPROXY);
+	V_nd_event_cpus = NULL;
+}
+
+/*
+ * Queue an event met on ifp in the current vnet. src and target may be
+ * NULL.
+ */
+void
+nd_event(int type, struct ifnet *ifp, int err, const struct in6_addr *src,
+    const struct in6_addr *target)
+{
+	struct nd_event_cpu *ec;
+	struct ndproxy_event *ne;
+	u_int head;
+
+	counter_u64_add(nd_event_count[type], 1);
+	critical_enter();
+	ec = &V_nd_event_cpus[curcpu];
+	head = ec->ec_head;
+	if (head - atomic_load_acq_int(&ec->ec_tail) >= ND_EVENT_RING) {
+		critical_exit();
+		counter_u64_add(nd_event_lost, 1);
+		return;
+	}
+	ne = &ec->ec_ring[head & (ND_EVENT_RING - 1)];
+	ne->ne_type = type;
+	ne->ne_err = err;
+	ne->ne_uptime = time_uptime;
+	ne->ne_ifindex = ifp != NULL ? ifp->if_index : 0;
+	if (src != NULL)
+		ne->ne_src = *src;
+	else
+		bzero(&ne->ne_src, sizeof(ne->ne_src));
+	if (target != NULL)
+		ne->ne_target = *target;
+	else
+		bzero(&ne->ne_target, sizeof(ne->ne_target));
+	atomic_store_rel_int(&ec->ec_head, head + 1);
+	critical_exit();
+}
+
+/*
+ * Number of events queued in the current vnet, for the size of a drain.
+ */
+u_int
+nd_event_pending(void)
+{
+	struct nd_event_cpu *ec;
+	u_int count;
+	int cpu;
+
+	count = 0;
+	CPU_FOREACH(cpu) {
+		ec = &V_nd_event_cpus[cpu];
+		count += atomic_load_acq_int(&ec->ec_head) - ec->ec_tail;
+	}
+	return (count);
+}
+
+/*
+ * Move up to max events of the current vnet to buf, CPU after CPU.
+ * Return how many were moved.
+ */
+u_int
+nd_event_copy(struct ndproxy_event *buf, u_int max)
+{
+	struct nd_event_cpu *ec;
+	u_int count, head, tail;
+	int cpu;
+
+	count = 0;
+	mtx_lock(&nd_event_lock);
+	CPU_FOREACH(cpu) {
+		ec = &V_nd_event_cpus[cpu];
+		tail = ec->ec_tail;
+		head = atomic_load_acq_int(&ec->ec_head);
+		for (; tail != head && count < max; tail++, count++)
+			buf[count] = ec->ec_ring[tail & (ND_EVENT_RING - 1)];
+		atomic_store_rel_int(&ec->ec_tail, tail);
+	}
+	mtx_unlock(&nd_event_lock);
+	return (count);
+}
+
+/*
+ * Log how many events of each type were met since the last summary,
+ * if any.
+ */
+static void
+nd_event_summary(void *arg __unused)
+{
+	char buf[256];
+	uint64_t count, lost;
+	int i, len;
+
+	len = 0;
+	buf[0] = '\0';
+	for (i = 0; i < NDPROXY_EV_COUNT; i++) {
+		count = counter_u64_fetch(nd_event_count[i]);
+		if (count != nd_event_logged[i] && len < sizeof(buf))
+			len += snprintf(buf + len, sizeof(buf) - len, " %s %ju",
+			    nd_event_names[i],
+			    (uintmax_t)(count - nd_event_logged[i]));
+		nd_event_logged[i] = count;
+	}
+	lost = counter_u64_fetch(nd_event_lost);
+	if (lost != nd_event_lost_logged && len < sizeof(buf))
+		len += snprintf(buf + len, sizeof(buf) - len, " (%ju not queued)",
+		    (uintmax_t)(lost - nd_event_lost_logged));
+	nd_event_lost_logged = lost;
+	if (len > 0)
+		log(LOG_WARNING, "NDPROXY: errors in the last %d s:%s\n",
+		    nd_event_interval, buf);
+	callout_reset(&nd_event_callout, nd_event_interval * hz,
+	    nd_event_summary, NULL);
+}
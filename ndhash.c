@@ -0,0 +1,159 @@
+/*-
+ * Copyright (c) 2015-2019 Alexandre Fenyo <alex@fenyo.net> - http://www.fenyo.net
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <sys/param.h>
+#include <sys/systm.h>
+#include <sys/malloc.h>
+#include <sys/socket.h>
+#include <net/if.h>
+#include <net/ethernet.h>
+#include <netinet/in.h>
+#include <netinet/icmp6.h>
+#include <netinet/ip6.h>
+
+#include "ndconf.h"
+#include "ndhash.h"
+
+#define ND_HASH_MINSLOTS	16
+
+/*
+ * Number of slots needed to store nentries addresses at half load.
+ */
+static u_int
+nd_hash_nslots(u_int nentries)
+{
+	u_int nslots = ND_HASH_MINSLOTS;
+
+	while (nslots < 2 * nentries)
+		nslots <<= 1;
+	return (nslots);
+}
+
+/*
+ * Store addr in the first empty slot of its probe sequence. The caller
+ * has checked that addr is not already there.
+ */
+static void
+nd_hash_place(struct in6_addr *slots, u_int mask, const struct in6_addr *addr)
+{
+	u_int i;
+
+	for (i = nd_hash_addr(addr) & mask; !IN6_IS_ADDR_UNSPECIFIED(&slots[i]);
+	    i = (i + 1) & mask)
+		;
+	slots[i] = *addr;
+}
+
+/*
+ * Allocate an empty set sized to hold nentries addresses without
+ * growing.
+ */
+struct nd_addr_hash *
+nd_hash_alloc(u_int nentries)
+{
+	struct nd_addr_hash *h;
+	u_int nslots;
+
+	nslots = nd_hash_nslots(nentries);
+	h = malloc(sizeof(*h), M_NDPROXY, M_WAITOK | M_ZERO);
+	h->nh_slots = mallocarray(nslots, sizeof(struct in6_addr), M_NDPROXY,
+	    M_WAITOK | M_ZERO);
+	h->nh_mask = nslots - 1;
+	return (h);
+}
+
+void
+nd_hash_free(struct nd_addr_hash *h)
+{
+	if (h == NULL)
+		return;
+	free(h->nh_slots, M_NDPROXY);
+	free(h, M_NDPROXY);
+}
+
+/*
+ * Double the number of slots and rehash every address.
+ */
+static void
+nd_hash_grow(struct nd_addr_hash *h)
+{
+	struct in6_addr *slots;
+	u_int i, mask;
+
+	mask = (h->nh_mask << 1) | 1;
+	slots = mallocarray(mask + 1, sizeof(struct in6_addr), M_NDPROXY,
+	    M_WAITOK | M_ZERO);
+	for (i = 0; i <= h->nh_mask; i++)
+		if (!IN6_IS_ADDR_UNSPECIFIED(&h->nh_slots[i]))
+			nd_hash_place(slots, mask, &h->nh_slots[i]);
+	free(h->nh_slots, M_NDPROXY);
+	h->nh_slots = slots;
+	h->nh_mask = mask;
+}
+
+/*
+ * Add addr to the set, growing the table when it gets more than half
+ * full. Adding an address already in the set is not an error.
+ */
+void
+nd_hash_insert(struct nd_addr_hash *h, const struct in6_addr *addr)
+{
+	if (nd_hash_lookup(h, addr))
+		return;
+	if (IN6_IS_ADDR_UNSPECIFIED(addr))
+		h->nh_unspec = true;
+	else {
+		if (2 * (h->nh_count + 1) > h->nh_mask + 1)
+			nd_hash_grow(h);
+		nd_hash_place(h->nh_slots, h->nh_mask, addr);
+	}
+	h->nh_count++;
+}
+
+/*
+ * Iterate over the set: *cursor must be 0 on the first call. Copy the
+ * next address to addr and return true, or return false at the end.
+ */
+int
+nd_hash_next(const struct nd_addr_hash *h, u_int *cursor, struct in6_addr *addr)
+{
+	if (h == NULL)
+		return (false);
+	if (*cursor == 0) {
+		(*cursor)++;
+		if (h->nh_unspec) {
+			*addr = in6addr_any;
+			return (true);
+		}
+	}
+	while (*cursor <= h->nh_mask + 1) {
+		*addr = h->nh_slots[*cursor - 1];
+		(*cursor)++;
+		if (!IN6_IS_ADDR_UNSPECIFIED(addr))
+			return (true);
+	}
+	return (false);
+}
@@ -0,0 +1,87 @@
+/*-
+ * Copyright (c) 2015-2019 Alexandre Fenyo <alex@fenyo.net> - http://www.fenyo.net
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef __NDHASH_H
+#define __NDHASH_H
+
+/*
+ * Open addressing (linear probing) hash set of IPv6 addresses.
+ *
+ * The table is kept at most half full, so that a lookup for an address
+ * that is not in the set stops quickly on an empty slot. An empty slot
+ * is the unspecified address, so :: is recorded by a separate flag.
+ */
+struct nd_addr_hash {
+	u_int		 nh_mask;	/* Number of slots - 1. */
+	u_int		 nh_count;	/* Addresses in the set. */
+	int		 nh_unspec;	/* :: is in the set. */
+	struct in6_addr	*nh_slots;
+};
+
+struct nd_addr_hash	*nd_hash_alloc(u_int);
+void			 nd_hash_free(struct nd_addr_hash *);
+void			 nd_hash_insert(struct nd_addr_hash *, const struct in6_addr *);
+int			 nd_hash_next(const struct nd_addr_hash *, u_int *, struct in6_addr *);
+
+/*
+ * Mix the two halves of an address into a slot index.
+ */
+static __inline u_int
+nd_hash_addr(const struct in6_addr *addr)
+{
+	uint64_t hi, lo;
+
+	bcopy(&addr->s6_addr[0], &hi, sizeof(hi));
+	bcopy(&addr->s6_addr[8], &lo, sizeof(lo));
+	hi = (hi * 0x9e3779b97f4a7c15ULL) ^ lo;
+	hi ^= hi >> 32;
+	hi *= 0xd6e8feb86659fd93ULL;
+	return ((u_int)(hi ^ (hi >> 32)));
+}
+
+/*
+ * Return true if addr is in the set.
+ */
+static __inline int
+nd_hash_lookup(const struct nd_addr_hash *h, const struct in6_addr *addr)
+{
+	const struct in6_addr *slot;
+	u_int i;
+
+	if (h == NULL || h->nh_count == 0)
+		return (false);
+	if (IN6_IS_ADDR_UNSPECIFIED(addr))
+		return (h->nh_unspec);
+	for (i = nd_hash_addr(addr) & h->nh_mask; ; i = (i + 1) & h->nh_mask) {
+		slot = &h->nh_slots[i];
+		if (IN6_ARE_ADDR_EQUAL(slot, addr))
+			return (true);
+		if (IN6_IS_ADDR_UNSPECIFIED(slot))
+			return (false);
+	}
+}
+
+#endif
@@ -0,0 +1,90 @@
+/*-
+ * Copyright (c) 2015-2019 Alexandre Fenyo <alex@fenyo.net> - http://www.fenyo.net
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * SDT probes and latency histograms of the stages a solicitation goes
+ * through, see ndlat.h.
+ */
+
+#include <sys/param.h>
+#include <sys/systm.h>
+#include <sys/counter.h>
+#include <sys/kernel.h>
+#include <sys/malloc.h>
+#include <sys/sdt.h>
+#include <machine/cpu.h>
+
+#include "ndlat.h"
+
+SDT_PROVIDER_DEFINE(ndproxy);
+SDT_PROBE_DEFINE2(ndproxy, , hook, iface, "struct mbuf *", "struct ifnet *");
+SDT_PROBE_DEFINE2(ndproxy, , hook, classify, "struct mbuf *",
+    "struct ifnet *");
+SDT_PROBE_DEFINE2(ndproxy, , hook, pe, "struct mbuf *", "struct ifnet *");
+SDT_PROBE_DEFINE2(ndproxy, , hook, cksum, "struct mbuf *", "struct ifnet *");
+SDT_PROBE_DEFINE2(ndproxy, , hook, target, "struct mbuf *",
+    "struct ifnet *");
+SDT_PROBE_DEFINE2(ndproxy, , reply, alloc, "struct nd_request *",
+    "struct ifnet *");
+SDT_PROBE_DEFINE2(ndproxy, , reply, src, "struct nd_request *",
+    "struct ifnet *");
+SDT_PROBE_DEFINE2(ndproxy, , reply, build, "struct nd_request *",
+    "struct ifnet *");
+SDT_PROBE_DEFINE3(ndproxy, , reply, output, "struct nd_request *",
+    "struct ifnet *", "int");
+
+int nd_latency __read_mostly = 0;
+counter_u64_t nd_lat[ND_LAT_STAGES][ND_LAT_BUCKETS];
+
+void
+nd_lat_init(void)
+{
+	int i;
+
+	for (i = 0; i < ND_LAT_STAGES; i++)
+		COUNTER_ARRAY_ALLOC(nd_lat[i], ND_LAT_BUCKETS, M_WAITOK);
+}
+
+/*
+ * Called once every pfil hook is gone.
+ */
+void
+nd_lat_free(void)
+{
+	int i;
+
+	for (i = 0; i < ND_LAT_STAGES; i++)
+		COUNTER_ARRAY_FREE(nd_lat[i], ND_LAT_BUCKETS);
+}
+
+void
+nd_lat_zero(void)
+{
+	int i;
+
+	for (i = 0; i < ND_LAT_STAGES; i++)
+		COUNTER_ARRAY_ZERO(nd_lat[i], ND_LAT_BUCKETS);
+}
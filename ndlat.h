@@ -0,0 +1,104 @@
+/*-
+ * Copyright (c) 2015-2019 Alexandre Fenyo <alex@fenyo.net> - http://www.fenyo.net
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef __NDLAT_H
+#define __NDLAT_H
+
+/*
+ * Stages of the handling of a solicitation. The hook goes through the
+ * first ones, nd_reply() through the others, so that deferred replies
+ * are timed from the taskqueue. Each stage has an SDT probe, fired when
+ * the stage is passed, and a latency histogram.
+ */
+enum nd_stage {
+	ND_LAT_IFACE,		/* Uplink interface lookup. */
+	ND_LAT_CLASSIFY,	/* Neighbor solicitation checks. */
+	ND_LAT_PE,		/* Uplink router match. */
+	ND_LAT_CKSUM,		/* Checksum verification. */
+	ND_LAT_TARGET,		/* Exceptions, policies and rate limits. */
+	ND_LAT_ALLOC,		/* mbuf of the reply. */
+	ND_LAT_SRC,		/* Source address selection. */
+	ND_LAT_BUILD,		/* Advertisement and its checksum. */
+	ND_LAT_OUTPUT,		/* Driver or ip6_output(). */
+	ND_LAT_STAGES
+};
+
+/*
+ * Bucket i of a histogram counts the stages that took from 2^(i-1) to
+ * 2^i - 1 CPU cycles, the last one everything longer.
+ */
+#define ND_LAT_BUCKETS		32
+
+SDT_PROVIDER_DECLARE(ndproxy);
+SDT_PROBE_DECLARE(ndproxy, , hook, iface);
+SDT_PROBE_DECLARE(ndproxy, , hook, classify);
+SDT_PROBE_DECLARE(ndproxy, , hook, pe);
+SDT_PROBE_DECLARE(ndproxy, , hook, cksum);
+SDT_PROBE_DECLARE(ndproxy, , hook, target);
+SDT_PROBE_DECLARE(ndproxy, , reply, alloc);
+SDT_PROBE_DECLARE(ndproxy, , reply, src);
+SDT_PROBE_DECLARE(ndproxy, , reply, build);
+SDT_PROBE_DECLARE(ndproxy, , reply, output);
+
+extern int nd_latency;		/* Fill the histograms. */
+extern counter_u64_t nd_lat[ND_LAT_STAGES][ND_LAT_BUCKETS];
+
+void	nd_lat_init(void);
+void	nd_lat_free(void);
+void	nd_lat_zero(void);
+
+/*
+ * Start timing, or return 0 when the histograms are off.
+ */
+static __inline uint64_t
+nd_lat_start(void)
+{
+	if (__predict_true(!nd_latency))
+		return (0);
+	return (get_cyclecount());
+}
+
+/*
+ * Account for a stage started at t, and return the start of the next
+ * one.
+ */
+static __inline uint64_t
+nd_lat_mark(enum nd_stage stage, uint64_t t)
+{
+	uint64_t now;
+	int bucket;
+
+	if (t == 0)
+		return (0);
+	now = get_cyclecount();
+	bucket = flsll(now - t);
+	if (bucket >= ND_LAT_BUCKETS)
+		bucket = ND_LAT_BUCKETS - 1;
+	counter_u64_add(nd_lat[stage][bucket], 1);
+	return (now);
+}
+
+#endif
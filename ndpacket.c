@@ -25,15 +25,20 @@
  */
 
 #include <sys/param.h>
+#include <sys/counter.h>
 #include <sys/socket.h>
 #include <sys/kdb.h>
+#include <sys/sdt.h>
+#include <machine/cpu.h>
 
 #include <net/if.h>
 #include <net/pfil.h>
 #include <net/if_var.h>
 #include <net/ethernet.h>
+#include <net/if_types.h>
 
 #include <netinet/in.h>
+#include <netinet/if_ether.h>
 #include <netinet/in_pcb.h>
 #include <netinet/icmp6.h>
 #include <netinet/ip6.h>
@@ -44,91 +49,505 @@
 
 #include "ndpacket.h"
 #include "ndconf.h"
+#include "ndevent.h"
+#include "ndhash.h"
+#include "ndlat.h"
+#include "ndproxy.h"
+#include "ndqueue.h"
+#include "ndrate.h"
+#include "ndreach.h"
+#include "ndtrie.h"
+
+/* Statistics, see struct ndproxystat. */
+VNET_PCPUSTAT_DEFINE(struct ndproxystat, ndproxystat);
+
+/* Send replies through if_transmit when possible, see packet(). */
+int nd_direct_output __read_mostly = 1;
+
+/* Build replies in the mbuf of the solicitation, see nd_reply(). */
+int nd_inplace __read_mostly = 1;
 
 /*
- * This is the pfil hook to perform proxying.
+ * Cache slot for the scope of the source of a request, or NULL if
+ * replies to that scope are not cached. Requests from the unspecified
+ * address, DAD probes and the unsolicited advertisements of the
+ * refresh wheel, have a slot of their own: the wheel sends thousands
+ * of them in a row.
  */
-pfil_return_t packet(struct mbuf **packet_mp, struct ifnet *packet_ifnet,
-    const int packet_dir, void *packet_arg, struct inpcb *packet_inpcb)
+static struct nd_cache_entry *
+nd_src_cache_slot(struct nd_iface *nif, const struct in6_addr *addr)
+{
+	if (IN6_IS_ADDR_UNSPECIFIED(addr))
+		return (&nif->ni_src[ND_SRC_UNSPEC]);
+	switch (in6_addrscope(addr)) {
+	case IPV6_ADDR_SCOPE_LINKLOCAL:
+		return (&nif->ni_src[ND_SRC_LINKLOCAL]);
+	case IPV6_ADDR_SCOPE_GLOBAL:
+		return (&nif->ni_src[ND_SRC_GLOBAL]);
+	default:
+		return (NULL);
+	}
+}
+
+/*
+ * Copy out a cache entry filled at generation gen. Return false on a
+ * miss, including when the entry is being written concurrently.
+ */
+static int
+nd_src_cache_get(struct nd_cache_entry *sc, u_int gen, struct in6_addr *src,
+    int *fallback)
+{
+	struct nd_cache_entry ce;
+
+	if (!nd_cache_get(sc, &ce) || ce.ce_gen != gen ||
+	    (u_int)(ticks - ce.ce_ticks) > ND_SRC_TTL)
+		return (false);
+	*src = ce.ce_addr;
+	*fallback = ce.ce_val;
+	return (true);
+}
+
+/*
+ * Select the source address of a reply to src received on ifp. Set
+ * fallback when there is no address in the scope of src, in which case
+ * the reply goes to the link-local all nodes multicast address from a
+ * link-local address, or from :: if there is none yet.
+ */
+static int
+nd_select_src(struct ifnet *ifp, const struct in6_addr *src,
+    struct in6_addr *srcaddr, int *fallback)
 {
-	struct mbuf *m = NULL, *mreply = NULL;
-	struct ip6_hdr *ip6, *ip6reply;
-	struct icmp6_hdr *icmp6;
-	struct in6_addr ip6_src, srcaddr, dstaddr;
-	struct in6_addr _dst_sa;
+	struct in6_addr dst, _dst_sa;
 	uint32_t _dst_sa_scopeid;
+	int ret;
+
+	*fallback = false;
+	dst = *src;
+	if ((ret = in6_setscope(&dst, ifp, NULL))) {
+		nd_event(NDPROXY_EV_SRC_SCOPE, ifp, ret, src, NULL);
+		return (ret);
+	}
+
+	/*
+	 * First, apply the RFC-3484 default address selection algorithm
+	 * to get a source address for the advertisement packet.
+	 */
+	in6_splitscope(&dst, &_dst_sa, &_dst_sa_scopeid);
+	ret = in6_selectsrc_addr(RT_DEFAULT_FIB, &_dst_sa,
+	    _dst_sa_scopeid, ifp, srcaddr, NULL);
+	if (ret && (ret != EHOSTUNREACH || in6_addrscope(src) == IPV6_ADDR_SCOPE_LINKLOCAL)) {
+		nd_event(NDPROXY_EV_SELECT_SRC, ifp, ret, src, NULL);
+		return (ret);
+	}
+	if (ret == 0)
+		return (0);
+
+	/* 
+	 * Secondly, try to reply with a link-local address attached
+	 * to the receiving interface.
+	 */
+	struct in6_ifaddr *llifaddr = in6ifa_ifpforlinklocal(ifp, 0);
+	if (llifaddr == NULL)
+		nd_event(NDPROXY_EV_NO_LLADDR, ifp, 0, src, NULL);
+
+#ifdef DEBUG_NDPROXY
+	printf("NDPROXY INFO: no address in requested scope, using a link-local address to reply\n");
+#endif
+	if (llifaddr != NULL) {
+		*srcaddr = (llifaddr->ia_addr).sin6_addr;
+		ifa_free((struct ifaddr *) llifaddr);
+	}
+	else {
+		/*
+		 * No link-local address, we may for instance currently
+		 * be verifying that the link-local stateless
+		 * autoconfiguration address is unused.
+		 * Then, we temporary use the unspecified address (::).
+		 */
+		bzero(srcaddr, sizeof(*srcaddr));
+	}
+	/*
+	 * Since we have no source address in the same scope of the destination address of the request packet,
+	 * we can not simply reply to the source address of the request packet.
+	 * Then we reply to the link-local all nodes multicast address (ff02::1).
+	 */
+	*fallback = true;
+	return (0);
+}
+
+/*
+ * Return the MAC in the source link-layer address option of a
+ * solicitation, or NULL if there is none.
+ */
+static const u_char *
+nd_ns_sllao(struct mbuf *m)
+{
+	struct ip6_hdr *ip6 = mtod(m, struct ip6_hdr *);
+	struct nd_opt_hdr *opt;
+	caddr_t p, end;
+	int len;
+
+	p = (caddr_t) ip6 + sizeof(struct ip6_hdr) +
+	    sizeof(struct nd_neighbor_solicit);
+	end = (caddr_t) ip6 + MIN(m->m_len,
+	    sizeof(struct ip6_hdr) + ntohs(ip6->ip6_plen));
+	while (p + sizeof(struct nd_opt_hdr) <= end) {
+		opt = (struct nd_opt_hdr *) p;
+		len = opt->nd_opt_len << 3;
+		if (len == 0 || p + len > end)
+			return (NULL);
+		if (opt->nd_opt_type == ND_OPT_SOURCE_LINKADDR &&
+		    len >= sizeof(struct nd_opt_hdr) + ETHER_ADDR_LEN)
+			return ((const u_char *) (opt + 1));
+		p += len;
+	}
+	return (NULL);
+}
+
+/*
+ * Send a reply in an Ethernet frame to lladdr, from the MAC of ifp,
+ * through the driver of ifp. The zone ids the kernel embeds in scoped
+ * addrs are cleared, as ip6_output() would do.
+ */
+static int
+nd_transmit(struct ifnet *ifp, struct mbuf *m, const u_char *lladdr)
+{
+	struct ether_header *eh;
+	struct ip6_hdr *ip6;
+
+	ip6 = mtod(m, struct ip6_hdr *);
+	in6_clearscope(&ip6->ip6_src);
+	in6_clearscope(&ip6->ip6_dst);
+	M_PREPEND(m, ETHER_HDR_LEN, M_NOWAIT);
+	if (m == NULL)
+		return (ENOBUFS);
+	eh = mtod(m, struct ether_header *);
+	bcopy(lladdr, eh->ether_dhost, ETHER_ADDR_LEN);
+	bcopy(IF_LLADDR(ifp), eh->ether_shost, ETHER_ADDR_LEN);
+	eh->ether_type = htons(ETHERTYPE_IPV6);
+	return (ifp->if_transmit(ifp, m));
+}
+
+/*
+ * Turn the mbuf of a solicitation into an empty advertisement: the
+ * solicitation is no longer needed once the request is filled, and
+ * nd_reply() overwrites every byte of the advertisement. The first
+ * mbuf is kept, pulled up if the advertisement does not fit in it, and
+ * the rest of the chain is freed. Return NULL if the mbuf can not be
+ * written to, or is too short and has no room to grow, in which case
+ * *mp is left alone. Otherwise *mp is cleared: it is also cleared when the
+ * pull up failed, which frees the mbuf.
+ */
+static struct mbuf *
+nd_reply_reuse(struct mbuf **mp)
+{
+	struct mbuf *m = *mp;
+	int len = sizeof(struct nd_na_template);
+
+	if (!M_WRITABLE(m))
+		return (NULL);
+	/* A solicitation without option is extended into its buffer. */
+	if (m->m_pkthdr.len < len &&
+	    (m->m_next != NULL || M_TRAILINGSPACE(m) < len - m->m_len))
+		return (NULL);
+	*mp = NULL;
+	if (m->m_len < len && m->m_pkthdr.len >= len &&
+	    (m = m_pullup(m, len)) == NULL)
+		return (NULL);
+	if (m->m_next != NULL) {
+		m_freem(m->m_next);
+		m->m_next = NULL;
+	}
+	m->m_len = m->m_pkthdr.len = len;
+
+	/* Forget what the stack learnt about the solicitation. */
+	m_tag_delete_chain(m, NULL);
+	m_clrprotoflags(m);
+	m->m_flags &= ~(M_BCAST | M_MCAST | M_VLANTAG);
+	m->m_pkthdr.csum_flags = 0;
+	m->m_pkthdr.rcvif = NULL;
+	M_HASHTYPE_CLEAR(m);
+	return (m);
+}
+
+/*
+ * Build the advertisement for a request accepted by packet(), and send
+ * it on ifp, which nif describes. When mp is not NULL, it points to the
+ * solicitation, which is turned into the advertisement if possible and
+ * cleared then. Return 0 once the advertisement is handed to the output
+ * path, or an error if none was built. The solicitation is only taken
+ * once a source address is found, so that it is left in *mp for the
+ * stack when the reply fails on the scope or on the source.
+ */
+int
+nd_reply(struct ifnet *ifp, struct nd_iface *nif, const struct nd_request *nr,
+    struct mbuf **mp)
+{
+	struct mbuf *mreply;
+	struct ip6_hdr *ip6reply;
+	struct in6_addr srcaddr, dstaddr;
+	struct nd_cache_entry *sc;
+	const struct ether_addr *mac = &nr->nr_mac;
+	u_int gen;
+	int fallback;
 	int output_flags = 0;
-	int maxlen, ret, i;
-	int ifaceIndex;
+	int maxlen, ret;
+	uint32_t flags, na_sum;
+	uint64_t t;
+	u_char lladdr[ETHER_ADDR_LEN];
 #ifdef DEBUG_NDPROXY
 	char ip6_str[INET6_ADDRSTRLEN];
 	char ip6_str2[INET6_ADDRSTRLEN];
-	
-	/* when debuging, increment counter of received packets from the uplink interface */
-	ndproxy_conf_count = ++ndproxy_conf_count < 0 ? 1 : ndproxy_conf_count;
 #endif
 
-	if (packet_mp == NULL) {
-		printf("NDPROXY ERROR: no mbuf\n");
-		return 0;
+	t = nd_lat_start();
+
+	/* 
+	 * Packet content:
+	 * IPv6 header + ICMPv6 Neighbor Advertisement including target
+	 * address + target link-layer ICMPv6 address option
+	 */
+	maxlen = sizeof(struct nd_na_template);
+
+	/*
+	 * According to RFC-4861 (7.2.4), "The Target Address of the
+	 * advertisement is copied from the Target Address of the solicitation.
+	 * [...] If the source of the solicitation is the unspecified address, the
+	 * node MUST [...] multicast the advertisement to the all-nodes address.".
+	 */
+	if (IN6_IS_ADDR_UNSPECIFIED(&nr->nr_src))
+		output_flags |= M_MCAST;
+
+	/*
+	 * The source address depends on the receiving interface and on the
+	 * scope of the source of the request, so it is looked up in the
+	 * cache of the interface first. The generation is read before
+	 * selecting, so that a change meanwhile leaves the entry stale.
+	 * This is done before taking the mbuf of the solicitation, which
+	 * is left to the stack when no reply can be sent.
+	 */
+	sc = nd_src_cache_slot(nif, &nr->nr_src);
+	gen = atomic_load_acq_int(&nd_src_gen);
+	if (sc == NULL || !nd_src_cache_get(sc, gen, &srcaddr, &fallback)) {
+		NDSTAT_INC(nds_src_miss);
+		if (nd_select_src(ifp, &nr->nr_src, &srcaddr, &fallback)) {
+			NDSTAT_INC(nds_scope);
+			return (EADDRNOTAVAIL);
+		}
+		/* The unspecified address is only a transient choice. */
+		if (sc != NULL && !IN6_IS_ADDR_UNSPECIFIED(&srcaddr))
+			nd_cache_put(sc, gen, fallback, &srcaddr);
+	} else
+		NDSTAT_INC(nds_src_hit);
+	if (fallback)
+		output_flags |= M_MCAST;
+
+	if (output_flags & M_MCAST)
+		dstaddr = in6addr_linklocal_allnodes;
+	else
+		dstaddr = nr->nr_src;
+	if ((ret = in6_setscope(&dstaddr, ifp, NULL))) {
+		nd_event(NDPROXY_EV_DST_SCOPE, ifp, ret, &nr->nr_src,
+		    &nr->nr_target);
+		NDSTAT_INC(nds_scope);
+		return (ret);
 	}
-	m = *packet_mp;
+	SDT_PROBE2(ndproxy, , reply, src, nr, ifp);
+	t = nd_lat_mark(ND_LAT_SRC, t);
 
 	/*
-	 * Ignore everything except neighbour solicitations. Reject
-	 * NS with extension headers (ie, ip6_nxt is anything but ICMPv6).
+	 * Reuse the mbuf of the solicitation, which saves an allocation and
+	 * a free, and can not fail for lack of mbufs. The space of its
+	 * Ethernet header is left in front of it for the output path.
 	 */
-	ip6 = mtod(m, struct ip6_hdr *);
-	if (ip6->ip6_nxt != IPPROTO_ICMPV6)
-		return 0;
-	icmp6 = (struct icmp6_hdr *) ((caddr_t) ip6 + sizeof(struct ip6_hdr));
-	if (icmp6->icmp6_type != ND_NEIGHBOR_SOLICIT || icmp6->icmp6_code)
-		return 0;
-	ip6_src = ip6->ip6_src;
+	if (mp != NULL && (mreply = nd_reply_reuse(mp)) != NULL)
+		NDSTAT_INC(nds_inplace);
+	else {
+		/* Create a new mbuf to send a neighbor advertisement. */
+		if (max_linkhdr + maxlen > MCLBYTES) {
+			nd_event(NDPROXY_EV_NOMBUF, ifp, EMSGSIZE, &nr->nr_src,
+			    &nr->nr_target);
+			NDSTAT_INC(nds_nombuf);
+			return (ENOBUFS);
+		}
+		if (max_linkhdr + maxlen > MHLEN)
+			mreply = m_getcl(M_NOWAIT, MT_DATA, M_PKTHDR);
+		else
+			mreply = m_gethdr(M_NOWAIT, MT_DATA);
+		if (mreply == NULL) {
+			nd_event(NDPROXY_EV_NOMBUF, ifp, ENOBUFS, &nr->nr_src,
+			    &nr->nr_target);
+			NDSTAT_INC(nds_nombuf);
+			return (ENOBUFS);
+		}
+		mreply->m_pkthdr.rcvif = NULL;
+		mreply->m_pkthdr.len = maxlen;
+		mreply->m_len = mreply->m_pkthdr.len;
+
+		/* reserve space for the link-layer header */
+		mreply->m_data += max_linkhdr;
+	}
+	SDT_PROBE2(ndproxy, , reply, alloc, nr, ifp);
+	t = nd_lat_mark(ND_LAT_ALLOC, t);
+
 #ifdef DEBUG_NDPROXY
-	inet_ntop(AF_INET6, &ip6_src, ip6_str, INET6_ADDRSTRLEN);
-	printf("NDPROXY DEBUG: got neighbor solicitation from %s\n", ip6_str);
+	inet_ntop(AF_INET6, &srcaddr, ip6_str, INET6_ADDRSTRLEN);
+	printf("NDPROXY DEBUG: source address used to reply: %s\n", ip6_str);
 #endif
 
-	/* handle only packets originating from an uplink interface. */
-	/* TODO: switch to using a different identifier from iface name
-	 * to avoid string traversal. */
-	for (i = 0; i < UP_IFACE_MAX; i++) {
-		if (*up_ifaces[i] == '\0') {
+	/*
+	 * Start from the advertisement prebuilt for the interface, with the
+	 * Router flag set and a target link-layer address option, and fill
+	 * in the MAC and what depends on the solicitation.
+	 */
+	ip6reply = mtod(mreply, struct ip6_hdr *);
+	bcopy(&nif->ni_na, ip6reply, sizeof(struct nd_na_template));
+	bcopy(mac, &((struct nd_na_template *) ip6reply)->nt_mac, ETHER_ADDR_LEN);
+	ip6reply->ip6_dst = dstaddr;
+	ip6reply->ip6_src = srcaddr;
+
+	struct nd_neighbor_advert *nd_na = (struct nd_neighbor_advert *) (ip6reply + 1);  
+
+	/*
+	 * According to RFC-4861 (7.2.4), "If the source of the solicitation is the unspecified address, the
+	 * node MUST set the Solicited flag to zero [...]"
+	 */
+	flags = 0;
+	if (!IN6_IS_ADDR_UNSPECIFIED(&nr->nr_src))
+		flags = ND_NA_FLAG_SOLICITED;
+	nd_na->nd_na_flags_reserved |= flags;
+
+	/* we send a solicited neighbor advertisement relative to the target contained in the received neighbor solicitation */
+	nd_na->nd_na_target = nr->nr_target;
+
 #ifdef DEBUG_NDPROXY
-			printf("NDPROXY DEBUG: packet not from uplink interface: %s - %d\n",
-			    if_name(packet_ifnet), ndproxy_conf_count);
+	printf("NDPROXY INFO: mac option: %02x:%02x:%02x:%02x:%02x:%02x\n",
+	    (unsigned char) mac->octet[0],
+	    (unsigned char) mac->octet[1],
+	    (unsigned char) mac->octet[2],
+	    (unsigned char) mac->octet[3],
+	    (unsigned char) mac->octet[4],
+	    (unsigned char) mac->octet[5]);
 #endif
-			return 0;
-		}
-		if (strncmp(if_name(packet_ifnet), up_ifaces[i], IFNAMSIZ) == 0) {
-			break;
+
+	/*
+	 * Compute outgoing packet checksum: the template sum covers every
+	 * constant word, only the MAC, the addrs and the solicited flag are
+	 * added.
+	 */
+	na_sum = nd_cksum_add(nif->ni_na_sum, mac, ETHER_ADDR_LEN);
+	na_sum = nd_cksum_addr(na_sum, &srcaddr);
+	na_sum = nd_cksum_addr(na_sum, &dstaddr);
+	na_sum = nd_cksum_addr(na_sum, &nr->nr_target);
+	na_sum = nd_cksum_add(na_sum, &flags, sizeof(flags));
+	nd_na->nd_na_cksum = nd_cksum_fold(na_sum);
+	SDT_PROBE2(ndproxy, , reply, build, nr, ifp);
+	t = nd_lat_mark(ND_LAT_BUILD, t);
+
+#ifdef DEBUG_NDPROXY
+	inet_ntop(AF_INET6, &ip6reply->ip6_src, ip6_str, INET6_ADDRSTRLEN);
+	inet_ntop(AF_INET6, &ip6reply->ip6_dst, ip6_str2, INET6_ADDRSTRLEN);
+	printf("NDPROXY DEBUG: src=%s / dst=%s\n", ip6_str, ip6_str2);
+#endif
+
+	/*
+	 * Hand the reply straight to the driver when the link-layer
+	 * destination is known: the all-nodes group, or the PE when its MAC
+	 * is in the source link-layer address option of the solicitation.
+	 * This saves the route lookup and the neighbor cache of ip6_output(),
+	 * which may have to resolve the PE while it is waiting for us.
+	 */
+	if (nd_direct_output && (ifp->if_type == IFT_ETHER ||
+	    ifp->if_type == IFT_L2VLAN) &&
+	    ((output_flags & M_MCAST) || nr->nr_has_pe_mac)) {
+		if (output_flags & M_MCAST)
+			ETHER_MAP_IPV6_MULTICAST(&dstaddr, lladdr);
+		else
+			bcopy(nr->nr_pe_mac, lladdr, ETHER_ADDR_LEN);
+		mreply->m_flags |= output_flags & M_MCAST;
+		if ((ret = nd_transmit(ifp, mreply, lladdr)) == 0)
+			NDSTAT_INC(nds_direct);
+	} else {
+		struct ip6_moptions im6o;
+		if (output_flags & M_MCAST) {
+			bzero(&im6o, sizeof im6o);
+			im6o.im6o_multicast_hlim = 255;
+			im6o.im6o_multicast_loop = false;
+			im6o.im6o_multicast_ifp = NULL;
 		}
+
+		/* send router advertisement */
+		ret = ip6_output(mreply, NULL, NULL, output_flags, output_flags & M_MCAST ? &im6o : NULL, NULL, NULL);
 	}
-	if (i == UP_IFACE_MAX) {
+	SDT_PROBE3(ndproxy, , reply, output, nr, ifp, ret);
+	(void) nd_lat_mark(ND_LAT_OUTPUT, t);
+	if (ret) {
+		nd_event(NDPROXY_EV_OUTPUT, ifp, ret, &nr->nr_src,
+		    &nr->nr_target);
+		NDSTAT_INC(nds_output_err);
 #ifdef DEBUG_NDPROXY
-		printf("NDPROXY DEBUG: packet not from uplink interface: %s - %d\n",
-		    if_name(packet_ifnet), ndproxy_conf_count);
+		kdb_backtrace();
+		return (ret);
 #endif
-		return 0;
-	}
-	ifaceIndex = i;
-	if (ifaceIndex >= downlink_mac_addrs_set) {
+	} else if (!nr->nr_refresh)
+		NDSTAT_INC(nds_sent);
 #ifdef DEBUG_NDPROXY
-		printf("NDPROXY DEBUG: packet from uplink interface without downlink MAC: %s - %d\n",
-		    if_name(packet_ifnet), ndproxy_conf_count);
+	printf("NDPROXY DEBUG: reply sent\n");
 #endif
-		return 0;
+	return (0);
+}
+
+/*
+ * Answer a solicitation received on an uplink interface, or queue it in
+ * deferred mode. *mp holds the IPv6 packet, and is cleared if it is
+ * turned into the advertisement. Return true if the solicitation is
+ * handled, in which case it must not go further.
+ */
+static __always_inline int
+nd_ns_input(struct mbuf **mp, struct ifnet *ifp, struct nd_conf *conf,
+    struct nd_iface *nif, const int shape)
+{
+	struct mbuf *m = *mp;
+	struct ip6_hdr *ip6;
+	struct in6_addr ip6_src;
+	struct nd_request nr;
+	uint16_t ns_sum;
+	int plen;
+	const struct nd_policy *np;
+	const struct ether_addr *mac;
+	const u_char *pe_mac;
+	uint64_t t;
+#ifdef DEBUG_NDPROXY
+	char ip6_str[INET6_ADDRSTRLEN];
+#endif
+
+	t = nd_lat_start();
+	ip6 = mtod(m, struct ip6_hdr *);
+	plen = ntohs(ip6->ip6_plen);
+	ip6_src = ip6->ip6_src;
+#ifdef DEBUG_NDPROXY
+	inet_ntop(AF_INET6, &ip6_src, ip6_str, INET6_ADDRSTRLEN);
+	printf("NDPROXY DEBUG: got neighbor solicitation from %s\n", ip6_str);
+#endif
+
+	if (!nif->ni_has_mac &&
+	    ((shape & ND_SHAPE_NO_EXCEPT) || conf->nc_policy == NULL)) {
+#ifdef DEBUG_NDPROXY
+		printf("NDPROXY DEBUG: packet from uplink interface without downlink MAC: %s\n",
+		    if_name(ifp));
+#endif
+		NDSTAT_INC(nds_no_mac);
+		return (false);
 	}
 
 	/*
 	 * Ignore packets that aren't from an upstream router. 
 	 *
-	 * XXX: this check is not perfect. It is possible that a router
-	 * could have a link-scoped address and be connected to one
-	 * interface, while another device could use the same link-scoped
-	 * address on a different interface. For now, assume that any device
-	 * on any interface using one of the given addrs should be treated as a router.
+	 * A router addr bound to an interface in uplink_addr_list is only
+	 * accepted on that interface. This handles a router with a
+	 * link-scoped address connected to one interface, while another
+	 * device uses the same link-scoped address on a different interface.
+	 * Unbound addrs are accepted on every uplink interface.
 	 *
 	 * The use case where this applies is when the proxy is not the downstream router.
 	 * The downstream router will perform its own NDP to which we should not reply. In
@@ -137,89 +556,98 @@ pfil_return_t packet(struct mbuf **packet_mp, struct ifnet *packet_ifnet,
 	 *
 	 * TODO: resolve this.
 	 */
-	for (i = 0; i < uplink_addrs_set; i++) {
-#ifdef DEBUG_NDPROXY
-		inet_ntop(AF_INET6, &uplink_addrs[i], ip6_str, INET6_ADDRSTRLEN);
-		inet_ntop(AF_INET6, &ip6_src, ip6_str2, INET6_ADDRSTRLEN);
-		printf("NDPROXY INFO: compare: %s (uplink router address) with %s (source address)\n", ip6_str, ip6_str2);
-#endif
-		if (IN6_ARE_ADDR_EQUAL(&uplink_addrs[i], &ip6_src))
-			break;
-	}
-	if (i == uplink_addrs_set) {
+	if (!((shape & ND_SHAPE_FEW_PE) ? nd_uplink_match_few(nif, &ip6_src) :
+	    nd_uplink_match(nif, &ip6_src))) {
 #ifdef DEBUG_NDPROXY
 		inet_ntop(AF_INET6, &ip6_src, ip6_str, INET6_ADDRSTRLEN);
-		printf("NDPROXY INFO: not from uplink router - from: %s - %d\n", ip6_str, ndproxy_conf_count);
+		printf("NDPROXY INFO: not from uplink router - from: %s\n", ip6_str);
 #endif
-		return 0;
+		NDSTAT_INC(nds_not_router);
+		return (false);
 	}
 
 #ifdef DEBUG_NDPROXY
-	printf("NDPROXY DEBUG: got packet from uplink router - %d\n", ndproxy_conf_count);
+	printf("NDPROXY DEBUG: got packet from uplink router\n");
 #endif
+	SDT_PROBE2(ndproxy, , hook, pe, m, ifp);
+	t = nd_lat_mark(ND_LAT_PE, t);
 
-	/* Checksum. */
-	const u_int16_t sum = icmp6->icmp6_cksum;
-	icmp6->icmp6_cksum = 0;
-	if (sum != in6_cksum(m, IPPROTO_ICMPV6, sizeof(struct ip6_hdr),
-	    m->m_len - sizeof(struct ip6_hdr))) {
-		icmp6->icmp6_cksum = sum;
-		printf("NDPROXY ERROR: bad checksum\n");
-		return 0;
+	/*
+	 * Checksum. When the NIC has summed the ICMPv6 message, finish its
+	 * sum as udp6_input() does. Otherwise sum the message in software,
+	 * checksum field included: a valid message sums to 0, so there is
+	 * no need to clear the field and write it back.
+	 */
+	if (m->m_pkthdr.csum_flags & CSUM_DATA_VALID) {
+		if (m->m_pkthdr.csum_flags & CSUM_PSEUDO_HDR)
+			ns_sum = m->m_pkthdr.csum_data;
+		else
+			ns_sum = in6_cksum_pseudo(ip6, plen, IPPROTO_ICMPV6,
+			    m->m_pkthdr.csum_data);
+		ns_sum ^= 0xffff;
+		NDSTAT_INC(nds_cksum_hw);
+	} else {
+		ns_sum = in6_cksum(m, IPPROTO_ICMPV6, sizeof(struct ip6_hdr),
+		    plen);
+		NDSTAT_INC(nds_cksum_sw);
 	}
-	icmp6->icmp6_cksum = sum;
-
-	/* Create a new mbuf to send a neighbor advertisement. */
-	maxlen = (sizeof(struct ip6_hdr) + sizeof(struct nd_neighbor_advert) +
-	    sizeof(struct nd_opt_hdr) + packet_ifnet->if_addrlen + 7) & ~7;
-	if (max_linkhdr + maxlen > MCLBYTES) {
-		printf("NDPROXY ERROR: reply length > MCLBYTES\n");
-		return 0;
+	if (ns_sum != 0) {
+		nd_event(NDPROXY_EV_BADSUM, ifp, 0, &ip6_src, NULL);
+		NDSTAT_INC(nds_badsum);
+		return (false);
 	}
-	if (max_linkhdr + maxlen > MHLEN)
-		mreply = m_getcl(M_NOWAIT, MT_DATA, M_PKTHDR);
-	else
-		mreply = m_gethdr(M_NOWAIT, MT_DATA);
-	if (mreply == NULL) {
-		printf("NDPROXY ERROR: no more mbufs (ENOBUFS)\n");
-		return 0;
+	SDT_PROBE2(ndproxy, , hook, cksum, m, ifp);
+	t = nd_lat_mark(ND_LAT_CKSUM, t);
+
+	struct nd_neighbor_solicit *nd_ns = (struct nd_neighbor_solicit *) (ip6 + 1);
+	struct in6_addr nd_ns_target = nd_ns->nd_ns_target;
+
+	/* according to RFC-4861 (7.2.3), the target address can not be a multicast address */
+	if (IN6_IS_ADDR_MULTICAST(&nd_ns_target)) {
+		nd_event(NDPROXY_EV_MCAST_TARGET, ifp, 0, &ip6_src,
+		    &nd_ns_target);
+		NDSTAT_INC(nds_mcast_target);
+		return (false);
 	}
-	mreply->m_pkthdr.rcvif = NULL;
 
-	/* 
-	 * Packet content:
-	 * IPv6 header + ICMPv6 Neighbor Advertisement including target
-	 * address + target link-layer ICMPv6 address option
-	 */
-	mreply->m_pkthdr.len = (sizeof(struct ip6_hdr) + sizeof(struct nd_neighbor_advert) +
-	    sizeof(struct nd_opt_hdr) + packet_ifnet->if_addrlen + 7) & ~7;
-	mreply->m_len = mreply->m_pkthdr.len;
-
-	/* reserve space for the link-layer header */
-	mreply->m_data += max_linkhdr;
-
-	/* fill in the destination address we want to reply to */
-	struct sockaddr_in6 dst_sa;
-	bzero(&dst_sa, sizeof(struct sockaddr_in6));
-	dst_sa.sin6_family = AF_INET6;
-	dst_sa.sin6_len = sizeof(struct sockaddr_in6);
-	dst_sa.sin6_addr = ip6->ip6_src;
-	if ((ret = in6_setscope(&dst_sa.sin6_addr, packet_ifnet, NULL))) {
-		printf("NDPROXY ERROR: can not set source scope id (err=%d)\n", ret);
-		m_freem(mreply);
-		return 0;
+	/* do not manage packets relative to exception target addresses */
+	if (!(shape & ND_SHAPE_NO_EXCEPT) &&
+	    nd_hash_lookup(conf->nc_exceptions, &nd_ns_target)) {
+#ifdef DEBUG_NDPROXY
+		printf("NDPROXY INFO: rejecting target\n");
+#endif
+		NDSTAT_INC(nds_exception);
+		return (false);
 	}
+#ifdef DEBUG_NDPROXY
+	inet_ntop(AF_INET6, &nd_ns_target, ip6_str, INET6_ADDRSTRLEN);
+	printf("NDPROXY INFO: accepting target: %s\n", ip6_str);
+#endif
 
 	/*
-	 * According to RFC-4861 (7.2.4), "The Target Address of the
-	 * advertisement is copied from the Target Address of the solicitation.
-	 * [...] If the source of the solicitation is the unspecified address, the
-	 * node MUST [...] multicast the advertisement to the all-nodes address.".
+	 * The longest target policy holding the target, if any, tells
+	 * whether to proxy it and with which MAC. Other targets are
+	 * proxied with the downlink MAC of the interface.
 	 */
-	if (!IN6_IS_ADDR_UNSPECIFIED(&ip6_src)) {
-		dstaddr = ip6->ip6_src;
+	np = (shape & ND_SHAPE_NO_EXCEPT) ? NULL :
+	    nd_trie_lookup(conf->nc_policy, &nd_ns_target);
+	if (np != NULL && np->np_ignore) {
+#ifdef DEBUG_NDPROXY
+		printf("NDPROXY INFO: target ignored by policy\n");
+#endif
+		NDSTAT_INC(nds_policy_ignore);
+		return (false);
 	}
+	if (np != NULL)
+		mac = &np->np_mac;
+	else if (nif->ni_has_mac)
+		mac = &nif->ni_downlink_mac;
 	else {
+		NDSTAT_INC(nds_no_mac);
+		return (false);
+	}
+
+	if (IN6_IS_ADDR_UNSPECIFIED(&ip6_src)) {
 		/*
 		 * Check compliance to RFC-4861: "If the IP source address
 		 * is the unspecified address, the IP destination address
@@ -234,197 +662,300 @@ pfil_return_t packet(struct mbuf **packet_mp, struct ifnet *packet_ifnet,
 #endif
 		}
 		else {
-			printf("NDPROXY ERROR: destination address should be a solicited-node multicast address\n");
-			m_freem(mreply);
-			return 0;
+			nd_event(NDPROXY_EV_BAD_DST, ifp, 0, &ip6_src,
+			    &nd_ns_target);
+			NDSTAT_INC(nds_bad_dst);
+			return (false);
 		}
-		output_flags |= M_MCAST;
-		dstaddr = in6addr_linklocal_allnodes;
-	}
-	if ((ret = in6_setscope(&dstaddr, packet_ifnet, NULL))) {
-		printf("NDPROXY ERROR: can not set destination scope id (err=%d)\n", ret);
-		m_freem(mreply);
-		return 0;
 	}
 
 	/*
-	 * First, apply the RFC-3484 default address selection algorithm
-	 * to get a source address for the advertisement packet.
+	 * In reachability filter mode, let the stack drop solicitations for
+	 * targets that nothing downstream answers for.
 	 */
-	in6_splitscope(&dst_sa.sin6_addr, &_dst_sa, &_dst_sa_scopeid);
-	ret = in6_selectsrc_addr(RT_DEFAULT_FIB, &_dst_sa,
-	    _dst_sa_scopeid, packet_ifnet, &srcaddr, NULL);
-	if (ret && (ret != EHOSTUNREACH || in6_addrscope(&ip6_src) == IPV6_ADDR_SCOPE_LINKLOCAL)) {
-		printf("NDPROXY ERROR: can not select a source address to reply (err=%d), source scope is %x\n",
-		    ret, in6_addrscope(&ip6_src));
-		m_freem(mreply);
-		return 0;
+	if (nd_reach_filter && !nd_reach_check(conf, &nd_ns_target)) {
+		NDSTAT_INC(nds_unreachable);
+		return (false);
 	}
-	if (ret) {
-		/* 
-		 * Secondly, try to reply with a link-local address attached
-		 * to the receiving interface.
-		 */
-		struct in6_ifaddr *llifaddr = in6ifa_ifpforlinklocal(packet_ifnet, 0);
-		if (llifaddr == NULL)
-			printf("NDPROXY WARNING: no link-local address attached to the receiving interface\n");
 
-#ifdef DEBUG_NDPROXY
-		printf("NDPROXY INFO: no address in requested scope, using a link-local address to reply\n");
-#endif
-		if (llifaddr != NULL) {
-			srcaddr = (llifaddr->ia_addr).sin6_addr;
-			ifa_free((struct ifaddr *) llifaddr);
-		}
-		else {
-			/*
-			 * No link-local address, we may for instance currently
-			 * be verifying that the link-local stateless
-			 * autoconfiguration address is unused.
-			 * Then, we temporary use the unspecified address (::).
-			 */
-			bzero(&srcaddr, sizeof srcaddr);
-		}
-		/*
-		 * Since we have no source address in the same scope of the destination address of the request packet,
-		 * we can not simply reply to the source address of the request packet.
-		 * Then we reply to the link-local all nodes multicast address (ff02::1).
-		 */
-		output_flags |= M_MCAST;
-		dstaddr = in6addr_linklocal_allnodes;
-		if ((ret = in6_setscope(&dstaddr, packet_ifnet, NULL))) {
-			printf("NDPROXY ERROR: can not set destination scope id (err=%d)\n", ret);
-			m_freem(mreply);
-			return 0;
-		}
+	/* Keep a storm of solicitations from turning into a storm of replies. */
+	if (!nd_rate_allow(&ip6_src, &nd_ns_target))
+		return (false);
+	SDT_PROBE2(ndproxy, , hook, target, m, ifp);
+	(void) nd_lat_mark(ND_LAT_TARGET, t);
+
+	/*
+	 * Keep what the reply needs from the solicitation. The MAC of the
+	 * PE is only used to send the reply through the driver.
+	 */
+	nr.nr_src = ip6_src;
+	nr.nr_target = nd_ns_target;
+	nr.nr_mac = *mac;
+	nr.nr_ifindex = ifp->if_index;
+	nr.nr_vnet = ifp->if_vnet;
+	nr.nr_refresh = false;
+	nr.nr_has_pe_mac = false;
+	if (nd_direct_output && (pe_mac = nd_ns_sllao(m)) != NULL) {
+		bcopy(pe_mac, nr.nr_pe_mac, ETHER_ADDR_LEN);
+		nr.nr_has_pe_mac = true;
 	}
 
-#ifdef DEBUG_NDPROXY
-	inet_ntop(AF_INET6, &srcaddr, ip6_str, INET6_ADDRSTRLEN);
-	printf("NDPROXY DEBUG: source address used to reply: %s\n", ip6_str);
-#endif
+	/*
+	 * In deferred mode, the reply is left to the taskqueue of this
+	 * CPU, so that the receive path does not wait for it. When the
+	 * queue is full, the solicitation is left to the stack.
+	 */
+	if (nd_deferred)
+		return (nd_defer(&nr));
+	return (nd_reply(ifp, nif, &nr, nd_inplace ? mp : NULL) == 0 ||
+	    *mp == NULL);
+}
 
-	struct nd_neighbor_solicit *nd_ns = (struct nd_neighbor_solicit *) (ip6 + 1);
-	struct in6_addr nd_ns_target = nd_ns->nd_ns_target;
+/*
+ * Return true if the IPv6 packet at off in m, pulled up to the end of
+ * the solicitation, is a neighbor solicitation. Reject NS with
+ * extension headers (ie, ip6_nxt is anything but ICMPv6).
+ */
+static __always_inline int
+nd_ns_check(const struct mbuf *m, const struct ip6_hdr *ip6, int off)
+{
+	const struct icmp6_hdr *icmp6;
 
-	/* Fill in the IPv6 header */
-	ip6reply = mtod(mreply, struct ip6_hdr *);
-	ip6reply->ip6_flow = 0;
-	ip6reply->ip6_vfc &= ~IPV6_VERSION_MASK;
-	ip6reply->ip6_vfc |= IPV6_VERSION;
-	ip6reply->ip6_plen = htons((u_short) (mreply->m_len - sizeof(struct ip6_hdr)));
-	ip6reply->ip6_nxt = IPPROTO_ICMPV6;
-	ip6reply->ip6_hlim = 255;
-	ip6reply->ip6_dst = dstaddr;
-	ip6reply->ip6_src = srcaddr;
+	if ((ip6->ip6_vfc & IPV6_VERSION_MASK) != IPV6_VERSION ||
+	    ip6->ip6_nxt != IPPROTO_ICMPV6) {
+		NDSTAT_INC(nds_not_icmp6);
+		return (false);
+	}
+	icmp6 = (const struct icmp6_hdr *) (ip6 + 1);
+	if (icmp6->icmp6_type != ND_NEIGHBOR_SOLICIT || icmp6->icmp6_code ||
+	    ntohs(ip6->ip6_plen) < sizeof(struct nd_neighbor_solicit) ||
+	    ntohs(ip6->ip6_plen) > m->m_pkthdr.len - off -
+	    sizeof(struct ip6_hdr)) {
+		NDSTAT_INC(nds_not_ns);
+		return (false);
+	}
+	return (true);
+}
 
-	/* Fill in the ICMPv6 neighbor advertisement header */
-	struct nd_neighbor_advert *nd_na = (struct nd_neighbor_advert *) (ip6reply + 1);  
-	nd_na->nd_na_type = ND_NEIGHBOR_ADVERT;
-	nd_na->nd_na_code = 0;
+/*
+ * Body of the pfil hook, see packet() below. conf is the conf the hook
+ * loaded, and shape the ND_SHAPE_* flags it is known to have: shape is
+ * a constant in each variant of the hook, so the branches it rules out
+ * are not compiled in.
+ */
+static __always_inline pfil_return_t
+nd_packet(struct mbuf **packet_mp, struct ifnet *packet_ifnet,
+    struct nd_conf *conf, const int shape)
+{
+	struct mbuf *m = NULL;
+	struct ether_header *eh;
+	struct nd_iface *nif;
+	uint64_t t;
+	int len;
+
+	t = nd_lat_start();
+	NDSTAT_INC(nds_received);
+	if (packet_mp == NULL) {
+		nd_event(NDPROXY_EV_NOMBUF, packet_ifnet, 0, NULL, NULL);
+		return 0;
+	}
+	m = *packet_mp;
 
-	nd_na->nd_na_flags_reserved = 0;
 	/*
-	 * According to RFC-4861 (7.2.4), "If the source of the solicitation is the unspecified address, the
-	 * node MUST set the Solicited flag to zero [...]"
+	 * handle only packets originating from an uplink interface. This is
+	 * checked first, as every frame received by the host goes through
+	 * here.
 	 */
-	if (!IN6_IS_ADDR_UNSPECIFIED(&ip6_src))
-		nd_na->nd_na_flags_reserved = ND_NA_FLAG_SOLICITED;
+	if ((shape & ND_SHAPE_ONE_IFACE) ?
+	    packet_ifnet->if_index != conf->nc_single_index :
+	    (conf == NULL || packet_ifnet->if_index >= conf->nc_ifaces_size ||
+	    conf->nc_ifaces[packet_ifnet->if_index] == NULL)) {
+#ifdef DEBUG_NDPROXY
+		printf("NDPROXY DEBUG: packet not from uplink interface: %s\n",
+		    if_name(packet_ifnet));
+#endif
+		NDSTAT_INC(nds_not_uplink);
+		if (nd_reach_filter && conf != NULL)
+			nd_reach_learn(m);
+		return 0;
+	}
+	nif = (shape & ND_SHAPE_ONE_IFACE) ? conf->nc_single :
+	    conf->nc_ifaces[packet_ifnet->if_index];
+	SDT_PROBE2(ndproxy, , hook, iface, m, packet_ifnet);
+	t = nd_lat_mark(ND_LAT_IFACE, t);
 
 	/*
-	 * According to RFC-4861 (7.2.4), "If the Target Address is either an anycast address or a unicast
-	 * address for which the node is providing proxy service, [...] the Override flag SHOULD
-	 * be set to zero."
-	 * Thus, we do not set the ND_NA_FLAG_OVERRIDE flag in nd_na->nd_na_flags_reserved.
+	 * A frame whose tag the NIC stripped belongs to a VLAN on top of
+	 * the interface, not to the interface itself, unless it is only
+	 * priority tagged.
 	 */
-	nd_na->nd_na_flags_reserved |= ND_NA_FLAG_ROUTER;
-
-	/* according to RFC-4861 (7.2.3), the target address can not be a multicast address */
-	if (IN6_IS_ADDR_MULTICAST(&nd_ns_target)) {
-		printf("NDPROXY WARNING: rejecting multicast target address\n");
-		m_freem(mreply);
+	if ((m->m_flags & M_VLANTAG) &&
+	    EVL_VLANOFTAG(m->m_pkthdr.ether_vtag) != 0) {
+		NDSTAT_INC(nds_not_uplink);
 		return 0;
 	}
 
-	/* we send a solicited neighbor advertisement relative to the target contained in the received neighbor solicitation */
-	nd_na->nd_na_target = nd_ns->nd_ns_target;
-	struct in6_addr nd_na_target = nd_na->nd_na_target;
-
-	/* do not manage packets relative to exception target addresses */
-	for (i = 0; i < exception_addrs_set; i++) {
-		if (IN6_ARE_ADDR_EQUAL(exception_addrs + i, &nd_na_target)) {
-#ifdef DEBUG_NDPROXY
-			printf("NDPROXY INFO: rejecting target\n");
-#endif
-			m_freem(mreply);
-			return 0;
-		} else {
-#ifdef DEBUG_NDPROXY
-			inet_ntop(AF_INET6, &exception_addrs[i], ip6_str, INET6_ADDRSTRLEN);
-			inet_ntop(AF_INET6, &nd_na_target, ip6_str2, INET6_ADDRSTRLEN);
-			printf("NDPROXY INFO: accepting target: %s - %s\n", ip6_str, ip6_str2);
-#endif
+	/*
+	 * Ignore everything except neighbour solicitations. The Ethernet
+	 * header is in the first mbuf, the headers after it are pulled up
+	 * only for IPv6.
+	 */
+	eh = mtod(m, struct ether_header *);
+	if (eh->ether_type != htons(ETHERTYPE_IPV6)) {
+		NDSTAT_INC(nds_not_icmp6);
+		return 0;
+	}
+	len = ETHER_HDR_LEN + sizeof(struct ip6_hdr) +
+	    sizeof(struct nd_neighbor_solicit);
+	if (m->m_pkthdr.len < len) {
+		NDSTAT_INC(nds_not_ns);
+		return 0;
+	}
+	if (m->m_len < len) {
+		if ((m = m_pullup(m, len)) == NULL) {
+			NDSTAT_INC(nds_nombuf);
+			*packet_mp = NULL;
+			return 1;
 		}
+		*packet_mp = m;
+		eh = mtod(m, struct ether_header *);
 	}
+	if (!nd_ns_check(m, (struct ip6_hdr *) (eh + 1), ETHER_HDR_LEN))
+		return 0;
+	SDT_PROBE2(ndproxy, , hook, classify, m, packet_ifnet);
+	(void) nd_lat_mark(ND_LAT_CLASSIFY, t);
 
-	/* proxy to the downlink router: fill in the target link-layer address option with the MAC downlink router address */
-	int optlen = sizeof(struct nd_opt_hdr) + ETHER_ADDR_LEN;
-	struct nd_opt_hdr *nd_opt = (struct nd_opt_hdr *) (nd_na + 1);
-	/* roundup to 8 bytes alignment */
-	optlen = (optlen + 7) & ~7;
-	bzero((caddr_t) nd_opt, optlen);
-	nd_opt->nd_opt_type = ND_OPT_TARGET_LINKADDR;
-	nd_opt->nd_opt_len = optlen >> 3;
-	
-	/* Select the MAC address for the interface. */
-	bcopy(&downlink_mac_addrs[ifaceIndex], (caddr_t) (nd_opt + 1), ETHER_ADDR_LEN);
+	/*
+	 * Handle the IPv6 packet as ip6_input() would see it, and put the
+	 * Ethernet header back if the frame goes further.
+	 */
+	m->m_data += ETHER_HDR_LEN;
+	m->m_len -= ETHER_HDR_LEN;
+	m->m_pkthdr.len -= ETHER_HDR_LEN;
+	if (nd_ns_input(&m, packet_ifnet, conf, nif, shape)) {
+		/* Do not process this packet further. */
+		m_freem(m);
+		*packet_mp = NULL;
+		return 1;
+	}
+	m->m_data -= ETHER_HDR_LEN;
+	m->m_len += ETHER_HDR_LEN;
+	m->m_pkthdr.len += ETHER_HDR_LEN;
+	return 0;
+}
 
-#ifdef DEBUG_NDPROXY
-	printf("NDPROXY INFO: mac option: %02x:%02x:%02x:%02x:%02x:%02x\n",
-	    (unsigned char) downlink_mac_addrs[ifaceIndex].octet[0],
-	    (unsigned char) downlink_mac_addrs[ifaceIndex].octet[1],
-	    (unsigned char) downlink_mac_addrs[ifaceIndex].octet[2],
-	    (unsigned char) downlink_mac_addrs[ifaceIndex].octet[3],
-	    (unsigned char) downlink_mac_addrs[ifaceIndex].octet[4],
-	    (unsigned char) downlink_mac_addrs[ifaceIndex].octet[5]);
-#endif
+/*
+ * This is the pfil hook to perform proxying. It is linked to the
+ * link-layer pfil head while an uplink interface is present, so it sees
+ * every Ethernet frame received: anything but a neighbor solicitation
+ * from an uplink interface must be let through at once.
+ *
+ * The conf is loaded once: everything must come from the same conf,
+ * even if a new one is published meanwhile. The pfil hooks run in the
+ * network epoch, so the conf can not be freed before we return.
+ */
+pfil_return_t packet(struct mbuf **packet_mp, struct ifnet *packet_ifnet,
+    const int packet_dir, void *packet_arg, struct inpcb *packet_inpcb)
+{
+	return (nd_packet(packet_mp, packet_ifnet,
+	    atomic_load_ptr(&V_nd_active_conf), 0));
+}
 
-	/* compute outgoing packet checksum */
-	nd_na->nd_na_cksum = 0;
-	nd_na->nd_na_cksum = in6_cksum(mreply, IPPROTO_ICMPV6, sizeof(struct ip6_hdr),
-				     mreply->m_len - sizeof(struct ip6_hdr));
+/*
+ * Hook linked to the inet6 pfil head along with the link-layer one.
+ * The link-layer hooks do not see the frames sent to another MAC than
+ * the one of the receiving interface (M_PROMISC), such as the unicast
+ * solicitations a PE sends to the downlink MAC to check that a target
+ * is still reachable (NUD, RFC-4861 7.3): on an interface in
+ * permanently promiscuous mode, those go up to ip6_input() and are
+ * answered here. Every other packet went through the link-layer hook.
+ */
+pfil_return_t
+packet_inet6(struct mbuf **packet_mp, struct ifnet *packet_ifnet,
+    const int packet_dir, void *packet_arg, struct inpcb *packet_inpcb)
+{
+	struct mbuf *m;
+	struct nd_conf *conf;
+	struct nd_iface *nif;
+	int len;
 
-#ifdef DEBUG_NDPROXY
-	inet_ntop(AF_INET6, &ip6reply->ip6_src, ip6_str, INET6_ADDRSTRLEN);
-	inet_ntop(AF_INET6, &ip6reply->ip6_dst, ip6_str2, INET6_ADDRSTRLEN);
-	printf("NDPROXY DEBUG: src=%s / dst=%s\n", ip6_str, ip6_str2);
-#endif
+	if (packet_mp == NULL || ((*packet_mp)->m_flags & M_PROMISC) == 0)
+		return 0;
+	conf = atomic_load_ptr(&V_nd_active_conf);
+	if (conf == NULL || packet_ifnet->if_index >= conf->nc_ifaces_size ||
+	    (nif = conf->nc_ifaces[packet_ifnet->if_index]) == NULL)
+		return 0;
+	NDSTAT_INC(nds_promisc);
 
-	struct ip6_moptions im6o;
-	if (output_flags & M_MCAST) {
-		bzero(&im6o, sizeof im6o);
-		im6o.im6o_multicast_hlim = 255;
-		im6o.im6o_multicast_loop = false;
-		im6o.im6o_multicast_ifp = NULL;
+	m = *packet_mp;
+	len = sizeof(struct ip6_hdr) + sizeof(struct nd_neighbor_solicit);
+	if (m->m_pkthdr.len < len) {
+		NDSTAT_INC(nds_not_ns);
+		return 0;
 	}
-
-	/* send router advertisement */
-	if ((ret = ip6_output(mreply, NULL, NULL, output_flags, output_flags & M_MCAST ? &im6o : NULL, NULL, NULL))) {
-		printf("NDPROXY DEBUG: can not send packet (err=%d)\n", ret);
-#ifdef DEBUG_NDPROXY
-		kdb_backtrace();
+	if (m->m_len < len) {
+		if ((m = m_pullup(m, len)) == NULL) {
+			NDSTAT_INC(nds_nombuf);
+			*packet_mp = NULL;
+			return 1;
+		}
+		*packet_mp = m;
+	}
+	if (!nd_ns_check(m, mtod(m, struct ip6_hdr *), 0))
 		return 0;
-#endif
+	if (nd_ns_input(&m, packet_ifnet, conf, nif, 0)) {
+		m_freem(m);
+		*packet_mp = NULL;
+		return 1;
 	}
-#ifdef DEBUG_NDPROXY
-	printf("NDPROXY DEBUG: reply sent\n");
-#endif
-#ifndef DEBUG_NDPROXY
-	/* when NOT debuging, increment counter for each neighbor advertisement sent */
-	ndproxy_conf_count = ++ndproxy_conf_count < 0 ? 1 : ndproxy_conf_count;
-#endif
-	/* Do not process this packet further. */
-	m_freem(m);
-	*packet_mp = NULL;
-	return 1;
+	return 0;
+}
+
+/*
+ * Variants of the hook for the shapes of conf, without the lookups and
+ * loops a conf of that shape does not need. The variant matching the
+ * conf is linked when the conf is published, but a frame may still
+ * come in with the next conf meanwhile: it then goes to packet().
+ */
+#define	ND_PACKET_VARIANT(name, shape)					\
+static pfil_return_t							\
+name(struct mbuf **packet_mp, struct ifnet *packet_ifnet,		\
+    const int packet_dir, void *packet_arg, struct inpcb *packet_inpcb)	\
+{									\
+	struct nd_conf *conf;						\
+									\
+	conf = atomic_load_ptr(&V_nd_active_conf);			\
+	if (__predict_false(conf == NULL ||				\
+	    (conf->nc_shape & (shape)) != (shape)))			\
+		return (packet(packet_mp, packet_ifnet, packet_dir,	\
+		    packet_arg, packet_inpcb));				\
+	return (nd_packet(packet_mp, packet_ifnet, conf, (shape)));	\
 }
+
+ND_PACKET_VARIANT(packet_1if, ND_SHAPE_ONE_IFACE)
+ND_PACKET_VARIANT(packet_noexc, ND_SHAPE_NO_EXCEPT)
+ND_PACKET_VARIANT(packet_1if_noexc, ND_SHAPE_ONE_IFACE | ND_SHAPE_NO_EXCEPT)
+ND_PACKET_VARIANT(packet_fewpe, ND_SHAPE_FEW_PE)
+ND_PACKET_VARIANT(packet_1if_fewpe, ND_SHAPE_ONE_IFACE | ND_SHAPE_FEW_PE)
+ND_PACKET_VARIANT(packet_noexc_fewpe, ND_SHAPE_NO_EXCEPT | ND_SHAPE_FEW_PE)
+ND_PACKET_VARIANT(packet_1if_noexc_fewpe,
+    ND_SHAPE_ONE_IFACE | ND_SHAPE_NO_EXCEPT | ND_SHAPE_FEW_PE)
+
+/*
+ * The hook for each shape, indexed by its flags, and the name of its
+ * rule in pfilctl(8).
+ */
+const struct nd_packet_variant nd_packet_variants[ND_SHAPE_COUNT] = {
+	[0] = { packet, "default-link" },
+	[ND_SHAPE_ONE_IFACE] = { packet_1if, "link-1if" },
+	[ND_SHAPE_NO_EXCEPT] = { packet_noexc, "link-noexc" },
+	[ND_SHAPE_ONE_IFACE | ND_SHAPE_NO_EXCEPT] =
+	    { packet_1if_noexc, "link-1if-noexc" },
+	[ND_SHAPE_FEW_PE] = { packet_fewpe, "link-fewpe" },
+	[ND_SHAPE_ONE_IFACE | ND_SHAPE_FEW_PE] =
+	    { packet_1if_fewpe, "link-1if-fewpe" },
+	[ND_SHAPE_NO_EXCEPT | ND_SHAPE_FEW_PE] =
+	    { packet_noexc_fewpe, "link-noexc-fewpe" },
+	[ND_SHAPE_ONE_IFACE | ND_SHAPE_NO_EXCEPT | ND_SHAPE_FEW_PE] =
+	    { packet_1if_noexc_fewpe, "link-1if-noexc-fewpe" },
+};
@@ -27,6 +27,39 @@
 #ifndef __NDPACKET_H
 #define __NDPACKET_H
 
+struct nd_iface;
+struct vnet;
+
+/*
+ * What the advertisement needs from a solicitation, so that it can be
+ * built once the solicitation is gone.
+ */
+struct nd_request {
+	struct in6_addr		nr_src;		/* Source of the NS. */
+	struct in6_addr		nr_target;
+	struct ether_addr	nr_mac;		/* MAC to advertise. */
+	u_char			nr_pe_mac[ETHER_ADDR_LEN]; /* From the SLLAO. */
+	u_char			nr_has_pe_mac;
+	u_short			nr_ifindex;	/* Receiving interface. */
+	u_char			nr_refresh;	/* Unsolicited, see ndrefresh.c. */
+	struct vnet		*nr_vnet;	/* Its vnet. */
+};
+
+extern int nd_direct_output;
+extern int nd_inplace;
+
+extern int nd_reply(struct ifnet *, struct nd_iface *, const struct nd_request *,
+    struct mbuf **);
 extern pfil_return_t packet(struct mbuf **m, struct ifnet *, int, void *, struct inpcb *);
+extern pfil_return_t packet_inet6(struct mbuf **m, struct ifnet *, int, void *,
+    struct inpcb *);
+
+/* Variant of the pfil hook specialized for a shape of conf. */
+struct nd_packet_variant {
+	pfil_func_t	 pv_func;
+	const char	*pv_name;	/* Rule name of the hook. */
+};
+
+extern const struct nd_packet_variant nd_packet_variants[];
 
 #endif
@@ -25,81 +25,339 @@
  */
 
 #include <sys/param.h>
+#include <sys/systm.h>
+#include <sys/counter.h>
+#include <sys/epoch.h>
+#include <sys/eventhandler.h>
+#include <sys/lock.h>
+#include <sys/malloc.h>
 #include <sys/socket.h>
 #include <sys/module.h>
+#include <sys/priv.h>
+#include <sys/sbuf.h>
+#include <sys/sdt.h>
+#include <sys/smp.h>
+#include <sys/sx.h>
 #include <sys/sysctl.h>
+#include <machine/cpu.h>
 
 #include <net/if.h>
+#include <net/if_var.h>
 #include <net/pfil.h>
 #include <net/ethernet.h>
+#include <net/route.h>
+#include <net/route/route_ctl.h>
 #include <netinet/in.h>
+#include <netinet/icmp6.h>
+#include <netinet/ip6.h>
 
 #include <net/vnet.h>
 #include <netinet6/ip6_var.h>
 
 #include "ndconf.h"
+#include "ndctl.h"
+#include "ndevent.h"
+#include "ndhash.h"
+#include "ndlat.h"
 #include "ndproxy.h"
 #include "ndpacket.h"
+#include "ndqueue.h"
+#include "ndrate.h"
+#include "ndreach.h"
+#include "ndrefresh.h"
+#include "ndtrie.h"
 
+/*
+ * Each vnet has its own hooks, linked to its own link-layer and inet6
+ * pfil heads.
+ */
+VNET_DEFINE_STATIC(int, hook_added) = false;
+VNET_DEFINE_STATIC(int, hook_linked) = false;
+VNET_DEFINE_STATIC(int, hook_inet6_linked) = false;
+VNET_DEFINE_STATIC(pfil_hook_t, pfh_hook);
+VNET_DEFINE_STATIC(pfil_hook_t, pfh_inet6_hook);
+VNET_DEFINE_STATIC(int, hook_shape) = 0;	/* Variant of pfh_hook. */
+VNET_DEFINE_STATIC(int, hook_specialize) = true;
+VNET_DEFINE_STATIC(struct rib_subscription *, rib_sub);
+#define	V_hook_added	VNET(hook_added)
+#define	V_hook_linked	VNET(hook_linked)
+#define	V_hook_inet6_linked	VNET(hook_inet6_linked)
+#define	V_pfh_hook	VNET(pfh_hook)
+#define	V_pfh_inet6_hook	VNET(pfh_inet6_hook)
+#define	V_hook_shape	VNET(hook_shape)
+#define	V_hook_specialize	VNET(hook_specialize)
+#define	V_rib_sub	VNET(rib_sub)
 
-char			sysctl_downlink_mac_list[DOWN_MAC_STR_MAX];
-char			sysctl_iface_list[UP_IFACE_STR_MAX];
-char			sysctl_exception_addr_list[EXCEPTION_STR_MAX];
-char			sysctl_uplink_addr_list[EXCEPTION_STR_MAX];
+static eventhandler_tag	ifnet_arrival_tag;
+static eventhandler_tag	ifnet_departure_tag;
+static eventhandler_tag	ifnet_rename_tag;
+static eventhandler_tag	ifaddr_tag;
 
-static int		hook_added = false;
-static pfil_hook_t	pfh_hook;
+/*
+ * Create the pfil hook for a shape of conf.
+ */
+static pfil_hook_t
+nd_hook_add(int shape)
+{
+	struct pfil_hook_args pha;
+
+	pha.pa_version = PFIL_VERSION;
+	pha.pa_type = PFIL_TYPE_ETHERNET;
+	pha.pa_flags = PFIL_IN;
+	pha.pa_modname = "ndproxy";
+	pha.pa_ruleset = NULL;
+	pha.pa_rulname = nd_packet_variants[shape].pv_name;
+	pha.pa_func = nd_packet_variants[shape].pv_func;
+	return (pfil_add_hook(&pha));
+}
 
 /*
- * Create and register the pfil hook.
+ * Create the hook of the inet6 head, see packet_inet6().
  */
-static void
-register_hook()
+static pfil_hook_t
+nd_hook_inet6_add(void)
 {
 	struct pfil_hook_args pha;
-	struct pfil_link_args pla;
-	
-	if (hook_added)
-		return;
 
 	pha.pa_version = PFIL_VERSION;
 	pha.pa_type = PFIL_TYPE_IP6;
 	pha.pa_flags = PFIL_IN;
 	pha.pa_modname = "ndproxy";
 	pha.pa_ruleset = NULL;
-	pha.pa_rulname = "default-in6";
-	pha.pa_func = packet;
-	pfh_hook = pfil_add_hook(&pha);
+	pha.pa_rulname = "default-inet6";
+	pha.pa_func = packet_inet6;
+	return (pfil_add_hook(&pha));
+}
+
+static int
+nd_hook_link_one(pfil_hook_t hook, pfil_head_t head, int link)
+{
+	struct pfil_link_args pla;
 
 	pla.pa_version = PFIL_VERSION;
 	pla.pa_flags = PFIL_IN | PFIL_HEADPTR | PFIL_HOOKPTR;
-	pla.pa_hook = pfh_hook;
-	pla.pa_head = V_inet6_pfil_head;
+	if (!link)
+		pla.pa_flags |= PFIL_UNLINK;
+	pla.pa_hook = hook;
+	pla.pa_head = head;
+	return (pfil_link(&pla));
+}
+
+/*
+ * Link the pfil hooks to the link-layer and inet6 heads, or unlink
+ * them. The hooks are only linked while an uplink interface is
+ * present, so that the frames received by a host without one do not go
+ * through them.
+ *
+ * The hook is the variant of packet() for the shape of conf. When the
+ * shape changes, the new variant is linked before the old one is
+ * removed: a solicitation is consumed by the first of them, and other
+ * frames just go through both meanwhile.
+ * Called with ndproxy_conf_lock held exclusively, when a conf is
+ * published.
+ */
+void
+nd_hook_link(const struct nd_conf *conf)
+{
+	pfil_hook_t hook;
+	int link, shape;
 
-	if (pfil_link(&pla) == 0)
-		hook_added = true;
+	sx_assert(&ndproxy_conf_lock, SA_XLOCKED);
+	if (!V_hook_added)
+		return;
+	link = conf != NULL && conf->nc_ifaces_size != 0;
+	shape = conf != NULL && V_hook_specialize ? conf->nc_shape : 0;
+
+	if (link != V_hook_inet6_linked &&
+	    nd_hook_link_one(V_pfh_inet6_hook, V_inet6_pfil_head, link) == 0)
+		V_hook_inet6_linked = link;
+	if (link && shape != V_hook_shape) {
+		hook = nd_hook_add(shape);
+		if (nd_hook_link_one(hook, V_link_pfil_head, true) != 0) {
+			pfil_remove_hook(hook);
+			return;
+		}
+		pfil_remove_hook(V_pfh_hook);
+		V_pfh_hook = hook;
+		V_hook_shape = shape;
+		V_hook_linked = true;
+		return;
+	}
+	if (link != V_hook_linked &&
+	    nd_hook_link_one(V_pfh_hook, V_link_pfil_head, link) == 0)
+		V_hook_linked = link;
 }
 
 /*
- * Remove the pfil hook (ignored if not registered).
+ * Create and register the pfil hooks.
+ */
+static void
+register_hook()
+{
+	sx_xlock(&ndproxy_conf_lock);
+	if (!V_hook_added) {
+		V_pfh_hook = nd_hook_add(0);
+		V_pfh_inet6_hook = nd_hook_inet6_add();
+		V_hook_shape = 0;
+		V_hook_added = true;
+	}
+	nd_hook_link(V_nd_active_conf);
+	sx_xunlock(&ndproxy_conf_lock);
+}
+
+/*
+ * Remove the pfil hooks (ignored if not registered).
  */
 static void
 unregister_hook()
 {
-	if (!hook_added)
+	if (!V_hook_added)
 		return;
-	pfil_remove_hook(pfh_hook);
+	pfil_remove_hook(V_pfh_hook);
+	pfil_remove_hook(V_pfh_inet6_hook);
+	V_hook_added = false;
+	V_hook_linked = false;
+	V_hook_inet6_linked = false;
+}
+
+/*
+ * Keep the interface table in sync with the uplink interfaces present.
+ */
+static void
+ifnet_arrival(void *arg, struct ifnet *ifp)
+{
+	CURVNET_SET(ifp->if_vnet);
+	nd_iface_event(ifp, false);
+	CURVNET_RESTORE();
+}
+
+static void
+ifnet_departure(void *arg, struct ifnet *ifp)
+{
+	CURVNET_SET(ifp->if_vnet);
+	nd_iface_event(ifp, true);
+	CURVNET_RESTORE();
+}
+
+/*
+ * ifconfig name: the interface may take or leave an uplink name.
+ */
+static void
+ifnet_rename(void *arg, struct ifnet *ifp, const char *old_name)
+{
+	CURVNET_SET(ifp->if_vnet);
+	nd_iface_event(ifp, false);
+	CURVNET_RESTORE();
+}
+
+/*
+ * Expire the cached reply source addrs when addrs or routes change.
+ */
+static void
+ifaddr_change(void *arg, struct ifnet *ifp)
+{
+	nd_src_invalidate();
+}
+
+static void
+route_change(struct rib_head *rnh, struct rib_cmd_info *rc, void *arg)
+{
+	nd_src_invalidate();
+}
+
+/*
+ * Set up an instance in each vnet, when the module is loaded or when a
+ * vnet is created.
+ */
+static void
+vnet_ndproxy_init(const void *unused __unused)
+{
+	VNET_PCPUSTAT_ALLOC(ndproxystat, M_WAITOK);
+	nd_rate_init();
+	nd_reach_init();
+	nd_event_vnet_init();
+	sx_xlock(&ndproxy_conf_lock);
+	nd_iface_conf_update();
+	sx_xunlock(&ndproxy_conf_lock);
+	V_rib_sub = rib_subscribe(RT_DEFAULT_FIB, AF_INET6, route_change,
+	    NULL, RIB_NOTIFY_DELAYED, true);
+	register_hook();
+	nd_refresh_start();
+}
+VNET_SYSINIT(vnet_ndproxy_init, SI_SUB_PROTO_FIREWALL, SI_ORDER_ANY,
+    vnet_ndproxy_init, NULL);
+
+/*
+ * Tear down the instance of a vnet, when the module is unloaded or when
+ * the vnet is destroyed. Requests queued in deferred mode for the vnet
+ * are sent before its conf is freed.
+ */
+static void
+vnet_ndproxy_uninit(const void *unused __unused)
+{
+	if (V_rib_sub != NULL) {
+#if __FreeBSD_version >= 1400000
+		rib_unsubscribe(V_rib_sub);
+#else
+		rib_unsibscribe(V_rib_sub);
+#endif
+		V_rib_sub = NULL;
+	}
+	unregister_hook();
+	nd_refresh_stop();
+	NET_EPOCH_WAIT();
+	nd_defer_drain();
+	sx_xlock(&ndproxy_conf_lock);
+	nd_refresh_update(NULL);
+	nd_conf_free();
+	nd_vars_free();
+	sx_xunlock(&ndproxy_conf_lock);
+	nd_rate_free();
+	nd_reach_free();
+	nd_event_vnet_free();
+	VNET_PCPUSTAT_FREE(ndproxystat);
+}
+VNET_SYSUNINIT(vnet_ndproxy_uninit, SI_SUB_PROTO_FIREWALL, SI_ORDER_ANY,
+    vnet_ndproxy_uninit, NULL);
+
+/*
+ * Free what the instances share, once every vnet is torn down: the
+ * module event handler runs before the vnet uninit functions.
+ */
+static void
+ndproxy_uninit(const void *unused __unused)
+{
+	nd_defer_free();
+	nd_lat_free();
+	nd_event_free();
 }
+SYSUNINIT(ndproxy_uninit, SI_SUB_DRIVERS, SI_ORDER_ANY, ndproxy_uninit, NULL);
 
 /*
- * Called when the module is loaded or unloaded.
+ * Called when the module is loaded or unloaded, before the instances
+ * of the vnets are set up and after they are torn down.
  */
 static int
 event_handler(struct module *module, const int event, void *arg)
 {
+	int err;
+
 	switch (event) {
 	case MOD_LOAD:
-		register_hook();
+		nd_defer_init();
+		nd_lat_init();
+		nd_event_init();
+		ifnet_arrival_tag = EVENTHANDLER_REGISTER(ifnet_arrival_event,
+		    ifnet_arrival, NULL, EVENTHANDLER_PRI_ANY);
+		ifnet_departure_tag = EVENTHANDLER_REGISTER(ifnet_departure_event,
+		    ifnet_departure, NULL, EVENTHANDLER_PRI_ANY);
+		ifnet_rename_tag = EVENTHANDLER_REGISTER(ifnet_rename_event,
+		    ifnet_rename, NULL, EVENTHANDLER_PRI_ANY);
+		ifaddr_tag = EVENTHANDLER_REGISTER(ifaddr_event,
+		    ifaddr_change, NULL, EVENTHANDLER_PRI_ANY);
+		if ((err = nd_ctl_init()) != 0)
+			printf("NDPROXY ERROR: can not create /dev/%s (err=%d)\n",
+			    NDPROXY_DEV, err);
 #ifdef DEBUG_NDPROXY
 		uprintf("NDPROXY loaded\n");
 		printf("NDPROXY loaded\n");
@@ -107,7 +365,11 @@ event_handler(struct module *module, const int event, void *arg)
 		return 0;
 
 	case MOD_UNLOAD:
-		unregister_hook();
+		nd_ctl_free();
+		EVENTHANDLER_DEREGISTER(ifnet_arrival_event, ifnet_arrival_tag);
+		EVENTHANDLER_DEREGISTER(ifnet_departure_event, ifnet_departure_tag);
+		EVENTHANDLER_DEREGISTER(ifnet_rename_event, ifnet_rename_tag);
+		EVENTHANDLER_DEREGISTER(ifaddr_event, ifaddr_tag);
 #ifdef DEBUG_NDPROXY
 		uprintf("NDPROXY unloaded\n");
 		printf("NDPROXY unloaded\n");
@@ -130,91 +392,419 @@ static moduledata_t ndproxy_conf = {
 DECLARE_MODULE(ndproxy, ndproxy_conf, SI_SUB_DRIVERS, SI_ORDER_MIDDLE);
 SYSCTL_DECL(_net_inet6);
 
+/*
+ * Copy in the new value of a string sysctl node. On success, *bufp is
+ * a NUL terminated copy to free with M_NDPROXY.
+ */
+static int
+sysctl_string_in(struct sysctl_req *req, char **bufp)
+{
+	char *buf;
+	int err;
+
+	buf = malloc(req->newlen + 1, M_NDPROXY, M_WAITOK);
+	if ((err = SYSCTL_IN(req, buf, req->newlen)) != 0) {
+		free(buf, M_NDPROXY);
+		return (err);
+	}
+	buf[req->newlen] = '\0';
+	*bufp = buf;
+	return (0);
+}
+
+/*
+ * Upper bound of the number of elements in a list.
+ */
+static int
+list_count(const char *buf)
+{
+	int count = 1;
+
+	for (; (buf = strchr(buf, DELIM)) != NULL; buf++)
+		count++;
+	return (count);
+}
+
 /*
  * Get or update the value of the sysctl node named
- * net.inet6.ndproxy.{uplink,exception}_addr_list
+ * net.inet6.ndproxy.uplink_addr_list
+ *
+ * An addr may be followed by SCOPE_DELIM and the name of the only
+ * uplink interface it is accepted on.
  */
 static int
-addr_list(SYSCTL_HANDLER_ARGS, int str_size, int nentries_max,
-    struct in6_addr *out_addrs, int *out_count)
+uplink_addr_list(SYSCTL_HANDLER_ARGS)
 {
-	struct in6_addr addrs[nentries_max];
-	char buf[str_size];
-	char *delim, *next;
-	int change = true;
-	int err, count = 0;
-
-	if (req->newptr != NULL)
-		strncpy(buf, (const char*)req->newptr, UP_IFACE_STR_MAX);
-	else
-		change = false;
+	struct nd_uplink_addr *addrs, *old;
+	struct sbuf sb;
+	char addr_str[INET6_ADDRSTRLEN];
+	char *buf, *delim, *next, *scope;
+	int err = 0, i, count = 0;
+
+	sx_slock(&ndproxy_conf_lock);
+	sbuf_new_for_sysctl(&sb, NULL, 8 * INET6_ADDRSTRLEN, req);
+	for (i = 0; i < V_uplink_addrs_set; i++) {
+		if (i > 0)
+			sbuf_putc(&sb, DELIM);
+		sbuf_cat(&sb, inet_ntop(AF_INET6, &V_uplink_addrs[i].nu_addr,
+		    addr_str, INET6_ADDRSTRLEN));
+		if (V_uplink_addrs[i].nu_ifname[0] != '\0')
+			sbuf_printf(&sb, "%c%s", SCOPE_DELIM,
+			    V_uplink_addrs[i].nu_ifname);
+	}
+	err = sbuf_finish(&sb);
+	sbuf_delete(&sb);
+	sx_sunlock(&ndproxy_conf_lock);
+	if (err != 0 || req->newptr == NULL)
+		return (err);
+
+	if ((err = sysctl_string_in(req, &buf)) != 0)
+		return (err);
+	addrs = mallocarray(UPLINK_MAX, sizeof(struct nd_uplink_addr),
+	    M_NDPROXY, M_WAITOK | M_ZERO);
 	next = buf;
-	while (change && *next != '\0') {
+	while (*next != '\0') {
 		delim = strchr(next, DELIM);
 		if (delim != NULL)
 			*delim = '\0';
+		scope = strchr(next, SCOPE_DELIM);
+		if (scope != NULL)
+			*scope++ = '\0';
 
-		err = inet_pton(AF_INET6, next, &addrs[count]);
-		if (err == 0)
+		if (count >= UPLINK_MAX ||
+		    inet_pton(AF_INET6, next, &addrs[count].nu_addr) != 1 ||
+		    (scope != NULL &&
+		    strlcpy(addrs[count].nu_ifname, scope, IFNAMSIZ) >= IFNAMSIZ)) {
 			err = EINVAL;
-		if (err != 1)
-			return (err);
+			break;
+		}
 #ifdef DEBUG_NDPROXY
 		printf("NDPROXY INFO: parsed: [ %s ]\n", next);
 #endif
 		count++;
 
-		/* Break at end of list, or max entries. */
-		if (delim == NULL || count >= nentries_max)
+		if (delim == NULL)
 			break;
-		else
-			next = delim + 1;
+		next = delim + 1;
 	}
-
-	if (count >= nentries_max)
-		return EINVAL;
-	
-	if ((err = sysctl_handle_string(oidp, arg1, arg2, req)) != 0)
+	free(buf, M_NDPROXY);
+	if (err != 0) {
+		free(addrs, M_NDPROXY);
 		return (err);
+	}
 
 	/* Apply changes. */
-	if (change) {
-		bcopy(addrs, out_addrs, count * sizeof(struct in6_addr));
-		*out_count = count;
-	}
-	return (err);
+	sx_xlock(&ndproxy_conf_lock);
+	old = V_uplink_addrs;
+	V_uplink_addrs = addrs;
+	V_uplink_addrs_set = count;
+	nd_iface_conf_update();
+	sx_xunlock(&ndproxy_conf_lock);
+	free(old, M_NDPROXY);
+	return (0);
 }
 
+/*
+ * Get or update the value of the sysctl node named
+ * net.inet6.ndproxy.exception_addr_list
+ *
+ * The list can hold far more addresses than a fixed string buffer, so
+ * it is read back from the hash table and a new table is built from
+ * the new value, then published in a new conf.
+ */
 static int
 exception_addr_list(SYSCTL_HANDLER_ARGS)
 {
-	return addr_list(oidp, arg1, arg2, req, EXCEPTION_STR_MAX, EXCEPTION_MAX,
-	    exception_addrs, &exception_addrs_set);
+	struct nd_addr_hash *h;
+	struct in6_addr addr;
+	struct sbuf sb;
+	char addr_str[INET6_ADDRSTRLEN];
+	char *buf, *delim, *next;
+	u_int cursor = 0;
+	int err, count;
+
+	sx_slock(&ndproxy_conf_lock);
+	sbuf_new_for_sysctl(&sb, NULL, 8 * INET6_ADDRSTRLEN, req);
+	h = V_nd_active_conf != NULL ? V_nd_active_conf->nc_exceptions : NULL;
+	for (count = 0; nd_hash_next(h, &cursor, &addr); count++) {
+		if (count > 0)
+			sbuf_putc(&sb, DELIM);
+		sbuf_cat(&sb, inet_ntop(AF_INET6, &addr, addr_str, INET6_ADDRSTRLEN));
+	}
+	err = sbuf_finish(&sb);
+	sbuf_delete(&sb);
+	sx_sunlock(&ndproxy_conf_lock);
+	if (err != 0 || req->newptr == NULL)
+		return (err);
+
+	if ((err = sysctl_string_in(req, &buf)) != 0)
+		return (err);
+	if (list_count(buf) > EXCEPTION_MAX) {
+		free(buf, M_NDPROXY);
+		return (EINVAL);
+	}
+	h = nd_hash_alloc(list_count(buf));
+	next = buf;
+	while (*next != '\0') {
+		delim = strchr(next, DELIM);
+		if (delim != NULL)
+			*delim = '\0';
+
+		if (inet_pton(AF_INET6, next, &addr) != 1) {
+			err = EINVAL;
+			break;
+		}
+#ifdef DEBUG_NDPROXY
+		printf("NDPROXY INFO: parsed: [ %s ]\n", next);
+#endif
+		nd_hash_insert(h, &addr);
+
+		if (delim == NULL)
+			break;
+		next = delim + 1;
+	}
+	free(buf, M_NDPROXY);
+	if (err != 0) {
+		nd_hash_free(h);
+		return (err);
+	}
+
+	/* Apply changes. */
+	sx_xlock(&ndproxy_conf_lock);
+	nd_exceptions_update(h);
+	sx_xunlock(&ndproxy_conf_lock);
+	return (0);
 }
 
+/*
+ * Get or update the value of the sysctl node named
+ * net.inet6.ndproxy.target_policy_list
+ *
+ * Each element is a prefix, PREFIX_DELIM, its length, ACTION_DELIM and
+ * what to do with solicitations for targets in the prefix: proxy them
+ * with a downlink MAC, or POLICY_IGNORE them. The policies are read
+ * back from the trie, sorted by length.
+ */
 static int
-uplink_addr_list(SYSCTL_HANDLER_ARGS)
+target_policy_list(SYSCTL_HANDLER_ARGS)
+{
+	struct nd_policy_trie *pt;
+	struct nd_policy *np, *policies;
+	struct sbuf sb;
+	char addr_str[INET6_ADDRSTRLEN];
+	char *action, *buf, *delim, *end, *len, *next;
+	int err = 0, i, count = 0;
+	unsigned int o0, o1, o2, o3, o4, o5;
+
+	sx_slock(&ndproxy_conf_lock);
+	sbuf_new_for_sysctl(&sb, NULL, 8 * INET6_ADDRSTRLEN, req);
+	pt = V_nd_active_conf != NULL ? V_nd_active_conf->nc_policy : NULL;
+	for (i = 0; pt != NULL && i < pt->pt_count; i++) {
+		np = &pt->pt_policies[i];
+		if (i > 0)
+			sbuf_putc(&sb, DELIM);
+		sbuf_printf(&sb, "%s%c%d%c", inet_ntop(AF_INET6, &np->np_prefix,
+		    addr_str, INET6_ADDRSTRLEN), PREFIX_DELIM, np->np_len,
+		    ACTION_DELIM);
+		if (np->np_ignore)
+			sbuf_cat(&sb, POLICY_IGNORE);
+		else
+			sbuf_printf(&sb, "%6D", np->np_mac.octet, ":");
+	}
+	err = sbuf_finish(&sb);
+	sbuf_delete(&sb);
+	sx_sunlock(&ndproxy_conf_lock);
+	if (err != 0 || req->newptr == NULL)
+		return (err);
+
+	if ((err = sysctl_string_in(req, &buf)) != 0)
+		return (err);
+	if (list_count(buf) > POLICY_MAX) {
+		free(buf, M_NDPROXY);
+		return (EINVAL);
+	}
+	policies = mallocarray(list_count(buf), sizeof(struct nd_policy),
+	    M_NDPROXY, M_WAITOK | M_ZERO);
+	next = buf;
+	while (*next != '\0') {
+		delim = strchr(next, DELIM);
+		if (delim != NULL)
+			*delim = '\0';
+		np = &policies[count];
+
+		len = strchr(next, PREFIX_DELIM);
+		action = strchr(next, ACTION_DELIM);
+		if (len == NULL || action == NULL || action < len) {
+			err = EINVAL;
+			break;
+		}
+		*len++ = '\0';
+		*action++ = '\0';
+		np->np_len = strtol(len, &end, 10);
+		if (inet_pton(AF_INET6, next, &np->np_prefix) != 1 ||
+		    *len == '\0' || *end != '\0' ||
+		    np->np_len < 0 || np->np_len > 128) {
+			err = EINVAL;
+			break;
+		}
+		if (strcmp(action, POLICY_IGNORE) == 0)
+			np->np_ignore = true;
+		else if (sscanf(action, "%x:%x:%x:%x:%x:%x",
+		    &o0, &o1, &o2, &o3, &o4, &o5) == 6) {
+			np->np_mac.octet[0] = o0;
+			np->np_mac.octet[1] = o1;
+			np->np_mac.octet[2] = o2;
+			np->np_mac.octet[3] = o3;
+			np->np_mac.octet[4] = o4;
+			np->np_mac.octet[5] = o5;
+		} else {
+			err = EINVAL;
+			break;
+		}
+#ifdef DEBUG_NDPROXY
+		printf("NDPROXY INFO: parsed: [ %s ]\n", next);
+#endif
+		count++;
+		if (delim == NULL)
+			break;
+		next = delim + 1;
+	}
+	free(buf, M_NDPROXY);
+	pt = NULL;
+	if (err == 0 && count > 0)
+		err = nd_trie_build(policies, count, &pt);
+	if (err != 0 || count == 0)
+		free(policies, M_NDPROXY);
+	if (err != 0)
+		return (err);
+
+	/* Apply changes. */
+	sx_xlock(&ndproxy_conf_lock);
+	nd_policy_update(pt);
+	sx_xunlock(&ndproxy_conf_lock);
+	return (0);
+}
+
+/*
+ * Get or update the value of the sysctl node named
+ * net.inet6.ndproxy.refresh_target_list
+ *
+ * Each element is a target, or a prefix, PREFIX_DELIM and its length,
+ * at least REFRESH_PREFIX_MIN, standing for all the targets in it.
+ */
+static int
+refresh_target_list(SYSCTL_HANDLER_ARGS)
 {
-	return addr_list(oidp, arg1, arg2, req, UPLINK_STR_MAX, UPLINK_MAX,
-	    uplink_addrs, &uplink_addrs_set);
+	struct nd_refresh *rf;
+	struct nd_refresh_elem *re, *elems;
+	struct sbuf sb;
+	char addr_str[INET6_ADDRSTRLEN];
+	char *buf, *delim, *end, *len, *next;
+	int err = 0, i, count = 0;
+
+	sx_slock(&ndproxy_conf_lock);
+	sbuf_new_for_sysctl(&sb, NULL, 8 * INET6_ADDRSTRLEN, req);
+	rf = V_nd_refresh;
+	for (i = 0; rf != NULL && i < rf->rf_elems_count; i++) {
+		re = &rf->rf_elems[i];
+		if (i > 0)
+			sbuf_putc(&sb, DELIM);
+		sbuf_cat(&sb, inet_ntop(AF_INET6, &re->re_prefix, addr_str,
+		    INET6_ADDRSTRLEN));
+		if (re->re_len != 128)
+			sbuf_printf(&sb, "%c%d", PREFIX_DELIM, re->re_len);
+	}
+	err = sbuf_finish(&sb);
+	sbuf_delete(&sb);
+	sx_sunlock(&ndproxy_conf_lock);
+	if (err != 0 || req->newptr == NULL)
+		return (err);
+
+	if ((err = sysctl_string_in(req, &buf)) != 0)
+		return (err);
+	if (list_count(buf) > REFRESH_MAX) {
+		free(buf, M_NDPROXY);
+		return (EINVAL);
+	}
+	elems = mallocarray(list_count(buf), sizeof(struct nd_refresh_elem),
+	    M_NDPROXY, M_WAITOK | M_ZERO);
+	next = buf;
+	while (*next != '\0') {
+		delim = strchr(next, DELIM);
+		if (delim != NULL)
+			*delim = '\0';
+		re = &elems[count];
+
+		re->re_len = 128;
+		if ((len = strchr(next, PREFIX_DELIM)) != NULL) {
+			*len++ = '\0';
+			re->re_len = strtol(len, &end, 10);
+			if (*len == '\0' || *end != '\0') {
+				err = EINVAL;
+				break;
+			}
+		}
+		if (inet_pton(AF_INET6, next, &re->re_prefix) != 1 ||
+		    re->re_len < REFRESH_PREFIX_MIN || re->re_len > 128) {
+			err = EINVAL;
+			break;
+		}
+#ifdef DEBUG_NDPROXY
+		printf("NDPROXY INFO: parsed: [ %s ]\n", next);
+#endif
+		count++;
+		if (delim == NULL)
+			break;
+		next = delim + 1;
+	}
+	free(buf, M_NDPROXY);
+	rf = NULL;
+	if (err == 0 && count > 0)
+		err = nd_refresh_build(elems, count, &rf);
+	if (err != 0 || count == 0)
+		free(elems, M_NDPROXY);
+	if (err != 0)
+		return (err);
+
+	/* Apply changes. */
+	sx_xlock(&ndproxy_conf_lock);
+	nd_refresh_update(rf);
+	sx_xunlock(&ndproxy_conf_lock);
+	return (0);
 }
 
 static int
 downlink_mac_list(SYSCTL_HANDLER_ARGS)
 {
-	struct ether_addr addrs[UP_IFACE_MAX];
-	char buf[DOWN_MAC_STR_MAX];
-	char *delim, *next;
-	int err, i, count = 0;
-	int change = true;
+	struct ether_addr *addrs, *old;
+	struct sbuf sb;
+	char *buf, *delim, *next;
+	int err = 0, i, count = 0;
 	unsigned int o0, o1, o2, o3, o4, o5;
 
-	if (req->newptr != NULL)
-		strncpy(buf, (const char*)req->newptr, UP_IFACE_STR_MAX);
-	else
-		change = false;
+	sx_slock(&ndproxy_conf_lock);
+	sbuf_new_for_sysctl(&sb, NULL, 8 * ETHER_ADDR_STRLEN, req);
+	for (i = 0; i < V_downlink_mac_addrs_set; i++) {
+		if (i > 0)
+			sbuf_putc(&sb, DELIM);
+		sbuf_printf(&sb, "%6D", V_downlink_mac_addrs[i].octet, ":");
+	}
+	err = sbuf_finish(&sb);
+	sbuf_delete(&sb);
+	sx_sunlock(&ndproxy_conf_lock);
+	if (err != 0 || req->newptr == NULL)
+		return (err);
+
+	if ((err = sysctl_string_in(req, &buf)) != 0)
+		return (err);
+	if (list_count(buf) > UP_IFACE_MAX) {
+		free(buf, M_NDPROXY);
+		return (EINVAL);
+	}
+	addrs = mallocarray(list_count(buf), sizeof(struct ether_addr),
+	    M_NDPROXY, M_WAITOK);
 	next = buf;
-	while (change && *next != '\0') {
+	while (*next != '\0') {
 		delim = strchr(next, DELIM);
 		if (delim != NULL)
 			*delim = '\0';
@@ -222,8 +812,10 @@ downlink_mac_list(SYSCTL_HANDLER_ARGS)
 		/* Parse MAC address. */
 		i = sscanf(next, "%x:%x:%x:%x:%x:%x",
 		    &o0, &o1, &o2, &o3, &o4, &o5);
-		if (i != 6)
-			return (EINVAL);
+		if (i != 6) {
+			err = EINVAL;
+			break;
+		}
 		addrs[count].octet[0] = o0;
 		addrs[count].octet[1] = o1;
 		addrs[count].octet[2] = o2;
@@ -234,86 +826,249 @@ downlink_mac_list(SYSCTL_HANDLER_ARGS)
 		printf("NDPROXY INFO: parsed: [ %s ]\n", next);
 #endif
 		count++;
-		if (delim == NULL || count >= UP_IFACE_MAX)
+		if (delim == NULL)
 			break;
-		else
-			next = delim + 1;
+		next = delim + 1;
 	}
-
-	/* Reached max entries. */
-	if (count >= UP_IFACE_MAX)
-		return EINVAL;
-
-	if ((err = sysctl_handle_string(oidp, arg1, arg2, req)) != 0)
+	free(buf, M_NDPROXY);
+	if (err != 0) {
+		free(addrs, M_NDPROXY);
 		return (err);
+	}
 
 	/* Apply changes. */
-	if (change) {
-		bcopy(addrs, downlink_mac_addrs, count * sizeof(struct ether_addr));
-		downlink_mac_addrs_set = count;
-	}
-	return (err);
+	sx_xlock(&ndproxy_conf_lock);
+	old = V_downlink_mac_addrs;
+	V_downlink_mac_addrs = addrs;
+	V_downlink_mac_addrs_set = count;
+	nd_iface_conf_update();
+	sx_xunlock(&ndproxy_conf_lock);
+	free(old, M_NDPROXY);
+	return (0);
 }
 
 static int
 uplink_iface_list(SYSCTL_HANDLER_ARGS)
 {
-	char addrs[UP_IFACE_MAX][IFNAMSIZ];
-	char buf[UP_IFACE_STR_MAX];
-	char *delim, *next;
-	int err, i, count = 0;
-	int change = true;
-
-	if (req->newptr != NULL)
-		strncpy(buf, (const char*)req->newptr, UP_IFACE_STR_MAX);
-	else
-		change = false;
+	char (*names)[IFNAMSIZ], (*old)[IFNAMSIZ];
+	struct sbuf sb;
+	char *buf, *delim, *next;
+	int err = 0, i, count = 0;
+
+	sx_slock(&ndproxy_conf_lock);
+	sbuf_new_for_sysctl(&sb, NULL, 8 * IFNAMSIZ, req);
+	for (i = 0; i < V_up_ifaces_set; i++) {
+		if (i > 0)
+			sbuf_putc(&sb, DELIM);
+		sbuf_cat(&sb, V_up_ifaces[i]);
+	}
+	err = sbuf_finish(&sb);
+	sbuf_delete(&sb);
+	sx_sunlock(&ndproxy_conf_lock);
+	if (err != 0 || req->newptr == NULL)
+		return (err);
+
+	if ((err = sysctl_string_in(req, &buf)) != 0)
+		return (err);
+	if (list_count(buf) > UP_IFACE_MAX) {
+		free(buf, M_NDPROXY);
+		return (EINVAL);
+	}
+	names = mallocarray(list_count(buf), IFNAMSIZ, M_NDPROXY, M_WAITOK);
 	next = buf;
-	while (change && *next != '\0') {
+	while (*next != '\0') {
 		delim = strchr(next, DELIM);
 		if (delim != NULL)
 			*delim = '\0';
 
-		strncpy(addrs[count], next, IFNAMSIZ);
+		if (strlcpy(names[count], next, IFNAMSIZ) >= IFNAMSIZ) {
+			err = EINVAL;
+			break;
+		}
 #ifdef DEBUG_NDPROXY
 		printf("NDPROXY INFO: parsed: [ %s ]\n", next);
 #endif
 		count++;
-		if (delim == NULL || count >= UP_IFACE_MAX)
+		if (delim == NULL)
 			break;
-		else
-			next = delim + 1;
+		next = delim + 1;
 	}
-
-	/* Reached max entries. */
-	if (count >= UP_IFACE_MAX)
-		return EINVAL;
-
-	if ((err = sysctl_handle_string(oidp, arg1, arg2, req)) != 0)
+	free(buf, M_NDPROXY);
+	if (err != 0) {
+		free(names, M_NDPROXY);
 		return (err);
+	}
 
 	/* Apply changes. */
-	if (change) {
-		for (i = 0; i < UP_IFACE_MAX; i++) {
-			if (i < count)
-				strncpy(up_ifaces[i], addrs[i], IFNAMSIZ);
-			else if (up_ifaces[i][0] == '\0')
-				break;
-			else
-				up_ifaces[i][0] = '\0';
-		}
-	}
-	return (err);
+	sx_xlock(&ndproxy_conf_lock);
+	old = V_up_ifaces;
+	V_up_ifaces = names;
+	V_up_ifaces_set = count;
+	nd_iface_conf_update();
+	sx_xunlock(&ndproxy_conf_lock);
+	free(old, M_NDPROXY);
+	return (0);
 }
 
 static int
 cb_count(SYSCTL_HANDLER_ARGS)
 {
+	uint64_t count;
+	int err;
+
 	register_hook();
 #ifdef DEBUG_NDPROXY
 	printf("NDPROXY INFO: count\n");
 #endif
-	return sysctl_handle_int(oidp, arg1, arg2, req);
+	count = counter_u64_fetch(V_ndproxystat[NDSTAT_IDX(nds_sent)]);
+	err = sysctl_handle_64(oidp, &count, 0, req);
+	if (err == 0 && req->newptr != NULL)
+		counter_u64_zero(V_ndproxystat[NDSTAT_IDX(nds_sent)]);
+	return (err);
+}
+
+/*
+ * Rate limits, in advertisements per second, 0 for no limit. A bucket
+ * holds up to rate * hz tokens in a u_int, see ndrate.c.
+ */
+static int
+rate_limit(SYSCTL_HANDLER_ARGS)
+{
+	int err, rate;
+
+	rate = *(int *)arg1;
+	err = sysctl_handle_int(oidp, &rate, 0, req);
+	if (err != 0 || req->newptr == NULL)
+		return (err);
+	if (rate < 0 || rate > ND_RATE_MAX || (u_int)rate > UINT_MAX / hz)
+		return (EINVAL);
+	*(int *)arg1 = rate;
+	return (0);
+}
+
+/*
+ * Batch size and queue depth of the deferred mode, interval of the
+ * event summaries, interval and burst of the refresh, lifetime of the
+ * reachability cache entries.
+ */
+static int
+defer_limit(SYSCTL_HANDLER_ARGS)
+{
+	int err, val;
+
+	val = *(int *)arg1;
+	err = sysctl_handle_int(oidp, &val, 0, req);
+	if (err != 0 || req->newptr == NULL)
+		return (err);
+	if (val < 1 || val > arg2)
+		return (EINVAL);
+	*(int *)arg1 = val;
+	return (0);
+}
+
+/*
+ * Turn the latency histograms on or off. They are zeroed when turned
+ * on, so that they only hold samples of the current run.
+ */
+static int
+latency_hist(SYSCTL_HANDLER_ARGS)
+{
+	int err, val;
+
+	val = nd_latency;
+	err = sysctl_handle_int(oidp, &val, 0, req);
+	if (err != 0 || req->newptr == NULL)
+		return (err);
+	if (val != 0 && val != 1)
+		return (EINVAL);
+	if (val && !nd_latency)
+		nd_lat_zero();
+	nd_latency = val;
+	return (0);
+}
+
+/*
+ * Drain the events queued in the vnet of the caller as an array of
+ * struct ndproxy_event. Those that do not fit in the buffer of the
+ * caller stay queued. Draining removes them for every reader, and they
+ * hold the addrs of the hosts, so this is reserved to the superuser.
+ */
+static int
+ndproxy_events(SYSCTL_HANDLER_ARGS)
+{
+	struct ndproxy_event *buf;
+	u_int count, max;
+	int err;
+
+	if ((err = priv_check(req->td, PRIV_NETINET_ND6)) != 0)
+		return (err);
+	if (req->oldptr == NULL)
+		return (SYSCTL_OUT(req, NULL,
+		    nd_event_pending() * sizeof(struct ndproxy_event)));
+	max = MIN(req->oldlen / sizeof(struct ndproxy_event),
+	    (mp_maxid + 1) * ND_EVENT_RING);
+	if (max == 0)
+		return (0);
+	buf = mallocarray(max, sizeof(struct ndproxy_event), M_NDPROXY,
+	    M_WAITOK);
+	count = nd_event_copy(buf, max);
+	err = SYSCTL_OUT(req, buf, count * sizeof(struct ndproxy_event));
+	free(buf, M_NDPROXY);
+	return (err);
+}
+
+/*
+ * Turn the variants of the hook specialized for the shape of the conf
+ * on or off. The generic hook is linked back at once when turned off,
+ * e.g. to compare them.
+ */
+static int
+hook_specialize(SYSCTL_HANDLER_ARGS)
+{
+	int err, val;
+
+	val = V_hook_specialize;
+	err = sysctl_handle_int(oidp, &val, 0, req);
+	if (err != 0 || req->newptr == NULL)
+		return (err);
+	if (val != 0 && val != 1)
+		return (EINVAL);
+	sx_xlock(&ndproxy_conf_lock);
+	V_hook_specialize = val;
+	nd_hook_link(V_nd_active_conf);
+	sx_xunlock(&ndproxy_conf_lock);
+	return (0);
+}
+
+/*
+ * Name of the variant of the hook in use.
+ */
+static int
+hook_variant(SYSCTL_HANDLER_ARGS)
+{
+	char name[32];
+
+	sx_slock(&ndproxy_conf_lock);
+	strlcpy(name, nd_packet_variants[V_hook_shape].pv_name, sizeof(name));
+	sx_sunlock(&ndproxy_conf_lock);
+	return (sysctl_handle_string(oidp, name, sizeof(name), req));
+}
+
+/*
+ * Copy out the statistics as a struct ndproxystat. Writing anything
+ * zeroes them.
+ */
+static int
+ndproxy_stats(SYSCTL_HANDLER_ARGS)
+{
+	struct ndproxystat stats;
+	int err;
+
+	COUNTER_ARRAY_COPY(V_ndproxystat, &stats, NDSTAT_COUNT);
+	err = SYSCTL_OUT(req, &stats, sizeof(stats));
+	if (err == 0 && req->newptr != NULL)
+		COUNTER_ARRAY_ZERO(V_ndproxystat, NDSTAT_COUNT);
+	return (err);
 }
 
 /*
@@ -322,21 +1077,182 @@ cb_count(SYSCTL_HANDLER_ARGS)
 SYSCTL_NODE(_net_inet6, OID_AUTO, ndproxy, CTLFLAG_RW, 0, "NDPROXY Config Ctr");
 
 SYSCTL_PROC(_net_inet6_ndproxy, OID_AUTO, downlink_mac_list,
-	    CTLTYPE_STRING | CTLFLAG_RW, sysctl_downlink_mac_list, sizeof(sysctl_downlink_mac_list),
+    CTLTYPE_STRING | CTLFLAG_RW | CTLFLAG_VNET | CTLFLAG_MPSAFE, NULL, 0,
     downlink_mac_list, "S", "Downlink MAC Addresses");
 
 SYSCTL_PROC(_net_inet6_ndproxy, OID_AUTO, uplink_iface_list,
-    CTLTYPE_STRING | CTLFLAG_RW, sysctl_iface_list, sizeof(sysctl_iface_list),
+    CTLTYPE_STRING | CTLFLAG_RW | CTLFLAG_VNET | CTLFLAG_MPSAFE, NULL, 0,
     uplink_iface_list, "S", "Interfaces with uplinks");
 
 SYSCTL_PROC(_net_inet6_ndproxy, OID_AUTO, exception_addr_list,
-    CTLTYPE_STRING | CTLFLAG_RW, sysctl_exception_addr_list, sizeof(sysctl_exception_addr_list),
+    CTLTYPE_STRING | CTLFLAG_RW | CTLFLAG_VNET | CTLFLAG_MPSAFE, NULL, 0,
     exception_addr_list, "S", "IPv6 addresses NOT to proxy");
 
 SYSCTL_PROC(_net_inet6_ndproxy, OID_AUTO, uplink_addr_list,
-    CTLTYPE_STRING | CTLFLAG_RW, sysctl_uplink_addr_list, sizeof(sysctl_uplink_addr_list),
+    CTLTYPE_STRING | CTLFLAG_RW | CTLFLAG_VNET | CTLFLAG_MPSAFE, NULL, 0,
     uplink_addr_list, "S", "Uplink router addresses");
 
+SYSCTL_PROC(_net_inet6_ndproxy, OID_AUTO, target_policy_list,
+    CTLTYPE_STRING | CTLFLAG_RW | CTLFLAG_VNET | CTLFLAG_MPSAFE, NULL, 0,
+    target_policy_list, "S", "Target prefixes and their downlink MAC");
+
+SYSCTL_PROC(_net_inet6_ndproxy, OID_AUTO, refresh_target_list,
+    CTLTYPE_STRING | CTLFLAG_RW | CTLFLAG_VNET | CTLFLAG_MPSAFE, NULL, 0,
+    refresh_target_list, "S", "Targets to advertise unsolicited");
+
+SYSCTL_PROC(_net_inet6_ndproxy, OID_AUTO, refresh_interval,
+    CTLTYPE_INT | CTLFLAG_RW | CTLFLAG_MPSAFE, &nd_refresh_interval,
+    ND_REFRESH_INTERVAL_MAX, defer_limit, "I",
+    "Seconds between two advertisements of a refresh target");
+
+SYSCTL_PROC(_net_inet6_ndproxy, OID_AUTO, refresh_burst,
+    CTLTYPE_INT | CTLFLAG_RW | CTLFLAG_MPSAFE, &nd_refresh_burst,
+    ND_REFRESH_BURST_MAX, defer_limit, "I",
+    "Max refresh targets advertised per step of the wheel");
+
 SYSCTL_PROC(_net_inet6_ndproxy, OID_AUTO, packet_count,
-    CTLTYPE_INT | CTLFLAG_RW, &ndproxy_conf_count, 0, cb_count, "I",
-    "fire an event");
+    CTLTYPE_U64 | CTLFLAG_RW | CTLFLAG_VNET | CTLFLAG_MPSAFE, NULL, 0,
+    cb_count, "QU",
+    "Neighbor advertisements sent");
+
+SYSCTL_PROC(_net_inet6_ndproxy, OID_AUTO, rate_pe,
+    CTLTYPE_INT | CTLFLAG_RW | CTLFLAG_MPSAFE, &nd_rate_pe, 0, rate_limit,
+    "I", "Max advertisements per second to a PE, per CPU (0: no limit)");
+
+SYSCTL_PROC(_net_inet6_ndproxy, OID_AUTO, rate_target,
+    CTLTYPE_INT | CTLFLAG_RW | CTLFLAG_MPSAFE, &nd_rate_target, 0, rate_limit,
+    "I", "Max advertisements per second for a target, per CPU (0: no limit)");
+
+SYSCTL_PROC(_net_inet6_ndproxy, OID_AUTO, rate_global,
+    CTLTYPE_INT | CTLFLAG_RW | CTLFLAG_MPSAFE, &nd_rate_global, 0, rate_limit,
+    "I", "Max advertisements per second, per vnet (0: no limit)");
+
+SYSCTL_INT(_net_inet6_ndproxy, OID_AUTO, direct_output, CTLFLAG_RW,
+    &nd_direct_output, 0,
+    "Send advertisements through the driver rather than ip6_output()");
+
+SYSCTL_INT(_net_inet6_ndproxy, OID_AUTO, inplace, CTLFLAG_RW,
+    &nd_inplace, 0, "Build advertisements in the mbuf of the solicitation");
+
+SYSCTL_INT(_net_inet6_ndproxy, OID_AUTO, reach_filter, CTLFLAG_RW,
+    &nd_reach_filter, 0,
+    "Only proxy targets routed or seen downstream");
+
+SYSCTL_PROC(_net_inet6_ndproxy, OID_AUTO, reach_ttl,
+    CTLTYPE_INT | CTLFLAG_RW | CTLFLAG_MPSAFE, &nd_reach_ttl,
+    ND_REACH_TTL_MAX, defer_limit, "I",
+    "Seconds a target stays in the reachability cache");
+
+SYSCTL_INT(_net_inet6_ndproxy, OID_AUTO, deferred, CTLFLAG_RW,
+    &nd_deferred, 0, "Send advertisements from per-CPU taskqueues");
+
+SYSCTL_PROC(_net_inet6_ndproxy, OID_AUTO, deferred_batch,
+    CTLTYPE_INT | CTLFLAG_RW | CTLFLAG_MPSAFE, &nd_defer_batch,
+    ND_DEFER_BATCH_MAX, defer_limit, "I",
+    "Advertisements sent per taskqueue run in deferred mode");
+
+SYSCTL_PROC(_net_inet6_ndproxy, OID_AUTO, deferred_depth,
+    CTLTYPE_INT | CTLFLAG_RW | CTLFLAG_MPSAFE, &nd_defer_depth,
+    ND_DEFER_MAX, defer_limit, "I",
+    "Solicitations queued per CPU in deferred mode");
+
+SYSCTL_PROC(_net_inet6_ndproxy, OID_AUTO, hook_specialize,
+    CTLTYPE_INT | CTLFLAG_RW | CTLFLAG_VNET | CTLFLAG_MPSAFE, NULL, 0,
+    hook_specialize, "I",
+    "Use the variant of the hook specialized for the config");
+
+SYSCTL_PROC(_net_inet6_ndproxy, OID_AUTO, hook_variant,
+    CTLTYPE_STRING | CTLFLAG_RD | CTLFLAG_VNET | CTLFLAG_MPSAFE, NULL, 0,
+    hook_variant, "A", "Variant of the hook in use");
+
+SYSCTL_PROC(_net_inet6_ndproxy, OID_AUTO, stats,
+    CTLTYPE_OPAQUE | CTLFLAG_RW | CTLFLAG_VNET | CTLFLAG_MPSAFE, NULL, 0,
+    ndproxy_stats,
+    "S,ndproxystat", "NDPROXY statistics (struct ndproxystat, ndproxy.h)");
+
+SYSCTL_PROC(_net_inet6_ndproxy, OID_AUTO, events,
+    CTLTYPE_OPAQUE | CTLFLAG_RD | CTLFLAG_VNET | CTLFLAG_MPSAFE, NULL, 0,
+    ndproxy_events,
+    "S,ndproxy_event", "Drain the errors queued (struct ndproxy_event)");
+
+SYSCTL_PROC(_net_inet6_ndproxy, OID_AUTO, events_interval,
+    CTLTYPE_INT | CTLFLAG_RW | CTLFLAG_MPSAFE, &nd_event_interval,
+    ND_EVENT_INTERVAL_MAX, defer_limit, "I",
+    "Seconds between two logs of the errors met");
+
+SYSCTL_COUNTER_U64(_net_inet6_ndproxy, OID_AUTO, events_lost, CTLFLAG_RD,
+    &nd_event_lost, "Errors not queued, the queue of the CPU being full");
+
+SYSCTL_PROC(_net_inet6_ndproxy, OID_AUTO, latency_hist,
+    CTLTYPE_INT | CTLFLAG_RW | CTLFLAG_MPSAFE, NULL, 0, latency_hist, "I",
+    "Fill the latency histograms of net.inet6.ndproxy.latency");
+
+/*
+ * Latency histograms, one sysctl per stage, see ndlat.h.
+ */
+SYSCTL_NODE(_net_inet6_ndproxy, OID_AUTO, latency, CTLFLAG_RD, 0,
+    "NDPROXY latency histograms, in log2 of CPU cycles");
+
+#define	NDLAT_SYSCTL(name, stage, descr)				\
+	SYSCTL_COUNTER_U64_ARRAY(_net_inet6_ndproxy_latency, OID_AUTO,	\
+	    name, CTLFLAG_RW, nd_lat[stage], ND_LAT_BUCKETS, descr)
+
+NDLAT_SYSCTL(iface, ND_LAT_IFACE, "Uplink interface lookup");
+NDLAT_SYSCTL(classify, ND_LAT_CLASSIFY, "Neighbor solicitation checks");
+NDLAT_SYSCTL(pe, ND_LAT_PE, "Uplink router match");
+NDLAT_SYSCTL(cksum, ND_LAT_CKSUM, "Checksum verification");
+NDLAT_SYSCTL(target, ND_LAT_TARGET, "Exceptions, policies and rate limits");
+NDLAT_SYSCTL(alloc, ND_LAT_ALLOC, "Allocation of the reply");
+NDLAT_SYSCTL(src, ND_LAT_SRC, "Source address selection");
+NDLAT_SYSCTL(build, ND_LAT_BUILD, "Advertisement and its checksum");
+NDLAT_SYSCTL(output, ND_LAT_OUTPUT, "Output of the advertisement");
+
+/*
+ * The same statistics, one sysctl per counter.
+ */
+SYSCTL_NODE(_net_inet6_ndproxy, OID_AUTO, counters, CTLFLAG_RD, 0,
+    "NDPROXY counters");
+
+#define	NDSTAT_SYSCTL(name, descr)					\
+	SYSCTL_COUNTER_U64(_net_inet6_ndproxy_counters, OID_AUTO, name,	\
+	    CTLFLAG_VNET | CTLFLAG_RD,						\
+	    &VNET_NAME(ndproxystat)[NDSTAT_IDX(nds_##name)], descr)
+
+NDSTAT_SYSCTL(received, "Frames seen by the hook");
+NDSTAT_SYSCTL(not_icmp6, "Not ICMPv6 or with extension headers");
+NDSTAT_SYSCTL(not_ns, "ICMPv6 other than a neighbor solicitation");
+NDSTAT_SYSCTL(not_uplink, "Not from an uplink interface");
+NDSTAT_SYSCTL(no_mac, "From an uplink interface without a downlink MAC");
+NDSTAT_SYSCTL(not_router, "Not from an uplink router");
+NDSTAT_SYSCTL(cksum_hw, "Checksums verified by the NIC");
+NDSTAT_SYSCTL(cksum_sw, "Checksums verified in software");
+NDSTAT_SYSCTL(badsum, "Bad checksum");
+NDSTAT_SYSCTL(mcast_target, "Multicast target");
+NDSTAT_SYSCTL(exception, "Target in exception_addr_list");
+NDSTAT_SYSCTL(nombuf, "No mbuf for the reply");
+NDSTAT_SYSCTL(bad_dst, "From :: but not to a solicited-node address");
+NDSTAT_SYSCTL(scope, "Scope or source address errors");
+NDSTAT_SYSCTL(src_hit, "Reply source address found in the cache");
+NDSTAT_SYSCTL(src_miss, "Reply source address selected");
+NDSTAT_SYSCTL(output_err, "ip6_output() errors");
+NDSTAT_SYSCTL(sent, "Neighbor advertisements sent");
+NDSTAT_SYSCTL(rl_pe, "Advertisements suppressed by rate_pe");
+NDSTAT_SYSCTL(rl_target, "Advertisements suppressed by rate_target");
+NDSTAT_SYSCTL(rl_global, "Advertisements suppressed by rate_global");
+NDSTAT_SYSCTL(policy_ignore, "Target ignored by target_policy_list");
+NDSTAT_SYSCTL(direct, "Advertisements sent through the driver");
+NDSTAT_SYSCTL(deferred, "Solicitations queued in deferred mode");
+NDSTAT_SYSCTL(defer_overflow, "Solicitations not queued, queue full");
+NDSTAT_SYSCTL(inplace, "Advertisements built in the mbuf of the solicitation");
+NDSTAT_SYSCTL(refresh_sent, "Unsolicited advertisements sent");
+NDSTAT_SYSCTL(refresh_err, "Unsolicited advertisements not sent");
+NDSTAT_SYSCTL(refresh_late, "Refresh targets skipped, the round being over");
+NDSTAT_SYSCTL(refresh_burst, "Steps of the refresh wheel over refresh_burst");
+NDSTAT_SYSCTL(unreachable, "Target not reachable downstream");
+NDSTAT_SYSCTL(reach_hit, "Target reachability found in the cache");
+NDSTAT_SYSCTL(reach_miss, "Target reachability looked up in the FIB");
+NDSTAT_SYSCTL(reach_learned,
+    "Sources received on non-uplink interfaces put in the cache");
+NDSTAT_SYSCTL(promisc, "Uplink packets for another MAC seen by the inet6 hook");
+NDSTAT_SYSCTL(defer_stale,
+    "Queued solicitations dropped, their uplink interface being gone");
@@ -27,5 +27,122 @@
 #ifndef __NDPROXY_H
 #define __NDPROXY_H
 
+/*
+ * Statistics of the pfil hook, one counter per decision it takes.
+ * Read as a whole from net.inet6.ndproxy.stats.
+ */
+struct ndproxystat {
+	uint64_t	nds_received;	/* Frames seen by the hook. */
+	uint64_t	nds_not_icmp6;	/* Not ICMPv6 or extension headers. */
+	uint64_t	nds_not_ns;	/* ICMPv6 other than an NS. */
+	uint64_t	nds_not_uplink;	/* Not from an uplink interface. */
+	uint64_t	nds_no_mac;	/* Uplink without a downlink MAC. */
+	uint64_t	nds_not_router;	/* Not from an uplink router. */
+	uint64_t	nds_cksum_hw;	/* Checksum verified by the NIC. */
+	uint64_t	nds_cksum_sw;	/* Checksum verified in software. */
+	uint64_t	nds_badsum;	/* Bad checksum. */
+	uint64_t	nds_mcast_target; /* Multicast target. */
+	uint64_t	nds_exception;	/* Target in exception_addr_list. */
+	uint64_t	nds_nombuf;	/* No mbuf for the reply. */
+	uint64_t	nds_bad_dst;	/* From :: but not to solicited-node. */
+	uint64_t	nds_scope;	/* Scope or source address errors. */
+	uint64_t	nds_src_hit;	/* Source address from the cache. */
+	uint64_t	nds_src_miss;	/* Source address selected. */
+	uint64_t	nds_output_err;	/* ip6_output() failed. */
+	uint64_t	nds_sent;	/* Advertisements sent. */
+	uint64_t	nds_rl_pe;	/* Suppressed by rate_pe. */
+	uint64_t	nds_rl_target;	/* Suppressed by rate_target. */
+	uint64_t	nds_rl_global;	/* Suppressed by rate_global. */
+	uint64_t	nds_policy_ignore; /* Target ignored by a policy. */
+	uint64_t	nds_direct;	/* Sent through if_transmit. */
+	uint64_t	nds_deferred;	/* Queued in deferred mode. */
+	uint64_t	nds_defer_overflow; /* Not queued, queue full. */
+	uint64_t	nds_inplace;	/* Built in the mbuf of the NS. */
+	uint64_t	nds_refresh_sent; /* Unsolicited NA sent. */
+	uint64_t	nds_refresh_err; /* Unsolicited NA not sent. */
+	uint64_t	nds_refresh_late; /* Targets skipped in a round. */
+	uint64_t	nds_refresh_burst; /* Slots over refresh_burst. */
+	uint64_t	nds_unreachable; /* Target not reachable downstream. */
+	uint64_t	nds_reach_hit;	/* Reachability from the cache. */
+	uint64_t	nds_reach_miss;	/* Reachability from the FIB. */
+	uint64_t	nds_reach_learned; /* Non-uplink sources cached. */
+	uint64_t	nds_promisc;	/* Uplink packets for another MAC. */
+	uint64_t	nds_defer_stale; /* Dequeued, uplink gone. */
+};
+
+/*
+ * Errors met while handling solicitations. Rather than printing them,
+ * the hook queues them on the CPU it runs on, and they are drained from
+ * net.inet6.ndproxy.events as an array of struct ndproxy_event.
+ */
+#define	NDPROXY_EV_NOMBUF	0	/* No mbuf. */
+#define	NDPROXY_EV_SRC_SCOPE	1	/* Scope of the NS source. */
+#define	NDPROXY_EV_SELECT_SRC	2	/* No source address to reply. */
+#define	NDPROXY_EV_NO_LLADDR	3	/* No link-local address. */
+#define	NDPROXY_EV_DST_SCOPE	4	/* Scope of the NA destination. */
+#define	NDPROXY_EV_BADSUM	5	/* Bad checksum. */
+#define	NDPROXY_EV_MCAST_TARGET	6	/* Multicast target. */
+#define	NDPROXY_EV_BAD_DST	7	/* From :: but not to solicited-node. */
+#define	NDPROXY_EV_OUTPUT	8	/* Output error. */
+#define	NDPROXY_EV_COUNT	9
+
+#define	NDPROXY_EV_NAMES						\
+	"nombuf", "src_scope", "select_src", "no_lladdr", "dst_scope",	\
+	"badsum", "mcast_target", "bad_dst", "output"
+
+struct ndproxy_event {
+	struct in6_addr	ne_src;		/* Source of the NS, if any. */
+	struct in6_addr	ne_target;	/* Its target, if known. */
+	int64_t		ne_uptime;	/* In seconds. */
+	int32_t		ne_err;		/* errno, if any. */
+	uint16_t	ne_type;	/* NDPROXY_EV_*. */
+	uint16_t	ne_ifindex;	/* Receiving interface. */
+};
+
+/*
+ * Bulk configuration through /dev/ndproxy, see ndproxyctl. The ioctl
+ * argument points to a packed nvlist(9) holding:
+ *   "op"	number, NDPROXY_OP_LOAD, NDPROXY_OP_ADD or NDPROXY_OP_DELETE;
+ *   "addrs"	binary, an array of struct in6_addr (NDPROXYIOC_EXCEPTIONS);
+ *   "policies"	binary, an array of struct ndproxy_policy
+ *		(NDPROXYIOC_POLICIES).
+ * A request is applied as a whole or not at all.
+ */
+#define	NDPROXY_DEV		"ndproxy"
+#define	NDPROXY_NV_MAX		(16 * 1024 * 1024) /* Max packed nvlist. */
+
+#define	NDPROXY_OP_LOAD		0	/* Replace the whole table. */
+#define	NDPROXY_OP_ADD		1
+#define	NDPROXY_OP_DELETE	2	/* Only the prefix and length count. */
+
+struct ndproxy_policy {
+	struct in6_addr	npp_prefix;
+	uint8_t		npp_len;
+	uint8_t		npp_ignore;	/* Do not proxy. */
+	uint8_t		npp_mac[6];	/* Downlink MAC otherwise. */
+};
+
+struct ndproxy_nv {
+	void		*nn_data;	/* Packed nvlist. */
+	size_t		 nn_len;
+};
+
+#define	NDPROXYIOC_EXCEPTIONS	_IOW('N', 1, struct ndproxy_nv)
+#define	NDPROXYIOC_POLICIES	_IOW('N', 2, struct ndproxy_nv)
+
+#ifdef _KERNEL
+#include <sys/counter.h>
+#include <net/vnet.h>
+
+#define	NDSTAT_COUNT	(sizeof(struct ndproxystat) / sizeof(uint64_t))
+#define	NDSTAT_IDX(name) (offsetof(struct ndproxystat, name) / sizeof(uint64_t))
+
+/* Each vnet has its own statistics. */
+VNET_PCPUSTAT_DECLARE(struct ndproxystat, ndproxystat);
+#define	V_ndproxystat	VNET(ndproxystat)
+
+#define	NDSTAT_ADD(name, val)	counter_u64_add(V_ndproxystat[NDSTAT_IDX(name)], (val))
+#define	NDSTAT_INC(name)	NDSTAT_ADD(name, 1)
+#endif
 
 #endif
@@ -0,0 +1,227 @@
+/*-
+ * Copyright (c) 2015-2019 Alexandre Fenyo <alex@fenyo.net> - http://www.fenyo.net
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Load, add or delete many exception addrs or target policies of the
+ * ndproxy module in one call, through the ioctls of /dev/ndproxy.
+ *
+ * The elements are read from a file, or from the standard input,
+ * separated by white space, with the syntax of the
+ * net.inet6.ndproxy.exception_addr_list and target_policy_list sysctls.
+ *
+ * Also drain and print the errors queued by the module.
+ */
+
+#include <sys/param.h>
+#include <sys/ioctl.h>
+#include <sys/nv.h>
+#include <sys/socket.h>
+#include <sys/sysctl.h>
+
+#include <net/if.h>
+
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include <err.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sysexits.h>
+#include <unistd.h>
+
+#include "ndproxy.h"
+
+static void
+usage(void)
+{
+	fprintf(stderr,
+	    "usage: ndproxyctl exceptions load|add|delete [file]\n"
+	    "       ndproxyctl policies load|add|delete [file]\n"
+	    "       ndproxyctl events\n");
+	exit(EX_USAGE);
+}
+
+/*
+ * Parse "prefix/len=MAC" or "prefix/len=ignore". When deleting, only
+ * the prefix and its length are needed.
+ */
+static int
+parse_policy(char *word, int op, struct ndproxy_policy *npp)
+{
+	char *action, *end, *len;
+	unsigned int o[6];
+	long l;
+	int i;
+
+	memset(npp, 0, sizeof(*npp));
+	if ((action = strchr(word, '=')) != NULL)
+		*action++ = '\0';
+	if ((len = strchr(word, '/')) == NULL)
+		return (-1);
+	*len++ = '\0';
+	l = strtol(len, &end, 10);
+	if (*len == '\0' || *end != '\0' || l < 0 || l > 128 ||
+	    inet_pton(AF_INET6, word, &npp->npp_prefix) != 1)
+		return (-1);
+	npp->npp_len = l;
+	if (action == NULL)
+		return (op == NDPROXY_OP_DELETE ? 0 : -1);
+	if (strcmp(action, "ignore") == 0) {
+		npp->npp_ignore = 1;
+		return (0);
+	}
+	if (sscanf(action, "%x:%x:%x:%x:%x:%x%n", &o[0], &o[1], &o[2], &o[3],
+	    &o[4], &o[5], &i) != 6 || action[i] != '\0')
+		return (-1);
+	for (i = 0; i < 6; i++)
+		npp->npp_mac[i] = o[i];
+	return (0);
+}
+
+/*
+ * Print the events queued by the module, one per line, and remove them
+ * from the queues.
+ */
+static int
+events(void)
+{
+	static const char *names[NDPROXY_EV_COUNT] = { NDPROXY_EV_NAMES };
+	struct ndproxy_event *ev;
+	char ifname[IF_NAMESIZE], src[INET6_ADDRSTRLEN];
+	char target[INET6_ADDRSTRLEN];
+	size_t i, len;
+
+	if (sysctlbyname("net.inet6.ndproxy.events", NULL, &len, NULL, 0) < 0)
+		err(EX_UNAVAILABLE, "net.inet6.ndproxy.events");
+	/* Leave room for the events queued meanwhile. */
+	len += 64 * sizeof(*ev);
+	if ((ev = malloc(len)) == NULL)
+		err(EX_OSERR, "malloc");
+	if (sysctlbyname("net.inet6.ndproxy.events", ev, &len, NULL, 0) < 0)
+		err(EX_UNAVAILABLE, "net.inet6.ndproxy.events");
+	for (i = 0; i < len / sizeof(*ev); i++) {
+		if (ev[i].ne_ifindex == 0 ||
+		    if_indextoname(ev[i].ne_ifindex, ifname) == NULL)
+			snprintf(ifname, sizeof(ifname), "-");
+		inet_ntop(AF_INET6, &ev[i].ne_src, src, sizeof(src));
+		inet_ntop(AF_INET6, &ev[i].ne_target, target, sizeof(target));
+		printf("%jd %s %s err=%d src=%s target=%s\n",
+		    (intmax_t)ev[i].ne_uptime, ev[i].ne_type < NDPROXY_EV_COUNT ?
+		    names[ev[i].ne_type] : "?", ifname, ev[i].ne_err, src,
+		    target);
+	}
+	free(ev);
+	return (0);
+}
+
+int
+main(int argc, char **argv)
+{
+	struct ndproxy_nv nn;
+	nvlist_t *nvl;
+	FILE *fp;
+	char word[256];
+	void *elems;
+	const char *key;
+	size_t count, size, alloc;
+	u_long cmd;
+	int exceptions, fd, op;
+
+	if (argc == 2 && strcmp(argv[1], "events") == 0)
+		return (events());
+	if (argc < 3 || argc > 4)
+		usage();
+	if (strcmp(argv[1], "exceptions") == 0) {
+		exceptions = 1;
+		cmd = NDPROXYIOC_EXCEPTIONS;
+		key = "addrs";
+		size = sizeof(struct in6_addr);
+	} else if (strcmp(argv[1], "policies") == 0) {
+		exceptions = 0;
+		cmd = NDPROXYIOC_POLICIES;
+		key = "policies";
+		size = sizeof(struct ndproxy_policy);
+	} else
+		usage();
+	if (strcmp(argv[2], "load") == 0)
+		op = NDPROXY_OP_LOAD;
+	else if (strcmp(argv[2], "add") == 0)
+		op = NDPROXY_OP_ADD;
+	else if (strcmp(argv[2], "delete") == 0)
+		op = NDPROXY_OP_DELETE;
+	else
+		usage();
+
+	fp = stdin;
+	if (argc == 4 && strcmp(argv[3], "-") != 0 &&
+	    (fp = fopen(argv[3], "r")) == NULL)
+		err(EX_NOINPUT, "%s", argv[3]);
+
+	count = 0;
+	alloc = 1024;
+	if ((elems = calloc(alloc, size)) == NULL)
+		err(EX_OSERR, "calloc");
+	while (fscanf(fp, "%255s", word) == 1) {
+		if (count == alloc) {
+			alloc *= 2;
+			if ((elems = reallocarray(elems, alloc, size)) == NULL)
+				err(EX_OSERR, "reallocarray");
+		}
+		if (exceptions ? inet_pton(AF_INET6, word,
+		    (struct in6_addr *)elems + count) != 1 :
+		    parse_policy(word, op, (struct ndproxy_policy *)elems +
+		    count) != 0)
+			errx(EX_DATAERR, "invalid element: %s", word);
+		count++;
+	}
+	if (ferror(fp))
+		err(EX_IOERR, "read");
+	if (fp != stdin)
+		fclose(fp);
+
+	nvl = nvlist_create(0);
+	nvlist_add_number(nvl, "op", op);
+	/* An empty array can not be added: leave it out, e.g. to clear. */
+	if (count > 0)
+		nvlist_add_binary(nvl, key, elems, count * size);
+	if (nvlist_error(nvl) != 0)
+		errc(EX_OSERR, nvlist_error(nvl), "nvlist");
+	if ((nn.nn_data = nvlist_pack(nvl, &nn.nn_len)) == NULL)
+		err(EX_OSERR, "nvlist_pack");
+
+	if ((fd = open("/dev/" NDPROXY_DEV, O_RDWR)) < 0)
+		err(EX_UNAVAILABLE, "/dev/" NDPROXY_DEV);
+	if (ioctl(fd, cmd, &nn) < 0)
+		err(EX_SOFTWARE, "%s %s", argv[1], argv[2]);
+	close(fd);
+	nvlist_destroy(nvl);
+	free(nn.nn_data);
+	free(elems);
+	return (0);
+}
@@ -0,0 +1,229 @@
+/*-
+ * Copyright (c) 2015-2019 Alexandre Fenyo <alex@fenyo.net> - http://www.fenyo.net
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Deferred, batched advertisements.
+ *
+ * In deferred mode, the pfil hook only checks the solicitation and
+ * queues what the advertisement needs (struct nd_request) on the CPU
+ * it runs on, so that a burst of solicitations does not hold the
+ * receive thread of the NIC while mbufs are allocated and replies are
+ * sent. Each CPU has a ring with a single producer, the hook, which
+ * runs in a critical section, and a single consumer, a taskqueue
+ * thread bound to the same CPU, which sends the advertisements by
+ * batches of nd_defer_batch. No lock is taken on either side.
+ *
+ * The hook only wakes up the taskqueue when it is idle: dc_pending is
+ * set by whoever enqueues the task, and cleared by the task once it
+ * finds the ring empty, before checking the ring a last time.
+ */
+
+#include <sys/param.h>
+#include <sys/systm.h>
+#include <sys/kernel.h>
+#include <sys/malloc.h>
+#include <sys/cpuset.h>
+#include <sys/epoch.h>
+#include <sys/pcpu.h>
+#include <sys/priority.h>
+#include <sys/proc.h>
+#include <sys/smp.h>
+#include <sys/socket.h>
+#include <sys/taskqueue.h>
+#include <net/if.h>
+#include <net/if_var.h>
+#include <net/ethernet.h>
+#include <net/vnet.h>
+#include <netinet/in.h>
+#include <netinet/icmp6.h>
+#include <netinet/ip6.h>
+
+#include "ndconf.h"
+#include "ndpacket.h"
+#include "ndproxy.h"
+#include "ndqueue.h"
+
+CTASSERT(powerof2(ND_DEFER_MAX));
+
+struct nd_defer_cpu {
+	/* Written by the hook. */
+	u_int			dc_head __aligned(CACHE_LINE_SIZE);
+	/* Written by the task. */
+	u_int			dc_tail __aligned(CACHE_LINE_SIZE);
+	u_int			dc_pending;	/* The task is enqueued. */
+	/* Read-only once set up. */
+	struct taskqueue	*dc_tq __aligned(CACHE_LINE_SIZE);
+	struct task		dc_task;
+	struct nd_request	dc_ring[ND_DEFER_MAX];
+} __aligned(CACHE_LINE_SIZE);
+
+int nd_deferred __read_mostly = 0;
+int nd_defer_batch __read_mostly = 32;
+int nd_defer_depth __read_mostly = 256;
+
+static struct nd_defer_cpu *nd_defer_cpus __read_mostly;
+
+static void	nd_defer_task(void *, int);
+
+void
+nd_defer_init(void)
+{
+	struct nd_defer_cpu *dc;
+	cpuset_t mask;
+	int cpu;
+
+	nd_defer_cpus = mallocarray(mp_maxid + 1, sizeof(struct nd_defer_cpu),
+	    M_NDPROXY, M_WAITOK | M_ZERO);
+	CPU_FOREACH(cpu) {
+		dc = &nd_defer_cpus[cpu];
+		TASK_INIT(&dc->dc_task, 0, nd_defer_task, dc);
+		dc->dc_tq = taskqueue_create("ndproxy", M_WAITOK,
+		    taskqueue_thread_enqueue, &dc->dc_tq);
+		CPU_SETOF(cpu, &mask);
+		taskqueue_start_threads_cpuset(&dc->dc_tq, 1, PI_NET, &mask,
+		    "ndproxy defer %d", cpu);
+	}
+}
+
+/*
+ * Send what is still queued. Called once a vnet has lost its hook, so
+ * that no request refers to it when it goes away.
+ */
+void
+nd_defer_drain(void)
+{
+	struct nd_defer_cpu *dc;
+	int cpu;
+
+	CPU_FOREACH(cpu) {
+		dc = &nd_defer_cpus[cpu];
+		taskqueue_drain(dc->dc_tq, &dc->dc_task);
+	}
+}
+
+/*
+ * Called once every pfil hook is gone.
+ */
+void
+nd_defer_free(void)
+{
+	int cpu;
+
+	nd_defer_drain();
+	CPU_FOREACH(cpu)
+		taskqueue_free(nd_defer_cpus[cpu].dc_tq);
+	free(nd_defer_cpus, M_NDPROXY);
+	nd_defer_cpus = NULL;
+}
+
+static void
+nd_defer_kick(struct nd_defer_cpu *dc)
+{
+	if (atomic_cmpset_int(&dc->dc_pending, 0, 1))
+		taskqueue_enqueue(dc->dc_tq, &dc->dc_task);
+}
+
+/*
+ * Queue a request on the current CPU. Return false if the queue is full.
+ */
+int
+nd_defer(const struct nd_request *nr)
+{
+	struct nd_defer_cpu *dc;
+	u_int head, depth;
+
+	depth = nd_defer_depth;
+	/* The net epoch is preemptible: stay on this CPU's ring. */
+	critical_enter();
+	dc = &nd_defer_cpus[curcpu];
+	head = dc->dc_head;
+	if (head - atomic_load_acq_int(&dc->dc_tail) >= depth) {
+		critical_exit();
+		NDSTAT_INC(nds_defer_overflow);
+		return (false);
+	}
+	dc->dc_ring[head & (ND_DEFER_MAX - 1)] = *nr;
+	atomic_store_rel_int(&dc->dc_head, head + 1);
+	critical_exit();
+	/*
+	 * Publish the request before looking at dc_pending. The taskqueue
+	 * lock may sleep, so the task of the ring is enqueued out of the
+	 * critical section, even if the hook has moved to another CPU.
+	 */
+	atomic_thread_fence_seq_cst();
+	if (atomic_load_int(&dc->dc_pending) == 0)
+		nd_defer_kick(dc);
+	NDSTAT_INC(nds_deferred);
+	return (true);
+}
+
+/*
+ * Send the advertisements for up to nd_defer_batch requests. The conf
+ * and the interface are looked up again in the vnet of the request, as
+ * they may have changed since the request was queued: a request for an
+ * interface that is no longer an uplink is dropped.
+ */
+static void
+nd_defer_task(void *arg, int pending __unused)
+{
+	struct nd_defer_cpu *dc = arg;
+	struct epoch_tracker et;
+	struct nd_request *nr;
+	struct nd_conf *conf;
+	struct nd_iface *nif;
+	struct ifnet *ifp;
+	u_int head, tail, batch;
+
+	batch = nd_defer_batch;
+	tail = dc->dc_tail;
+	head = atomic_load_acq_int(&dc->dc_head);
+	NET_EPOCH_ENTER(et);
+	for (; tail != head && batch > 0; tail++, batch--) {
+		nr = &dc->dc_ring[tail & (ND_DEFER_MAX - 1)];
+		CURVNET_SET(nr->nr_vnet);
+		conf = atomic_load_ptr(&V_nd_active_conf);
+		if (conf == NULL || nr->nr_ifindex >= conf->nc_ifaces_size ||
+		    (nif = conf->nc_ifaces[nr->nr_ifindex]) == NULL ||
+		    (ifp = ifnet_byindex(nr->nr_ifindex)) == NULL)
+			NDSTAT_INC(nds_defer_stale);
+		else
+			(void) nd_reply(ifp, nif, nr, NULL);
+		CURVNET_RESTORE();
+	}
+	NET_EPOCH_EXIT(et);
+	atomic_store_rel_int(&dc->dc_tail, tail);
+
+	/* Let the other tasks of the CPU run before the next batch. */
+	if (tail != head) {
+		taskqueue_enqueue(dc->dc_tq, &dc->dc_task);
+		return;
+	}
+	atomic_store_rel_int(&dc->dc_pending, 0);
+	/* Clear dc_pending before looking at the ring a last time. */
+	atomic_thread_fence_seq_cst();
+	if (atomic_load_acq_int(&dc->dc_head) != tail)
+		nd_defer_kick(dc);
+}
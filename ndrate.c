@@ -0,0 +1,182 @@
+/*-
+ * Copyright (c) 2015-2019 Alexandre Fenyo <alex@fenyo.net> - http://www.fenyo.net
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Rate limiting of the advertisements, so that a PE soliciting every
+ * address of the prefix (when the prefix is scanned from outside) can
+ * not make us spend the router CPU and the uplink answering.
+ *
+ * Each CPU has its own token buckets, indexed by a hash of the PE addr
+ * and by a hash of the target, so the hook shares no cache line with
+ * other CPUs. Different PEs or targets may share a bucket; this only
+ * makes the limit stricter for them. The global ceiling, checked last,
+ * is a ppsratecheck(9) shared by every CPU, as for ICMPv6 errors. A
+ * token is only spent once every limit lets the advertisement through,
+ * so a reply suppressed by one limit does not count against the others.
+ *
+ * The buckets and the ceiling belong to a vnet, so that a scan in a
+ * jail does not use up the limits of the others. The limits themselves
+ * are set for every vnet.
+ */
+
+#include <sys/param.h>
+#include <sys/systm.h>
+#include <sys/kernel.h>
+#include <sys/malloc.h>
+#include <sys/pcpu.h>
+#include <sys/proc.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <net/if.h>
+#include <net/ethernet.h>
+#include <net/vnet.h>
+#include <netinet/in.h>
+#include <netinet/icmp6.h>
+#include <netinet/ip6.h>
+
+#include "ndconf.h"
+#include "ndhash.h"
+#include "ndproxy.h"
+#include "ndrate.h"
+
+#define ND_RATE_PE_SLOTS	256
+#define ND_RATE_TARGET_SLOTS	4096
+
+/*
+ * Tokens are counted in 1/hz of an advertisement, so that a bucket is
+ * refilled by rate tokens per tick. A bucket holds at most one second
+ * worth of advertisements: rate * hz tokens, which rate_limit() keeps
+ * within a u_int.
+ */
+struct nd_bucket {
+	int	nb_ticks;	/* Last refill. */
+	u_int	nb_tokens;
+};
+
+struct nd_rate_cpu {
+	struct nd_bucket	nr_pe[ND_RATE_PE_SLOTS];
+	struct nd_bucket	nr_target[ND_RATE_TARGET_SLOTS];
+} __aligned(CACHE_LINE_SIZE);
+
+/*
+ * State of a vnet: the global ceiling, written by every CPU, then the
+ * buckets of each CPU. It is allocated rather than in the vnet, where
+ * the ceiling would share a cache line with what the hook reads.
+ */
+struct nd_rate_vnet {
+	struct timeval		rv_last __aligned(CACHE_LINE_SIZE);
+	int			rv_pps;
+	struct nd_rate_cpu	rv_cpus[];
+};
+
+int nd_rate_pe __read_mostly = 0;
+int nd_rate_target __read_mostly = 0;
+int nd_rate_global __read_mostly = 0;
+
+VNET_DEFINE_STATIC(struct nd_rate_vnet *, nd_rate) = NULL;
+#define	V_nd_rate	VNET(nd_rate)
+
+void
+nd_rate_init(void)
+{
+	V_nd_rate = malloc(sizeof(struct nd_rate_vnet) +
+	    (mp_maxid + 1) * sizeof(struct nd_rate_cpu), M_NDPROXY,
+	    M_WAITOK | M_ZERO);
+}
+
+/*
+ * Called once the pfil hook of the vnet is gone.
+ */
+void
+nd_rate_free(void)
+{
+	free(V_nd_rate, M_NDPROXY);
+	V_nd_rate = NULL;
+}
+
+/*
+ * Refill a bucket and return true if it holds a token.
+ */
+static int
+nd_bucket_refill(struct nd_bucket *nb, u_int rate, int now)
+{
+	uint64_t tokens, max;
+
+	max = (uint64_t)rate * hz;
+	tokens = nb->nb_tokens + (uint64_t)(u_int)(now - nb->nb_ticks) * rate;
+	nb->nb_ticks = now;
+	if (tokens > max)
+		tokens = max;
+	nb->nb_tokens = tokens;
+	return (tokens >= hz);
+}
+
+/*
+ * Return true if an advertisement for target may be sent to pe.
+ */
+int
+nd_rate_allow(const struct in6_addr *pe, const struct in6_addr *target)
+{
+	struct nd_rate_vnet *rv;
+	struct nd_rate_cpu *nr;
+	struct nd_bucket *nb_pe, *nb_target;
+	int rate_pe, rate_target, rate_global, now, ok;
+
+	rate_pe = nd_rate_pe;
+	rate_target = nd_rate_target;
+	rate_global = nd_rate_global;
+	if ((rate_pe | rate_target | rate_global) == 0)
+		return (true);
+
+	ok = true;
+	now = ticks;
+	/* The net epoch is preemptible: stay on this CPU's buckets. */
+	critical_enter();
+	rv = V_nd_rate;
+	nr = &rv->rv_cpus[curcpu];
+	nb_pe = &nr->nr_pe[nd_hash_addr(pe) & (ND_RATE_PE_SLOTS - 1)];
+	nb_target = &nr->nr_target[nd_hash_addr(target) &
+	    (ND_RATE_TARGET_SLOTS - 1)];
+	if (rate_pe != 0 && !nd_bucket_refill(nb_pe, rate_pe, now)) {
+		NDSTAT_INC(nds_rl_pe);
+		ok = false;
+	} else if (rate_target != 0 &&
+	    !nd_bucket_refill(nb_target, rate_target, now)) {
+		NDSTAT_INC(nds_rl_target);
+		ok = false;
+	} else if (rate_global != 0 &&
+	    !ppsratecheck(&rv->rv_last, &rv->rv_pps, rate_global)) {
+		NDSTAT_INC(nds_rl_global);
+		ok = false;
+	}
+	/* Every limit passed: spend the tokens. */
+	if (ok && rate_pe != 0)
+		nb_pe->nb_tokens -= hz;
+	if (ok && rate_target != 0)
+		nb_target->nb_tokens -= hz;
+	critical_exit();
+	return (ok);
+}
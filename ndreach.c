@@ -0,0 +1,213 @@
+/*-
+ * Copyright (c) 2015-2019 Alexandre Fenyo <alex@fenyo.net> - http://www.fenyo.net
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Reachability filter, see ndreach.h.
+ *
+ * A solicitation for a target is answered from the cache with a single
+ * probe most of the time; a miss costs a route lookup. Misses, the
+ * targets of a scan, are cached too, so that a scan costs one route
+ * lookup per target and per nd_reach_ttl, but in a cache of their own:
+ * a scan must not evict the hosts that are answered. The caches are
+ * written without a lock: a reader that races with a writer takes a
+ * miss, and two writers of the same entry leave it to the first one.
+ *
+ * Downstream is any interface that is not an uplink, for the learned
+ * sources as for the routes: the conf only names the uplinks. Only
+ * Ethernet interfaces go through the link-layer hook, so sources are
+ * not learned from the loopback or from tunnels.
+ */
+
+#include <sys/param.h>
+#include <sys/systm.h>
+#include <sys/kernel.h>
+#include <sys/malloc.h>
+#include <sys/mbuf.h>
+#include <sys/socket.h>
+#include <machine/atomic.h>
+#include <net/if.h>
+#include <net/if_var.h>
+#include <net/ethernet.h>
+#include <net/route.h>
+#include <net/route/nhop.h>
+#include <net/vnet.h>
+#include <netinet/in.h>
+#include <netinet/icmp6.h>
+#include <netinet/ip6.h>
+#include <netinet6/in6_fib.h>
+
+#include "ndconf.h"
+#include "ndhash.h"
+#include "ndproxy.h"
+#include "ndreach.h"
+
+int nd_reach_filter __read_mostly = 0;
+int nd_reach_ttl __read_mostly = 60;
+
+VNET_DEFINE_STATIC(struct nd_cache_entry *, nd_reach) = NULL;
+VNET_DEFINE_STATIC(struct nd_cache_entry *, nd_reach_neg) = NULL;
+#define	V_nd_reach	VNET(nd_reach)
+#define	V_nd_reach_neg	VNET(nd_reach_neg)
+
+/*
+ * Allocate the caches of the current vnet.
+ */
+void
+nd_reach_init(void)
+{
+	V_nd_reach = mallocarray(ND_REACH_SLOTS, sizeof(struct nd_cache_entry),
+	    M_NDPROXY, M_WAITOK | M_ZERO);
+	V_nd_reach_neg = mallocarray(ND_REACH_NEG_SLOTS,
+	    sizeof(struct nd_cache_entry), M_NDPROXY, M_WAITOK | M_ZERO);
+}
+
+/*
+ * Free the caches of the current vnet, once the hook is unlinked and
+ * the epoch is over.
+ */
+void
+nd_reach_free(void)
+{
+	free(V_nd_reach, M_NDPROXY);
+	free(V_nd_reach_neg, M_NDPROXY);
+	V_nd_reach = NULL;
+	V_nd_reach_neg = NULL;
+}
+
+static __inline struct nd_cache_entry *
+nd_reach_slot(const struct in6_addr *addr)
+{
+	return (&V_nd_reach[nd_hash_addr(addr) & (ND_REACH_SLOTS - 1)]);
+}
+
+static __inline struct nd_cache_entry *
+nd_reach_neg_slot(const struct in6_addr *addr)
+{
+	return (&V_nd_reach_neg[nd_hash_addr(addr) &
+	    (ND_REACH_NEG_SLOTS - 1)]);
+}
+
+/*
+ * Copy out the state of addr from its entry, and how old the entry is.
+ * Return false on a miss: another addr, an expired entry, or one being
+ * written.
+ */
+static int
+nd_reach_get(struct nd_cache_entry *re, const struct in6_addr *addr,
+    u_int gen, int *state, u_int *age)
+{
+	struct nd_cache_entry ce;
+
+	if (!nd_cache_get(re, &ce) || !IN6_ARE_ADDR_EQUAL(&ce.ce_addr, addr))
+		return (false);
+	*age = ticks - ce.ce_ticks;
+	if (*age > (u_int)nd_reach_ttl * hz)
+		return (false);
+	*state = ce.ce_val;
+	return (*state == ND_REACH_LEARNED || ce.ce_gen == gen);
+}
+
+/*
+ * Return true if the FIB routes target through an interface that is
+ * not an uplink: the default route, through the uplink, does not
+ * count, nor do reject and blackhole routes. Called in the net epoch.
+ */
+static int
+nd_reach_route(const struct nd_conf *conf, const struct in6_addr *target)
+{
+	struct nhop_object *nh;
+	u_int idx;
+
+	nh = fib6_lookup(RT_DEFAULT_FIB, target, 0, NHR_NONE, 0);
+	if (nh == NULL || (nh->nh_flags & (NHF_REJECT | NHF_BLACKHOLE)) != 0)
+		return (false);
+	idx = nh->nh_ifp->if_index;
+	return (idx >= conf->nc_ifaces_size || conf->nc_ifaces[idx] == NULL);
+}
+
+/*
+ * Return true if target is reachable downstream, looking it up in the
+ * FIB on a miss of both caches. Called in the net epoch.
+ */
+int
+nd_reach_check(const struct nd_conf *conf, const struct in6_addr *target)
+{
+	struct nd_cache_entry *re, *neg;
+	u_int age, gen;
+	int state;
+
+	re = nd_reach_slot(target);
+	neg = nd_reach_neg_slot(target);
+	gen = atomic_load_acq_int(&nd_src_gen);
+	if (nd_reach_get(re, target, gen, &state, &age) ||
+	    nd_reach_get(neg, target, gen, &state, &age)) {
+		NDSTAT_INC(nds_reach_hit);
+		return (state != ND_REACH_NONE);
+	}
+	NDSTAT_INC(nds_reach_miss);
+	if (nd_reach_route(conf, target)) {
+		nd_cache_put(re, gen, ND_REACH_ROUTE, target);
+		return (true);
+	}
+	nd_cache_put(neg, gen, ND_REACH_NONE, target);
+	return (false);
+}
+
+/*
+ * Take note of the source of an IPv6 frame received on an interface
+ * that is not an uplink. Only global unicast sources are learned, and
+ * only the frames whose IPv6 header is in the first mbuf are looked at.
+ * An entry still valid for half its lifetime is left as is, so that a
+ * busy host does not have its entry written on every packet.
+ */
+void
+nd_reach_learn(const struct mbuf *m)
+{
+	const struct ether_header *eh;
+	const struct ip6_hdr *ip6;
+	struct nd_cache_entry *re;
+	struct in6_addr src;
+	u_int age;
+	int state;
+
+	if (m->m_len < ETHER_HDR_LEN + sizeof(struct ip6_hdr))
+		return;
+	eh = mtod(m, const struct ether_header *);
+	if (eh->ether_type != htons(ETHERTYPE_IPV6))
+		return;
+	ip6 = (const struct ip6_hdr *)(eh + 1);
+	src = ip6->ip6_src;
+	if (IN6_IS_ADDR_UNSPECIFIED(&src) || IN6_IS_ADDR_LOOPBACK(&src) ||
+	    IN6_IS_ADDR_MULTICAST(&src) || IN6_IS_ADDR_LINKLOCAL(&src))
+		return;
+
+	re = nd_reach_slot(&src);
+	if (nd_reach_get(re, &src, 0, &state, &age) &&
+	    state == ND_REACH_LEARNED && age <= (u_int)nd_reach_ttl * hz / 2)
+		return;
+	nd_cache_put(re, 0, ND_REACH_LEARNED, &src);
+	NDSTAT_INC(nds_reach_learned);
+}
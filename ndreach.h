@@ -0,0 +1,63 @@
+/*-
+ * Copyright (c) 2015-2019 Alexandre Fenyo <alex@fenyo.net> - http://www.fenyo.net
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef __NDREACH_H
+#define __NDREACH_H
+
+/*
+ * Reachability filter: when on, only targets with a route through an
+ * interface that is not an uplink, or recently seen as the source of a
+ * packet received on such an interface, are proxied. Scans of the
+ * proxied prefix then stop at the PE rather than being forwarded to us.
+ */
+#define ND_REACH_SLOTS		4096	/* Entries of the cache, a power of 2. */
+#define ND_REACH_NEG_SLOTS	4096	/* Of the negative cache, a power of 2. */
+#define ND_REACH_TTL_MAX	3600
+
+/*
+ * What an entry of the caches says about its target, in ce_val. The
+ * per-vnet target caches hold struct nd_cache_entry and are direct
+ * mapped: a target only goes in the entry its hash points to, evicting
+ * the one there. Reachable targets and the others are cached apart, so
+ * that the targets of a scan only evict each other. An entry expires
+ * after nd_reach_ttl seconds; one filled from the FIB also when
+ * nd_src_gen moves, as routes changed.
+ */
+#define ND_REACH_NONE		0	/* No downstream route. */
+#define ND_REACH_ROUTE		1	/* Route through a non-uplink. */
+#define ND_REACH_LEARNED	2	/* Source seen on a non-uplink. */
+
+extern int nd_reach_filter;	/* Filter on. */
+extern int nd_reach_ttl;	/* Seconds an entry is valid. */
+
+struct nd_conf;
+
+void	nd_reach_init(void);
+void	nd_reach_free(void);
+int	nd_reach_check(const struct nd_conf *, const struct in6_addr *);
+void	nd_reach_learn(const struct mbuf *);
+
+#endif
@@ -0,0 +1,286 @@
+/*-
+ * Copyright (c) 2015-2019 Alexandre Fenyo <alex@fenyo.net> - http://www.fenyo.net
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Unsolicited neighbor advertisements for the targets of
+ * refresh_target_list, see ndrefresh.h.
+ *
+ * Each vnet has a callout that walks its wheel one slot at a time, so
+ * that tens of thousands of targets are sent evenly over the interval
+ * rather than in a single burst. A slot holding more than
+ * nd_refresh_burst targets is finished on the next runs; targets still
+ * not sent when the wheel comes back to its first slot are skipped.
+ */
+
+#include <sys/param.h>
+#include <sys/systm.h>
+#include <sys/kernel.h>
+#include <sys/lock.h>
+#include <sys/malloc.h>
+#include <sys/epoch.h>
+#include <sys/socket.h>
+#include <sys/sx.h>
+#include <sys/time.h>
+#include <net/if.h>
+#include <net/if_var.h>
+#include <net/ethernet.h>
+#include <net/vnet.h>
+#include <netinet/in.h>
+#include <netinet/icmp6.h>
+#include <netinet/ip6.h>
+
+#include "ndconf.h"
+#include "ndhash.h"
+#include "ndpacket.h"
+#include "ndproxy.h"
+#include "ndrefresh.h"
+#include "ndtrie.h"
+
+int nd_refresh_interval __read_mostly = 30;
+int nd_refresh_burst __read_mostly = 64;
+
+VNET_DEFINE(struct nd_refresh *, nd_refresh) = NULL;
+VNET_DEFINE_STATIC(u_int, nd_refresh_gen) = 0;	/* Of the last published. */
+#define	V_nd_refresh_gen	VNET(nd_refresh_gen)
+
+/* State of the wheel, only used by the callout. */
+VNET_DEFINE_STATIC(struct callout, nd_refresh_callout);
+VNET_DEFINE_STATIC(u_int, nd_refresh_step);	/* Slot to send next. */
+VNET_DEFINE_STATIC(u_int, nd_refresh_next);	/* Target to send next. */
+VNET_DEFINE_STATIC(u_int, nd_refresh_seen);	/* rf_gen of the wheel walked. */
+#define	V_nd_refresh_callout	VNET(nd_refresh_callout)
+#define	V_nd_refresh_step	VNET(nd_refresh_step)
+#define	V_nd_refresh_next	VNET(nd_refresh_next)
+#define	V_nd_refresh_seen	VNET(nd_refresh_seen)
+
+static void	nd_refresh_tick(void *);
+
+static void
+nd_refresh_free(struct nd_refresh *rf)
+{
+	if (rf == NULL)
+		return;
+	free(rf->rf_elems, M_NDPROXY);
+	free(rf->rf_targets, M_NDPROXY);
+	free(rf, M_NDPROXY);
+}
+
+static void
+nd_refresh_free_cb(struct epoch_context *ctx)
+{
+	nd_refresh_free(__containerof(ctx, struct nd_refresh, rf_epoch_ctx));
+}
+
+/*
+ * Build a wheel from the elements of refresh_target_list, which it then
+ * owns, expanding the prefixes.
+ */
+int
+nd_refresh_build(struct nd_refresh_elem *elems, int count,
+    struct nd_refresh **rfp)
+{
+	struct nd_refresh *rf;
+	struct in6_addr *targets;
+	u_int *slots;
+	u_int i, j, n, total;
+
+	total = 0;
+	for (i = 0; i < count; i++) {
+		if (elems[i].re_len < REFRESH_PREFIX_MIN ||
+		    elems[i].re_len > 128)
+			return (EINVAL);
+		total += 1 << (128 - elems[i].re_len);
+	}
+	if (total > REFRESH_MAX)
+		return (E2BIG);
+
+	rf = malloc(sizeof(*rf), M_NDPROXY, M_WAITOK | M_ZERO);
+	rf->rf_elems = elems;
+	rf->rf_elems_count = count;
+	rf->rf_count = total;
+	targets = mallocarray(MAX(total, 1), sizeof(struct in6_addr),
+	    M_NDPROXY, M_WAITOK);
+	rf->rf_targets = mallocarray(MAX(total, 1), sizeof(struct in6_addr),
+	    M_NDPROXY, M_WAITOK);
+	slots = mallocarray(MAX(total, 1), sizeof(u_int), M_NDPROXY,
+	    M_WAITOK);
+
+	/* Expand the prefixes, whose host bits are in the last byte. */
+	for (i = 0, n = 0; i < count; i++) {
+		elems[i].re_prefix.s6_addr[15] &=
+		    ~((1 << (128 - elems[i].re_len)) - 1);
+		for (j = 0; j < 1 << (128 - elems[i].re_len); j++) {
+			targets[n] = elems[i].re_prefix;
+			targets[n].s6_addr[15] |= j;
+			slots[n] = nd_hash_addr(&targets[n]) &
+			    (ND_REFRESH_SLOTS - 1);
+			rf->rf_slot[slots[n] + 1]++;
+			n++;
+		}
+	}
+
+	/* Sort them by slot. */
+	for (i = 1; i <= ND_REFRESH_SLOTS; i++)
+		rf->rf_slot[i] += rf->rf_slot[i - 1];
+	for (n = 0; n < total; n++)
+		rf->rf_targets[rf->rf_slot[slots[n]]++] = targets[n];
+	for (i = ND_REFRESH_SLOTS; i > 0; i--)
+		rf->rf_slot[i] = rf->rf_slot[i - 1];
+	rf->rf_slot[0] = 0;
+
+	free(slots, M_NDPROXY);
+	free(targets, M_NDPROXY);
+	*rfp = rf;
+	return (0);
+}
+
+/*
+ * Publish another wheel, or none, under a new generation. The callout
+ * starts it over from the current slot.
+ * Called with ndproxy_conf_lock held exclusively.
+ */
+void
+nd_refresh_update(struct nd_refresh *rf)
+{
+	struct nd_refresh *old;
+
+	sx_assert(&ndproxy_conf_lock, SA_XLOCKED);
+
+	old = V_nd_refresh;
+	/* 0 is left for no wheel seen. */
+	if (++V_nd_refresh_gen == 0)
+		V_nd_refresh_gen = 1;
+	if (rf != NULL)
+		rf->rf_gen = V_nd_refresh_gen;
+	atomic_store_rel_ptr((volatile uintptr_t *)&V_nd_refresh,
+	    (uintptr_t)rf);
+	if (old != NULL)
+		NET_EPOCH_CALL(nd_refresh_free_cb, &old->rf_epoch_ctx);
+}
+
+/*
+ * Send an unsolicited advertisement for target on every uplink
+ * interface, unless the target is an exception or ignored by a policy:
+ * from :: in the request, nd_reply() sends it to all nodes with the
+ * Solicited flag cleared, and counts it apart from the replies.
+ */
+static void
+nd_refresh_target(struct nd_conf *conf, const struct in6_addr *target)
+{
+	const struct nd_policy *np;
+	struct nd_request nr;
+	struct nd_iface *nif;
+	struct ifnet *ifp;
+	u_int i;
+
+	if (nd_hash_lookup(conf->nc_exceptions, target))
+		return;
+	np = nd_trie_lookup(conf->nc_policy, target);
+	if (np != NULL && np->np_ignore)
+		return;
+
+	bzero(&nr, sizeof(nr));
+	nr.nr_target = *target;
+	nr.nr_vnet = curvnet;
+	nr.nr_refresh = true;
+	for (i = 0; i < conf->nc_ifaces_size; i++) {
+		if ((nif = conf->nc_ifaces[i]) == NULL ||
+		    (np == NULL && !nif->ni_has_mac) ||
+		    (ifp = ifnet_byindex(i)) == NULL)
+			continue;
+		nr.nr_mac = np != NULL ? np->np_mac : nif->ni_downlink_mac;
+		nr.nr_ifindex = i;
+		if (nd_reply(ifp, nif, &nr, NULL) == 0)
+			NDSTAT_INC(nds_refresh_sent);
+		else
+			NDSTAT_INC(nds_refresh_err);
+	}
+}
+
+/*
+ * Send the targets of the next slot, up to nd_refresh_burst of them.
+ */
+static void
+nd_refresh_tick(void *arg)
+{
+	struct epoch_tracker et;
+	struct nd_refresh *rf;
+	struct nd_conf *conf;
+	sbintime_t next;
+	u_int end, n, slot;
+	int burst;
+
+	CURVNET_SET((struct vnet *)arg);
+	NET_EPOCH_ENTER(et);
+	rf = atomic_load_ptr(&V_nd_refresh);
+	conf = atomic_load_ptr(&V_nd_active_conf);
+	/* Nothing to send: look again in a second. */
+	next = SBT_1S;
+	if (rf != NULL && conf != NULL) {
+		slot = V_nd_refresh_step++ & (ND_REFRESH_SLOTS - 1);
+		if (rf->rf_gen != V_nd_refresh_seen) {
+			V_nd_refresh_seen = rf->rf_gen;
+			V_nd_refresh_next = rf->rf_slot[slot];
+		} else if (slot == 0) {
+			NDSTAT_ADD(nds_refresh_late,
+			    rf->rf_count - V_nd_refresh_next);
+			V_nd_refresh_next = 0;
+		}
+		end = rf->rf_slot[slot + 1];
+		burst = nd_refresh_burst;
+		for (n = V_nd_refresh_next; n < end && burst > 0; n++, burst--)
+			nd_refresh_target(conf, &rf->rf_targets[n]);
+		if (n < end)
+			NDSTAT_INC(nds_refresh_burst);
+		V_nd_refresh_next = n;
+		next = SBT_1S * nd_refresh_interval / ND_REFRESH_SLOTS;
+	}
+	NET_EPOCH_EXIT(et);
+	callout_reset_sbt(&V_nd_refresh_callout, next, 0, nd_refresh_tick,
+	    arg, 0);
+	CURVNET_RESTORE();
+}
+
+/*
+ * Start the wheel of the current vnet.
+ */
+void
+nd_refresh_start(void)
+{
+	callout_init(&V_nd_refresh_callout, 1);
+	callout_reset(&V_nd_refresh_callout, hz, nd_refresh_tick, curvnet);
+}
+
+/*
+ * Stop the wheel of the current vnet. Its table is freed with the conf,
+ * by nd_refresh_update(NULL).
+ */
+void
+nd_refresh_stop(void)
+{
+	callout_drain(&V_nd_refresh_callout);
+	V_nd_refresh_seen = 0;
+}
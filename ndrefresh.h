@@ -0,0 +1,76 @@
+/*-
+ * Copyright (c) 2015-2019 Alexandre Fenyo <alex@fenyo.net> - http://www.fenyo.net
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef __NDREFRESH_H
+#define __NDREFRESH_H
+
+/*
+ * Unsolicited advertisements sent periodically for a declared set of
+ * targets, so that the neighbor cache of the PE holds them before a
+ * packet comes in for them.
+ */
+#define REFRESH_MAX		65536	/* Max targets, prefixes expanded. */
+#define REFRESH_PREFIX_MIN	120	/* Shortest prefix: 256 targets. */
+#define ND_REFRESH_SLOTS	1024	/* Slots of the wheel, a power of 2. */
+#define ND_REFRESH_INTERVAL_MAX	3600
+#define ND_REFRESH_BURST_MAX	REFRESH_MAX
+
+/* Element of net.inet6.ndproxy.refresh_target_list. */
+struct nd_refresh_elem {
+	struct in6_addr	re_prefix;
+	int		re_len;		/* 128 for a single target. */
+};
+
+/*
+ * Hashed timer wheel: the targets are spread over ND_REFRESH_SLOTS
+ * slots by a hash of their addr, and a slot is sent every
+ * nd_refresh_interval / ND_REFRESH_SLOTS seconds. Targets are sorted by
+ * slot, rf_slot[s] being the first target of slot s. Published and
+ * freed as the conf is. rf_gen tells the callout a new wheel from the
+ * one it walks, even when allocated at the same addr.
+ */
+struct nd_refresh {
+	struct epoch_context	 rf_epoch_ctx;
+	u_int			 rf_gen;
+	int			 rf_elems_count;
+	struct nd_refresh_elem	*rf_elems;	/* As configured. */
+	u_int			 rf_count;	/* Targets. */
+	struct in6_addr		*rf_targets;
+	u_int			 rf_slot[ND_REFRESH_SLOTS + 1];
+};
+
+extern int nd_refresh_interval;	/* Seconds between two refreshes. */
+extern int nd_refresh_burst;	/* Max targets per slot. */
+
+VNET_DECLARE(struct nd_refresh *, nd_refresh);
+#define	V_nd_refresh	VNET(nd_refresh)
+
+int	nd_refresh_build(struct nd_refresh_elem *, int, struct nd_refresh **);
+void	nd_refresh_update(struct nd_refresh *);
+void	nd_refresh_start(void);
+void	nd_refresh_stop(void);
+
+#endif
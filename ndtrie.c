@@ -0,0 +1,167 @@
+/*-
+ * Copyright (c) 2015-2019 Alexandre Fenyo <alex@fenyo.net> - http://www.fenyo.net
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <sys/param.h>
+#include <sys/systm.h>
+#include <sys/malloc.h>
+#include <sys/socket.h>
+#include <net/if.h>
+#include <net/ethernet.h>
+#include <netinet/in.h>
+#include <netinet/icmp6.h>
+#include <netinet/ip6.h>
+
+#include "ndconf.h"
+#include "ndtrie.h"
+
+/*
+ * Order policies by length, then by prefix.
+ */
+int
+nd_policy_cmp(const void *a, const void *b)
+{
+	const struct nd_policy *pa = a, *pb = b;
+
+	if (pa->np_len != pb->np_len)
+		return (pa->np_len < pb->np_len ? -1 : 1);
+	return (memcmp(&pa->np_prefix, &pb->np_prefix, sizeof(struct in6_addr)));
+}
+
+/*
+ * Clear the bits of the prefix past its length.
+ */
+void
+nd_policy_mask(struct nd_policy *np)
+{
+	int j, len;
+
+	for (j = 0; j < sizeof(struct in6_addr); j++) {
+		len = np->np_len - j * 8;
+		if (len <= 0)
+			np->np_prefix.s6_addr[j] = 0;
+		else if (len < 8)
+			np->np_prefix.s6_addr[j] &= 0xff << (8 - len);
+	}
+}
+
+/*
+ * Append a node filled with value e, growing the node array as needed.
+ */
+static uint32_t
+nd_trie_node(struct nd_policy_trie *pt, u_int *nalloc, uint32_t e)
+{
+	uint32_t *nodes;
+	u_int i, node;
+
+	if (pt->pt_nnodes == *nalloc) {
+		*nalloc = MIN(*nalloc * 2, ND_TRIE_NODE_MAX);
+		nodes = mallocarray(*nalloc, ND_TRIE_FANOUT * sizeof(uint32_t),
+		    M_NDPROXY, M_WAITOK);
+		bcopy(pt->pt_nodes, nodes,
+		    pt->pt_nnodes * ND_TRIE_FANOUT * sizeof(uint32_t));
+		free(pt->pt_nodes, M_NDPROXY);
+		pt->pt_nodes = nodes;
+	}
+	node = pt->pt_nnodes++;
+	for (i = 0; i < ND_TRIE_FANOUT; i++)
+		pt->pt_nodes[node * ND_TRIE_FANOUT + i] = e;
+	return (node);
+}
+
+/*
+ * Compile count policies into a trie, which then owns the array.
+ * Bits of a prefix past its length are cleared. Fail with EINVAL if
+ * two policies have the same prefix, or with E2BIG if the trie would
+ * need more than ND_TRIE_NODE_MAX nodes; the array is then the
+ * caller's to free.
+ *
+ * Policies are inserted from the shortest to the longest. A policy
+ * then only overwrites entries of shorter prefixes, and a node created
+ * under an entry starts with the value of that entry (leaf pushing).
+ */
+int
+nd_trie_build(struct nd_policy *policies, u_int count,
+    struct nd_policy_trie **ptp)
+{
+	struct nd_policy_trie *pt;
+	struct nd_policy *np;
+	uint32_t child;
+	u_int i, j, k, nalloc, node, span;
+	int depth;
+
+	for (i = 0; i < count; i++)
+		nd_policy_mask(&policies[i]);
+	qsort(policies, count, sizeof(struct nd_policy), nd_policy_cmp);
+	for (i = 1; i < count; i++)
+		if (nd_policy_cmp(&policies[i - 1], &policies[i]) == 0)
+			return (EINVAL);
+
+	pt = malloc(sizeof(*pt), M_NDPROXY, M_WAITOK | M_ZERO);
+	nalloc = 16;
+	pt->pt_nodes = mallocarray(nalloc, ND_TRIE_FANOUT * sizeof(uint32_t),
+	    M_NDPROXY, M_WAITOK);
+	nd_trie_node(pt, &nalloc, 0);
+
+	for (i = 0; i < count; i++) {
+		np = &policies[i];
+		depth = np->np_len == 0 ? 0 : (np->np_len - 1) / ND_TRIE_STRIDE;
+		node = 0;
+		for (j = 0; j < depth; j++) {
+			k = node * ND_TRIE_FANOUT + np->np_prefix.s6_addr[j];
+			if ((pt->pt_nodes[k] & ND_TRIE_CHILD) == 0) {
+				if (pt->pt_nnodes == ND_TRIE_NODE_MAX) {
+					nd_trie_free(pt);
+					return (E2BIG);
+				}
+				child = nd_trie_node(pt, &nalloc,
+				    pt->pt_nodes[k]);
+				pt->pt_nodes[k] = child | ND_TRIE_CHILD;
+			}
+			node = pt->pt_nodes[k] & ~ND_TRIE_CHILD;
+		}
+		span = 1 << ((depth + 1) * ND_TRIE_STRIDE - np->np_len);
+		k = np->np_prefix.s6_addr[depth] & ~(span - 1);
+		for (j = k; j < k + span; j++)
+			pt->pt_nodes[node * ND_TRIE_FANOUT + j] = i + 1;
+	}
+	pt->pt_count = count;
+	pt->pt_policies = policies;
+	*ptp = pt;
+	return (0);
+}
+
+/*
+ * Free a trie and its policies (NULL is ignored).
+ */
+void
+nd_trie_free(struct nd_policy_trie *pt)
+{
+	if (pt == NULL)
+		return;
+	free(pt->pt_policies, M_NDPROXY);
+	free(pt->pt_nodes, M_NDPROXY);
+	free(pt, M_NDPROXY);
+}
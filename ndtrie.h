@@ -0,0 +1,85 @@
+/*-
+ * Copyright (c) 2015-2019 Alexandre Fenyo <alex@fenyo.net> - http://www.fenyo.net
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef __NDTRIE_H
+#define __NDTRIE_H
+
+/*
+ * Target policy: what to do with solicitations for targets in a prefix.
+ */
+struct nd_policy {
+	struct in6_addr		np_prefix;
+	int			np_len;
+	int			np_ignore;	/* Do not proxy. */
+	struct ether_addr	np_mac;		/* Downlink MAC otherwise. */
+};
+
+/*
+ * Longest prefix match of target policies, compiled into a multibit
+ * trie with a stride of 8 bits and leaf pushing: a node is 256 entries
+ * indexed by one byte of the address, and each entry is either the
+ * index of the child node for the next byte (ND_TRIE_CHILD set) or the
+ * rank + 1 of the longest policy covering it, 0 if none. A lookup takes
+ * one memory access per byte of the matched prefix, e.g. 7 for a /56,
+ * whatever the number of policies. Node 0 is the root.
+ */
+#define ND_TRIE_STRIDE		8
+#define ND_TRIE_FANOUT		(1 << ND_TRIE_STRIDE)
+#define ND_TRIE_CHILD		0x80000000U
+#define ND_TRIE_NODE_MAX	65536	/* 64 MB of nodes. */
+
+struct nd_policy_trie {
+	u_int			 pt_count;	/* Policies. */
+	u_int			 pt_nnodes;
+	struct nd_policy	*pt_policies;	/* By length, then prefix. */
+	uint32_t		*pt_nodes;
+};
+
+int			 nd_policy_cmp(const void *, const void *);
+void			 nd_policy_mask(struct nd_policy *);
+int			 nd_trie_build(struct nd_policy *, u_int,
+			    struct nd_policy_trie **);
+void			 nd_trie_free(struct nd_policy_trie *);
+
+/*
+ * Return the policy of the longest prefix holding addr, or NULL.
+ */
+static __inline const struct nd_policy *
+nd_trie_lookup(const struct nd_policy_trie *pt, const struct in6_addr *addr)
+{
+	uint32_t e;
+	int i;
+
+	if (pt == NULL)
+		return (NULL);
+	e = pt->pt_nodes[addr->s6_addr[0]];
+	for (i = 1; (e & ND_TRIE_CHILD) != 0; i++)
+		e = pt->pt_nodes[(e & ~ND_TRIE_CHILD) * ND_TRIE_FANOUT +
+		    addr->s6_addr[i]];
+	return (e == 0 ? NULL : &pt->pt_policies[e - 1]);
+}
+
+#endif